@@ -123,6 +123,23 @@ public:
     {
         
     }
+    
+    void onSessionDetailsLoaded(const std::string& usrName, const Session& session) const
+    {
+        __block __weak ViewController* viewController = m_viewController;
+        __block NSString *localUsrName = [NSString stringWithUTF8String:usrName.c_str()];
+        // The loader keeps filling its own sessions, so hand a copy over to the main thread
+        __block Session *localSession = new Session(session);
+        dispatch_async(dispatch_get_main_queue(), ^{
+            __strong __typeof(viewController)strongVC = viewController;
+            if (strongVC)
+            {
+                [strongVC onSessionDetailsLoaded:localUsrName session:localSession];
+                strongVC = nil;
+            }
+            delete localSession;
+        });
+    }
 	
 };
 
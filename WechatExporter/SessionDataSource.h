@@ -12,6 +12,7 @@
 #import <Cocoa/Cocoa.h>
 #include <vector>
 #include <set>
+#include <map>
 #include <utility>
 
 #import "WechatObjects.h"
@@ -48,6 +49,9 @@
 
 - (void)loadData:(const std::vector<std::pair<Friend, std::vector<Session>>> *)usersAndSessions withAllUsers:(BOOL)allUsers indexOfSelectedUser:(NSInteger)indexOfSelectedUser includesSubscription:(BOOL)includesSubscriptions;
 - (void)getSelectedUserAndSessions:(std::map<std::string, std::map<std::string, void *>>&)usersAndSessions;
+- (NSInteger)updateSession:(const Session&)session ofUser:(NSString *)usrName;
+// usrName of user => usrNames of the sessions at the rows
+- (void)getUsersAndSessions:(std::map<std::string, std::vector<std::string>>&)usersAndSessions atRows:(NSIndexSet *)rows;
 
 - (void)bindCellView:(NSTableCellView *)cellView atRow:(NSInteger)row andColumnId:(NSString *)identifier;
 - (NSControlStateValue)updateCheckStateAtRow:(NSInteger)row;
@@ -118,6 +118,17 @@
     }
 }
 
+- (void)getUsersAndSessions:(std::map<std::string, std::vector<std::string>>&)usersAndSessions atRows:(NSIndexSet *)rows
+{
+    [rows enumerateIndexesUsingBlock:^(NSUInteger row, BOOL *stop) {
+        if (row < m_sessions.count)
+        {
+            SessionItem *sessionItem = [m_sessions objectAtIndex:row];
+            usersAndSessions[[sessionItem.usrName UTF8String]].push_back([sessionItem.sessionUsrName UTF8String]);
+        }
+    }];
+}
+
 - (void)loadData:(const std::vector<std::pair<Friend, std::vector<Session>>> *)usersAndSessions withAllUsers:(BOOL)allUsers indexOfSelectedUser:(NSInteger)indexOfSelectedUser includesSubscription:(BOOL)includesSubscriptions
 {
     m_usersAndSessions = usersAndSessions;
@@ -154,36 +165,10 @@
             sessionItem.orgIndex = orgIndex;
             sessionItem.userIndex = userIndex;
             sessionItem.checked = YES;
-            sessionItem.displayName = [NSString stringWithUTF8String:it2->getDisplayName().c_str()];
-            if (it2->isDeleted())
-            {
-                sessionItem.displayName = [sessionItem.displayName stringByAppendingString:NSLocalizedString(@"session-deleted", comment: "")];
-            }
             sessionItem.sessionUsrName = [NSString stringWithUTF8String:it2->getUsrName().c_str()];
-            sessionItem.recordCount = it2->getRecordCount();
             sessionItem.usrName = [NSString stringWithUTF8String:it->first.getUsrName().c_str()];
             sessionItem.userDisplayName = [NSString stringWithUTF8String:it->first.getDisplayName().c_str()];
-#ifndef NDEBUG
-            sessionItem.lastMessageTime = it2->getLastMessageTime();
-#endif
-            
-            NSString *displayMsg = nil;
-            std::string msg = it2->getLastMessage();
-            if (it2->isTextMessage())
-            {
-                if (it2->hasLastMessageUserDisplayName())
-                {
-                    msg = it2->getLastMessageUserDisplayName() + ": " + msg;
-                }
-                displayMsg = [NSString stringWithUTF8String:msg.c_str()];
-            }
-            else
-            {
-                displayMsg = NSLocalizedString(@"not-text-msg", comment: "");
-            }
-            // NSLocalizedString(@"err-failed-to-parse-backup", comment: "")
-            
-            sessionItem.lastMessage = displayMsg;
+            [self bindSessionItem:sessionItem withSession:*it2];
             
             [sessions addObject:sessionItem];
         }
@@ -192,6 +177,55 @@
     m_sessions = sessions;
 }
 
+- (void)bindSessionItem:(SessionItem *)sessionItem withSession:(const Session&)session
+{
+    sessionItem.displayName = [NSString stringWithUTF8String:session.getDisplayName().c_str()];
+    if (session.isDeleted())
+    {
+        sessionItem.displayName = [sessionItem.displayName stringByAppendingString:NSLocalizedString(@"session-deleted", comment: "")];
+    }
+    sessionItem.recordCount = session.getRecordCount();
+#ifndef NDEBUG
+    sessionItem.lastMessageTime = session.getLastMessageTime();
+#endif
+    
+    NSString *displayMsg = nil;
+    std::string msg = session.getLastMessage();
+    if (session.isTextMessage())
+    {
+        if (session.hasLastMessageUserDisplayName())
+        {
+            msg = session.getLastMessageUserDisplayName() + ": " + msg;
+        }
+        displayMsg = [NSString stringWithUTF8String:msg.c_str()];
+    }
+    else
+    {
+        displayMsg = NSLocalizedString(@"not-text-msg", comment: "");
+    }
+    // NSLocalizedString(@"err-failed-to-parse-backup", comment: "")
+    
+    sessionItem.lastMessage = displayMsg;
+}
+
+// Refresh the row of a session whose details were loaded after the list was shown; returns the row or -1 if it isn't listed
+- (NSInteger)updateSession:(const Session&)session ofUser:(NSString *)usrName
+{
+    NSString *sessionUsrName = [NSString stringWithUTF8String:session.getUsrName().c_str()];
+    NSInteger row = 0;
+    for (SessionItem *sessionItem in m_sessions)
+    {
+        if ([sessionItem.sessionUsrName isEqualToString:sessionUsrName] && [sessionItem.usrName isEqualToString:usrName])
+        {
+            [self bindSessionItem:sessionItem withSession:session];
+            return row;
+        }
+        ++row;
+    }
+    
+    return -1;
+}
+
 - (void)checkAllSessions:(BOOL)checked
 {
     for (NSInteger idx = 0; idx < m_sessions.count; ++idx)
@@ -8,6 +8,10 @@
 
 #import <Cocoa/Cocoa.h>
 
+#ifdef __cplusplus
+class Session;
+#endif
+
 @interface ViewController : NSViewController
 
 @property (weak) IBOutlet NSTextField *lblITunes;
@@ -38,6 +42,9 @@
 - (void)onSessionStart:(NSString *)usrName row:(NSInteger)row;
 - (void)onSessionProgress:(NSString *)sessionUsrName row:(NSInteger)row numberOfMessages:(NSUInteger)numberOfMessages numberOfTotalMessages:(NSUInteger)numberOfTotalMessages;
 - (void)onSessionComplete:(NSString *)usrName;
+#ifdef __cplusplus
+- (void)onSessionDetailsLoaded:(NSString *)usrName session:(const Session *)session;
+#endif
 
 @end
 
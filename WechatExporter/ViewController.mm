@@ -27,6 +27,7 @@
     PdfConverterImpl *m_pdfConverter;
     
     Exporter* m_exporter;
+    Exporter* m_sessionLoader;  // Keeps loading the details of sessions after the list is shown
     
     // std::vector<BackupManifest> m_manifests;
     std::vector<BackupItem> m_manifests;
@@ -76,9 +77,21 @@
 
 -(void)dealloc
 {
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:NSViewBoundsDidChangeNotification object:self.sclSessions.contentView];
+    [self stopLoadingSessionDetails];
     [self stopExporting];
 }
 
+- (void)stopLoadingSessionDetails
+{
+    if (NULL != m_sessionLoader)
+    {
+        // Joins the loader thread
+        delete m_sessionLoader;
+        m_sessionLoader = NULL;
+    }
+}
+
 - (void)stopExporting
 {
     if (NULL != m_exporter)
@@ -165,6 +178,7 @@
     m_logger = new LoggerImpl(self);
     m_notifier = new ExportNotifierImpl(self);
     m_exporter = NULL;
+    m_sessionLoader = NULL;
 
     [self.btnBackup setTarget:self];
     [self.btnBackup setAction:@selector(btnBackupClicked:)];
@@ -188,6 +202,9 @@
     [self.tblSessions setTarget:self];
     [self.tblSessions setDoubleAction:@selector(tableViewDoubleClick:)];
 #endif
+    // The details of the visible sessions are loaded first
+    self.sclSessions.contentView.postsBoundsChangedNotifications = YES;
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(sessionsDidScroll:) name:NSViewBoundsDidChangeNotification object:self.sclSessions.contentView];
     
 #ifndef NDEBUG
     [self.btnBackupDevice setTarget:self];
@@ -360,6 +377,7 @@
 {
     if (popupButton == self.popupBackup)
     {
+        [self stopLoadingSessionDetails];
         m_usersAndSessions.clear();
         [self.popupUsers removeAllItems];
         self.txtViewLogs.string = @"";
@@ -397,6 +415,7 @@
         [m_dataSource loadData:&m_usersAndSessions withAllUsers:allUsers indexOfSelectedUser:indexOfSelectedItem includesSubscription:[AppConfiguration includeSubscriptions]];
         self.btnToggleAll.state = NSControlStateValueOn;
         [self.tblSessions reloadData];
+        [self prioritizeVisibleSessions];
     }
 }
 
@@ -413,17 +432,20 @@
     [self setUIEnabled:NO withCancellable:NO];
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
         
+        __block Exporter *exp = NULL;
         __strong typeof(weakSelf) strongSelf = weakSelf;  // strong by default
         if (nil != strongSelf)
         {
-            Exporter exp([workDir UTF8String], [backupDir UTF8String], "", strongSelf->m_logger, NULL);
+            exp = new Exporter([workDir UTF8String], [backupDir UTF8String], "", strongSelf->m_logger, NULL);
             ExportOption options;
             options.outputDebugLogs([AppConfiguration outputDebugLogs]);
-            exp.setOptions(options);
-            exp.setLanguageCode([[self getCurrentLanguageCode] UTF8String]);
-            // exp.setLanguageCode([[self getCurrentLanguageCode] UTF8String]);
-            exp.loadUsersAndSessions();
-            exp.swapUsersAndSessions(strongSelf->m_usersAndSessions);
+            exp->setOptions(options);
+            exp->setLanguageCode([[self getCurrentLanguageCode] UTF8String]);
+            // exp->setLanguageCode([[self getCurrentLanguageCode] UTF8String]);
+            exp->setNotifier(strongSelf->m_notifier);
+            // Only the list of sessions here, the details come with onSessionDetailsLoaded
+            exp->loadUsersAndSessions(true);
+            exp->swapUsersAndSessions(strongSelf->m_usersAndSessions);
         }
         
         // update UI on the main thread
@@ -435,6 +457,18 @@
     #endif
                 [strongSelf loadUsers];
                 [strongSelf setUIEnabled:YES withCancellable:NO];
+                
+                [strongSelf stopLoadingSessionDetails];
+                strongSelf->m_sessionLoader = exp;
+                if (NULL != exp)
+                {
+                    exp->loadSessionDetails();
+                    [strongSelf prioritizeVisibleSessions];
+                }
+            }
+            else if (NULL != exp)
+            {
+                delete exp;
             }
         });
     });
@@ -888,6 +922,38 @@
     [self updateRow:-1];
 }
 
+- (void)onSessionDetailsLoaded:(NSString *)usrName session:(const Session *)session
+{
+    std::string user = [usrName UTF8String];
+    for (std::vector<std::pair<Friend, std::vector<Session>>>::iterator it = m_usersAndSessions.begin(); it != m_usersAndSessions.end(); ++it)
+    {
+        if (it->first.getUsrName() != user)
+        {
+            continue;
+        }
+        for (std::vector<Session>::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2)
+        {
+            if (it2->getUsrName() != session->getUsrName())
+            {
+                continue;
+            }
+            // The copy comes from the loader, keep the owner and data of ours
+            void *data = it2->getData();
+            *it2 = *session;
+            it2->setOwner(&(it->first));
+            it2->setData(data);
+            
+            NSInteger row = [m_dataSource updateSession:*it2 ofUser:usrName];
+            if (row != -1)
+            {
+                [self.tblSessions reloadDataForRowIndexes:[NSIndexSet indexSetWithIndex:row] columnIndexes:m_columns];
+            }
+            return;
+        }
+        return;
+    }
+}
+
 - (void)updateRow:(NSInteger)row
 {
     if (row == m_dataSource.rowInProgress)
@@ -1018,6 +1084,36 @@
     return cellView;
 }
 
+- (void)tableViewSelectionDidChange:(NSNotification *)notification
+{
+    [self prioritizeSessionDetailsAtRows:self.tblSessions.selectedRowIndexes];
+}
+
+- (void)sessionsDidScroll:(NSNotification *)notification
+{
+    [self prioritizeVisibleSessions];
+}
+
+- (void)prioritizeVisibleSessions
+{
+    NSRange visibleRange = [self.tblSessions rowsInRect:self.tblSessions.visibleRect];
+    [self prioritizeSessionDetailsAtRows:[NSIndexSet indexSetWithIndexesInRange:visibleRange]];
+}
+
+- (void)prioritizeSessionDetailsAtRows:(NSIndexSet *)rows
+{
+    if (NULL == m_sessionLoader || rows.count == 0)
+    {
+        return;
+    }
+    std::map<std::string, std::vector<std::string>> usersAndSessions;
+    [m_dataSource getUsersAndSessions:usersAndSessions atRows:rows];
+    for (std::map<std::string, std::vector<std::string>>::const_iterator it = usersAndSessions.cbegin(); it != usersAndSessions.cend(); ++it)
+    {
+        m_sessionLoader->prioritizeSessionDetails(it->first, it->second);
+    }
+}
+
 - (void)tableViewColumnDidResize:(NSNotification *)notification
 {
     if ([notification.name isEqualToString:NSTableViewColumnDidResizeNotification])
@@ -0,0 +1,326 @@
+//
+//  AsyncLogger.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2022/5/8.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "AsyncLogger.h"
+#include <ctime>
+#include <functional>
+#include "Utils.h"
+
+AsyncLogger::AsyncLogger(int level/* = LOG_LEVEL_INFO*/, bool jsonLines/* = false*/, size_t capacity/* = DEFAULT_CAPACITY*/) : m_records(NULL), m_mask(0), m_enqueuePos(0), m_dequeuePos(0), m_level(level), m_jsonLines(jsonLines), m_console(stdout), m_logFile(NULL), m_stopped(false), m_writerWaiting(false), m_numberOfRecords(0), m_numberOfWritten(0), m_thread(NULL), m_lastSecond(0)
+{
+    // Round up to power of 2 so the slot can be located by mask
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    m_mask = size - 1;
+    m_records = new Record[size];
+    for (size_t idx = 0; idx < size; ++idx)
+    {
+        m_records[idx].sequence.store(idx, std::memory_order_relaxed);
+    }
+
+    m_thread = new std::thread(&AsyncLogger::ThreadFunc, this);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    stop();
+    if (NULL != m_logFile)
+    {
+        delete m_logFile;
+        m_logFile = NULL;
+    }
+    if (NULL != m_records)
+    {
+        delete[] m_records;
+        m_records = NULL;
+    }
+}
+
+bool AsyncLogger::openLogFile(const std::string& path)
+{
+    File* logFile = new File();
+    if (!logFile->open(path, false))
+    {
+        delete logFile;
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::swap(m_logFile, logFile);
+    lock.unlock();
+    if (NULL != logFile)
+    {
+        delete logFile;
+    }
+    return true;
+}
+
+void AsyncLogger::write(const std::string& log)
+{
+    if (isLevelEnabled(LOG_LEVEL_INFO))
+    {
+        push(LOG_LEVEL_INFO, log);
+    }
+}
+
+void AsyncLogger::debug(const std::string& log)
+{
+    if (isLevelEnabled(LOG_LEVEL_DEBUG))
+    {
+        push(LOG_LEVEL_DEBUG, log);
+    }
+}
+
+void AsyncLogger::flush()
+{
+    uint64_t target = m_numberOfRecords.load();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.notify_one();
+    while (m_numberOfWritten.load() < target && NULL != m_thread)
+    {
+        m_flushCv.wait_for(lock, std::chrono::milliseconds(100));
+    }
+}
+
+void AsyncLogger::stop()
+{
+    std::thread* thread = NULL;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stopped.store(true);
+        m_cv.notify_one();
+        std::swap(thread, m_thread);
+    }
+    if (NULL != thread)
+    {
+        thread->join();
+        delete thread;
+    }
+}
+
+void AsyncLogger::push(int level, const std::string& log)
+{
+    if (m_stopped.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    Record* record = NULL;
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        record = &m_records[pos & m_mask];
+        size_t seq = record->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            if (m_stopped.load())
+            {
+                // Full and the writer is gone(or going), nobody would drain it
+                return;
+            }
+            // Full: kick the writer and give it a chance to drain rather than dropping the log
+            if (m_writerWaiting.load())
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.notify_one();
+            }
+            std::this_thread::yield();
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    record->level = level;
+    record->time = std::chrono::system_clock::now();
+    record->threadId = std::this_thread::get_id();
+    record->message = log;
+    record->sequence.store(pos + 1, std::memory_order_release);
+
+    m_numberOfRecords.fetch_add(1);
+
+    if (m_writerWaiting.load())
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.notify_one();
+    }
+}
+
+bool AsyncLogger::pop(Record& record)
+{
+    Record& slot = m_records[m_dequeuePos & m_mask];
+    size_t seq = slot.sequence.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(m_dequeuePos + 1) < 0)
+    {
+        return false;
+    }
+
+    record.level = slot.level;
+    record.time = slot.time;
+    record.threadId = slot.threadId;
+    record.message.swap(slot.message);
+    slot.message.clear();
+
+    slot.sequence.store(m_dequeuePos + m_mask + 1, std::memory_order_release);
+    ++m_dequeuePos;
+    return true;
+}
+
+void AsyncLogger::formatRecord(const Record& record, std::string& line) const
+{
+    std::time_t tt = std::chrono::system_clock::to_time_t(record.time);
+    if (tt != m_lastSecond || m_lastSecondText.empty())
+    {
+        fromUnixTime(static_cast<unsigned int>(tt), m_lastSecondText);
+        m_lastSecond = tt;
+    }
+    int millis = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch()).count() % 1000);
+    char ms[8];
+    snprintf(ms, sizeof(ms), ".%03d", millis);
+
+    line.clear();
+    if (m_jsonLines)
+    {
+        line.append("{\"ts\":\"").append(m_lastSecondText).append(ms);
+        line.append("\",\"level\":\"").append(record.level == LOG_LEVEL_DEBUG ? "debug" : "info");
+        line.append("\",\"tid\":").append(std::to_string(std::hash<std::thread::id>()(record.threadId) & 0xFFFFFFFF));
+        line.append(",\"msg\":\"");
+
+        for (std::string::const_iterator it = record.message.cbegin(); it != record.message.cend(); ++it)
+        {
+            unsigned char ch = static_cast<unsigned char>(*it);
+            switch (ch)
+            {
+                case '"':
+                    line.append("\\\"");
+                    break;
+                case '\\':
+                    line.append("\\\\");
+                    break;
+                case '\n':
+                    line.append("\\n");
+                    break;
+                case '\r':
+                    line.append("\\r");
+                    break;
+                case '\t':
+                    line.append("\\t");
+                    break;
+                default:
+                    if (ch < 0x20)
+                    {
+                        char buffer[8];
+                        snprintf(buffer, sizeof(buffer), "\\u%04x", ch);
+                        line.append(buffer);
+                    }
+                    else
+                    {
+                        line.push_back(*it);
+                    }
+                    break;
+            }
+        }
+        line.append("\"}\n");
+    }
+    else
+    {
+        line.append(m_lastSecondText).append(ms).append(": ");
+        if (record.level == LOG_LEVEL_DEBUG)
+        {
+            line.append("DBG:: ");
+        }
+        line.append(record.message).append("\n");
+    }
+}
+
+void AsyncLogger::writeConsole(const std::string& lines)
+{
+    if (NULL != m_console)
+    {
+        fwrite(lines.c_str(), 1, lines.size(), m_console);
+        fflush(m_console);
+    }
+}
+
+void AsyncLogger::output(const std::string& lines)
+{
+    writeConsole(lines);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (NULL != m_logFile)
+    {
+        size_t bytesWritten = 0;
+        m_logFile->write(reinterpret_cast<const unsigned char *>(lines.c_str()), lines.size(), bytesWritten);
+    }
+}
+
+void AsyncLogger::ThreadFunc()
+{
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    setThreadName("logger");
+#endif
+
+    Record record;
+    std::string line;
+    std::string lines;
+    for (;;)
+    {
+        uint64_t count = 0;
+        lines.clear();
+        while (pop(record))
+        {
+            formatRecord(record, line);
+            lines.append(line);
+            ++count;
+            if (lines.size() >= 65536)
+            {
+                output(lines);
+                lines.clear();
+            }
+        }
+        if (!lines.empty())
+        {
+            output(lines);
+        }
+
+        if (count > 0)
+        {
+            m_numberOfWritten.fetch_add(count);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_flushCv.notify_all();
+            continue;
+        }
+
+        if (m_stopped.load())
+        {
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_writerWaiting.store(true);
+        // Timed wait: a producer may publish between the empty check and here
+        m_cv.wait_for(lock, std::chrono::milliseconds(50));
+        m_writerWaiting.store(false);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_flushCv.notify_all();
+}
@@ -0,0 +1,116 @@
+//
+//  AsyncLogger.h
+//  WechatExporter
+//
+//  Created by Matthew on 2022/5/8.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#ifndef AsyncLogger_h
+#define AsyncLogger_h
+
+#include <cstdio>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include "Logger.h"
+#include "FileSystem.h"
+
+// Logger backend for long exports: write()/debug() only push the raw message into a bounded
+// multi-producer/single-consumer ring buffer, the timestamp/level/JSON formatting and the actual
+// I/O are done by a background writer thread which flushes once per batch instead of per line.
+class AsyncLogger : public Logger
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 4096;
+
+    AsyncLogger(int level = LOG_LEVEL_INFO, bool jsonLines = false, size_t capacity = DEFAULT_CAPACITY);
+    virtual ~AsyncLogger();
+
+    // Additional sink, the console(stdout) is always written
+    bool openLogFile(const std::string& path);
+    void setConsoleOutput(FILE* console)
+    {
+        m_console = console;
+    }
+
+    int getLevel() const
+    {
+        return m_level.load(std::memory_order_relaxed);
+    }
+    void setLevel(int level)
+    {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+
+    bool isLevelEnabled(int level) const
+    {
+        return level >= m_level.load(std::memory_order_relaxed);
+    }
+
+    virtual bool isDebugEnabled() const
+    {
+        return isLevelEnabled(LOG_LEVEL_DEBUG);
+    }
+
+    virtual void write(const std::string& log);
+    virtual void debug(const std::string& log);
+
+    // Blocks until all queued records have been written out
+    void flush();
+    void stop();
+
+    uint64_t getNumberOfRecords() const
+    {
+        return m_numberOfRecords.load(std::memory_order_relaxed);
+    }
+
+protected:
+    struct Record
+    {
+        std::atomic<size_t> sequence;
+        int level;
+        std::chrono::system_clock::time_point time;
+        std::thread::id threadId;
+        std::string message;
+    };
+
+    void push(int level, const std::string& log);
+    bool pop(Record& record);
+
+    void formatRecord(const Record& record, std::string& line) const;
+    void output(const std::string& lines);
+    // Called on the writer thread only, subclasses call stop() in their destructor if overriding it
+    virtual void writeConsole(const std::string& lines);
+
+    void ThreadFunc();
+
+private:
+    Record* m_records;
+    size_t m_mask;
+    std::atomic<size_t> m_enqueuePos;
+    size_t m_dequeuePos;
+
+    std::atomic<int> m_level;
+    bool m_jsonLines;
+
+    FILE* m_console;
+    File* m_logFile;
+
+    std::atomic<bool> m_stopped;
+    std::atomic<bool> m_writerWaiting;
+    std::atomic<uint64_t> m_numberOfRecords;
+    std::atomic<uint64_t> m_numberOfWritten;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::condition_variable m_flushCv;
+    std::thread* m_thread;
+
+    mutable std::time_t m_lastSecond;
+    mutable std::string m_lastSecondText;
+};
+
+#endif /* AsyncLogger_h */
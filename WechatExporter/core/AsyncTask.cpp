@@ -18,6 +18,7 @@
 #endif
 #include "FileSystem.h"
 #include "Utils.h"
+#include "Tracer.h"
 
 // #define FAKE_DOWNLOAD
 size_t writeHttpDataToBuffer(void *buffer, size_t size, size_t nmemb, void *user_p)
@@ -153,6 +154,7 @@ unsigned int DownloadTask::getRetries() const
 
 bool DownloadTask::run()
 {
+    TRACE_SPAN_ARG(TRACE_CAT_TASK, "download", m_url);
     std::string* urls[] = { &m_url, &m_urlBackup };
     
     for (int item = 0; item < sizeof(urls) / sizeof(std::string*); ++item)
@@ -303,17 +305,33 @@ size_t DownloadTask::writeData(void *buffer, size_t size, size_t nmemb)
     return 0;
 }
 
-CopyTask::CopyTask(const std::string &src, const std::string& dest, const std::string& name) : m_src(src), m_dest(dest), m_name(name)
+CopyTask::CopyTask(const std::string &src, const std::string& dest, const std::string& name, time_t mtime/* = 0*/, bool overwrite/* = true*/) : m_src(src), m_dest(dest), m_name(name), m_mtime(mtime), m_overwrite(overwrite)
 {
 }
 
 bool CopyTask::run()
 {
-    if (::copyFile(m_src, m_dest))
+    TRACE_SPAN_ARG(TRACE_CAT_TASK, "copy", m_dest);
+    if (!m_overwrite && existsFile(m_dest))
+    {
+        return true;
+    }
+    if (::copyFileWithTime(m_src, m_dest, m_mtime))
     {
         return true;
     }
     
+    // The destination directory is only checked after a failure, it exists in most cases
+    std::string::size_type pos = m_dest.find_last_of(DIR_SEP);
+    if (pos != std::string::npos && !existsDirectory(m_dest.substr(0, pos)))
+    {
+        makeDirectory(m_dest.substr(0, pos));
+        if (::copyFileWithTime(m_src, m_dest, m_mtime))
+        {
+            return true;
+        }
+    }
+    
     if (!existsFile(m_src))
     {
         m_error = "Failed CP: " + m_src + "(not existed)  => " + m_dest;
@@ -341,6 +359,7 @@ void Mp3Task::swapBuffer(std::vector<unsigned char>& buffer)
 
 bool Mp3Task::run()
 {
+    TRACE_SPAN_ARG(TRACE_CAT_TASK, "transcode", m_mp3);
     std::vector<unsigned char> pcmData;
     bool isSilk = false;
     bool res = silkToPcm(m_pcm, pcmData, isSilk, &m_error) && !pcmData.empty();
@@ -373,12 +392,3 @@ bool Mp3Task::run()
      */
     return false;
 }
-
-PdfTask::PdfTask(PdfConverter* pdfConveter, const std::string &src, const std::string& dest, const std::string& name) : m_pdfConverter(pdfConveter), m_src(src), m_dest(dest), m_name(name)
-{
-}
-
-bool PdfTask::run()
-{
-    return m_pdfConverter->convert(m_src, m_dest);
-}
@@ -11,12 +11,10 @@
 
 #include <stdio.h>
 #include "AsyncExecutor.h"
-#include "PdfConverter.h"
 
 #define TASK_TYPE_DOWNLOAD  1
 #define TASK_TYPE_COPY      2
 #define TASK_TYPE_AUDIO     3
-#define TASK_TYPE_PDF       4
 
 class DownloadTask : public AsyncExecutor::Task
 {
@@ -90,7 +88,7 @@ protected:
 class CopyTask : public AsyncExecutor::Task
 {
 public:
-    CopyTask(const std::string &src, const std::string& dest, const std::string& name);
+    CopyTask(const std::string &src, const std::string& dest, const std::string& name, time_t mtime = 0, bool overwrite = true);
     virtual ~CopyTask() {}
     
     virtual int getType() const
@@ -109,6 +107,10 @@ public:
     {
         return m_error;
     }
+    inline std::string getDest() const
+    {
+        return m_dest;
+    }
     
     bool run();
     
@@ -117,6 +119,8 @@ private:
     std::string m_dest;
     std::string m_name;
     std::string m_error;
+    time_t m_mtime;
+    bool m_overwrite;
 };
 
 class Mp3Task : public AsyncExecutor::Task
@@ -155,28 +159,4 @@ private:
     std::vector<unsigned char> m_pcmData;
 };
 
-class PdfTask : public AsyncExecutor::Task
-{
-public:
-    PdfTask(PdfConverter* pdfConveter, const std::string &src, const std::string& dest, const std::string& name);
-    virtual ~PdfTask() {}
-    
-    virtual int getType() const
-    {
-        return TASK_TYPE_PDF;
-    }
-    virtual std::string getName() const
-    {
-        return "PDF: " + m_src + " => " + m_dest;
-    }
-    
-    bool run();
-    
-private:
-    PdfConverter   *m_pdfConverter;
-    std::string m_src;
-    std::string m_dest;
-    std::string m_name;
-};
-
 #endif /* AsyncTask_h */
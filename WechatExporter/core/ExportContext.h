@@ -17,8 +17,10 @@
 #include <list>
 #include <map>
 #include <set>
+#include <algorithm>
 
 #include <sqlite3.h>
+#include "Utils.h"
 
 #define RETURN_FALSE_IF_FAILED(rc) if (SQLITE_OK != rc) { return false; }
 
@@ -29,6 +31,85 @@
 #else
 #define WXEXP_DATA_FILE   "wxexp.dat"
 #endif
+// Written while exporting and removed when the exporting completes, an interrupted exporting resumes from it
+#define WXEXP_CHECKPOINT_FILE   "checkpoint.dat"
+// The changes of the sessions exported after the checkpoint was written, one line for each change
+#define WXEXP_CHECKPOINT_JOURNAL_FILE   "checkpoint.log"
+
+class PageInfo
+{
+private:
+    uint32_t m_page;
+    uint32_t m_count;
+    uint16_t m_year;
+    uint16_t m_month;
+    std::string m_text;
+    std::string m_fileName;
+
+public:
+    
+    PageInfo(uint32_t page, uint32_t count, uint16_t year, uint16_t month, const std::string& fileName) : m_page(page), m_count(count), m_year(year), m_month(month), m_text(std::to_string(page + 1)), m_fileName(fileName)
+    {
+    }
+    
+    PageInfo(uint32_t page, uint32_t count, uint16_t year, uint16_t month, const std::string& fileName, const std::string& text) : m_page(page), m_count(count), m_year(year), m_month(month), m_text(text), m_fileName(fileName)
+    {
+    }
+
+    uint32_t getPage() const
+    {
+        return m_page;
+    }
+    
+    uint32_t getCount() const
+    {
+        return m_count;
+    }
+    
+    void setCount(uint32_t count)
+    {
+        m_count = count;
+    }
+    
+    uint16_t getYear() const
+    {
+        return m_year;
+    }
+    
+    uint16_t getMonth() const
+    {
+        return m_month;
+    }
+    
+    std::string getText() const
+    {
+        return m_text;
+    }
+    
+    std::string getFileName() const
+    {
+        return m_fileName;
+    }
+    
+};
+
+// The messages of a session in the message database, the session is not changed since previous exporting
+// if its fingerprint is same
+struct SessionFingerprint
+{
+    std::string dbFile;
+    int64_t maxId;          // MAX(MesLocalID)
+    int64_t numberOfRows;
+    
+    SessionFingerprint() : maxId(0), numberOfRows(0)
+    {
+    }
+    
+    bool operator==(const SessionFingerprint& rhs) const
+    {
+        return maxId == rhs.maxId && numberOfRows == rhs.numberOfRows && dbFile == rhs.dbFile;
+    }
+};
 
 class ExportContext
 {
@@ -41,6 +122,13 @@ private:
     std::vector<std::pair<std::string, std::list<std::string>>> m_accountAndSessions;
     
     std::map<std::string, int64_t> m_maxIdForSessions;  //
+    // Pages of the paged html output, the incremental exporting only rewrites the pages gaining messages
+    std::map<std::string, std::vector<PageInfo>> m_pagesForSessions;
+    std::map<std::string, SessionFingerprint> m_fingerprintsForSessions;
+    // The session being exported when the checkpoint is written, its files may be written partially
+    std::string m_activeAccount;
+    std::string m_activeSession;
+    uint64_t m_msgFileSizeOfActiveSession;
     
     sqlite3*        m_db;
     sqlite3_stmt*   m_stmt;
@@ -62,8 +150,30 @@ private:
         }
     }
     
+    void addSession(const std::string& accountUsrName, const std::string& sessionUsrName)
+    {
+        auto it = m_accountAndSessions.begin();
+        for (; it != m_accountAndSessions.end(); ++it)
+        {
+            if (it->first == accountUsrName)
+            {
+                break;
+            }
+        }
+        // m_accountAndSessions
+        if (it == m_accountAndSessions.end())
+        {
+            it = m_accountAndSessions.insert(it, std::pair<std::string, std::list<std::string>>(accountUsrName, std::list<std::string>()));
+        }
+        // The sessions of previous exporting are loaded already
+        if (std::find(it->second.cbegin(), it->second.cend(), sessionUsrName) == it->second.cend())
+        {
+            it->second.push_back(sessionUsrName);
+        }
+    }
+    
 public:
-    ExportContext() : m_db(NULL), m_stmt(NULL), m_maxIdForSession(0)
+    ExportContext() : m_msgFileSizeOfActiveSession(0), m_db(NULL), m_stmt(NULL), m_maxIdForSession(0)
     {
     }
     
@@ -135,26 +245,13 @@ public:
 
     void setMaxId(const std::string& accountUsrName, const std::string& sessionUsrName, int64_t maxId)
     {
-        auto it = m_accountAndSessions.begin();
-        for (; it != m_accountAndSessions.end(); ++it)
-        {
-            if (it->first == accountUsrName)
-            {
-                break;
-            }
-        }
-        // m_accountAndSessions
-        if (it == m_accountAndSessions.end())
-        {
-            it = m_accountAndSessions.insert(it, std::pair<std::string, std::list<std::string>>(accountUsrName, std::list<std::string>()));
-        }
-        it->second.push_back(sessionUsrName);
+        addSession(accountUsrName, sessionUsrName);
 
         std::string key = accountUsrName + "\t" + sessionUsrName;
         std::map<std::string, int64_t>::iterator it2 = m_maxIdForSessions.find(key);
         if (it2 != m_maxIdForSessions.end())
         {
-            maxId = it2->second;
+            it2->second = maxId;
         }
         else
         {
@@ -162,6 +259,69 @@ public:
         }
     }
     
+    bool isSessionUnchanged(const std::string& accountUsrName, const std::string& sessionUsrName, const SessionFingerprint& fingerprint) const
+    {
+        std::map<std::string, SessionFingerprint>::const_iterator it = m_fingerprintsForSessions.find(accountUsrName + "\t" + sessionUsrName);
+        return (it != m_fingerprintsForSessions.cend()) && (it->second == fingerprint);
+    }
+    
+    void setFingerprint(const std::string& accountUsrName, const std::string& sessionUsrName, const SessionFingerprint& fingerprint)
+    {
+        // The sessions without messages are kept too, so that they are skipped next time
+        addSession(accountUsrName, sessionUsrName);
+        m_fingerprintsForSessions[accountUsrName + "\t" + sessionUsrName] = fingerprint;
+    }
+    
+    bool getPages(const std::string& accountUsrName, const std::string& sessionUsrName, std::vector<PageInfo>& pages) const
+    {
+        std::map<std::string, std::vector<PageInfo>>::const_iterator it = m_pagesForSessions.find(accountUsrName + "\t" + sessionUsrName);
+        if (it != m_pagesForSessions.cend())
+        {
+            pages = it->second;
+            return true;
+        }
+        return false;
+    }
+    
+    void setPages(const std::string& accountUsrName, const std::string& sessionUsrName, const std::vector<PageInfo>& pages)
+    {
+        m_pagesForSessions[accountUsrName + "\t" + sessionUsrName] = pages;
+    }
+    
+    // msgFileSize: the size of the messages file(.dat) of the session before it is exported
+    bool getActiveSession(const std::string& accountUsrName, const std::string& sessionUsrName, uint64_t& msgFileSize) const
+    {
+        if (m_activeAccount == accountUsrName && m_activeSession == sessionUsrName && !m_activeSession.empty())
+        {
+            msgFileSize = m_msgFileSizeOfActiveSession;
+            return true;
+        }
+        return false;
+    }
+    
+    void setActiveSession(const std::string& accountUsrName, const std::string& sessionUsrName, uint64_t msgFileSize)
+    {
+        m_activeAccount = accountUsrName;
+        m_activeSession = sessionUsrName;
+        m_msgFileSizeOfActiveSession = msgFileSize;
+    }
+    
+    void clearActiveSession()
+    {
+        m_activeAccount.clear();
+        m_activeSession.clear();
+        m_msgFileSizeOfActiveSession = 0;
+    }
+    
+    // The session will be exported again as a new one
+    void resetSession(const std::string& accountUsrName, const std::string& sessionUsrName)
+    {
+        std::string key = accountUsrName + "\t" + sessionUsrName;
+        m_maxIdForSessions.erase(key);
+        m_pagesForSessions.erase(key);
+        m_fingerprintsForSessions.erase(key);
+    }
+    
     bool prepareUserDatabase(const Friend& user, const std::string& outputDir)
     {
         closeDb();
@@ -267,15 +427,27 @@ public:
     std::string serialize() const
     {
         Json::Value contextObj(Json::objectValue);
+        serialize(contextObj);
+
+        Json::StreamWriterBuilder builder;
+#ifndef NDEBUG
+        builder["indentation"] = "\t";
+        builder["emitUTF8"] = true;
+#else
+        builder["indentation"] = "";
+#endif
+        
+        return Json::writeString(builder, contextObj);
+    }
+    
+    void serialize(Json::Value& contextObj) const
+    {
         contextObj["version"] = Json::Value(EXPORT_CONTEXT_VERSION);
         contextObj["options"] = Json::Value(m_options);
         contextObj["exportTime"] = Json::Value(static_cast<int64_t>(m_exportTime));
         contextObj["accounts"] = Json::Value(Json::arrayValue);
         Json::Value& accounts = contextObj["accounts"];
         
-        int64_t maxId = 0;
-        auto it3 = m_maxIdForSessions.cend();
-        
         for (auto it = m_accountAndSessions.cbegin(); it != m_accountAndSessions.cend(); ++it)
         {
             Json::Value& accountObj = accounts.append(Json::Value(Json::objectValue));
@@ -290,30 +462,122 @@ public:
             
             for (auto it2 = sessions.cbegin(); it2 != sessions.cend(); ++it2)
             {
-                Json::Value& itemObj = sessionsObj.append(Json::Value(Json::objectValue));
-                
-                std::string key = it->first + "\t" + *it2;
-                
-                itemObj["usrName"] = Json::Value(*it2);
-                maxId = 0;
-                it3 = m_maxIdForSessions.find(key);
-                if (it3 != m_maxIdForSessions.cend())
+                serializeSession(it->first, *it2, sessionsObj.append(Json::Value(Json::objectValue)));
+            }
+        }
+        
+        serializeActiveSession(contextObj);
+    }
+    
+    void serializeSession(const std::string& accountUsrName, const std::string& sessionUsrName, Json::Value& itemObj) const
+    {
+        std::string key = accountUsrName + "\t" + sessionUsrName;
+        
+        itemObj["usrName"] = Json::Value(sessionUsrName);
+        int64_t maxId = 0;
+        auto it3 = m_maxIdForSessions.find(key);
+        if (it3 != m_maxIdForSessions.cend())
+        {
+            maxId = it3->second;
+        }
+        itemObj["maxId"] = Json::Value(maxId);
+        
+        auto it6 = m_fingerprintsForSessions.find(key);
+        if (it6 != m_fingerprintsForSessions.cend())
+        {
+            // [dbFile, MAX(MesLocalID), number of rows]
+            itemObj["fingerprint"] = Json::Value(Json::arrayValue);
+            Json::Value& fingerprintObj = itemObj["fingerprint"];
+            fingerprintObj.append(Json::Value(it6->second.dbFile));
+            fingerprintObj.append(Json::Value(it6->second.maxId));
+            fingerprintObj.append(Json::Value(it6->second.numberOfRows));
+        }
+        
+        auto it4 = m_pagesForSessions.find(key);
+        if (it4 != m_pagesForSessions.cend())
+        {
+            // [count, year, month] of each page
+            itemObj["pages"] = Json::Value(Json::arrayValue);
+            Json::Value& pagesObj = itemObj["pages"];
+            for (auto it5 = it4->second.cbegin(); it5 != it4->second.cend(); ++it5)
+            {
+                Json::Value& pageObj = pagesObj.append(Json::Value(Json::arrayValue));
+                pageObj.append(Json::Value(it5->getCount()));
+                pageObj.append(Json::Value(it5->getYear()));
+                pageObj.append(Json::Value(it5->getMonth()));
+            }
+        }
+    }
+    
+    void serializeActiveSession(Json::Value& contextObj) const
+    {
+        if (!m_activeSession.empty())
+        {
+            // [account, session, size of the messages file]
+            contextObj["activeSession"] = Json::Value(Json::arrayValue);
+            Json::Value& activeSessionObj = contextObj["activeSession"];
+            activeSessionObj.append(Json::Value(m_activeAccount));
+            activeSessionObj.append(Json::Value(m_activeSession));
+            activeSessionObj.append(Json::Value(static_cast<Json::UInt64>(m_msgFileSizeOfActiveSession)));
+        }
+    }
+    
+    // Replaces the session with the one written by serializeSession, for the journal of the checkpoint
+    bool unserializeSession(const std::string& accountUsrName, const Json::Value& itemObj)
+    {
+        if (!itemObj.isObject() || !itemObj.isMember("usrName") || !itemObj.isMember("maxId"))
+        {
+            return false;
+        }
+        std::string sessionUsrName = itemObj["usrName"].asString();
+        resetSession(accountUsrName, sessionUsrName);
+        addSession(accountUsrName, sessionUsrName);
+        
+        std::string key = accountUsrName + "\t" + sessionUsrName;
+        int64_t maxId = itemObj["maxId"].asInt64();
+        if (maxId != 0)
+        {
+            m_maxIdForSessions[key] = maxId;
+        }
+        
+        const Json::Value& fingerprintObj = itemObj["fingerprint"];
+        if (fingerprintObj.isArray() && fingerprintObj.size() >= 3)
+        {
+            SessionFingerprint& fingerprint = m_fingerprintsForSessions[key];
+            fingerprint.dbFile = fingerprintObj[0].asString();
+            fingerprint.maxId = fingerprintObj[1].asInt64();
+            fingerprint.numberOfRows = fingerprintObj[2].asInt64();
+        }
+        
+        const Json::Value& pagesObj = itemObj["pages"];
+        if (pagesObj.isArray() && !pagesObj.empty())
+        {
+            std::vector<PageInfo>& pages = m_pagesForSessions[key];
+            pages.reserve(pagesObj.size());
+            for (Json::ArrayIndex pageIdx = 0; pageIdx < pagesObj.size(); pageIdx++)
+            {
+                const Json::Value& pageObj = pagesObj[pageIdx];
+                if (!pageObj.isArray() || pageObj.size() < 3)
                 {
-                    maxId = it3->second;
+                    return false;
                 }
-                itemObj["maxId"] = Json::Value(maxId);
+                pages.emplace_back(pageIdx, pageObj[0].asUInt(), static_cast<uint16_t>(pageObj[1].asUInt()), static_cast<uint16_t>(pageObj[2].asUInt()), std::to_string(pageIdx + 1));
             }
         }
-
-        Json::StreamWriterBuilder builder;
-#ifndef NDEBUG
-        builder["indentation"] = "\t";
-        builder["emitUTF8"] = true;
-#else
-        builder["indentation"] = "";
-#endif
-        
-        return Json::writeString(builder, contextObj);
+        return true;
+    }
+    
+    void unserializeActiveSession(const Json::Value& contextObj)
+    {
+        const Json::Value& activeSessionObj = contextObj["activeSession"];
+        if (activeSessionObj.isArray() && activeSessionObj.size() >= 3)
+        {
+            setActiveSession(activeSessionObj[0].asString(), activeSessionObj[1].asString(), activeSessionObj[2].asUInt64());
+        }
+        else
+        {
+            clearActiveSession();
+        }
     }
     
     bool upgrade(const std::string& data)
@@ -398,6 +662,12 @@ public:
             return false;
         }
         
+        return unserialize(contextObj);
+    }
+    
+    bool unserialize(const Json::Value& contextObj)
+    {
+        clearActiveSession();
         if (contextObj.isMember("version"))
         {
             m_version = contextObj["version"].asString();
@@ -467,6 +737,8 @@ public:
             
             m_accountAndSessions.clear();
             m_maxIdForSessions.clear();
+            m_pagesForSessions.clear();
+            m_fingerprintsForSessions.clear();
             
             if (!accounts.empty())
             {
@@ -505,72 +777,42 @@ public:
                     {
                         m_maxIdForSessions.insert(std::pair<std::string, int64_t>(account + "\t" + (*it2), itemObj["maxId"].asInt64()));
                     }
+                    
+                    const Json::Value& fingerprintObj = itemObj["fingerprint"];
+                    if (fingerprintObj.isArray() && fingerprintObj.size() >= 3)
+                    {
+                        SessionFingerprint& fingerprint = m_fingerprintsForSessions[account + "\t" + (*it2)];
+                        fingerprint.dbFile = fingerprintObj[0].asString();
+                        fingerprint.maxId = fingerprintObj[1].asInt64();
+                        fingerprint.numberOfRows = fingerprintObj[2].asInt64();
+                    }
+                    
+                    const Json::Value& pagesObj = itemObj["pages"];
+                    if (pagesObj.isArray() && !pagesObj.empty())
+                    {
+                        std::vector<PageInfo>& pages = m_pagesForSessions[account + "\t" + (*it2)];
+                        pages.reserve(pagesObj.size());
+                        for (Json::ArrayIndex pageIdx = 0; pageIdx < pagesObj.size(); pageIdx++)
+                        {
+                            const Json::Value& pageObj = pagesObj[pageIdx];
+                            if (!pageObj.isArray() || pageObj.size() < 3)
+                            {
+                                return false;
+                            }
+                            pages.emplace_back(pageIdx, pageObj[0].asUInt(), static_cast<uint16_t>(pageObj[1].asUInt()), static_cast<uint16_t>(pageObj[2].asUInt()), std::to_string(pageIdx + 1));
+                        }
+                    }
                 }
                 
             }
+            
+            unserializeActiveSession(contextObj);
         }
 
         return true;
     }
 };
 
-class PageInfo
-{
-private:
-    uint32_t m_page;
-    uint32_t m_count;
-    uint16_t m_year;
-    uint16_t m_month;
-    std::string m_text;
-    std::string m_fileName;
-
-public:
-    
-    PageInfo(uint32_t page, uint32_t count, uint16_t year, uint16_t month, const std::string& fileName) : m_page(page), m_count(count), m_year(year), m_month(month), m_text(std::to_string(page + 1)), m_fileName(fileName)
-    {
-    }
-    
-    PageInfo(uint32_t page, uint32_t count, uint16_t year, uint16_t month, const std::string& fileName, const std::string& text) : m_page(page), m_count(count), m_year(year), m_month(month), m_text(text), m_fileName(fileName)
-    {
-    }
-
-    uint32_t getPage() const
-    {
-        return m_page;
-    }
-    
-    uint32_t getCount() const
-    {
-        return m_count;
-    }
-    
-    void setCount(uint32_t count)
-    {
-        m_count = count;
-    }
-    
-    uint16_t getYear() const
-    {
-        return m_year;
-    }
-    
-    uint16_t getMonth() const
-    {
-        return m_month;
-    }
-    
-    std::string getText() const
-    {
-        return m_text;
-    }
-    
-    std::string getFileName() const
-    {
-        return m_fileName;
-    }
-    
-};
-
 class WXMSG;
 
 class Pager
@@ -590,6 +832,14 @@ public:
         return false;
     }
     
+    // Continues with the pages of previous exporting, the new messages(ASC) may fill the last page first
+    virtual void resume(const std::vector<PageInfo>& pages)
+    {
+        m_pages = pages;
+        m_last = m_pages.empty() ? m_pages.end() : (m_pages.end() - 1);
+        m_totalNumberOfPreviousPages = 0;
+    }
+    
     const std::vector<PageInfo>& getPages() const
     {
         return m_pages;
@@ -618,6 +868,16 @@ public:
     {
     }
     
+    virtual void resume(const std::vector<PageInfo>& pages)
+    {
+        Pager::resume(pages);
+        m_numberOfRawMsgs = 0;
+        for (auto it = pages.cbegin(); it != pages.cend(); ++it)
+        {
+            m_numberOfRawMsgs += it->getCount();
+        }
+    }
+    
     virtual bool buildNewPage(const WXMSG *msg, const std::vector<std::string>& messages)
     {
         m_numberOfRawMsgs++;
@@ -653,11 +913,17 @@ public:
     {
     }
     
+    virtual void resume(const std::vector<PageInfo>& pages)
+    {
+        Pager::resume(pages);
+        m_previousYear = pages.empty() ? 0 : pages.back().getYear();
+    }
+    
     bool buildNewPage(const WXMSG *msg, const std::vector<std::string>& messages)
     {
-        std::time_t ts = msg->createTime;
-        std::tm* t1 = std::localtime(&ts);
-        uint16_t year = t1->tm_year + 1900;
+        DateTimeParts parts;
+        splitUnixTime(msg->createTime, parts);
+        uint16_t year = parts.year;
         
         if (m_previousYear != year)
         {
@@ -689,12 +955,18 @@ public:
     {
     }
     
+    virtual void resume(const std::vector<PageInfo>& pages)
+    {
+        YearPager::resume(pages);
+        m_previousMonth = pages.empty() ? 0 : pages.back().getMonth();
+    }
+    
     bool buildNewPage(const WXMSG *msg, const std::vector<std::string>& messages)
     {
-        std::time_t ts = msg->createTime;
-        std::tm* t1 = std::localtime(&ts);
-        uint16_t year = t1->tm_year + 1900;
-        uint16_t month = t1->tm_mon + 1;
+        DateTimeParts parts;
+        splitUnixTime(msg->createTime, parts);
+        uint16_t year = parts.year;
+        uint16_t month = parts.month;
         
         if ((m_previousYear != year) || (m_previousMonth != month))
         {
@@ -1,6 +1,8 @@
 #ifndef ExportNotifier_h
 #define ExportNotifier_h
 
+class Session;
+
 class ExportNotifier
 {
 public:
@@ -21,6 +23,10 @@ public:
     virtual void onTasksStart(const std::string& usrName, uint32_t numberOfTotalTasks) const = 0;
     virtual void onTasksProgress(const std::string& usrName, uint32_t numberOfCompletedTasks, uint32_t numberOfTotalMessages) const = 0;
     virtual void onTasksComplete(const std::string& usrName, bool cancelled) const = 0;
+    
+    // Lazy loading of the session list(Exporter::loadSessionDetails), called on the loading thread
+    virtual void onSessionDetailsLoaded(const std::string& /*usrName*/, const Session& /*session*/) const {}
+    virtual void onSessionDetailsComplete(bool /*cancelled*/) const {}
 
 };
 
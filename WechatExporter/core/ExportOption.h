@@ -73,6 +73,7 @@ enum EXPORT_OPTION : uint64_t
     
     EO_SUPPORT_FILTER = 1ull << 40,
     EO_INCLUDING_SUBSCRIPTION = 1ull << 41,
+    EO_SEARCH_DB = 1ull << 42,
 
     EO_END,
     // EO_LARGR_VALUE =
@@ -216,6 +217,19 @@ public:
         return (m_options & EO_INCLUDING_SUBSCRIPTION) == EO_INCLUDING_SUBSCRIPTION;
     }
     
+    void buildSearchDatabase(bool searchDatabase = true)
+    {
+        if (searchDatabase)
+            m_options |= EO_SEARCH_DB;
+        else
+            m_options &= ~EO_SEARCH_DB;
+    }
+    
+    bool isBuildingSearchDatabase() const
+    {
+        return (m_options & EO_SEARCH_DB) == EO_SEARCH_DB;
+    }
+    
     bool isSyncLoading() const
     {
         return (m_options & EO_ASYNC_MASK) == 0;
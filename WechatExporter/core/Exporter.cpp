@@ -7,6 +7,9 @@
 //
 
 #include "Exporter.h"
+#include <deque>
+#include <mutex>
+#include <iterator>
 #include <json/json.h>
 #ifdef USING_DOWNLOADER
 #include "Downloader.h"
@@ -16,6 +19,9 @@
 #include "TaskManager.h"
 #include "WechatParser.h"
 #include "ExportContext.h"
+#include "Tracer.h"
+#include "SearchIndex.h"
+#include "SearchDatabase.h"
 #ifdef _WIN32
 #include <winsock.h>
 #endif
@@ -29,6 +35,163 @@ static const size_t PAGE_SIZE = 100;
 static const size_t PAGE_SIZE = 1000;
 #endif
 
+// Phase two of the lazy loading of sessions: works on its own copy of the sessions of phase one(the
+// caller has taken the loaded ones by swapUsersAndSessions) and fills them one by one on a background thread
+class SessionDetailsLoader
+{
+public:
+    struct UserSessions
+    {
+        Friend user;
+        Friends friends;
+        std::vector<Session> sessions;
+        SessionsParser* parser;
+        
+        UserSessions(const Friend& u) : user(u), parser(NULL)
+        {
+        }
+        
+        ~UserSessions()
+        {
+            if (NULL != parser)
+            {
+                delete parser;
+                parser = NULL;
+            }
+        }
+    };
+    
+    SessionDetailsLoader() : m_notifier(NULL), m_cancelled(false)
+    {
+    }
+    
+    ~SessionDetailsLoader()
+    {
+        cancel();
+        for (std::vector<UserSessions *>::iterator it = m_users.begin(); it != m_users.end(); ++it)
+        {
+            delete *it;
+        }
+        m_users.clear();
+    }
+    
+    UserSessions* addUser(const Friend& user)
+    {
+        UserSessions* userSessions = new UserSessions(user);
+        m_users.push_back(userSessions);
+        return userSessions;
+    }
+    
+    bool start(ExportNotifier* notifier)
+    {
+        if (m_thread.joinable())
+        {
+            return false;
+        }
+        
+        m_notifier = notifier;
+        m_cancelled = false;
+        m_pending.clear();
+        for (size_t userIdx = 0; userIdx < m_users.size(); ++userIdx)
+        {
+            for (size_t sessionIdx = 0; sessionIdx < m_users[userIdx]->sessions.size(); ++sessionIdx)
+            {
+                m_pending.push_back(std::make_pair(userIdx, sessionIdx));
+            }
+        }
+        
+        std::thread th(&SessionDetailsLoader::run, this);
+        m_thread.swap(th);
+        return true;
+    }
+    
+    void prioritize(const std::string& usrName, const std::vector<std::string>& sessionUsrNames)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t userIdx = 0; userIdx < m_users.size(); ++userIdx)
+        {
+            if (m_users[userIdx]->user.getUsrName() != usrName)
+            {
+                continue;
+            }
+            
+            // The first one of sessionUsrNames is moved to the front at last
+            const std::vector<Session>& sessions = m_users[userIdx]->sessions;
+            for (std::vector<std::string>::const_reverse_iterator it = sessionUsrNames.crbegin(); it != sessionUsrNames.crend(); ++it)
+            {
+                for (std::deque<std::pair<size_t, size_t>>::iterator itPending = m_pending.begin(); itPending != m_pending.end(); ++itPending)
+                {
+                    if (itPending->first == userIdx && sessions[itPending->second].getUsrName() == *it)
+                    {
+                        std::pair<size_t, size_t> item = *itPending;
+                        m_pending.erase(itPending);
+                        m_pending.push_front(item);
+                        break;
+                    }
+                }
+            }
+            break;
+        }
+    }
+    
+    void cancel()
+    {
+        m_cancelled = true;
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+    
+protected:
+    void run()
+    {
+        if (Tracer::isEnabled())
+        {
+            Tracer::setThreadName("session details");
+        }
+        
+        while (!m_cancelled)
+        {
+            std::pair<size_t, size_t> item;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_pending.empty())
+                {
+                    break;
+                }
+                item = m_pending.front();
+                m_pending.pop_front();
+            }
+            
+            UserSessions* userSessions = m_users[item.first];
+            Session& session = userSessions->sessions[item.second];
+            {
+                TRACE_SPAN_ARG(TRACE_CAT_SESSION, "session details", session.getUsrName());
+                userSessions->parser->parseSessionDetails(userSessions->user, session);
+            }
+            if (NULL != m_notifier)
+            {
+                m_notifier->onSessionDetailsLoaded(userSessions->user.getUsrName(), session);
+            }
+        }
+        
+        if (NULL != m_notifier)
+        {
+            m_notifier->onSessionDetailsComplete(m_cancelled);
+        }
+    }
+    
+private:
+    std::vector<UserSessions *> m_users;
+    ExportNotifier* m_notifier;
+    
+    std::mutex m_mutex;
+    std::deque<std::pair<size_t, size_t>> m_pending;    // (index of user, index of session)
+    std::atomic<bool> m_cancelled;
+    std::thread m_thread;
+};
+
 Exporter::Exporter(const std::string& workDir, const std::string& backup, const std::string& output, Logger* logger, PdfConverter* pdfConverter)
 {
     m_running = false;
@@ -46,15 +209,25 @@ Exporter::Exporter(const std::string& workDir, const std::string& backup, const
     m_extName = "html";
     m_templatesName = "templates";
     m_exportContext = NULL;
+    m_sessionDetailsLoader = NULL;
+    m_searchDb = NULL;
+    m_pendingTasks = NULL;
+    m_checkpointId = 0;
 }
 
 Exporter::~Exporter()
 {
+    cancelSessionDetails();
     if (NULL != m_exportContext)
     {
         delete m_exportContext;
         m_exportContext = NULL;
     }
+    if (NULL != m_pendingTasks)
+    {
+        delete m_pendingTasks;
+        m_pendingTasks = NULL;
+    }
     releaseITunes();
     m_logger = NULL;
     m_notifier = NULL;
@@ -144,6 +317,296 @@ bool Exporter::loadExportContext(const std::string& contextFile, ExportContext *
     return true;
 }
 
+// [output, src, backupSrc, defaultFile, mtime, download]
+static void serializePendingTask(const PendingTask& task, Json::Value& taskObj)
+{
+    taskObj.append(Json::Value(task.output));
+    taskObj.append(Json::Value(task.src));
+    taskObj.append(Json::Value(task.backupSrc));
+    taskObj.append(Json::Value(task.defaultFile));
+    taskObj.append(Json::Value(static_cast<int64_t>(task.mtime)));
+    taskObj.append(Json::Value(task.download));
+}
+
+static bool unserializePendingTask(const Json::Value& taskObj, PendingTask& task)
+{
+    if (!taskObj.isArray() || taskObj.size() < 6)
+    {
+        return false;
+    }
+    task.output = taskObj[0].asString();
+    task.src = taskObj[1].asString();
+    task.backupSrc = taskObj[2].asString();
+    task.defaultFile = taskObj[3].asString();
+    task.mtime = static_cast<time_t>(taskObj[4].asInt64());
+    task.download = taskObj[5].asBool();
+    return true;
+}
+
+bool Exporter::writeCheckpoint(const std::string& usrName, TaskManager* taskManager)
+{
+    TRACE_SPAN(TRACE_CAT_EXPORT, "checkpoint");
+    Json::Value checkpointObj(Json::objectValue);
+    m_exportContext->serialize(checkpointObj);
+    uint32_t checkpointId = m_checkpointId + 1;
+    checkpointObj["checkpointId"] = Json::Value(checkpointId);
+    
+    // usrName of the account => [task, ...]
+    checkpointObj["pendingTasks"] = Json::Value(Json::objectValue);
+    Json::Value& pendingTasksObj = checkpointObj["pendingTasks"];
+    std::vector<PendingTask> pendingTasks;
+    if (NULL != taskManager)
+    {
+        taskManager->getPendingTasks(pendingTasks);
+    }
+    if (!pendingTasks.empty())
+    {
+        Json::Value& tasksObj = pendingTasksObj[usrName] = Json::Value(Json::arrayValue);
+        for (std::vector<PendingTask>::const_iterator it = pendingTasks.cbegin(); it != pendingTasks.cend(); ++it)
+        {
+            serializePendingTask(*it, tasksObj.append(Json::Value(Json::arrayValue)));
+        }
+    }
+    if (NULL != m_pendingTasks)
+    {
+        // The tasks of the accounts which are not exported yet
+        for (std::map<std::string, std::vector<PendingTask>>::const_iterator it = m_pendingTasks->cbegin(); it != m_pendingTasks->cend(); ++it)
+        {
+            if (it->first == usrName)
+            {
+                continue;
+            }
+            Json::Value& tasksObj = pendingTasksObj[it->first] = Json::Value(Json::arrayValue);
+            for (std::vector<PendingTask>::const_iterator it2 = it->second.cbegin(); it2 != it->second.cend(); ++it2)
+            {
+                serializePendingTask(*it2, tasksObj.append(Json::Value(Json::arrayValue)));
+            }
+        }
+    }
+    
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    
+    // Written to a temporary file first, so the previous checkpoint is kept if the exporting is interrupted here.
+    // The lines of the old journal don't match the new checkpointId, they are ignored even if it's not deleted
+    std::string fileName = combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_CHECKPOINT_FILE);
+    std::string tmpFileName = fileName + ".tmp";
+    if (!writeFile(tmpFileName, Json::writeString(builder, checkpointObj)) || !replaceFile(tmpFileName, fileName))
+    {
+        m_logger->debug("Failed to write the checkpoint: " + fileName);
+        return false;
+    }
+    m_checkpointId = checkpointId;
+    deleteFile(combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_CHECKPOINT_JOURNAL_FILE));
+    return true;
+}
+
+bool Exporter::appendCheckpointJournal(const std::string& usrName, const std::string& sessionUsrName, TaskManager* taskManager)
+{
+    TRACE_SPAN(TRACE_CAT_EXPORT, "checkpoint journal");
+    // The session, the active session and the changes of the pending tasks, so the line doesn't grow with the sessions
+    Json::Value lineObj(Json::objectValue);
+    lineObj["checkpointId"] = Json::Value(m_checkpointId);
+    lineObj["account"] = Json::Value(usrName);
+    lineObj["session"] = Json::Value(Json::objectValue);
+    m_exportContext->serializeSession(usrName, sessionUsrName, lineObj["session"]);
+    m_exportContext->serializeActiveSession(lineObj);
+    
+    std::vector<PendingTask> addedTasks;
+    std::vector<std::string> removedOutputs;
+    if (NULL != taskManager)
+    {
+        taskManager->getPendingTaskChanges(addedTasks, removedOutputs);
+    }
+    if (!addedTasks.empty())
+    {
+        Json::Value& tasksObj = lineObj["addedTasks"] = Json::Value(Json::arrayValue);
+        for (std::vector<PendingTask>::const_iterator it = addedTasks.cbegin(); it != addedTasks.cend(); ++it)
+        {
+            serializePendingTask(*it, tasksObj.append(Json::Value(Json::arrayValue)));
+        }
+    }
+    if (!removedOutputs.empty())
+    {
+        Json::Value& outputsObj = lineObj["removedTasks"] = Json::Value(Json::arrayValue);
+        for (std::vector<std::string>::const_iterator it = removedOutputs.cbegin(); it != removedOutputs.cend(); ++it)
+        {
+            outputsObj.append(Json::Value(*it));
+        }
+    }
+    
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    
+    // An interrupted append leaves a broken last line, which ends the reading of the journal
+    std::string fileName = combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_CHECKPOINT_JOURNAL_FILE);
+    if (!appendFile(fileName, Json::writeString(builder, lineObj) + "\n"))
+    {
+        m_logger->debug("Failed to write the journal of the checkpoint: " + fileName);
+        return false;
+    }
+    return true;
+}
+
+bool Exporter::loadCheckpoint(const std::string& checkpointFile, std::map<std::string, std::vector<PendingTask>>& pendingTasks)
+{
+    std::string contents = readFile(checkpointFile);
+    if (contents.empty())
+    {
+        return false;
+    }
+    
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+
+    Json::Value checkpointObj;
+    Json::String error;
+    if (!reader->parse(contents.c_str(), contents.c_str() + contents.size(), &checkpointObj, &error) || !m_exportContext->unserialize(checkpointObj))
+    {
+        delete m_exportContext;
+        m_exportContext = new ExportContext();
+        return false;
+    }
+    m_checkpointId = checkpointObj["checkpointId"].asUInt();
+    
+    // Output => task, so the journal can add and remove them
+    std::map<std::string, std::map<std::string, PendingTask>> tasksOfAccounts;
+    const Json::Value& pendingTasksObj = checkpointObj["pendingTasks"];
+    if (pendingTasksObj.isObject())
+    {
+        for (Json::Value::const_iterator it = pendingTasksObj.begin(); it != pendingTasksObj.end(); ++it)
+        {
+            if (!it->isArray())
+            {
+                continue;
+            }
+            std::map<std::string, PendingTask>& tasks = tasksOfAccounts[it.name()];
+            for (Json::ArrayIndex idx = 0; idx < it->size(); idx++)
+            {
+                PendingTask task;
+                if (unserializePendingTask((*it)[idx], task))
+                {
+                    tasks[task.output] = task;
+                }
+            }
+        }
+    }
+    
+    // The sessions exported after the checkpoint was written
+    std::string journal = readFile(combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_CHECKPOINT_JOURNAL_FILE));
+    std::string::size_type lineStart = 0;
+    while (lineStart < journal.size())
+    {
+        std::string::size_type lineEnd = journal.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+        {
+            // Interrupted in the middle of the line
+            break;
+        }
+        Json::Value lineObj;
+        if (!reader->parse(journal.c_str() + lineStart, journal.c_str() + lineEnd, &lineObj, &error) || !lineObj.isObject())
+        {
+            break;
+        }
+        lineStart = lineEnd + 1;
+        if (lineObj["checkpointId"].asUInt() != m_checkpointId)
+        {
+            continue;
+        }
+        
+        std::string account = lineObj["account"].asString();
+        if (!m_exportContext->unserializeSession(account, lineObj["session"]))
+        {
+            break;
+        }
+        m_exportContext->unserializeActiveSession(lineObj);
+        
+        std::map<std::string, PendingTask>& tasks = tasksOfAccounts[account];
+        const Json::Value& addedTasksObj = lineObj["addedTasks"];
+        for (Json::ArrayIndex idx = 0; addedTasksObj.isArray() && idx < addedTasksObj.size(); idx++)
+        {
+            PendingTask task;
+            if (unserializePendingTask(addedTasksObj[idx], task))
+            {
+                tasks[task.output] = task;
+            }
+        }
+        const Json::Value& removedTasksObj = lineObj["removedTasks"];
+        for (Json::ArrayIndex idx = 0; removedTasksObj.isArray() && idx < removedTasksObj.size(); idx++)
+        {
+            tasks.erase(removedTasksObj[idx].asString());
+        }
+    }
+    
+    if (m_exportContext->getNumberOfSessions() == 0)
+    {
+        // Nothing to resume, start over with a clean context
+        delete m_exportContext;
+        m_exportContext = new ExportContext();
+        m_checkpointId = 0;
+        return false;
+    }
+    
+    for (std::map<std::string, std::map<std::string, PendingTask>>::const_iterator it = tasksOfAccounts.cbegin(); it != tasksOfAccounts.cend(); ++it)
+    {
+        if (it->second.empty())
+        {
+            continue;
+        }
+        std::vector<PendingTask>& tasks = pendingTasks[it->first];
+        tasks.reserve(it->second.size());
+        for (std::map<std::string, PendingTask>::const_iterator it2 = it->second.cbegin(); it2 != it->second.cend(); ++it2)
+        {
+            tasks.push_back(it2->second);
+        }
+    }
+    
+    return true;
+}
+
+void Exporter::resumePendingTasks(const std::string& usrName, TaskManager& taskManager)
+{
+    if (NULL == m_pendingTasks)
+    {
+        return;
+    }
+    std::map<std::string, std::vector<PendingTask>>::iterator itTasks = m_pendingTasks->find(usrName);
+    if (itTasks == m_pendingTasks->end())
+    {
+        return;
+    }
+    
+    size_t numberOfTasks = 0;
+    for (std::vector<PendingTask>::const_iterator it = itTasks->second.cbegin(); it != itTasks->second.cend(); ++it)
+    {
+        if (it->download)
+        {
+            // The downloads are renamed from the temporary files when they are done
+            if (!existsFile(it->output))
+            {
+                taskManager.markResumedTask(it->output);
+                taskManager.download(NULL, it->src, it->backupSrc, it->output, it->mtime, it->defaultFile);
+                ++numberOfTasks;
+            }
+        }
+        else
+        {
+            // The copy may be interrupted in the middle, overwrite it
+            taskManager.markResumedTask(it->output);
+            taskManager.copyFile(it->src, it->output, it->mtime, true);
+            ++numberOfTasks;
+        }
+    }
+    m_logger->write(formatString(m_resManager.getLocaleString("%d unfinished task(s) resumed."), (int)numberOfTasks));
+    
+    m_pendingTasks->erase(itTasks);
+    if (m_pendingTasks->empty())
+    {
+        delete m_pendingTasks;
+        m_pendingTasks = NULL;
+    }
+}
+
 void Exporter::setNotifier(ExportNotifier *notifier)
 {
     m_notifier = notifier;
@@ -197,6 +660,9 @@ bool Exporter::run()
         
         return false;
     }
+    
+    // Both use the iTunes catalog which may be reloaded by the exporting
+    cancelSessionDetails();
 
     if (!existsDirectory(m_output))
     {
@@ -212,8 +678,9 @@ bool Exporter::run()
     return true;
 }
 
-bool Exporter::loadUsersAndSessions()
+bool Exporter::loadUsersAndSessions(bool lazy/* = false*/)
 {
+    cancelSessionDetails();
     m_usersAndSessions.clear();
     
     m_resManager.initLocaleResource(m_workDir, m_languageCode);
@@ -246,11 +713,35 @@ bool Exporter::loadUsersAndSessions()
 
     m_logger->debug("WeChat Users loaded.");
     m_usersAndSessions.reserve(users.size()); // Avoid re-allocation and causing the pointer changed
+    if (lazy)
+    {
+        m_sessionDetailsLoader = new SessionDetailsLoader();
+    }
     for (std::vector<Friend>::const_iterator it = users.cbegin(); it != users.cend(); ++it)
     {
         std::vector<std::pair<Friend, std::vector<Session>>>::iterator it2 = m_usersAndSessions.emplace(m_usersAndSessions.cend(), std::pair<Friend, std::vector<Session>>(*it, std::vector<Session>()));
-        Friends friends;
-        loadUserFriendsAndSessions(it2->first, friends, it2->second, false);
+        if (!lazy)
+        {
+            Friends friends;
+            loadUserFriendsAndSessions(it2->first, friends, it2->second, false);
+            continue;
+        }
+        
+        TRACE_SPAN_ARG(TRACE_CAT_EXPORT, "discover sessions", it2->first.getUsrName());
+        SessionDetailsLoader::UserSessions* userSessions = m_sessionDetailsLoader->addUser(it2->first);
+        std::string wcdbPath = m_iTunesDb->findRealPath(combinePath("Documents", it2->first.getHash(), "DB", "WCDB_Contact.sqlite"));
+        FriendsParser friendsParser(false);
+        friendsParser.parseWcdb(wcdbPath, userSessions->friends);
+        
+        userSessions->parser = new SessionsParser(m_iTunesDb, m_iTunesDbShare, userSessions->friends, m_wechatInfo.getCellDataVersion(), m_logger, false);
+        userSessions->parser->parseSessions(it2->first, it2->second);
+        std::sort(it2->second.begin(), it2->second.end(), SessionActiveTimeCompare());
+        userSessions->sessions = it2->second;
+        // The copies must not point back into m_usersAndSessions, which the caller may swap away while the loader runs
+        for (std::vector<Session>::iterator it3 = userSessions->sessions.begin(); it3 != userSessions->sessions.end(); ++it3)
+        {
+            it3->setOwner(&userSessions->user);
+        }
     }
 
     return true;
@@ -261,11 +752,41 @@ void Exporter::swapUsersAndSessions(std::vector<std::pair<Friend, std::vector<Se
     usersAndSessions.swap(m_usersAndSessions);
 }
 
+bool Exporter::loadSessionDetails()
+{
+    if (NULL == m_sessionDetailsLoader)
+    {
+        return false;
+    }
+    return m_sessionDetailsLoader->start(m_notifier);
+}
+
+void Exporter::prioritizeSessionDetails(const std::string& usrName, const std::vector<std::string>& sessionUsrNames)
+{
+    if (NULL != m_sessionDetailsLoader)
+    {
+        m_sessionDetailsLoader->prioritize(usrName, sessionUsrNames);
+    }
+}
+
+void Exporter::cancelSessionDetails()
+{
+    if (NULL != m_sessionDetailsLoader)
+    {
+        delete m_sessionDetailsLoader;
+        m_sessionDetailsLoader = NULL;
+    }
+}
+
 bool Exporter::runImpl()
 {
 #if !defined(NDEBUG) || defined(DBG_PERF)
     setThreadName("exp");
 #endif
+    if (Tracer::isEnabled())
+    {
+        Tracer::setThreadName("exporter");
+    }
     time_t startTime;
     std::time(&startTime);
     notifyStart();
@@ -333,7 +854,22 @@ bool Exporter::runImpl()
     }
     uint64_t orgOptions = m_options;
     std::string contextFileName = combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_DATA_FILE);
-    if ((m_options.isIncrementalExporting()) && loadExportContext(contextFileName, m_exportContext))
+    std::string checkpointFileName = combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_CHECKPOINT_FILE);
+    std::map<std::string, std::vector<PendingTask>> pendingTasks;
+    if (existsFile(checkpointFileName) && loadCheckpoint(checkpointFileName, pendingTasks))
+    {
+        // The previous exporting was interrupted, it goes on as incremental exporting with its options:
+        // the completed sessions are skipped and the others append the messages after their last pages
+        m_options = m_exportContext->getOptions();
+        m_options.setIncrementalExporting(true);
+        if (!pendingTasks.empty())
+        {
+            m_pendingTasks = new std::map<std::string, std::vector<PendingTask>>();
+            m_pendingTasks->swap(pendingTasks);
+        }
+        m_logger->write(m_resManager.getLocaleString("Resuming the interrupted exporting"));
+    }
+    else if ((m_options.isIncrementalExporting()) && loadExportContext(contextFileName, m_exportContext))
     {
         // Use the previous options
         m_options = m_exportContext->getOptions();
@@ -346,6 +882,17 @@ bool Exporter::runImpl()
         m_exportContext->setOptions(m_options);
     }
     
+    if (m_options.isBuildingSearchDatabase())
+    {
+        m_searchDb = new SearchDatabase();
+        if (!m_searchDb->open(SearchDatabase::getPath(m_output), false))
+        {
+            m_logger->write(formatString(m_resManager.getLocaleString("Failed to open the search database: %s"), m_searchDb->getError().c_str()));
+            delete m_searchDb;
+            m_searchDb = NULL;
+        }
+    }
+    
     std::string htmlBody;
 
     std::set<std::string> userFileNames;
@@ -399,6 +946,13 @@ bool Exporter::runImpl()
     
     writeFile(fileName, html);
     
+    if (m_options.isPdfMode() && NULL != m_pdfConverter)
+    {
+        // The pages of the last sessions may still be printing
+        TRACE_SPAN(TRACE_CAT_TASK, "wait for pdf");
+        m_pdfConverter->waitForCompletion();
+    }
+    
     m_options = orgOptions;
     if (m_exportContext->getNumberOfSessions() > 0)
     {
@@ -406,9 +960,24 @@ bool Exporter::runImpl()
         fileName = combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_DATA_FILE);
         writeFile(fileName, m_exportContext->serialize());
     }
+    if (!m_cancelled)
+    {
+        deleteFile(checkpointFileName);
+        deleteFile(combinePath(m_output, WXEXP_DATA_FOLDER, WXEXP_CHECKPOINT_JOURNAL_FILE));
+    }
     
     delete m_exportContext;
     m_exportContext = NULL;
+    if (NULL != m_pendingTasks)
+    {
+        delete m_pendingTasks;
+        m_pendingTasks = NULL;
+    }
+    if (NULL != m_searchDb)
+    {
+        delete m_searchDb;
+        m_searchDb = NULL;
+    }
     
     time_t endTime = 0;
     std::time(&endTime);
@@ -430,6 +999,7 @@ bool Exporter::runImpl()
 
 bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
 {
+    TRACE_SPAN_ARG(TRACE_CAT_EXPORT, "user", user.getUsrName());
     std::string uidMd5 = user.getHash();
     
     std::string userBase = combinePath("Documents", uidMd5);
@@ -515,7 +1085,10 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
     TaskManager taskManager(m_logger);
 #endif
 #ifndef NDEBUG
-    m_logger->debug("UA: " + m_wechatInfo.buildUserAgent());
+    if (m_logger->isDebugEnabled())
+    {
+        m_logger->debug("UA: " + m_wechatInfo.buildUserAgent());
+    }
 #endif
     
 #ifdef USING_DOWNLOADER
@@ -525,11 +1098,17 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
 #endif
 
     MessageParser msgParser(*m_iTunesDb, *m_iTunesDbShare, taskManager, friends, *myself, m_options, m_workDir, outputBase, m_resManager);
+    resumePendingTasks(user.getUsrName(), taskManager);
+    // The sessions of the account are journaled after this
+    writeCheckpoint(user.getUsrName(), &taskManager);
     
     if (!m_options.isTextMode())
     {
 #ifndef NDEBUG
-        m_logger->debug("Download avatar: *" + user.getPortrait() + "* => " + combinePath(outputBase, "Portrait", user.getLocalPortrait()));
+        if (m_logger->isDebugEnabled())
+        {
+            m_logger->debug("Download avatar: *" + user.getPortrait() + "* => " + combinePath(outputBase, "Portrait", user.getLocalPortrait()));
+        }
 #endif
         msgParser.copyPortraitIcon(NULL, user, combinePath(outputBase, "Portrait"));
         // downloader.addTask(user.getPortrait(), combinePath(outputBase, "Portrait", user.getLocalPortrait()), 0);
@@ -572,6 +1151,11 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
     writeFile(contactPath, csvContents);
     
     std::string weChatIdFormat = m_resManager.getLocaleString(" (WeChat ID: %s)");
+    
+    // The fingerprints are saved in the context even if it's not incremental exporting, for the next one
+    std::map<std::string, SessionFingerprint> fingerprints;
+    buildSessionFingerprints(sessions, fingerprints);
+    int numberOfUnchangedSessions = 0;
 
     std::set<std::string> sessionFileNames;
     for (std::vector<Session>::iterator it = sessions.begin(); it != sessions.end(); ++it)
@@ -593,8 +1177,16 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
             it->setData(itSession->second);
         }
         
+        std::map<std::string, SessionFingerprint>::const_iterator itFingerprint = fingerprints.find(it->getUsrName());
+        // No new or deleted rows in the message database since previous exporting: nothing to write, the files are kept
+        bool unchanged = m_options.isIncrementalExporting() && (itFingerprint != fingerprints.cend()) && m_exportContext->isSessionUnchanged(user.getUsrName(), it->getUsrName(), itFingerprint->second);
+        
         int recordCount = it->getRecordCount();
-        if (m_options.isIncrementalExporting())
+        if (unchanged)
+        {
+            recordCount = 0;
+        }
+        else if (m_options.isIncrementalExporting())
         {
             int64_t maxMsgId = 0;
             m_exportContext->getMaxId(user.getUsrName(), it->getUsrName(), maxMsgId);
@@ -625,14 +1217,55 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
 			notifySessionComplete(it->getUsrName(), it->getData(), m_cancelled);
             continue;
         }
-        if (!m_options.isTextMode())
+        int count = 0;
+        if (unchanged)
         {
-            // Download avatar for session
-            msgParser.copyPortraitIcon(&(*it), *it, combinePath(outputBase, "Portrait"));
+            ++numberOfUnchangedSessions;
+            m_logger->write(m_resManager.getLocaleString("No new messages. Skip it."));
+            // Same as exportSession without new messages, the session is listed if it was exported
+            count = (itFingerprint->second.maxId > 0) ? 1 : 0;
+        }
+        else
+        {
+            if (!m_options.isTextMode())
+            {
+                // Download avatar for session
+                msgParser.copyPortraitIcon(&(*it), *it, combinePath(outputBase, "Portrait"));
+            }
+            if (NULL != m_searchDb && !m_searchDb->beginSession(user.getUsrName(), *it, userOutputPath + "/" + it->getOutputFileName(), !m_options.isTextMode()))
+            {
+                m_logger->write(formatString(m_resManager.getLocaleString("Failed to write the search database: %s"), m_searchDb->getError().c_str()));
+            }
+            // The session is active in the checkpoints until its files are written. If the messages file was changed
+            // by the interrupted exporting, the max id and pages in the context don't match the files any more
+            std::string rawMsgFileName = combinePath(m_output, WXEXP_DATA_FOLDER, user.getUsrName(), it->getUsrName() + ".dat");
+            uint64_t msgFileSize = existsFile(rawMsgFileName) ? getFileSize(rawMsgFileName) : 0;
+            uint64_t prevMsgFileSize = 0;
+            if (m_exportContext->getActiveSession(user.getUsrName(), it->getUsrName(), prevMsgFileSize) && prevMsgFileSize != msgFileSize)
+            {
+                m_logger->debug("Export the interrupted session again: " + it->getUsrName());
+                m_exportContext->resetSession(user.getUsrName(), it->getUsrName());
+                deleteFile(rawMsgFileName);
+                msgFileSize = 0;
+            }
+            m_exportContext->setActiveSession(user.getUsrName(), it->getUsrName(), msgFileSize);
+            appendCheckpointJournal(user.getUsrName(), it->getUsrName(), &taskManager);
+            count = exportSession(*myself, msgParser, *it, userBase, outputBase);
+            if (NULL != m_searchDb)
+            {
+                m_searchDb->endSession();
+            }
+            taskManager.clearCopiedFiles();
+            // A cancelled session is written as far as it goes, next exporting continues after its last message
+            m_exportContext->clearActiveSession();
+            if (!m_cancelled && itFingerprint != fingerprints.cend())
+            {
+                m_exportContext->setFingerprint(user.getUsrName(), it->getUsrName(), itFingerprint->second);
+            }
+            appendCheckpointJournal(user.getUsrName(), it->getUsrName(), &taskManager);
+            
+            m_logger->write(formatString(m_resManager.getLocaleString("Succeeded handling %d messages."), count));
         }
-        int count = exportSession(*myself, msgParser, *it, userBase, outputBase);
-        
-        m_logger->write(formatString(m_resManager.getLocaleString("Succeeded handling %d messages."), count));
 
         if (count > 0)
         {
@@ -665,19 +1298,27 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
 
 		notifySessionComplete(it->getUsrName(), it->getData(), m_cancelled);
         
-        if (pdfOutput)
+        if (pdfOutput && !unchanged)
         {
             // std::string 
             std::string htmlFileName = combinePath(outputBase, it->getOutputFileName(), "index." + m_extName);
             if (existsFile(htmlFileName))
             {
                 std::string pdfFileName = combinePath(m_output, "pdf", userOutputPath, it->getOutputFileName() + ".pdf");
+                // The images/videos of the session are copied asynchronously
+                taskManager.waitForCopies();
                 // taskManager.convertPdf(&(*it), htmlFileName, pdfFileName, m_pdfConverter);
+                TRACE_SPAN_ARG(TRACE_CAT_TASK, "pdf", pdfFileName);
                 m_pdfConverter->convert(htmlFileName, pdfFileName);
             }
         }
     }
 
+    if (numberOfUnchangedSessions > 0)
+    {
+        m_logger->write(formatString(m_resManager.getLocaleString("%d unchanged chat(s) skipped."), numberOfUnchangedSessions));
+    }
+
     std::string html = m_resManager.getTemplate("listframe");
     replaceAll(html, "%%USERNAME%%", " - " + user.getDisplayName());
     replaceAll(html, "%%TBODY%%", userBody);
@@ -718,6 +1359,7 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
 
     notifyTasksStart(user.getUsrName(), static_cast<uint32_t>(dlCount));
     
+    TraceSpan waitingSpan(TRACE_CAT_EXPORT, "wait for tasks");
 #ifdef USING_DOWNLOADER
     downloader.shutdown();
 #else
@@ -747,6 +1389,22 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
     }
 #endif
 
+    waitingSpan.end();
+    // The tasks dropped by cancellation are kept in the checkpoint
+    writeCheckpoint(user.getUsrName(), &taskManager);
+    
+    // The checkpoint doesn't keep the failed ones, which would be resumed again and again, so tell the user about them
+    std::vector<PendingTask> failedTasks;
+    taskManager.getFailedResumedTasks(failedTasks);
+    if (!failedTasks.empty())
+    {
+        m_logger->write(formatString(m_resManager.getLocaleString("%d resumed task(s) failed."), (int)failedTasks.size()));
+        for (std::vector<PendingTask>::const_iterator it = failedTasks.cbegin(); it != failedTasks.cend(); ++it)
+        {
+            m_logger->write(it->src + " => " + it->output);
+        }
+    }
+
     if (dlCount != prevDlCount)
     {
         notifyTasksProgress(user.getUsrName(), static_cast<uint32_t>(dlCount - prevDlCount), static_cast<uint32_t>(dlCount));
@@ -761,8 +1419,42 @@ bool Exporter::exportUser(Friend& user, std::string& userOutputPath)
     return true;
 }
 
+void Exporter::buildSessionFingerprints(const std::vector<Session>& sessions, std::map<std::string, SessionFingerprint>& fingerprints)
+{
+    TRACE_SPAN(TRACE_CAT_EXPORT, "fingerprints");
+    std::map<std::string, std::vector<std::string>> sessionHashesOfDbs;
+    for (std::vector<Session>::const_iterator it = sessions.cbegin(); it != sessions.cend(); ++it)
+    {
+        if (!it->isDbFileEmpty())
+        {
+            sessionHashesOfDbs[it->getDbFile()].push_back(it->getHash());
+        }
+    }
+    
+    std::map<std::string, int64_t> maxIds;
+    for (std::map<std::string, std::vector<std::string>>::const_iterator it = sessionHashesOfDbs.cbegin(); it != sessionHashesOfDbs.cend(); ++it)
+    {
+        SessionParser::queryMaxIds(it->first, it->second, maxIds);
+    }
+    
+    for (std::vector<Session>::const_iterator it = sessions.cbegin(); it != sessions.cend(); ++it)
+    {
+        std::map<std::string, int64_t>::const_iterator itMaxId = maxIds.find(it->getHash());
+        if (it->isDbFileEmpty() || itMaxId == maxIds.cend())
+        {
+            continue;
+        }
+        // The rows are counted when the sessions are loaded
+        SessionFingerprint& fingerprint = fingerprints[it->getUsrName()];
+        fingerprint.dbFile = it->getDbFile();
+        fingerprint.maxId = itMaxId->second;
+        fingerprint.numberOfRows = it->getRecordCount();
+    }
+}
+
 bool Exporter::loadUserFriendsAndSessions(const Friend& user, Friends& friends, std::vector<Session>& sessions, bool detailedInfo/* = true*/)
 {
+    TRACE_SPAN_ARG(TRACE_CAT_EXPORT, "discover sessions", user.getUsrName());
     std::string uidMd5 = user.getHash();
     std::string userBase = combinePath("Documents", uidMd5);
 
@@ -773,7 +1465,10 @@ bool Exporter::loadUserFriendsAndSessions(const Friend& user, Friends& friends,
 #endif
     friendsParser.parseWcdb(wcdbPath, friends);
 
-    m_logger->debug("WeChat Friends(" + std::to_string(friends.friends.size()) + ") for: " + user.getDisplayName() + " loaded.");
+    if (m_logger->isDebugEnabled())
+    {
+        m_logger->debug("WeChat Friends(" + std::to_string(friends.friends.size()) + ") for: " + user.getDisplayName() + " loaded.");
+    }
     
     m_tags.clear();
     if (detailedInfo)
@@ -811,24 +1506,42 @@ bool Exporter::loadUserFriendsAndSessions(const Friend& user, Friends& friends,
     return true;
 }
 
-bool Exporter::buildScriptFile(const std::string& fileName, std::vector<std::string>::const_iterator b, std::vector<std::string>::const_iterator e, const PageInfo& page) const
+// The messages are already rendered, so they are escaped directly instead of going through Json::Value
+static void buildJsonStringArray(std::string& output, std::vector<std::string>::const_iterator b, std::vector<std::string>::const_iterator e)
 {
-    std::string scripts = m_resManager.getTemplate("scripts");
-    Json::Value jsonMsgs(Json::arrayValue);
+    size_t length = 2;
     for (auto it = b; it != e; ++it)
     {
-        jsonMsgs.append(*it);
+        length += it->size() + (it->size() >> 3) + 3;
     }
-    Json::StreamWriterBuilder builder;
+    output.reserve(output.size() + length);
+    
+    output.push_back('[');
+    for (auto it = b; it != e; ++it)
+    {
+        if (it != b)
+        {
+            output.push_back(',');
+        }
 #ifndef NDEBUG
-    builder["indentation"] = "\t";  // assume default for comments is None
-    builder["emitUTF8"] = true;
-#else
-    builder["indentation"] = "";
+        output.append("\n\t", 2);
+#endif
+        appendJsonString(output, it->c_str(), it->size());
+    }
+#ifndef NDEBUG
+    output.push_back('\n');
 #endif
-    std::string moreMsgs = Json::writeString(builder, jsonMsgs);
+    output.push_back(']');
+}
+
+bool Exporter::buildScriptFile(const std::string& fileName, std::vector<std::string>::const_iterator b, std::vector<std::string>::const_iterator e, const PageInfo& page) const
+{
+    std::string scripts = m_resManager.getTemplate("scripts");
+    std::string moreMsgs;
+    buildJsonStringArray(moreMsgs, b, e);
 
     replaceAll(scripts, "%%JSON_DATA%%", moreMsgs);
+    replaceAll(scripts, "%%PAGE%%", std::to_string(page.getPage() + 1));
     
     // std::string dataFileName = combinePath(dataPath, "msg-" + page.getFileName() + ".js");
     writeFile(fileName, scripts);
@@ -843,6 +1556,7 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
         return 0;
     }
     
+    TRACE_SPAN_ARG(TRACE_CAT_SESSION, "session", session.getUsrName());
     std::string sessionBasePath = combinePath(outputBase, session.getOutputFileName(), "Files");
     if (!m_options.isTextMode())
     {
@@ -867,15 +1581,56 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
     {
         m_exportContext->prepareSessionTable(session);
     }
+    
+    std::string rawMsgFileName = combinePath(m_output, WXEXP_DATA_FOLDER, session.getOwner()->getUsrName(), session.getUsrName() + ".dat");
+    bool mergingMessages = m_options.isIncrementalExporting();
+    // Paged html output: the new messages are appended to the pages of previous exporting, so only the pages
+    // gaining messages are rewritten. The page files in DESC order or without the pages in the context can't
+    // be updated in place, all the messages of the session are exported again.
+    std::vector<PageInfo> previousPages;
+    uint32_t numberOfPreviousMsgs = 0;
+    if (mergingMessages && maxMsgId > 0 && m_options.isHtmlMode() && !m_options.isSyncLoading())
+    {
+        bool resumingPages = false;
+        if (!m_options.isDesc() && m_exportContext->getPages(user.getUsrName(), session.getUsrName(), previousPages))
+        {
+            for (auto it = previousPages.cbegin(); it != previousPages.cend(); ++it)
+            {
+                numberOfPreviousMsgs += it->getCount();
+            }
+            resumingPages = (numberOfPreviousMsgs > 0) && (numberOfPreviousMsgs == getNumberOfSerializedMessages(rawMsgFileName));
+        }
+        if (!resumingPages)
+        {
+            previousPages.clear();
+            numberOfPreviousMsgs = 0;
+            maxMsgId = 0;
+            mergingMessages = false;
+        }
+    }
 
 #if !defined(NDEBUG) || defined(DBG_PERF)
-    m_logger->debug("DB: " + session.getDbFile() + " Table: Chat_" + session.getHash());
+    if (m_logger->isDebugEnabled())
+    {
+        m_logger->debug("DB: " + session.getDbFile() + " Table: Chat_" + session.getHash());
+    }
 #endif
     
     int numberOfMsgs = 0;
     SessionParser sessionParser(m_options);
+    // The stages of the messages loop run once per message, each one is added as one span inside "messages".
+    // The enumerator reads the rows lazily, so "enumerate" covers the sql queries.
+    TraceSpan messagesSpan(TRACE_CAT_SESSION, "messages");
+    int64_t stageTs = Tracer::isEnabled() ? Tracer::now() : 0;
+    TraceAccumulator enumerateStage(TRACE_CAT_SESSION, "enumerate");
+    TraceAccumulator parseStage(TRACE_CAT_SESSION, "parse");
+    TraceAccumulator renderStage(TRACE_CAT_SESSION, "render");
+    // Incremental context database and search database
+    TraceAccumulator storeStage(TRACE_CAT_SESSION, "store");
+    enumerateStage.start();
     std::unique_ptr<SessionParser::MessageEnumerator> enumerator(sessionParser.buildMsgEnumerator(session, maxMsgId));
-    std::vector<TemplateValues> tvs;
+    enumerateStage.stop();
+    TemplateValuesArena& tvs = TemplateValuesArena::local();
     std::unique_ptr<Pager> pager;
     uint16_t year = 0;
     uint16_t month = 0;
@@ -903,19 +1658,27 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
     {
         pager.reset(new Pager());
     }
+    if (!previousPages.empty())
+    {
+        pager->resume(previousPages);
+    }
     
     WXMSG msg;
 #if !defined(NDEBUG) || defined(DBG_PERF)
     m_logger->debug("Start exporting session");
 #endif
+    enumerateStage.start();
     while (enumerator->nextMessage(msg))
     {
+        enumerateStage.stop();
 #if !defined(NDEBUG) || defined(DBG_PERF)
         // m_logger->debug("Export msg: " + msg.msgId);
 #endif
         if (m_options.isIncrementalExporting())
         {
+            storeStage.start();
             m_exportContext->insertMessage(session, msg);
+            storeStage.stop();
         }
         
         if (msg.msgIdValue > maxMsgId)
@@ -923,16 +1686,26 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
             maxMsgId = msg.msgIdValue;
         }
         
-        tvs.clear();
+        tvs.reset();
+        parseStage.start();
         if (!msgParser.parse(msg, session, tvs))
         {
-            if (hasDebugLogs() && msgParser.hasError())
+            if (hasDebugLogs() && msgParser.hasError() && m_logger->isDebugEnabled())
             {
                 m_logger->debug(msgParser.getError());
             }
         }
+        parseStage.stop();
+        if (NULL != m_searchDb)
+        {
+            storeStage.start();
+            m_searchDb->insertMessage(msg, tvs);
+            storeStage.stop();
+        }
 
+        renderStage.start();
         exportMessage(session, tvs, messages);
+        renderStage.stop();
         ++numberOfMsgs;
 
         pager->buildNewPage(&msg, messages);
@@ -945,8 +1718,14 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
         {
             break;
         }
+        enumerateStage.start();
     }
 
+    stageTs = enumerateStage.end(stageTs);
+    stageTs = parseStage.end(stageTs);
+    stageTs = storeStage.end(stageTs);
+    renderStage.end(stageTs);
+    messagesSpan.end();
 #if !defined(NDEBUG) || defined(DBG_PERF)
     m_logger->debug("Finish exporting session");
 #endif
@@ -967,31 +1746,91 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
         // Export memebers
     }
     
-    std::string rawMsgFileName = combinePath(m_output, WXEXP_DATA_FOLDER, session.getOwner()->getUsrName(), session.getUsrName() + ".dat");
-    if (m_options.isIncrementalExporting())
+    // The search box can only find the messages of the pages which are loaded, give it an index of all pages
+    std::unique_ptr<SearchIndexBuilder> searchIndex;
+    if (m_options.isHtmlMode() && m_options.isAsyncLoading() && !m_options.hasPager() && m_options.isSupportingFilter())
     {
-        m_logger->debug("Merge incremental messages.");
-        mergeMessages(rawMsgFileName, messages);
+        searchIndex.reset(new SearchIndexBuilder());
     }
     
-    m_logger->debug("Save messages for incremental exporting.");
-    serializeMessages(rawMsgFileName, messages);
+    // The messages file(.dat) for incremental exporting
+    TraceSpan serializeSpan(TRACE_CAT_SESSION, "serialize");
+    // The messages before the first page to rewrite aren't loaded, unless the search index needs them
+    size_t firstPageToWrite = 0;
+    size_t firstMsgInMemory = 0;
+    if (!previousPages.empty())
+    {
+        const std::vector<PageInfo>& pages = pager->getPages();
+        firstPageToWrite = previousPages.size() - 1;
+        if (pages[firstPageToWrite].getCount() == previousPages[firstPageToWrite].getCount())
+        {
+            // The last page was full, the new messages start a new page
+            ++firstPageToWrite;
+        }
+        size_t numberOfUnchangedMsgs = numberOfPreviousMsgs - ((firstPageToWrite < previousPages.size()) ? previousPages[firstPageToWrite].getCount() : 0);
+        firstMsgInMemory = searchIndex ? 0 : numberOfUnchangedMsgs;
+        
+        m_logger->debug("Append incremental messages from page " + std::to_string(firstPageToWrite + 1) + ".");
+        std::vector<std::string> previousMessages;
+        unserializeMessages(rawMsgFileName, firstMsgInMemory, previousMessages);
+        if (!appendSerializedMessages(rawMsgFileName, numberOfPreviousMsgs, messages))
+        {
+            m_logger->write("Failed to save messages for incremental exporting: " + rawMsgFileName);
+        }
+        previousMessages.reserve(previousMessages.size() + messages.size());
+        std::move(messages.begin(), messages.end(), std::back_inserter(previousMessages));
+        messages.swap(previousMessages);
+    }
+    else
+    {
+        if (mergingMessages)
+        {
+            m_logger->debug("Merge incremental messages.");
+            mergeMessages(rawMsgFileName, messages);
+        }
+        
+        m_logger->debug("Save messages for incremental exporting.");
+        serializeMessages(rawMsgFileName, messages);
+    }
     
     // m_logger->debug("After serializeMessages.");
+    serializeSpan.end();
 
     if (numberOfMsgs > 0)
     {
         Json::Value jsonPages(Json::arrayValue);
         
+        TraceSpan pagesSpan(TRACE_CAT_SESSION, "pages");
+        stageTs = Tracer::isEnabled() ? Tracer::now() : 0;
+        TraceAccumulator writeStage(TRACE_CAT_SESSION, "write");
+        TraceAccumulator indexStage(TRACE_CAT_SESSION, "index");
         if (pager->hasPages())
         {
+            // Index of the first message of the page in all messages of the session
             numberOfExportedMsgs = 0;
-            auto pages = pager->getPages();
+            const std::vector<PageInfo>& pages = pager->getPages();
             for (auto it = pages.cbegin(); it != pages.cend(); ++it)
             {
-                auto b = messages.cbegin() + numberOfExportedMsgs;
-                auto e = b + it->getCount();
-                buildScriptFile(combinePath(dataPath, "msg-" + it->getFileName() + ".js"), b, e, *it);
+                if (numberOfExportedMsgs >= firstMsgInMemory)
+                {
+                    auto b = messages.cbegin() + (numberOfExportedMsgs - firstMsgInMemory);
+                    auto e = b + it->getCount();
+                    if (it->getPage() >= firstPageToWrite)
+                    {
+                        writeStage.start();
+                        buildScriptFile(combinePath(dataPath, "msg-" + it->getFileName() + ".js"), b, e, *it);
+                        writeStage.stop();
+                    }
+                    if (searchIndex)
+                    {
+                        indexStage.start();
+                        for (auto itMsg = b; itMsg != e; ++itMsg)
+                        {
+                            searchIndex->addMessage(it->getPage() + 1, *itMsg);
+                        }
+                        indexStage.stop();
+                    }
+                }
                 numberOfExportedMsgs += it->getCount();
                 
                 Json::Value jsonPage(Json::objectValue);
@@ -1008,6 +1847,7 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
                 }
                 jsonPages.append(jsonPage);
             }
+            m_exportContext->setPages(user.getUsrName(), session.getUsrName(), pages);
         }
         
         Json::StreamWriterBuilder builder;
@@ -1018,14 +1858,28 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
         builder["indentation"] = "";
 #endif
         std::string pageData = Json::writeString(builder, jsonPages);
+        
+        uint32_t numberOfSearchShards = 0;
+        indexStage.start();
+        if (searchIndex && !searchIndex->write(dataPath, numberOfSearchShards))
+        {
+            m_logger->write("Failed to write search index: " + dataPath);
+            numberOfSearchShards = 0;
+        }
+        indexStage.stop();
+        stageTs = writeStage.end(stageTs);
+        indexStage.end(stageTs);
+        pagesSpan.end();
 
+        // The frame html(index.html) of the session
+        TraceSpan renderSpan(TRACE_CAT_SESSION, "render");
         auto b = messages.cbegin();
         // No page for text mode
         auto e = (m_options.isTextMode() || m_options.isSyncLoading() || (messages.size() <= PAGE_SIZE)) ? messages.cend() : (b + PAGE_SIZE);
         
         // const size_t numberOfMessages = std::distance(e, messages.cend());
-        const size_t numberOfMessages = numberOfMsgs;
-        const size_t numberOfPages = (messages.size() + PAGE_SIZE - 1) / PAGE_SIZE;
+        const size_t numberOfMessages = firstMsgInMemory + messages.size();
+        const size_t numberOfPages = (numberOfMessages + PAGE_SIZE - 1) / PAGE_SIZE;
         
 #if USING_NEW_TEMPLATE
         std::map<std::string, std::string> values;
@@ -1075,6 +1929,7 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
 
         values["%%DATA_PATH%%"] = "Files/Data";
         values["%%PAGE_DATA%%"] = pageData;
+        values["%%SEARCH_SHARDS%%"] = std::to_string(numberOfSearchShards);
         
         // m_logger->debug("Before join");
         if (!m_options.isHtmlMode() || m_options.isSyncLoading())
@@ -1115,12 +1970,16 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
         replaceAll(html, "%%DATA_PATH%%", "Files/Data");
         
         replaceAll(html, "%%PAGE_DATA%%", pageData);
+        replaceAll(html, "%%SEARCH_SHARDS%%", std::to_string(numberOfSearchShards));
         
         replaceAll(html, "%%BODY%%", join(b, e, ""));
         replaceAll(html, "%%HEADER_FILTER%%", m_options.isSupportingFilter() ? m_resManager.getTemplate("filter") : "");
         
 #endif
         
+        renderSpan.end();
+        
+        TRACE_SPAN(TRACE_CAT_SESSION, "write");
         std::string fileName = combinePath(outputBase, session.getOutputFileName(), "index." + m_extName);
         if (!writeFile(fileName, html))
         {
@@ -1134,23 +1993,23 @@ int Exporter::exportSession(const Friend& user, const MessageParser& msgParser,
     return numberOfMsgs;
 }
 
-bool Exporter::exportMessage(const Session& session, const std::vector<TemplateValues>& tvs, std::vector<std::string>& messages)
+bool Exporter::exportMessage(const Session& session, const TemplateValuesArena& tvs, std::vector<std::string>& messages)
 {
     std::string content;
-    for (std::vector<TemplateValues>::const_iterator it = tvs.cbegin(); it != tvs.cend(); ++it)
+    for (TemplateValuesArena::const_iterator it = tvs.cbegin(); it != tvs.cend(); ++it)
     {
 #if USING_NEW_TEMPLATE
-        content.append(m_resManager.buildFromTemplate(it->getName(), it->getValues()));
+        content.append(m_resManager.buildFromTemplate(it->getName(), *it));
 #else
         content.append(buildContentFromTemplateValues(*it));
 #endif
     }
     
-    messages.push_back(content);
+    messages.push_back(std::move(content));
     return m_cancelled;
 }
 
-bool Exporter::exportPageToFile(const Friend& user, const Session& session, const std::vector<TemplateValues>& tvs, std::vector<std::string>& messages, const PageInfo& pageInfo, const std::string& outputBase)
+bool Exporter::exportPageToFile(const Friend& user, const Session& session, const TemplateValuesArena& tvs, std::vector<std::string>& messages, const PageInfo& pageInfo, const std::string& outputBase)
 {
     if (messages.empty())
     {
@@ -1259,21 +2118,11 @@ bool Exporter::exportPageToFile(const Friend& user, const Session& session, cons
             // b = e;
             std::string scripts = m_resManager.getTemplate("scripts");
             // e = (page == (numberOfPages - 1)) ? messages.cend() : (b + PAGE_SIZE);
-            Json::Value jsonMsgs(Json::arrayValue);
-            for (auto it = messages.cbegin(); it != messages.cend(); ++it)
-            {
-                jsonMsgs.append(*it);
-            }
-            Json::StreamWriterBuilder builder;
-#ifndef NDEBUG
-            builder["indentation"] = "\t";  // assume default for comments is None
-            builder["emitUTF8"] = true;
-#else
-            builder["indentation"] = "";
-#endif
-            std::string moreMsgs = Json::writeString(builder, jsonMsgs);
+            std::string moreMsgs;
+            buildJsonStringArray(moreMsgs, messages.cbegin(), messages.cend());
 
             replaceAll(scripts, "%%JSON_DATA%%", moreMsgs);
+            replaceAll(scripts, "%%PAGE%%", std::to_string(pageInfo.getPage() + 1));
             
             fullFileName = combinePath(dataPath, "msg-" + std::to_string(pageInfo.getPage() + 1) + ".js");
             writeFile(fullFileName, scripts);
@@ -1304,14 +2153,20 @@ void Exporter::serializeMessages(const std::string& fileName, const std::vector<
 
 void Exporter::unserializeMessages(const std::string& fileName, std::vector<std::string>& messages)
 {
-    std::vector<unsigned char> data;
-    if (!readFile(fileName, data))
+    unserializeMessages(fileName, 0, messages);
+}
+
+void Exporter::unserializeMessages(const std::string& fileName, size_t firstMessage, std::vector<std::string>& messages)
+{
+    MappedFile file;
+    if (!file.open(fileName))
     {
         messages.clear();
         return;
     }
     
-    size_t dataSize = data.size();
+    const unsigned char* data = file.getData();
+    size_t dataSize = file.getSize();
     if (dataSize < sizeof(uint32_t))
     {
         return;
@@ -1324,7 +2179,10 @@ void Exporter::unserializeMessages(const std::string& fileName, std::vector<std:
     itemSize = ntohl(itemSize);
     
     messages.clear();
-    messages.reserve(itemSize);
+    if (itemSize > firstMessage)
+    {
+        messages.reserve(itemSize - firstMessage);
+    }
     
     uint32_t sizeOfString = 0;
     for (uint32_t idx = 0; idx < itemSize; ++idx)
@@ -1342,11 +2200,45 @@ void Exporter::unserializeMessages(const std::string& fileName, std::vector<std:
             break;
         }
         
-        messages.emplace_back(reinterpret_cast<const char *>(&data[offset]), sizeOfString);
+        if (idx >= firstMessage)
+        {
+            messages.emplace_back(reinterpret_cast<const char *>(&data[offset]), sizeOfString);
+        }
         offset += sizeOfString;
     }
 }
 
+uint32_t Exporter::getNumberOfSerializedMessages(const std::string& fileName)
+{
+    File file;
+    uint32_t itemSize = 0;
+    size_t bytesRead = 0;
+    if (file.open(fileName) && file.read(reinterpret_cast<unsigned char *>(&itemSize), sizeof(itemSize), bytesRead) && bytesRead == sizeof(itemSize))
+    {
+        return ntohl(itemSize);
+    }
+    return 0;
+}
+
+bool Exporter::appendSerializedMessages(const std::string& fileName, uint32_t numberOfMessages, const std::vector<std::string>& messages)
+{
+    std::string data;
+    uint32_t size = 0;
+    for (std::vector<std::string>::const_iterator it = messages.cbegin(); it != messages.cend(); ++it)
+    {
+        size = htonl(static_cast<uint32_t>(it->size()));
+        data.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        data.append(*it);
+    }
+    if (!appendFile(fileName, data))
+    {
+        return false;
+    }
+    // The number of messages is the header of the file
+    size = htonl(static_cast<uint32_t>(numberOfMessages + messages.size()));
+    return updateFile(fileName, 0, reinterpret_cast<const unsigned char *>(&size), sizeof(size));
+}
+
 void Exporter::mergeMessages(const std::string& fileName, std::vector<std::string>& messages)
 {
     std::vector<std::string> orgMessages;
@@ -1411,35 +2303,47 @@ void Exporter::releaseITunes()
 
 bool Exporter::loadITunes(bool detailedInfo/* = true*/)
 {
+    if (NULL != m_iTunesDb && NULL != m_iTunesDbShare)
+    {
+        // Loaded already(loadUsersAndSessions): the group domain is never filtered and the files dropped from
+        // the app domain are added to it instead of loading both again
+        if (!detailedInfo || m_iTunesDb->loadRemainingFiles())
+        {
+            return true;
+        }
+    }
     releaseITunes();
     
 #ifndef USING_DECODED_ITUNESBACKUP
     m_iTunesDb = new ITunesDb(m_backup, "Manifest.db");
+    m_iTunesDbShare = new ITunesDb(m_backup, "Manifest.db");
 #else
     m_iTunesDb = new DecodedWechatITunesDb(m_backup, "Manifest.db");
+    m_iTunesDbShare = new DecodedWechatITunesDb(m_backup, "Manifest.db");
 #endif
     if (!detailedInfo)
     {
-        std::function<bool(const char*, int)> fn = std::bind(&Exporter::filterITunesFile, this, std::placeholders::_1, std::placeholders::_2);
-        m_iTunesDb->setLoadingFilter(fn);
+        ITunesLoadingFilter loadingFilter;
+        buildITunesLoadingFilter(loadingFilter);
+        m_iTunesDb->setLoadingFilter(loadingFilter);
     }
-    if (!m_iTunesDb->load("AppDomain-com.tencent.xin", !detailedInfo))
-    {
-        return false;
-    }
-#ifndef USING_DECODED_ITUNESBACKUP
-    m_iTunesDbShare = new ITunesDb(m_backup, "Manifest.db");
-#else
-    m_iTunesDbShare = new DecodedWechatITunesDb(m_backup, "Manifest.db");
-#endif
+    m_iTunesDb->setPreparsingFileInfo(true);
+    m_iTunesDbShare->setPreparsingFileInfo(true);
     
-    if (!m_iTunesDbShare->load("AppDomainGroup-group.com.tencent.xin"))
-    {
+    // Both domains are loaded at the same time on their own connections
+    ITunesDb* iTunesDbShare = m_iTunesDbShare;
+    std::thread shareLoader([iTunesDbShare]() {
         // Optional
-        // return false;
-    }
+        iTunesDbShare->load("AppDomainGroup-group.com.tencent.xin");
+    });
+    bool succeeded = m_iTunesDb->load("AppDomain-com.tencent.xin", !detailedInfo);
+    shareLoader.join();
     
-    return true;
+    if (!succeeded)
+    {
+        releaseITunes();
+    }
+    return succeeded;
 }
 
 std::string Exporter::getITunesVersion() const
@@ -1570,39 +2474,18 @@ void Exporter::notifyTasksProgress(const std::string& usrName, uint32_t numberOf
     }
 }
 
-bool Exporter::filterITunesFile(const char *file, int flags) const
+void Exporter::buildITunesLoadingFilter(ITunesLoadingFilter& loadingFilter) const
 {
-    if (startsWith(file, "Documents/MMappedKV/"))
-    {
-        return startsWith(file, "mmsetting", 20);
-    }
-    
-    if (std::strncmp(file, "Documents/MapDocument/", 22) == 0 ||
-        std::strncmp(file, "Library/WebKit/", 15) == 0)
-    {
-        return false;
-    }
+    // Only mmsetting is needed in MMappedKV
+    loadingFilter.includePrefix("Documents/MMappedKV/mmsetting");
+    loadingFilter.excludePrefix("Documents/MMappedKV/");
+    loadingFilter.excludePrefix("Documents/MapDocument/");
+    loadingFilter.excludePrefix("Library/WebKit/");
     
-    const char *str = std::strchr(file, '/');
-    if (str != NULL)
+    // Documents/<user>/Img/...
+    const char* segments[] = {"Audio", "Img", "OpenData", "Video", "appicon", "translate", "Brand", "Pattern_v3", "WCPay"};
+    for (size_t idx = 0; idx < sizeof(segments) / sizeof(const char *); ++idx)
     {
-        str = std::strchr(str + 1, '/');
-        if (str != NULL)
-        {
-            if (std::strncmp(str, "/Audio/", 7) == 0 ||
-                std::strncmp(str, "/Img/", 5) == 0 ||
-                std::strncmp(str, "/OpenData/", 10) == 0 ||
-                std::strncmp(str, "/Video/", 7) == 0 ||
-                std::strncmp(str, "/appicon/", 9) == 0 ||
-                std::strncmp(str, "/translate/", 11) == 0 ||
-                std::strncmp(str, "/Brand/", 7) == 0 ||
-                std::strncmp(str, "/Pattern_v3/", 12) == 0 ||
-                std::strncmp(str, "/WCPay/", 7) == 0)
-            {
-                return false;
-            }
-        }
+        loadingFilter.excludeSegment(segments[idx]);
     }
-    
-    return true;
 }
@@ -26,8 +26,14 @@
 
 class MessageParser;
 class TemplateValues;
+class TemplateValuesArena;
 class ExportContext;
 class PageInfo;
+struct SessionFingerprint;
+class SessionDetailsLoader;
+class SearchDatabase;
+class TaskManager;
+struct PendingTask;
 
 class Exporter
 {
@@ -64,6 +70,13 @@ protected:
     std::vector<std::pair<Friend, std::vector<Session>>> m_usersAndSessions;
     
     ExportContext*  m_exportContext;
+    SessionDetailsLoader* m_sessionDetailsLoader;
+    SearchDatabase* m_searchDb;
+    // The downloads and copies of the interrupted exporting by the usrName of the account, each account queues its own
+    // ones again on its task manager
+    std::map<std::string, std::vector<PendingTask>>* m_pendingTasks;
+    // Identifies the checkpoint which the lines of the journal belong to
+    uint32_t m_checkpointId;
     
     std::string m_languageCode;
     
@@ -75,8 +88,14 @@ public:
 
     void setNotifier(ExportNotifier *notifier);
     
-    bool loadUsersAndSessions();
+    // lazy: only the sessions in session.db are loaded, call loadSessionDetails after swapUsersAndSessions to
+    // fill the message count, last message and display name of each session on a background thread
+    bool loadUsersAndSessions(bool lazy = false);
     void swapUsersAndSessions(std::vector<std::pair<Friend, std::vector<Session>>>& usersAndSessions);
+    bool loadSessionDetails();
+    // Loads the details of these sessions(visible or selected ones) before the others
+    void prioritizeSessionDetails(const std::string& usrName, const std::vector<std::string>& sessionUsrNames);
+    void cancelSessionDetails();
 
     bool run();
     bool isRunning() const;
@@ -108,9 +127,11 @@ protected:
     bool exportUser(Friend& user, std::string& userOutputPath);
     // bool loadUserSessions(Friend& user, std::vector<Session>& sessions) const;
     bool loadUserFriendsAndSessions(const Friend& user, Friends& friends, std::vector<Session>& sessions, bool detailedInfo = true);
+    // Keyed by the usrName of session, one query per message database
+    void buildSessionFingerprints(const std::vector<Session>& sessions, std::map<std::string, SessionFingerprint>& fingerprints);
     int exportSession(const Friend& user, const MessageParser& msgParser, const Session& session, const std::string& userBase, const std::string& outputBase);
     
-    bool exportMessage(const Session& session, const std::vector<TemplateValues>& tvs, std::vector<std::string>& messages);
+    bool exportMessage(const Session& session, const TemplateValuesArena& tvs, std::vector<std::string>& messages);
 
     bool buildScriptFile(const std::string& fileName, std::vector<std::string>::const_iterator b, std::vector<std::string>::const_iterator e, const PageInfo& page) const;
     
@@ -133,14 +154,25 @@ protected:
     bool buildFileNameForUser(Friend& user, std::set<std::string>& existingFileNames);
     std::string buildContentFromTemplateValues(const TemplateValues& values) const;
     
-    bool filterITunesFile(const char * file, int flags) const;
+    void buildITunesLoadingFilter(ITunesLoadingFilter& loadingFilter) const;
     
-    bool exportPageToFile(const Friend& user, const Session& session, const std::vector<TemplateValues>& tvs, std::vector<std::string>& messages, const PageInfo& pagenfo, const std::string& outputBase);
+    bool exportPageToFile(const Friend& user, const Session& session, const TemplateValuesArena& tvs, std::vector<std::string>& messages, const PageInfo& pagenfo, const std::string& outputBase);
     void serializeMessages(const std::string& fileName, const std::vector<std::string>& messages);
     void unserializeMessages(const std::string& fileName, std::vector<std::string>& messages);
+    // Skips the first messages, which are not changed by incremental exporting
+    void unserializeMessages(const std::string& fileName, size_t firstMessage, std::vector<std::string>& messages);
+    uint32_t getNumberOfSerializedMessages(const std::string& fileName);
+    // numberOfMessages: the number of the messages already in the file
+    bool appendSerializedMessages(const std::string& fileName, uint32_t numberOfMessages, const std::vector<std::string>& messages);
     void mergeMessages(const std::string& fileName, std::vector<std::string>& messages);
     
     static bool loadExportContext(const std::string& contextFile, ExportContext *context);
+    // The checkpoint is the export context with the pending tasks of the account(taskManager) and the accounts not resumed yet,
+    // it's replaced atomically once for each account. The sessions append their changes to its journal instead
+    bool writeCheckpoint(const std::string& usrName, TaskManager* taskManager);
+    bool appendCheckpointJournal(const std::string& usrName, const std::string& sessionUsrName, TaskManager* taskManager);
+    bool loadCheckpoint(const std::string& checkpointFile, std::map<std::string, std::vector<PendingTask>>& pendingTasks);
+    void resumePendingTasks(const std::string& usrName, TaskManager& taskManager);
     
     
 };
@@ -14,6 +14,7 @@
 // #include <iomanip>
 #include <fstream>
 #include <queue>
+#include <atomic>
 
 #ifdef _WIN32
 #include <algorithm>
@@ -26,6 +27,17 @@
 #ifdef __APPLE__
 // https://developer.apple.com/library/archive/documentation/System/Conceptual/ManPages_iPhoneOS/man3/copyfile.3.html
 #include <copyfile.h>
+#else
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
 #endif
 #include <sys/stat.h>
 #include <sys/statvfs.h>
@@ -33,6 +45,9 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fts.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #endif //  _WIN32
 
 #ifdef _WIN32
@@ -444,6 +459,161 @@ bool listDirectory(const std::string& path, std::vector<std::string>& subDirecto
     return true;
 }
 
+static std::atomic<uint64_t> s_numberOfCopies[COPY_METHOD_MAX];
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define COPY_BUFFER_SIZE    (1024 * 1024)
+
+// Tries reflink(metadata only on btrfs/XFS), copy_file_range(in-kernel, server-side on NFS/CIFS), sendfile
+// and a large-buffer read/write in order, each one continues from where the previous one stopped.
+// mtime(if not zero) is set on the descriptor before it is closed, so no extra stat/utime by path.
+static bool copyFileLinux(const std::string& src, const std::string& dest, time_t mtime, int& copyMethod)
+{
+    copyMethod = COPY_METHOD_NONE;
+    int srcFd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (srcFd == -1)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(srcFd, &st) != 0)
+    {
+        close(srcFd);
+        return false;
+    }
+    int destFd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (destFd == -1)
+    {
+        close(srcFd);
+        return false;
+    }
+    
+    const off_t size = st.st_size;
+    off_t copied = 0;
+    bool succeeded = false;
+    
+    if (size > 0 && ioctl(destFd, FICLONE, srcFd) == 0)
+    {
+        copyMethod = COPY_METHOD_CLONE;
+        copied = size;
+    }
+    
+#ifdef SYS_copy_file_range
+    if (copied < size)
+    {
+        loff_t srcOffset = copied;
+        loff_t destOffset = copied;
+        while (copied < size)
+        {
+            ssize_t bytes = syscall(SYS_copy_file_range, srcFd, &srcOffset, destFd, &destOffset, static_cast<size_t>(size - copied), 0);
+            if (bytes <= 0)
+            {
+                if (bytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                // ENOSYS/EXDEV/EINVAL/EOPNOTSUPP...: not supported for this pair, try next one
+                break;
+            }
+            copied += bytes;
+            copyMethod = COPY_METHOD_COPY_RANGE;
+        }
+    }
+#endif
+    
+    // copy_file_range takes explicit offsets and leaves the file position of destFd at 0, sendfile writes at
+    // the file position. If the seek fails, the buffered copy below takes over
+    if (copied < size && lseek(destFd, copied, SEEK_SET) != -1)
+    {
+        off_t offset = copied;
+        while (copied < size)
+        {
+            ssize_t bytes = sendfile(destFd, srcFd, &offset, static_cast<size_t>(size - copied));
+            if (bytes <= 0)
+            {
+                if (bytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            copied += bytes;
+            copyMethod = COPY_METHOD_SENDFILE;
+        }
+    }
+    
+    if (copied < size || size == 0)
+    {
+        // The size in stat may be stale(file is growing) or 0 for special files, read until EOF
+        static thread_local std::vector<char> buffer;
+        if (buffer.empty())
+        {
+            buffer.resize(COPY_BUFFER_SIZE);
+        }
+        
+        succeeded = true;
+        if (lseek(srcFd, copied, SEEK_SET) == -1 || lseek(destFd, copied, SEEK_SET) == -1)
+        {
+            succeeded = false;
+        }
+        while (succeeded)
+        {
+            ssize_t bytesRead = read(srcFd, &buffer[0], buffer.size());
+            if (bytesRead < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytesRead <= 0)
+            {
+                succeeded = (bytesRead == 0);
+                break;
+            }
+            ssize_t bytesWritten = 0;
+            while (bytesWritten < bytesRead)
+            {
+                ssize_t bytes = write(destFd, &buffer[bytesWritten], static_cast<size_t>(bytesRead - bytesWritten));
+                if (bytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (bytes <= 0)
+                {
+                    succeeded = false;
+                    break;
+                }
+                bytesWritten += bytes;
+            }
+            copied += bytesWritten;
+        }
+        if (copyMethod == COPY_METHOD_NONE)
+        {
+            copyMethod = COPY_METHOD_BUFFERED;
+        }
+    }
+    else
+    {
+        succeeded = true;
+    }
+    
+    if (succeeded && mtime != 0)
+    {
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;  // keep atime unchanged
+        times[1].tv_sec = mtime;
+        times[1].tv_nsec = 0;
+        futimens(destFd, times);
+    }
+    
+    close(srcFd);
+    if (close(destFd) != 0)
+    {
+        succeeded = false;
+    }
+    return succeeded;
+}
+#endif
+
 #ifdef _WIN32
 inline bool copyFileImpl(LPCTSTR src, LPCTSTR dest)
 #else
@@ -451,7 +621,8 @@ inline bool copyFileImpl(const std::string& src, const std::string& dest)
 #endif
 {
 #ifdef _WIN32
-    BOOL bRet = ::CopyFile(src, dest, TRUE);
+    // Callers which don't overwrite have checked dest already, the existing one is replaced as copyfile/open(O_TRUNC) do
+    BOOL bRet = ::CopyFile(src, dest, FALSE);
 #ifndef NDEBUG
     DWORD err = ::GetLastError();
     TCHAR buffer[256] = { 0 };
@@ -472,30 +643,53 @@ inline bool copyFileImpl(const std::string& src, const std::string& dest)
 
     return (ret == 0);
 #else
-    std::ifstream ss(src, std::ios::in | std::ios::binary);
-    if (!ss.is_open())
-    {
-#ifndef NDEBUG
-        // assert(false);
+    int copyMethod = COPY_METHOD_NONE;
+    bool result = copyFileLinux(src, dest, 0, copyMethod);
+    s_numberOfCopies[copyMethod]++;
+    return result;
 #endif
-        return false;
-    }
-    std::ofstream ds(dest, std::ios::out | std::ios::binary | std::ios::trunc);
-    if (!ds.is_open())
+}
+
+bool copyFileWithTime(const std::string& src, const std::string& dest, time_t mtime, int* copyMethod)
+{
+    int method = COPY_METHOD_NONE;
+    bool result = false;
+#if !defined(_WIN32) && !defined(__APPLE__)
+    result = copyFileLinux(src, dest, mtime, method);
+#else
+#ifdef _WIN32
+    CW2T pszSrc(CA2W(src.c_str(), CP_UTF8));
+    CW2T pszDest(CA2W(dest.c_str(), CP_UTF8));
+    result = copyFileImpl(pszSrc, pszDest);
+#else
+    result = copyFileImpl(src, dest);
+#endif
+    if (result)
     {
-#ifndef NDEBUG
-        assert(false);
+        method = COPY_METHOD_SYSTEM;
+        if (mtime != 0)
+        {
+            updateFileTime(dest, mtime);
+        }
+    }
 #endif
-        ss.close();
-        return false;
+    s_numberOfCopies[method]++;
+    if (NULL != copyMethod)
+    {
+        *copyMethod = method;
     }
-    ds << ss.rdbuf();
+    return result;
+}
 
-    ss.close();
-    ds.close();
-    
-    return true;
-#endif
+uint64_t getNumberOfCopies(int copyMethod)
+{
+    return (copyMethod >= 0 && copyMethod < COPY_METHOD_MAX) ? s_numberOfCopies[copyMethod].load() : 0;
+}
+
+const char* getCopyMethodName(int copyMethod)
+{
+    static const char* names[COPY_METHOD_MAX] = { "none", "clone", "copy_file_range", "sendfile", "buffered", "system" };
+    return (copyMethod >= 0 && copyMethod < COPY_METHOD_MAX) ? names[copyMethod] : "";
 }
 
 bool copyFile(const std::string& src, const std::string& dest, bool overwrite)
@@ -523,7 +717,7 @@ bool copyFile(const std::string& src, const std::string& dest, bool overwrite)
 #ifdef _WIN32
 inline bool checkFileNewer(LPCTSTR src, LPCTSTR dest)
 #else
-inline bool checkFileNewer(const std::string& src, const std::string& dest)
+inline bool checkFileNewer(const std::string& src, const std::string& dest, time_t& srcModifiedTime)
 #endif
 {
 #ifdef _WIN32
@@ -571,17 +765,13 @@ inline bool checkFileNewer(const std::string& src, const std::string& dest)
 
     return CompareFileTime(&ftSrc, &ftDest) != 0;
 #else
-    if (!existsFile(dest))
-    {
-        return true;
-    }
-    
     struct stat sbSrc, sbDest;
     int rc = stat(src.c_str(), &sbSrc);
     if (rc != 0)
     {
         return true;
     }
+    srcModifiedTime = sbSrc.st_mtime;
     rc = stat(dest.c_str(), &sbDest);
     if (rc != 0)
     {
@@ -605,11 +795,17 @@ bool copyFileIfNewer(const std::string& src, const std::string& dest)
     return copyFileImpl(pszSrc, pszDest);
     
 #else
-    if (!checkFileNewer(src, dest))
+    time_t srcModifiedTime = 0;
+    if (!checkFileNewer(src, dest, srcModifiedTime))
     {
         return true;
     }
+#ifdef __APPLE__
     return copyFileImpl(src, dest);
+#else
+    // The time has to be copied too, otherwise the file is always newer next time
+    return copyFileWithTime(src, dest, srcModifiedTime);
+#endif
 #endif
 }
 
@@ -772,6 +968,18 @@ bool moveFile(const std::string& src, const std::string& dest, bool overwrite/*
 #endif
 }
 
+bool replaceFile(const std::string& src, const std::string& dest)
+{
+#ifdef _WIN32
+	CW2T pszSrc(CA2W(src.c_str(), CP_UTF8));
+	CW2T pszDest(CA2W(dest.c_str(), CP_UTF8));
+	return ::MoveFileEx((LPCTSTR)pszSrc, (LPCTSTR)pszDest, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == TRUE;
+#else
+    // rename replaces dest atomically
+    return rename(src.c_str(), dest.c_str()) == 0;
+#endif
+}
+
 #ifdef _WIN32
 CString removeInvalidCharsForFileName(const CString& fileName)
 {
@@ -1028,6 +1236,40 @@ bool appendFile(const std::string& path, const unsigned char* data, size_t dataL
 #endif
 }
 
+bool updateFile(const std::string& path, uint64_t offset, const unsigned char* data, size_t dataLength)
+{
+#ifdef _WIN32
+    CW2T pszT(CA2W(path.c_str(), CP_UTF8));
+
+    HANDLE hFile = ::CreateFile(pszT, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER distance;
+    distance.QuadPart = static_cast<LONGLONG>(offset);
+    BOOL bErrorFlag = ::SetFilePointerEx(hFile, distance, NULL, FILE_BEGIN);
+    if (bErrorFlag)
+    {
+        DWORD dwBytesToWrite = static_cast<DWORD>(dataLength);
+        DWORD dwBytesWritten = 0;
+        bErrorFlag = WriteFile(hFile, data, dwBytesToWrite, &dwBytesWritten, NULL);
+    }
+    ::CloseHandle(hFile);
+    return (TRUE == bErrorFlag);
+#else
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+    ssize_t bytesWritten = pwrite(fd, data, dataLength, static_cast<off_t>(offset));
+    ::close(fd);
+    return bytesWritten == static_cast<ssize_t>(dataLength);
+#endif
+}
+
 std::string combinePath(const std::string& p1, const std::string& p2)
 {
     if (p1.empty() && p2.empty())
@@ -1401,3 +1643,99 @@ void File::close()
     }
 #endif
 }
+
+MappedFile::MappedFile() : m_data(NULL), m_size(0)
+{
+#ifdef _WIN32
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    CW2T pszT(CA2W(path.c_str(), CP_UTF8));
+    m_file = CreateFile((LPCTSTR)pszT, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == m_file)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == m_mapping)
+    {
+        close();
+        return false;
+    }
+    void* data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (NULL == data)
+    {
+        close();
+        return false;
+    }
+    m_data = reinterpret_cast<const unsigned char *>(data);
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) != 0 || statbuf.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    // The mapping keeps the file referenced, the descriptor isn't needed any more
+    void* data = mmap(NULL, static_cast<size_t>(statbuf.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == data)
+    {
+        return false;
+    }
+    madvise(data, static_cast<size_t>(statbuf.st_size), MADV_SEQUENTIAL);
+    m_data = reinterpret_cast<const unsigned char *>(data);
+    m_size = static_cast<size_t>(statbuf.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (NULL != m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (NULL != m_mapping)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+    if (INVALID_HANDLE_VALUE != m_file)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (NULL != m_data)
+    {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+    }
+#endif
+    m_data = NULL;
+    m_size = 0;
+}
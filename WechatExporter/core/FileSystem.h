@@ -32,6 +32,14 @@
 #define ALT_DIR_SEP '\\'
 #endif
 
+#define COPY_METHOD_NONE        0   // failed
+#define COPY_METHOD_CLONE       1   // reflink, only metadata is written
+#define COPY_METHOD_COPY_RANGE  2
+#define COPY_METHOD_SENDFILE    3
+#define COPY_METHOD_BUFFERED    4
+#define COPY_METHOD_SYSTEM      5   // CopyFile/copyfile of the system
+#define COPY_METHOD_MAX         6
+
 size_t getFileSize(const std::string& path);
 bool existsDirectory(const std::string& path);
 bool makeDirectory(const std::string& path);
@@ -42,8 +50,15 @@ bool listSubDirectories(const std::string& path, std::vector<std::string>& subDi
 bool listDirectory(const std::string& path, std::vector<std::string>& subDirectories, std::vector<std::string>& subFiles);
 bool copyFile(const std::string& src, const std::string& dest, bool overwrite = true);
 bool copyFileIfNewer(const std::string& src, const std::string& dest);
+// Always overwrites, mtime(if not zero) is applied as part of the copy.
+// copyMethod receives the COPY_METHOD_* which copied the data.
+bool copyFileWithTime(const std::string& src, const std::string& dest, time_t mtime, int* copyMethod = NULL);
+uint64_t getNumberOfCopies(int copyMethod);
+const char* getCopyMethodName(int copyMethod);
 bool copyDirectory(const std::string& src, const std::string& dest);
 bool moveFile(const std::string& src, const std::string& dest, bool overwrite = true);
+// Renames src to dest in one step, dest(if existed) is replaced and never missing
+bool replaceFile(const std::string& src, const std::string& dest);
 // ref: https://blackbeltreview.wordpress.com/2015/01/27/illegal-filename-characters-on-windows-vs-mac-os/
 bool isValidFileName(const std::string& fileName);
 std::string removeInvalidCharsForFileName(const std::string& fileName);
@@ -55,6 +70,8 @@ bool writeFile(const std::string& path, const std::string& data);
 bool writeFile(const std::string& path, const unsigned char* data, size_t dataLength);
 bool appendFile(const std::string& path, const std::string& data);
 bool appendFile(const std::string& path, const unsigned char* data, size_t dataLength);
+// Overwrites the bytes at the offset of an existing file, the rest of the file is kept
+bool updateFile(const std::string& path, uint64_t offset, const unsigned char* data, size_t dataLength);
 
 
 
@@ -133,5 +150,32 @@ private:
 #endif
 };
 
+// Read-only mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+    
+    bool open(const std::string& path);
+    void close();
+    
+    const unsigned char* getData() const
+    {
+        return m_data;
+    }
+    size_t getSize() const
+    {
+        return m_size;
+    }
+    
+private:
+#ifdef _WIN32
+    HANDLE m_file;
+    HANDLE m_mapping;
+#endif
+    const unsigned char* m_data;
+    size_t m_size;
+};
 
 #endif /* FileSystem_h */
@@ -11,9 +11,13 @@
 #include <map>
 #include <queue>
 #include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <sys/types.h>
 #include <sqlite3.h>
 #include <algorithm>
+#include <cstring>
 #include <plist/plist.h>
 #include <libxml/tree.h>
 #include <libxml/parser.h>
@@ -32,12 +36,16 @@
 #else
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 #endif
 
 #include "MbdbReader.h"
 #include "Utils.h"
 #include "FileSystem.h"
+#include "Tracer.h"
+#include "AsyncExecutor.h"
+#include "AsyncTask.h"
 
 inline std::string getPlistStringValue(plist_t node)
 {
@@ -86,10 +94,246 @@ struct __string_less
     bool operator()(const ITunesFile* __x, const ITunesFile* __y) const {return __x->relativePath < __y->relativePath;}
 };
 
+// Minimal reader of the binary plist(NSKeyedArchiver of MBFile) in Manifest.db,
+// only walks $objects[1] for LastModified and Size without building the plist tree.
+class MBFileInfoReader
+{
+public:
+    MBFileInfoReader(const unsigned char* data, size_t length) : m_data(data), m_length(length), m_offsetIntSize(0), m_objectRefSize(0), m_numberOfObjects(0), m_topObject(0), m_offsetTableOffset(0)
+    {
+    }
+    
+    bool read(uint64_t& modifiedTime, uint64_t& size)
+    {
+        if (m_length < 40 || std::memcmp(m_data, "bplist00", 8) != 0)
+        {
+            return false;
+        }
+        const unsigned char* trailer = m_data + m_length - 32;
+        m_offsetIntSize = trailer[6];
+        m_objectRefSize = trailer[7];
+        m_numberOfObjects = readInt(trailer + 8, 8);
+        m_topObject = readInt(trailer + 16, 8);
+        m_offsetTableOffset = readInt(trailer + 24, 8);
+        if (m_offsetIntSize == 0 || m_offsetIntSize > 8 || m_objectRefSize == 0 || m_objectRefSize > 8 || m_topObject >= m_numberOfObjects ||
+            m_offsetTableOffset >= m_length || m_numberOfObjects > (m_length - m_offsetTableOffset) / m_offsetIntSize)
+        {
+            return false;
+        }
+        
+        uint64_t objects = 0;
+        uint64_t fileInfo = 0;
+        if (!findDictValue(m_topObject, "$objects", objects) || !getArrayItem(objects, 1, fileInfo))
+        {
+            return false;
+        }
+        uint64_t ref = 0;
+        bool found = false;
+        if (findDictValue(fileInfo, "LastModified", ref) && readInteger(ref, modifiedTime))
+        {
+            found = true;
+        }
+        if (findDictValue(fileInfo, "Size", ref) && readInteger(ref, size))
+        {
+            found = true;
+        }
+        return found;
+    }
+    
+private:
+    static uint64_t readInt(const unsigned char* p, size_t bytes)
+    {
+        uint64_t value = 0;
+        for (size_t idx = 0; idx < bytes; ++idx)
+        {
+            value = (value << 8) | p[idx];
+        }
+        return value;
+    }
+    
+    bool getObjectOffset(uint64_t ref, uint64_t& offset) const
+    {
+        if (ref >= m_numberOfObjects)
+        {
+            return false;
+        }
+        offset = readInt(m_data + m_offsetTableOffset + ref * m_offsetIntSize, m_offsetIntSize);
+        return offset >= 8 && offset < m_offsetTableOffset;
+    }
+    
+    // Parses the marker of array/dict/string, offset is moved to the first byte of the contents
+    bool readMarker(uint64_t& offset, unsigned char& type, uint64_t& count) const
+    {
+        unsigned char marker = m_data[offset++];
+        type = marker >> 4;
+        count = marker & 0x0F;
+        if (count == 0x0F && type != 0x1)
+        {
+            if (offset >= m_offsetTableOffset || (m_data[offset] >> 4) != 0x1)
+            {
+                return false;
+            }
+            size_t bytes = static_cast<size_t>(1) << (m_data[offset] & 0x0F);
+            if (bytes > 8 || offset + 1 + bytes > m_offsetTableOffset)
+            {
+                return false;
+            }
+            count = readInt(m_data + offset + 1, bytes);
+            offset += 1 + bytes;
+        }
+        return true;
+    }
+    
+    bool getArrayItem(uint64_t ref, uint64_t index, uint64_t& itemRef) const
+    {
+        uint64_t offset = 0;
+        unsigned char type = 0;
+        uint64_t count = 0;
+        if (!getObjectOffset(ref, offset) || !readMarker(offset, type, count) || type != 0xA || index >= count || count > m_offsetTableOffset || offset + count * m_objectRefSize > m_offsetTableOffset)
+        {
+            return false;
+        }
+        itemRef = readInt(m_data + offset + index * m_objectRefSize, m_objectRefSize);
+        return true;
+    }
+    
+    bool findDictValue(uint64_t ref, const char* key, uint64_t& valueRef) const
+    {
+        uint64_t offset = 0;
+        unsigned char type = 0;
+        uint64_t count = 0;
+        if (!getObjectOffset(ref, offset) || !readMarker(offset, type, count) || type != 0xD || count > m_offsetTableOffset || offset + count * 2 * m_objectRefSize > m_offsetTableOffset)
+        {
+            return false;
+        }
+        size_t keyLength = std::strlen(key);
+        for (uint64_t idx = 0; idx < count; ++idx)
+        {
+            uint64_t keyOffset = 0;
+            unsigned char keyType = 0;
+            uint64_t keyCount = 0;
+            if (!getObjectOffset(readInt(m_data + offset + idx * m_objectRefSize, m_objectRefSize), keyOffset) || !readMarker(keyOffset, keyType, keyCount))
+            {
+                return false;
+            }
+            // Keys of the archive are always ASCII strings
+            if (keyType == 0x5 && keyCount == keyLength && keyOffset + keyCount <= m_offsetTableOffset && std::memcmp(m_data + keyOffset, key, keyLength) == 0)
+            {
+                valueRef = readInt(m_data + offset + (count + idx) * m_objectRefSize, m_objectRefSize);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool readInteger(uint64_t ref, uint64_t& value) const
+    {
+        uint64_t offset = 0;
+        if (!getObjectOffset(ref, offset) || (m_data[offset] >> 4) != 0x1)
+        {
+            return false;
+        }
+        size_t bytes = static_cast<size_t>(1) << (m_data[offset] & 0x0F);
+        if (bytes > 16 || offset + 1 + bytes > m_offsetTableOffset)
+        {
+            return false;
+        }
+        // 16-byte integers are only used for values above INT64_MAX, the low 8 bytes are the value
+        value = bytes > 8 ? readInt(m_data + offset + 1 + bytes - 8, 8) : readInt(m_data + offset + 1, bytes);
+        return true;
+    }
+    
+private:
+    const unsigned char* m_data;
+    size_t m_length;
+    size_t m_offsetIntSize;
+    size_t m_objectRefSize;
+    uint64_t m_numberOfObjects;
+    uint64_t m_topObject;
+    uint64_t m_offsetTableOffset;
+};
+
+static bool parseFileBlob(const unsigned char* data, size_t length, unsigned int& modifiedTime, size_t& size)
+{
+    uint64_t val = 0;
+    uint64_t fileSize = 0;
+    MBFileInfoReader reader(data, length);
+    if (reader.read(val, fileSize))
+    {
+        modifiedTime = static_cast<unsigned int>(val);
+        size = static_cast<size_t>(fileSize);
+        return true;
+    }
+    
+    val = 0;
+    plist_t node = NULL;
+    plist_from_memory(reinterpret_cast<const char *>(data), static_cast<uint32_t>(length), &node);
+    if (NULL != node)
+    {
+        plist_t lastModifiedNode = plist_access_path(node, 3, "$objects", 1, "LastModified");
+        if (NULL != lastModifiedNode)
+        {
+            plist_get_uint_val(lastModifiedNode, &val);
+            modifiedTime = (unsigned int)val;
+        }
+        
+        plist_t sizeNode = plist_access_path(node, 3, "$objects", 1, "Size");
+        if (NULL != sizeNode)
+        {
+            val = 0;
+            plist_get_uint_val(sizeNode, &val);
+            size = val;
+        }
+        
+        plist_free(node);
+        return true;
+    }
+    
+    return false;
+}
+
+bool ITunesLoadingFilter::match(const char* path) const
+{
+    for (std::vector<std::string>::const_iterator it = m_includedPrefixes.cbegin(); it != m_includedPrefixes.cend(); ++it)
+    {
+        if (std::strncmp(path, it->c_str(), it->size()) == 0)
+        {
+            return true;
+        }
+    }
+    for (std::vector<std::string>::const_iterator it = m_excludedPrefixes.cbegin(); it != m_excludedPrefixes.cend(); ++it)
+    {
+        if (std::strncmp(path, it->c_str(), it->size()) == 0)
+        {
+            return false;
+        }
+    }
+    
+    const char *str = m_excludedSegments.empty() ? NULL : std::strchr(path, '/');
+    if (str != NULL)
+    {
+        str = std::strchr(str + 1, '/');
+        if (str != NULL)
+        {
+            for (std::vector<std::string>::const_iterator it = m_excludedSegments.cbegin(); it != m_excludedSegments.cend(); ++it)
+            {
+                if (std::strncmp(str + 1, it->c_str(), it->size()) == 0)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    
+    return true;
+}
+
 class SqliteITunesFileEnumerator : public ITunesDb::ITunesFileEnumerator
 {
 public:
-    SqliteITunesFileEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile) : m_db(NULL), m_stmt(NULL), m_onlyFile(onlyFile)
+    // remainingFiles: only the rows which onlyFile and the loading filter drop
+    // minRowId/maxRowId: the range of rowid to load, all the rows if minRowId > maxRowId
+    SqliteITunesFileEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile, const ITunesLoadingFilter* loadingFilter, bool remainingFiles = false, int64_t minRowId = 0, int64_t maxRowId = -1) : m_db(NULL), m_stmt(NULL), m_onlyFile(onlyFile && !remainingFiles)
     {
 #ifndef NDEBUG
         if (!existsFile(dbPath))
@@ -109,13 +353,45 @@ public:
         sqlite3_exec(m_db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
         
         std::string sql = "SELECT fileID,domain,relativePath,flags,file FROM Files";
+        std::vector<std::string> conditions;
         if (domains.size() > 0)
         {
-            sql += " WHERE ";
             // domain=?";
-            std::vector<std::string> conditions(domains.size(), "domain=?");
-                
-            sql += join(conditions, " OR ");
+            std::vector<std::string> domainConditions(domains.size(), "domain=?");
+            conditions.push_back("(" + join(domainConditions, " OR ") + ")");
+        }
+        bool hasFilter = NULL != loadingFilter && !loadingFilter->empty();
+        if (hasFilter)
+        {
+            // Evaluated on the column text in place, the dropped rows are never copied out of sqlite.
+            // The rules are cheaper as one native function than as substr/instr expressions
+            sqlite3_create_function(m_db, "wx_loading_filter", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, const_cast<ITunesLoadingFilter *>(loadingFilter), matchLoadingFilter, NULL, NULL);
+        }
+        if (remainingFiles)
+        {
+            std::vector<std::string> droppedConditions;
+            if (hasFilter)
+            {
+                droppedConditions.push_back("NOT wx_loading_filter(relativePath)");
+            }
+            if (onlyFile)
+            {
+                droppedConditions.push_back("IFNULL(flags,0)<>1");
+            }
+            conditions.push_back(droppedConditions.empty() ? "0" : ("(" + join(droppedConditions, " OR ") + ")"));
+        }
+        else if (hasFilter)
+        {
+            conditions.push_back("wx_loading_filter(relativePath)");
+        }
+        if (minRowId <= maxRowId)
+        {
+            // Together with domain=? it is a range seek on the index of domain
+            conditions.push_back("rowid>=" + std::to_string(minRowId) + " AND rowid<=" + std::to_string(maxRowId));
+        }
+        if (!conditions.empty())
+        {
+            sql += " WHERE " + join(conditions, " AND ");
         }
 
         rc = sqlite3_prepare_v2(m_db, sql.c_str(), (int)(sql.size()), &m_stmt, NULL);
@@ -191,12 +467,20 @@ public:
             file.blob.clear();
             file.size = 0;
             file.modifiedTime = 0;
+            file.blobParsed = false;
             if (blobBytes > 0 && NULL != blob)
             {
-                std::vector<unsigned char> blobVector(blob, blob + blobBytes);
-                file.blob.insert(file.blob.end(), blob, blob + blobBytes);
+                if (m_preparsingFileInfo)
+                {
+                    // Parsed straight from the sqlite buffer, the blob is never copied
+                    parseFileBlob(blob, static_cast<size_t>(blobBytes), file.modifiedTime, file.size);
+                    file.blobParsed = true;
+                }
+                else
+                {
+                    file.blob.insert(file.blob.end(), blob, blob + blobBytes);
+                }
             }
-            file.blobParsed = false;
 
 			return true;
             // break;
@@ -212,6 +496,13 @@ public:
     }
     
 private:
+    static void matchLoadingFilter(sqlite3_context* context, int argc, sqlite3_value** argv)
+    {
+        const ITunesLoadingFilter* loadingFilter = reinterpret_cast<const ITunesLoadingFilter *>(sqlite3_user_data(context));
+        const char* path = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+        sqlite3_result_int(context, (NULL == path || loadingFilter->match(path)) ? 1 : 0);
+    }
+    
     void closeDb()
     {
         if (NULL != m_db)
@@ -239,9 +530,8 @@ private:
 class MbdbITunesFileEnumerator : public ITunesDb::ITunesFileEnumerator
 {
 public:
-    MbdbITunesFileEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile) : m_valid(false), m_domains(domains), m_onlyFile(onlyFile)
+    MbdbITunesFileEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile, const ITunesLoadingFilter* loadingFilter, bool remainingFiles = false) : m_valid(false), m_domains(domains), m_onlyFile(onlyFile), m_loadingFilter((NULL != loadingFilter && !loadingFilter->empty()) ? loadingFilter : NULL), m_remainingFiles(remainingFiles)
     {
-        std::memset(m_fixedData, 0, 40);
         if (!m_reader.open(dbPath))
         {
             return;
@@ -257,106 +547,72 @@ public:
     
     virtual bool nextFile(ITunesFile& file)
     {
-        std::string domainInFile;
-        std::string path;
-        std::string linkTarget;
-        std::string dataHash;
-        std::string alwaysNull;
-        unsigned short fileMode = 0;
-        bool isDir = false;
-        bool skipped = false;
+        const char* domain = NULL;
+        size_t domainLength = 0;
+        const char* path = NULL;
+        size_t pathLength = 0;
         
-        // bool hasFilter = (bool)m_loadingFilter;
-
+        // The records are walked in place, only the ones which are kept are copied into file
         while (m_reader.hasMoreData())
         {
-            if (!m_reader.read(domainInFile))
+            if (!m_reader.read(domain, domainLength) || !m_reader.read(path, pathLength))
             {
                 break;
             }
             
-            skipped = false;
-            if (!existsDomain(domainInFile))
+            // linkTarget, dataHash and alwaysNull
+            if (!m_reader.skipString() || !m_reader.skipString() || !m_reader.skipString())
             {
-                skipped = true;
+                break;
             }
             
-            if (skipped)
+            const unsigned char* fixedData = m_reader.read(40);
+            if (NULL == fixedData)
             {
-                // will skip it
-                m_reader.skipString();    // path
-                m_reader.skipString();    // linkTarget
-                m_reader.skipString();    // dataHash
-                m_reader.skipString();    // alwaysNull;
-                
-                m_reader.read(m_fixedData, 40);
-                int propertyCount = m_fixedData[39];
-
-                for (int j = 0; j < propertyCount; ++j)
-                {
-                    m_reader.skipString();
-                    m_reader.skipString();
-                }
+                break;
             }
-            else
+            
+            int propertyCount = fixedData[39];
+            bool truncated = false;
+            for (int j = 0; j < propertyCount && !truncated; ++j)
             {
-                m_reader.read(path);
-                m_reader.read(linkTarget);
-                m_reader.readD(dataHash);
-                m_reader.readD(alwaysNull);
-                
-                m_reader.read(m_fixedData, 40);
-
-                fileMode = (m_fixedData[0] << 8) | m_fixedData[1];
-                
-                isDir = S_ISDIR(fileMode);
-                
-                // unsigned char flags = fixedData[38];
-                
-                if (m_onlyFile && isDir)
-                {
-                    skipped = true;
-                }
-                
-                unsigned int aTime = bigEndianToNative(*((uint32_t *)(m_fixedData + 18)));
-                unsigned int bTime = bigEndianToNative(*((uint32_t *)(m_fixedData + 22)));
-                // unsigned int cTime = bigEndianToNative(*((uint32_t *)(m_fixedData + 26)));
-                
-                file.size = bigEndianToNative(*((int64_t *)(m_fixedData + 30)));
-                
-                int propertyCount = m_fixedData[39];
-                
-                for (int j = 0; j < propertyCount; ++j)
-                {
-                    if (skipped)
-                    {
-                        m_reader.skipString(); // name
-                        m_reader.skipString(); // value
-                    }
-                    else
-                    {
-                        std::string name;
-                        std::string value;
-                        
-                        m_reader.read(name);
-                        m_reader.read(value);
-                    }
-                }
-                
-                if (!skipped)
-                {
-                    file.relativePath = path;
-                    file.domain = domainInFile;
-                    file.fileId = sha1(domainInFile + "-" + path);
-                    file.flags = isDir ? 2 : 1;
-                    file.modifiedTime = aTime != 0 ? aTime : bTime;
-                    file.blobParsed = true;
-                    // file.size =
-                    
-                    return true;
-                }
-                
+                // name and value
+                truncated = !m_reader.skipString() || !m_reader.skipString();
+            }
+            if (truncated)
+            {
+                break;
+            }
+            
+            if (!existsDomain(domain, domainLength))
+            {
+                continue;
+            }
+            
+            unsigned short fileMode = (fixedData[0] << 8) | fixedData[1];
+            bool isDir = S_ISDIR(fileMode);
+            
+            file.relativePath.assign(path, pathLength);
+            bool dropped = (m_onlyFile && isDir) || (NULL != m_loadingFilter && !m_loadingFilter->match(file.relativePath.c_str()));
+            if (m_remainingFiles ? !dropped : dropped)
+            {
+                continue;
             }
+            
+            unsigned int aTime = MbdbReader::readUInt32(fixedData + 18);
+            unsigned int bTime = MbdbReader::readUInt32(fixedData + 22);
+            // unsigned int cTime = MbdbReader::readUInt32(fixedData + 26);
+            
+            file.domain.assign(domain, domainLength);
+            m_fileIdSource.assign(domain, domainLength).append("-").append(path, pathLength);
+            file.fileId = sha1(m_fileIdSource);
+            file.flags = isDir ? 2 : 1;
+            file.size = static_cast<size_t>(MbdbReader::readUInt64(fixedData + 30));
+            file.modifiedTime = aTime != 0 ? aTime : bTime;
+            file.blob.clear();
+            file.blobParsed = true;
+            
+            return true;
         }
         
         return false;
@@ -367,7 +623,7 @@ public:
     }
     
 private:
-    bool existsDomain(const std::string& domain) const
+    bool existsDomain(const char* domain, size_t length) const
     {
         if (m_domains.empty())
         {
@@ -376,7 +632,7 @@ private:
         
         for (std::vector<std::string>::const_iterator it = m_domains.cbegin(); it != m_domains.cend(); ++it)
         {
-            if (domain == *it)
+            if (it->size() == length && std::memcmp(it->c_str(), domain, length) == 0)
             {
                 return true;
             }
@@ -389,10 +645,100 @@ private:
     bool                        m_valid;
     std::vector<std::string>    m_domains;
     bool                        m_onlyFile;
-    unsigned char               m_fixedData[40];
+    const ITunesLoadingFilter*  m_loadingFilter;
+    bool                        m_remainingFiles;
+    std::string                 m_fileIdSource;
 };
 
-ITunesDb::ITunesDb(const std::string& rootPath, const std::string& manifestFileName) : m_isMbdb(false), m_rootPath(rootPath), m_manifestFileName(manifestFileName)
+#define MAX_MIRRORING_FILES 256
+#define MAX_CATALOG_LOADERS 4
+#define MIN_ROWS_PER_CATALOG_LOADER 16384
+
+// Copies one file of ITunesDb::copy. Files which were already mirrored(same size and modified time)
+// are skipped by copyFileIfNewer, so running the copy again resumes an interrupted mirror.
+class MirrorFileTask : public AsyncExecutor::Task
+{
+public:
+    MirrorFileTask(const std::string& src, const std::string& dest) : m_src(src), m_dest(dest)
+    {
+    }
+    
+    virtual int getType() const
+    {
+        return TASK_TYPE_COPY;
+    }
+    
+    bool run()
+    {
+        // Missing files in the source backup are skipped silently as before
+        if (!existsFile(m_src))
+        {
+            return true;
+        }
+        return copyFileIfNewer(m_src, m_dest);
+    }
+    
+    const std::string& getDest() const
+    {
+        return m_dest;
+    }
+    
+private:
+    std::string m_src;
+    std::string m_dest;
+};
+
+class MirrorCallback : public AsyncExecutor::Callback
+{
+public:
+    MirrorCallback() : m_pending(0), m_failures(0)
+    {
+    }
+    
+    virtual void onTaskStart(const AsyncExecutor* executor, const AsyncExecutor::Task *task)
+    {
+    }
+    
+    virtual void onTaskComplete(const AsyncExecutor* executor, const AsyncExecutor::Task *task, bool succeeded)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_pending--;
+        if (!succeeded)
+        {
+            if (m_failures == 0)
+            {
+                m_firstFailure = static_cast<const MirrorFileTask *>(task)->getDest();
+            }
+            m_failures++;
+        }
+        lock.unlock();
+        m_cv.notify_all();
+    }
+    
+    size_t getNumberOfFailures(std::string& firstFailure) const
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        firstFailure = m_firstFailure;
+        return m_failures;
+    }
+    
+    // Called before a task is added, keeps the enumerator from running too far ahead of the copies
+    void waitForSlot(size_t maxPending)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this, maxPending] { return m_pending < maxPending; });
+        m_pending++;
+    }
+    
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    size_t m_pending;
+    size_t m_failures;
+    std::string m_firstFailure;
+};
+
+ITunesDb::ITunesDb(const std::string& rootPath, const std::string& manifestFileName) : m_isMbdb(false), m_rootPath(rootPath), m_manifestFileName(manifestFileName), m_preparsingFileInfo(false), m_onlyFile(false)
 {
     std::replace(m_rootPath.begin(), m_rootPath.end(), ALT_DIR_SEP, DIR_SEP);
     
@@ -438,57 +784,182 @@ bool ITunesDb::load(const std::string& domain)
 
 bool ITunesDb::load(const std::string& domain, bool onlyFile)
 {
-    std::vector<std::string> domains;
+    TRACE_SPAN_ARG(TRACE_CAT_ITUNES, "load manifest", domain);
+    m_domains.clear();
     if (!domain.empty())
     {
-        domains.push_back(domain);
+        m_domains.push_back(domain);
     }
+    m_onlyFile = onlyFile;
     
 #if !defined(NDEBUG) || defined(DBG_PERF)
     printf("PERF: start.....%s\r\n", getTimestampString(false, true).c_str());
 #endif
     
-    std::unique_ptr<ITunesFileEnumerator> enumerator(buildEnumerator(domains, onlyFile));
-    if (enumerator->isInvalid())
+    bool succeeded = loadCatalog(false);
+
+#if !defined(NDEBUG) || defined(DBG_PERF)
+    printf("PERF: end.....%s, size=%lu\r\n", getTimestampString(false, true).c_str(), m_files.size());
+#endif
+    return succeeded;
+}
+
+bool ITunesDb::loadRemainingFiles()
+{
+    if (m_loadingFilter.empty() && !m_onlyFile)
+    {
+        return true;
+    }
+    
+    TRACE_SPAN(TRACE_CAT_ITUNES, "load remaining files");
+    if (!loadCatalog(true))
     {
         return false;
     }
+    m_loadingFilter = ITunesLoadingFilter();
+    m_onlyFile = false;
+    return true;
+}
 
-    bool hasFilter = (bool)m_loadingFilter;
+// Manifest.db is loaded in ranges of rowid on their own connections(stepping sqlite and parsing the
+// blobs are what the loading costs), every range is sorted by its loader and merged at the end.
+bool ITunesDb::loadCatalog(bool remainingFiles)
+{
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    int64_t minRowId = 0;
+    int64_t maxRowId = -1;
+    if (!m_isMbdb && queryRowIdRange(minRowId, maxRowId))
+    {
+        unsigned int numberOfLoaders = std::thread::hardware_concurrency();
+        numberOfLoaders = numberOfLoaders == 0 ? 2 : std::min(numberOfLoaders, (unsigned int)MAX_CATALOG_LOADERS);
+        int64_t rowsPerLoader = std::max((maxRowId - minRowId) / numberOfLoaders + 1, (int64_t)MIN_ROWS_PER_CATALOG_LOADER);
+        for (int64_t rowId = minRowId; rowId <= maxRowId; rowId += rowsPerLoader)
+        {
+            ranges.push_back(std::pair<int64_t, int64_t>(rowId, std::min(rowId + rowsPerLoader - 1, maxRowId)));
+        }
+    }
+    if (ranges.empty())
+    {
+        // No partitioning(mbdb or the range is unknown)
+        ranges.push_back(std::pair<int64_t, int64_t>(0, -1));
+    }
+    
+    std::vector<std::vector<ITunesFile *>> shards(ranges.size());
+    std::vector<int> results(ranges.size(), 0);
+    std::vector<std::thread> loaders;
+    for (size_t idx = 1; idx < ranges.size(); ++idx)
+    {
+        loaders.emplace_back(&ITunesDb::loadCatalogRange, this, remainingFiles, ranges[idx].first, ranges[idx].second, &shards[idx], &results[idx]);
+    }
+    loadCatalogRange(remainingFiles, ranges[0].first, ranges[0].second, &shards[0], &results[0]);
+    for (std::vector<std::thread>::iterator it = loaders.begin(); it != loaders.end(); ++it)
+    {
+        it->join();
+    }
+    
+    bool succeeded = std::find(results.cbegin(), results.cend(), 0) == results.cend();
+    size_t numberOfFiles = m_files.size();
+    for (std::vector<std::vector<ITunesFile *>>::const_iterator it = shards.cbegin(); it != shards.cend(); ++it)
+    {
+        numberOfFiles += it->size();
+    }
+    m_files.reserve(numberOfFiles);
+    for (std::vector<std::vector<ITunesFile *>>::const_iterator it = shards.cbegin(); it != shards.cend(); ++it)
+    {
+        size_t middle = m_files.size();
+        m_files.insert(m_files.end(), it->cbegin(), it->cend());
+        std::inplace_merge(m_files.begin(), m_files.begin() + middle, m_files.end(), __string_less());
+    }
+
+    return succeeded;
+}
+
+void ITunesDb::loadCatalogRange(bool remainingFiles, int64_t minRowId, int64_t maxRowId, std::vector<ITunesFile *>* files, int* result) const
+{
+    TRACE_SPAN(TRACE_CAT_ITUNES, "load manifest range");
+    std::string dbPath = combinePath(m_rootPath, m_isMbdb ? "Manifest.mbdb" : "Manifest.db");
+    const ITunesLoadingFilter* loadingFilter = m_loadingFilter.empty() ? NULL : &m_loadingFilter;
+    // The loading filter is pushed into the query of Manifest.db(or applied by the mbdb reader)
+    std::unique_ptr<ITunesFileEnumerator> enumerator(m_isMbdb ? (ITunesFileEnumerator*)(new MbdbITunesFileEnumerator(dbPath, m_domains, m_onlyFile, loadingFilter, remainingFiles)) : (ITunesFileEnumerator*)(new SqliteITunesFileEnumerator(dbPath, m_domains, m_onlyFile, loadingFilter, remainingFiles, minRowId, maxRowId)));
+    if (enumerator->isInvalid())
+    {
+        *result = 0;
+        return;
+    }
+    // Parsing is cheaper than stepping sqlite, so it is done inline and the blob is never kept
+    enumerator->setPreparsingFileInfo(m_preparsingFileInfo);
     
     ITunesFile file;
-    m_files.reserve(2048);
+    files->reserve(2048);
     while (enumerator->nextFile(file))
     {
-        if (hasFilter && !m_loadingFilter(file.relativePath.c_str(), file.flags))
+        files->push_back(new ITunesFile(file));
+    }
+    std::sort(files->begin(), files->end(), __string_less());
+    *result = 1;
+}
+
+bool ITunesDb::queryRowIdRange(int64_t& minRowId, int64_t& maxRowId) const
+{
+    sqlite3 *db = NULL;
+    int rc = openSqlite3Database(combinePath(m_rootPath, "Manifest.db"), &db);
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return false;
+    }
+    
+    // min/max of rowid are single seeks on the index of domain
+    const char* sqls[] = {"SELECT min(rowid) FROM Files WHERE domain=?", "SELECT max(rowid) FROM Files WHERE domain=?", "SELECT min(rowid) FROM Files", "SELECT max(rowid) FROM Files"};
+    bool found = false;
+    std::vector<std::string> domains = m_domains;
+    if (domains.empty())
+    {
+        domains.push_back(std::string());
+    }
+    for (std::vector<std::string>::const_iterator it = domains.cbegin(); it != domains.cend(); ++it)
+    {
+        for (int idx = 0; idx < 2; ++idx)
         {
-            continue;
+            const char* sql = sqls[it->empty() ? (idx + 2) : idx];
+            sqlite3_stmt* stmt = NULL;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+            {
+                continue;
+            }
+            if (!it->empty())
+            {
+                sqlite3_bind_text(stmt, 1, it->c_str(), (int)(it->size()), NULL);
+            }
+            if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+            {
+                int64_t rowId = sqlite3_column_int64(stmt, 0);
+                if (!found)
+                {
+                    minRowId = rowId;
+                    maxRowId = rowId;
+                    found = true;
+                }
+                minRowId = std::min(minRowId, rowId);
+                maxRowId = std::max(maxRowId, rowId);
+            }
+            sqlite3_finalize(stmt);
         }
-        m_files.push_back(new ITunesFile(file));
     }
-
-#if !defined(NDEBUG) || defined(DBG_PERF)
-    printf("PERF: end.....%s, size=%lu\r\n", getTimestampString(false, true).c_str(), m_files.size());
-#endif
+    sqlite3_close(db);
     
-    std::sort(m_files.begin(), m_files.end(), __string_less());
-
-#if !defined(NDEBUG) || defined(DBG_PERF)
-    printf("PERF: after sort.....%s\r\n", getTimestampString(false, true).c_str());
-#endif
-    return true;
+    return found;
 }
 
-ITunesDb::ITunesFileEnumerator* ITunesDb::buildEnumerator(const std::vector<std::string>& domains, bool onlyFile) const
+ITunesDb::ITunesFileEnumerator* ITunesDb::buildEnumerator(const std::vector<std::string>& domains, bool onlyFile, const ITunesLoadingFilter* loadingFilter/* = NULL*/) const
 {
     std::string dbPath = combinePath(m_rootPath, m_isMbdb ? "Manifest.mbdb" : "Manifest.db");
-    ITunesFileEnumerator* enumerator = m_isMbdb ? (ITunesFileEnumerator*)(new MbdbITunesFileEnumerator(dbPath, domains, onlyFile)) : (ITunesFileEnumerator*)(new SqliteITunesFileEnumerator(dbPath, domains, onlyFile));
-    return enumerator;
+    return buildEnumerator(dbPath, domains, onlyFile, loadingFilter);
 }
 
-ITunesDb::ITunesFileEnumerator* ITunesDb::buildEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile) const
+ITunesDb::ITunesFileEnumerator* ITunesDb::buildEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile, const ITunesLoadingFilter* loadingFilter/* = NULL*/) const
 {
-    ITunesFileEnumerator* enumerator = m_isMbdb ? (ITunesFileEnumerator*)(new MbdbITunesFileEnumerator(dbPath, domains, onlyFile)) : (ITunesFileEnumerator*)(new SqliteITunesFileEnumerator(dbPath, domains, onlyFile));
+    ITunesFileEnumerator* enumerator = m_isMbdb ? (ITunesFileEnumerator*)(new MbdbITunesFileEnumerator(dbPath, domains, onlyFile, loadingFilter)) : (ITunesFileEnumerator*)(new SqliteITunesFileEnumerator(dbPath, domains, onlyFile, loadingFilter));
     return enumerator;
 }
 
@@ -596,56 +1067,63 @@ bool ITunesDb::copy(const std::string& destPath, const std::string& backupId, st
         return false;
     }
     
-    std::string subPath;
-    std::string prefix;
-    std::string srcFilePath;
-    std::set<std::string> subFolders;
-    ITunesFile file;
-    while (enumerator->nextFile(file))
+    if (!m_isMbdb)
     {
-        if (file.fileId.empty())
-        {
-            continue;
-        }
-        
-		prefix = file.fileId.substr(0, 2);
-        
-        srcFilePath = combinePath(m_rootPath, prefix, file.fileId);
-        if (!existsFile(srcFilePath))
-        {
-#ifndef NDEBUG
-            // assert(!"Source file not exists.");
-#endif
-            continue;
-        }
-
-        subPath = combinePath(destBackupPath, prefix);
-        if (subFolders.find(prefix) == subFolders.cend())
+        // fileIds are sha1 hashes, so all 256 prefixes are used by any real backup
+        char prefix[3] = { 0 };
+        for (int idx = 0; idx < 256; ++idx)
         {
+            snprintf(prefix, sizeof(prefix), "%02x", idx);
+            std::string subPath = combinePath(destBackupPath, prefix);
             if (!existsDirectory(subPath))
             {
                 makeDirectory(subPath);
             }
-            subFolders.insert(prefix);
-        }
-        bool ret = ::copyFile(srcFilePath, combinePath(subPath, file.fileId));
-#ifndef NDEBUG
-        if (!ret)
-        {
-            std::string msg = "Failed to copy file" + combinePath(subPath, file.fileId);
-            assert(!msg.c_str());
         }
+    }
+    
+    TRACE_SPAN(TRACE_CAT_ITUNES, "mirror files");
+    MirrorCallback callback;
+    {
+        AsyncExecutor executor(4, 8, &callback);
+#if !defined(NDEBUG) || defined(DBG_PERF)
+        executor.setTag("mirror");
 #endif
-        
-        if (func)
+    
+        ITunesFile file;
+        while (enumerator->nextFile(file))
         {
-            if (!func(this, &file))
+            if (file.fileId.empty())
             {
-                break;
+                continue;
+            }
+        
+            std::string destFilePath = m_isMbdb ? combinePath(destBackupPath, file.fileId) : combinePath(destBackupPath, file.fileId.substr(0, 2), file.fileId);
+            callback.waitForSlot(MAX_MIRRORING_FILES);
+            executor.addTask(new MirrorFileTask(fileIdToRealPath(file.fileId), destFilePath));
+        
+            if (func)
+            {
+                if (!func(this, &file))
+                {
+                    executor.cancel();
+                    break;
+                }
             }
         }
+    
+        // The executor drains the queued copies and joins its threads when it goes out of scope,
+        // the failures are counted after that
+        executor.shutdown();
     }
 
+    std::string firstFailure;
+    size_t numberOfFailures = callback.getNumberOfFailures(firstFailure);
+    if (numberOfFailures > 0)
+    {
+        m_lastError = "Failed to copy " + std::to_string(numberOfFailures) + " file(s), e.g. " + firstFailure;
+        return false;
+    }
     return true;
 }
 
@@ -656,6 +1134,13 @@ unsigned int ITunesDb::parseModifiedTime(const std::vector<unsigned char>& data)
         return 0;
     }
     uint64_t val = 0;
+    uint64_t size = 0;
+    MBFileInfoReader reader(&data[0], data.size());
+    if (reader.read(val, size))
+    {
+        return static_cast<unsigned int>(val);
+    }
+    val = 0;
     plist_t node = NULL;
     plist_from_memory(reinterpret_cast<const char *>(&data[0]), static_cast<uint32_t>(data.size()), &node);
     if (NULL != node)
@@ -672,9 +1157,22 @@ unsigned int ITunesDb::parseModifiedTime(const std::vector<unsigned char>& data)
     return static_cast<unsigned int>(val);
 }
 
+unsigned int ITunesDb::getModifiedTime(const ITunesFile* file)
+{
+    if (NULL == file)
+    {
+        return 0;
+    }
+    if (file->modifiedTime == 0 && !file->blobParsed)
+    {
+        parseFileInfo(file);
+    }
+    return file->modifiedTime;
+}
+
 bool ITunesDb::parseFileInfo(const ITunesFile* file)
 {
-    if (NULL == file || file->blob.empty())
+    if (NULL == file)
     {
         return false;
     }
@@ -684,35 +1182,14 @@ bool ITunesDb::parseFileInfo(const ITunesFile* file)
         return true;
     }
     
-    file->blobParsed = true;
-    
-    uint64_t val = 0;
-    plist_t node = NULL;
-    plist_from_memory(reinterpret_cast<const char *>(&file->blob[0]), static_cast<uint32_t>(file->blob.size()), &node);
-    if (NULL != node)
+    if (file->blob.empty())
     {
-        plist_t lastModifiedNode = plist_access_path(node, 3, "$objects", 1, "LastModified");
-        if (NULL != lastModifiedNode)
-        {
-            plist_type pt = plist_get_node_type(lastModifiedNode);
-            plist_get_uint_val(lastModifiedNode, &val);
-            file->modifiedTime = (unsigned int)val;
-        }
-        
-        plist_t sizeNode = plist_access_path(node, 3, "$objects", 1, "Size");
-        if (NULL != sizeNode)
-        {
-            plist_type pt = plist_get_node_type(sizeNode);
-            val = 0;
-            plist_get_uint_val(sizeNode, &val);
-            file->size = val;
-        }
-        
-        plist_free(node);
-        return true;
+        return false;
     }
     
-    return false;
+    file->blobParsed = true;
+    
+    return parseFileBlob(&file->blob[0], file->blob.size(), file->modifiedTime, file->size);
 }
 
 std::string ITunesDb::findFileId(const std::string& relativePath) const
@@ -781,12 +1258,7 @@ bool ITunesDb::copyFile(const std::string& vpath, const std::string& dest, bool
         if (!srcPath.empty())
         {
             normalizePath(srcPath);
-            bool result = ::copyFile(srcPath, destPath, true);
-            if (result)
-            {
-                updateFileTime(dest, ITunesDb::parseModifiedTime(file->blob));
-            }
-            return result;
+            return ::copyFileWithTime(srcPath, destPath, ITunesDb::getModifiedTime(file));
         }
     }
     
@@ -812,19 +1284,7 @@ bool ITunesDb::copyFile(const std::string& vpath, const std::string& destPath, c
             {
                 makeDirectory(destPath);
             }
-            bool result = ::copyFile(srcPath, destFullPath, true);
-            if (result)
-            {
-                if (file->modifiedTime != 0)
-                {
-                    updateFileTime(destFullPath, static_cast<time_t>(file->modifiedTime));
-                }
-                else if (!file->blob.empty())
-                {
-                    updateFileTime(destFullPath, ITunesDb::parseModifiedTime(file->blob));
-                }
-            }
-            return result;
+            return ::copyFileWithTime(srcPath, destFullPath, ITunesDb::getModifiedTime(file));
         }
     }
     
@@ -843,142 +1303,245 @@ DecodedWechatITunesDb::~DecodedWechatITunesDb()
 
 bool DecodedWechatITunesDb::load(const std::string& domain, bool onlyFile)
 {
+    m_onlyFile = onlyFile;
     return loadFiles(m_rootPath, onlyFile);
 }
 
-bool DecodedWechatITunesDb::loadFiles(const std::string& root, bool onlyFile)
+bool DecodedWechatITunesDb::loadRemainingFiles()
+{
+    if (m_loadingFilter.empty() && !m_onlyFile)
+    {
+        return true;
+    }
+    
+    // The files loaded already may be held by the callers, so only the missing ones are merged into the catalog
+    bool succeeded = loadFiles(m_rootPath, m_onlyFile, true);
+    m_loadingFilter = ITunesLoadingFilter();
+    m_onlyFile = false;
+    return succeeded;
+}
+
+// Directories are shared by a small pool of walkers(the loading thread is one of them), every walker
+// keeps the files it finds in its own shard which is sorted by the walker and merged at the end.
+struct DecodedWechatITunesDb::WalkContext
+{
+    std::string root;
+    bool onlyFile;
+    bool remainingFiles;
+    
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::string> directories;
+    size_t pending;     // queued + being listed
+    bool failed;
+};
+
+bool DecodedWechatITunesDb::loadFiles(const std::string& root, bool onlyFile, bool remainingFiles/* = false*/)
+{
+    TRACE_SPAN(TRACE_CAT_ITUNES, "walk decoded backup");
+    WalkContext context;
+    context.root = root;
+    context.onlyFile = onlyFile;
+    context.remainingFiles = remainingFiles;
+    context.directories.push_back("");
+    context.pending = 1;
+    context.failed = false;
+    
+    unsigned int numberOfWalkers = std::thread::hardware_concurrency();
+    numberOfWalkers = numberOfWalkers == 0 ? 2 : std::min(numberOfWalkers, 8u);
+    
+    std::vector<std::vector<ITunesFile *>> shards(numberOfWalkers);
+    std::vector<std::thread> walkers;
+    for (unsigned int idx = 1; idx < numberOfWalkers; ++idx)
+    {
+        walkers.emplace_back(&DecodedWechatITunesDb::walkDirectories, this, &context, &shards[idx]);
+    }
+    walkDirectories(&context, &shards[0]);
+    for (std::vector<std::thread>::iterator it = walkers.begin(); it != walkers.end(); ++it)
+    {
+        it->join();
+    }
+    
+    size_t numberOfFiles = m_files.size();
+    for (std::vector<std::vector<ITunesFile *>>::const_iterator it = shards.cbegin(); it != shards.cend(); ++it)
+    {
+        numberOfFiles += it->size();
+    }
+    m_files.reserve(numberOfFiles);
+    std::sort(m_files.begin(), m_files.end(), __string_less());
+    for (std::vector<std::vector<ITunesFile *>>::const_iterator it = shards.cbegin(); it != shards.cend(); ++it)
+    {
+        size_t middle = m_files.size();
+        m_files.insert(m_files.end(), it->cbegin(), it->cend());
+        std::inplace_merge(m_files.begin(), m_files.begin() + middle, m_files.end(), __string_less());
+    }
+    
+    return !context.failed;
+}
+
+void DecodedWechatITunesDb::walkDirectories(WalkContext* context, std::vector<ITunesFile *>* files)
+{
+    std::string dirName;
+    std::vector<std::string> subDirectories;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(context->mutex);
+            context->cv.wait(lock, [context] { return context->failed || context->pending == 0 || !context->directories.empty(); });
+            if (context->failed || context->directories.empty())
+            {
+                break;
+            }
+            dirName.swap(context->directories.back());
+            context->directories.pop_back();
+        }
+        
+        subDirectories.clear();
+        bool succeeded = listDirectory(context, dirName, *files, subDirectories);
+        
+        std::unique_lock<std::mutex> lock(context->mutex);
+        if (!succeeded)
+        {
+            context->failed = true;
+        }
+        context->pending += subDirectories.size();
+        context->pending--;
+        for (std::vector<std::string>::iterator it = subDirectories.begin(); it != subDirectories.end(); ++it)
+        {
+            context->directories.push_back(std::move(*it));
+        }
+        lock.unlock();
+        context->cv.notify_all();
+    }
+    
+    std::sort(files->begin(), files->end(), __string_less());
+}
+
+bool DecodedWechatITunesDb::listDirectory(const WalkContext* context, const std::string& dirName, std::vector<ITunesFile *>& files, std::vector<std::string>& subDirectories)
 {
+    bool hasFilter = !m_loadingFilter.empty();
 #ifdef _WIN32
-	std::queue<CString> directories;
-	directories.push("");
-	
 	TCHAR szRoot[MAX_PATH] = { 0 };
-	_tcscpy(szRoot, CW2T(CA2W(root.c_str(), CP_UTF8)));
+	_tcscpy(szRoot, CW2T(CA2W(context->root.c_str(), CP_UTF8)));
 	PathAddBackslash(szRoot);
 	
+	CString szDirName = CW2T(CA2W(dirName.c_str(), CP_UTF8));
 	TCHAR szPath[MAX_PATH] = { 0 };
 	TCHAR szRelativePath[MAX_PATH] = { 0 };
 	ULARGE_INTEGER ull;
 
-	while (!directories.empty())
-	{
-		const CString& dirName = directories.front();
-
-		PathCombine(szPath, szRoot, dirName);
-		PathAddBackslash(szPath);
-		PathAppend(szPath, TEXT("*.*"));
+	PathCombine(szPath, szRoot, szDirName);
+	PathAddBackslash(szPath);
+	PathAppend(szPath, TEXT("*.*"));
 
-		WIN32_FIND_DATA FindFileData;
-		HANDLE hFind = INVALID_HANDLE_VALUE;
-
-		hFind = FindFirstFile((LPTSTR)szPath, &FindFileData);
-		if (hFind == INVALID_HANDLE_VALUE)
+	WIN32_FIND_DATA FindFileData;
+	HANDLE hFind = FindFirstFile((LPTSTR)szPath, &FindFileData);
+	if (hFind == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	do
+	{
+		if (_tcscmp(FindFileData.cFileName, TEXT(".")) == 0 || _tcscmp(FindFileData.cFileName, TEXT("..")) == 0)
 		{
-			return false;
+			continue;
 		}
-		do
+		bool isDir = ((FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+		
+		PathCombine(szRelativePath, szDirName, FindFileData.cFileName);
+		
+		CW2A pszU8(CT2W(szRelativePath), CP_UTF8);
+		if (isDir)
 		{
-			if (_tcscmp(FindFileData.cFileName, TEXT(".")) == 0 || _tcscmp(FindFileData.cFileName, TEXT("..")) == 0)
-			{
-				continue;
-			}
-			bool isDir = ((FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
-			
-			PathCombine(szRelativePath, dirName, FindFileData.cFileName);
-			
-			if (!onlyFile || !isDir)
-			{
-				CString relativePath = szRelativePath;
-				relativePath.Replace(DIR_SEP, ALT_DIR_SEP);
-
-				CW2A pszU8(CT2W(szRelativePath), CP_UTF8);
-
-				ITunesFile *file = new ITunesFile();
-				file->relativePath = (LPCSTR)CW2A(CT2W(relativePath), CP_UTF8);;
-				file->fileId = (LPCSTR)pszU8;
-				file->flags = isDir ? 2 : 1;
-
-				ull.LowPart = FindFileData.ftLastWriteTime.dwLowDateTime;
-				ull.HighPart = FindFileData.ftLastWriteTime.dwHighDateTime;
-
-				file->modifiedTime = static_cast<unsigned int>(ull.QuadPart / 10000000ULL - 11644473600ULL);
-				
-				m_files.push_back(file);
-			}
+			subDirectories.push_back(std::string((LPCSTR)pszU8) + DIR_SEP);
+		}
+		
+		CString relativePath = szRelativePath;
+		relativePath.Replace(DIR_SEP, ALT_DIR_SEP);
+		std::string u8RelativePath = (LPCSTR)CW2A(CT2W(relativePath), CP_UTF8);
+		bool dropped = (context->onlyFile && isDir) || (hasFilter && !m_loadingFilter.match(u8RelativePath.c_str()));
+		if (context->remainingFiles ? dropped : !dropped)
+		{
+			ITunesFile *file = new ITunesFile();
+			file->relativePath = u8RelativePath;
+			file->fileId = (LPCSTR)pszU8;
+			file->flags = isDir ? 2 : 1;
 
-			if (isDir)
-			{
-				PathAddBackslash(szRelativePath);
-				directories.emplace(szRelativePath);
-			}
+			ull.LowPart = FindFileData.ftLastWriteTime.dwLowDateTime;
+			ull.HighPart = FindFileData.ftLastWriteTime.dwHighDateTime;
 
-		} while (::FindNextFile(hFind, &FindFileData));
-		FindClose(hFind);
+			file->modifiedTime = static_cast<unsigned int>(ull.QuadPart / 10000000ULL - 11644473600ULL);
+			
+			files.push_back(file);
+		}
 
-		directories.pop();
-	}
+	} while (::FindNextFile(hFind, &FindFileData));
+	FindClose(hFind);
     
 #else
-	std::queue<std::string> directories;
-	directories.push("");
-    struct stat statbuf;
+    std::string path = combinePath(context->root, dirName);
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL)
+    {
+        return false;
+    }
+    int fd = dirfd(dir);
     
-    while (!directories.empty())
+    struct dirent *entry = NULL;
+    struct stat statbuf;
+    std::string relativePath;
+    while ((entry = readdir(dir)) != NULL)
     {
-        const std::string& dirName = directories.front();
-        std::string path = combinePath(root, dirName);
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
         
-        struct dirent *entry = NULL;
-        DIR *dir = opendir(path.c_str());
-        if (dir == NULL)
+        if (filterFile(dirName, entry->d_name))
         {
-            return false;
+            continue;
         }
-
-        while ((entry = readdir(dir)) != NULL)
+        
+        // d_type comes with the directory entry, stat is only needed on file systems which don't fill it
+        bool hasStat = false;
+        bool isDir = false;
+        if (entry->d_type == DT_UNKNOWN)
         {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-            {
-                continue;
-            }
-            
-            if (filterFile(dirName, entry->d_name))
+            hasStat = fstatat(fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0;
+            isDir = hasStat && S_ISDIR(statbuf.st_mode);
+        }
+        else
+        {
+            isDir = entry->d_type == DT_DIR;
+        }
+        
+        relativePath.assign(dirName).append(entry->d_name);
+        if (isDir)
+        {
+            subDirectories.push_back(relativePath + "/");
+        }
+        
+        bool dropped = (context->onlyFile && isDir) || (hasFilter && !m_loadingFilter.match(relativePath.c_str()));
+        if (context->remainingFiles ? dropped : !dropped)
+        {
+            // Only the files in the catalog need the modified time
+            if (!hasStat)
             {
-                continue;
+                hasStat = fstatat(fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0;
             }
             
-            bool isDir = false;
+            ITunesFile *file = new ITunesFile();
+            file->relativePath = relativePath;
+            file->fileId = relativePath;
+            file->flags = isDir ? 2 : 1;
+            file->modifiedTime = hasStat ? static_cast<unsigned int>(statbuf.st_mtime) : 0;
             
-            std::string relativePath = dirName + entry->d_name;
-
-            lstat(combinePath(path, entry->d_name).c_str(), &statbuf);
-            isDir = S_ISDIR(statbuf.st_mode);
-            
-            if (!onlyFile || !isDir)
-            {
-				std::string fileId = relativePath;
-
-                ITunesFile *file = new ITunesFile();
-                file->relativePath = relativePath;
-                file->fileId = fileId;
-                file->flags = isDir ? 2 : 1;
-                file->modifiedTime = static_cast<unsigned int>(statbuf.st_mtimespec.tv_sec);
-                
-                m_files.push_back(file);
-            }
-            if (isDir)
-            {
-                directories.push(endsWith(relativePath, "/") ? relativePath : (relativePath + "/"));
-            }
+            files.push_back(file);
         }
-        closedir(dir);
-        directories.pop();
     }
-    
+    closedir(dir);
 #endif
     
-    std::sort(m_files.begin(), m_files.end(), __string_less());
-    
     return true;
 }
 
@@ -1008,6 +1571,7 @@ DecodedSharedWechatITunesDb::~DecodedSharedWechatITunesDb()
 
 bool DecodedSharedWechatITunesDb::load(const std::string& domain, bool onlyFile)
 {
+    m_onlyFile = onlyFile;
     return loadFiles(m_rootPath, onlyFile);
 }
 
@@ -39,6 +39,40 @@ struct ITunesFile
     }
 };
 
+// Loading filter which is declared as rules instead of a callback, so that ITunesDb can push it into
+// the WHERE clause of Manifest.db and the dropped rows never leave sqlite.
+// A path is kept if it starts with one of the included prefixes, otherwise it is dropped if it starts with
+// one of the excluded prefixes or its third component(e.g. Img of Documents/<user>/Img/...) is excluded.
+class ITunesLoadingFilter
+{
+public:
+    void includePrefix(const std::string& prefix)
+    {
+        m_includedPrefixes.push_back(prefix);
+    }
+    void excludePrefix(const std::string& prefix)
+    {
+        m_excludedPrefixes.push_back(prefix);
+    }
+    // Directory name without slashes
+    void excludeSegment(const std::string& segment)
+    {
+        m_excludedSegments.push_back(segment + "/");
+    }
+    
+    bool empty() const
+    {
+        return m_includedPrefixes.empty() && m_excludedPrefixes.empty() && m_excludedSegments.empty();
+    }
+    
+    bool match(const char* path) const;
+    
+private:
+    std::vector<std::string> m_includedPrefixes;
+    std::vector<std::string> m_excludedPrefixes;
+    std::vector<std::string> m_excludedSegments;
+};
+
 using ITunesFileVector = std::vector<ITunesFile *>;
 using ITunesFilesIterator = typename ITunesFileVector::iterator;
 using ITunesFilesConstIterator = typename ITunesFileVector::const_iterator;
@@ -190,10 +224,21 @@ public:
     class ITunesFileEnumerator
     {
     public:
+        ITunesFileEnumerator() : m_preparsingFileInfo(false) {}
+        
         virtual bool isInvalid() const = 0;
         virtual bool nextFile(ITunesFile& file) = 0;
         
+        // Extracts LastModified/Size from the file blob in place instead of copying the blob out
+        void setPreparsingFileInfo(bool preparsingFileInfo)
+        {
+            m_preparsingFileInfo = preparsingFileInfo;
+        }
+        
         virtual ~ITunesFileEnumerator() {}
+        
+    protected:
+        bool m_preparsingFileInfo;
     };
     
     ITunesDb(const std::string& rootPath, const std::string& manifestFileName);
@@ -209,15 +254,24 @@ public:
         return m_iOSVersion;
     }
     
-    void setLoadingFilter(std::function<bool(const char *, int flags)> loadingFilter)
+    void setLoadingFilter(const ITunesLoadingFilter& loadingFilter)
+    {
+        m_loadingFilter = loadingFilter;
+    }
+    
+    // Extracts LastModified/Size while loading and drops the blobs
+    void setPreparsingFileInfo(bool preparsingFileInfo)
     {
-        m_loadingFilter = std::move(loadingFilter);
+        m_preparsingFileInfo = preparsingFileInfo;
     }
     
     bool load();
     bool load(const std::string& domain);
     virtual bool load(const std::string& domain, bool onlyFile);
-    ITunesFileEnumerator* buildEnumerator(const std::vector<std::string>& domains, bool onlyFile) const;
+    // Loads the files which the loading filter and onlyFile dropped in the last load, so that a filtered
+    // catalog becomes a detailed one without loading the files it has again
+    virtual bool loadRemainingFiles();
+    ITunesFileEnumerator* buildEnumerator(const std::vector<std::string>& domains, bool onlyFile, const ITunesLoadingFilter* loadingFilter = NULL) const;
     bool copy(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains, std::function<bool(const ITunesDb*, const ITunesFile*)>& func) const;
     
     const ITunesFile* findITunesFile(const std::string& relativePath) const;
@@ -238,6 +292,7 @@ public:
     
     static unsigned int parseModifiedTime(const std::vector<unsigned char>& data);
     static bool parseFileInfo(const ITunesFile* file);
+    static unsigned int getModifiedTime(const ITunesFile* file);
     bool copyFile(const std::string& vpath, const std::string& dest, bool overwrite = false) const;
     bool copyFile(const std::string& vpath, const std::string& destPath, const std::string& destFileName, bool overwrite = false) const;
 #ifndef NDEBUG
@@ -246,7 +301,10 @@ public:
 protected:
     // bool copyMbdb(const std::string& destPath, const std::string& backupId, std::vector<std::string>& domains) const;
     virtual std::string fileIdToRealPath(const std::string& fileId) const;
-    ITunesFileEnumerator* buildEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile) const;
+    ITunesFileEnumerator* buildEnumerator(const std::string& dbPath, const std::vector<std::string>& domains, bool onlyFile, const ITunesLoadingFilter* loadingFilter = NULL) const;
+    bool loadCatalog(bool remainingFiles);
+    void loadCatalogRange(bool remainingFiles, int64_t minRowId, int64_t maxRowId, std::vector<ITunesFile *>* files, int* result) const;
+    bool queryRowIdRange(int64_t& minRowId, int64_t& maxRowId) const;
 protected:
     bool m_isMbdb;
     mutable std::vector<ITunesFile *> m_files;
@@ -254,7 +312,10 @@ protected:
     std::string m_manifestFileName;
     std::string m_version;
     std::string m_iOSVersion;
-    std::function<bool(const char *, int flags)> m_loadingFilter;
+    ITunesLoadingFilter m_loadingFilter;
+    bool m_preparsingFileInfo;
+    std::vector<std::string> m_domains; // of the last load
+    bool m_onlyFile;
     
 #ifndef NDEBUG
     mutable std::string m_lastError;
@@ -268,9 +329,15 @@ public:
     ~DecodedWechatITunesDb();
     
     virtual bool load(const std::string& domain, bool onlyFile);
+    virtual bool loadRemainingFiles();
     
 protected:
-    bool loadFiles(const std::string& root, bool onlyFile);
+    struct WalkContext;
+    
+    // remainingFiles: only the entries which onlyFile and the loading filter dropped
+    bool loadFiles(const std::string& root, bool onlyFile, bool remainingFiles = false);
+    void walkDirectories(WalkContext* context, std::vector<ITunesFile *>* files);
+    bool listDirectory(const WalkContext* context, const std::string& dirName, std::vector<ITunesFile *>& files, std::vector<std::string>& subDirectories);
     virtual std::string fileIdToRealPath(const std::string& fileId) const;
     virtual bool filterFile(const std::string& relativeDir, const std::string& fileName);
 };
@@ -11,12 +11,22 @@
 #ifndef Logger_h
 #define Logger_h
 
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_NONE      2
+
 class Logger
 {
 public:
     virtual void write(const std::string& log) = 0;
     virtual void debug(const std::string& log) = 0;
     virtual ~Logger() {}
+    
+    // Callers check this before building a debug string, so the formatting cost is skipped when nobody reads it
+    virtual bool isDebugEnabled() const
+    {
+        return true;
+    }
 };
 
 #endif /* Logger_h */
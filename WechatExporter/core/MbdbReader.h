@@ -6,7 +6,10 @@
 //  Copyright © 2021 Matthew. All rights reserved.
 //
 
-#include <fstream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include "FileSystem.h"
 
 #ifndef MbdbReader_h
 #define MbdbReader_h
@@ -35,153 +38,105 @@
     // string name
     // string value can be a string or a binary content
 
+// Walks the records in place on the mapped file, the strings are returned as pointers into the mapping
 class MbdbReader {
     
-    std::ifstream m_ifs;
-    std::vector<char> m_buffer;
+    MappedFile m_file;
+    const unsigned char* m_data;
+    size_t m_size;
+    size_t m_pos;
     
-#ifndef NDEBUG
-    std::ifstream::streampos m_pos;
-#endif
 public:
-    
-    ~MbdbReader()
+    MbdbReader() : m_data(NULL), m_size(0), m_pos(0)
     {
-        if (m_ifs.is_open())
-        {
-            m_ifs.close();
-        }
     }
     
     bool open(const std::string& fileName)
     {
-        m_ifs.open(fileName, std::ios_base::in | std::ios_base::binary);
-        if (!m_ifs.is_open())
+        if (!m_file.open(fileName))
         {
             return false;
         }
         
-        char signature[7] = { 0 };
-        m_ifs.read(&signature[0], 6);
-        if (strcmp(signature, "mbdb\5\0") != 0)
+        m_data = m_file.getData();
+        m_size = m_file.getSize();
+        if (m_size < 6 || std::memcmp(m_data, "mbdb\5\0", 6) != 0)
         {
-            m_ifs.close();
+            m_file.close();
+            m_data = NULL;
+            m_size = 0;
             return false;
         }
+        m_pos = 6;
         
         return true;
     }
     
-    bool hasMoreData()
+    bool hasMoreData() const
     {
-        return !m_ifs.eof();
+        return m_pos < m_size;
     }
     
-    bool read(unsigned char *buffer, size_t length)
+    // Fixed-size fields, NULL if the file is truncated
+    const unsigned char* read(size_t length)
     {
-        m_ifs.read(reinterpret_cast<char *>(buffer), length);
-
-        return true;
-    }
-    
-    bool read(std::string& str)
-    {
-        int b0 = m_ifs.get();
-        int b1 = m_ifs.get();
-        
-        if ((b0 == 255 && b1 == 255) || (b0 == 0 && b1 == 0))
+        if (length > m_size - m_pos)
         {
-            str.clear();
-            return true;
+            m_pos = m_size;
+            return NULL;
         }
-        
-        if (b0 == std::ifstream::traits_type::eof() || b1 == std::ifstream::traits_type::eof())
-        {
-            return false;
-        }
-        
-        int lengthOfString = b0 * 256 + b1;
-        m_buffer.resize(lengthOfString);
-        m_ifs.read(&m_buffer[0], lengthOfString);
-
-        str.clear();
-        std::copy(m_buffer.begin(), m_buffer.end(), std::back_inserter(str));
-        
-        return true;
+        const unsigned char* data = m_data + m_pos;
+        m_pos += length;
+        return data;
     }
     
-    bool readD(std::string& str)
+    bool read(const char*& str, size_t& length)
     {
-        if (!read(str))
+        const unsigned char* header = read(2);
+        if (NULL == header)
         {
             return false;
         }
         
-        // If only ASCII printable characters, return the string
-        size_t i = 0, length = str.size();
-        for (; i < length; ++i)
-        {
-            if (str[i] < 32 || str[i] >= 128)
-            {
-                break;
-            }
-        }
-        if (i == length)
+        if ((header[0] == 255 && header[1] == 255) || (header[0] == 0 && header[1] == 0))
         {
+            str = "";
+            length = 0;
             return true;
         }
-
-        // otherwise the hexadecimal dump
-        std::string result;
-        for (i = 0; i < length; ++i)
-        {
-            result.push_back(toHex(str[i] >> 4));
-            result.push_back(toHex(str[i] & 15));
-        }
-
-        str.swap(result);
-        return true;
+        
+        length = header[0] * 256 + header[1];
+        str = reinterpret_cast<const char *>(read(length));
+        return NULL != str;
     }
-
-    bool skipString()
+    
+    bool read(std::string& str)
     {
-        int b0 = m_ifs.get();
-        int b1 = m_ifs.get();
-        
-        if ((b0 == 255 && b1 == 255) || (b0 == 0 && b1 == 0))
-        {
-            return true;
-        }
-        
-        if (b0 == std::ifstream::traits_type::eof() || b1 == std::ifstream::traits_type::eof())
+        const char* data = NULL;
+        size_t length = 0;
+        if (!read(data, length))
         {
             return false;
         }
-        
-        int lengthOfString = b0 * 256 + b1;
-        m_ifs.seekg(lengthOfString, std::ios_base::cur);
-
+        str.assign(data, length);
         return true;
     }
-    // static size_t skipString(const unsigned char *data, size_t length);
     
-    bool skip(size_t length)
+    bool skipString()
     {
-        m_ifs.seekg(length, std::ios_base::cur);
-        return true;
+        const char* data = NULL;
+        size_t length = 0;
+        return read(data, length);
     }
     
-protected:
-    char toHex(int value)
+    static uint32_t readUInt32(const unsigned char* data)
     {
-        value &= 0xF;
-        return (value >= 0 && value <= 9) ? (char)('0' + value) : (char)('A' + (value - 10));
+        return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) | (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
     }
-
-    char toHexLow(int value)
+    
+    static uint64_t readUInt64(const unsigned char* data)
     {
-        value &= 0xF;
-        return (value >= 0 && value <= 9) ? (char)('0' + value) : (char)('a' + (value - 10));
+        return (static_cast<uint64_t>(readUInt32(data)) << 32) | readUInt32(data + 4);
     }
 };
 
@@ -13,25 +13,29 @@
 #include <json/json.h>
 #include <plist/plist.h>
 #include "XmlParser.h"
+#include "Tracer.h"
 
 #define ALIGNMENT_LEFT  "left"
 #define ALIGNMENT_RIGHT  "right"
 
 #define DIR_ASSETS  "Files"
 
-MessageParser::MessageParser(const ITunesDb& iTunesDb, const ITunesDb& iTunesDbShare, TaskManager& taskManager, Friends& friends, Friend myself, const ExportOption& options, const std::string& resPath, const std::string& outputPath, const ResManager& resManager) : m_iTunesDb(iTunesDb), m_iTunesDbShare(iTunesDbShare), m_resManager(resManager), m_taskManager(taskManager), m_friends(friends), m_myself(myself), m_options(options), m_resPath(resPath), m_outputPath(outputPath)
+#define CHANNELS_NODES          { {"objectId", ""}, {"nickname", ""}, {"avatar", ""}, {"desc", ""}, {"mediaCount", ""}, {"feedType", ""}, {"username", ""} }
+#define CHANNELS_VIDEO_NODES    { {"mediaType", ""}, {"url", ""}, {"thumbUrl", ""}, {"coverUrl", ""}, {"videoPlayDuration", ""} }
+
+MessageParser::MessageParser(const ITunesDb& iTunesDb, const ITunesDb& iTunesDbShare, TaskManager& taskManager, Friends& friends, Friend myself, const ExportOption& options, const std::string& resPath, const std::string& outputPath, const ResManager& resManager) : m_iTunesDb(iTunesDb), m_iTunesDbShare(iTunesDbShare), m_resManager(resManager), m_taskManager(taskManager), m_friends(friends), m_myself(myself), m_options(options), m_resPath(resPath), m_outputPath(outputPath), m_senderSession(NULL)
 {
     m_userBase = "Documents/" + m_myself.getHash();
 }
 
-bool MessageParser::parse(WXMSG& msg, const Session& session, std::vector<TemplateValues>& tvs) const
+bool MessageParser::parse(WXMSG& msg, const Session& session, TemplateValuesArena& tvs) const
 {
-    TemplateValues& tv = *(tvs.emplace(tvs.end(), "msg"));
+    TemplateValues& tv = tvs.add("msg");
     
     tv["%%MSGID%%"] = msg.msgId;
     tv["%%NAME%%"] = "";
     tv["%%WXNAME%%"] = "";
-    tv["%%TIME%%"] = fromUnixTime(msg.createTime);
+    fromUnixTime(msg.createTime, tv["%%TIME%%"]);
     tv["%%MSGTYPE%%"] = std::to_string(msg.type);
     tv["%%MESSAGE%%"] = "";
 
@@ -135,121 +139,118 @@ bool MessageParser::parse(WXMSG& msg, const Session& session, std::vector<Templa
     
 #endif
 
-    std::string portraitPath = (DIR_ASSETS DIR_SEP_STR "Portrait" DIR_SEP_STR);
-    std::string portraitUrlPath = (DIR_ASSETS "/Portrait/");
+    bool outgoing = session.isChatroom() ? (msg.des == 0) : (msg.des == 0 || session.getUsrName() == m_myself.getUsrName());
+    tv["%%ALIGNMENT%%"] = outgoing ? ALIGNMENT_RIGHT : ALIGNMENT_LEFT;
+    if (!outgoing && session.isChatroom() && senderId.empty())
+    {
+        tv["%%NAME%%"] = senderId;
+        tv["%%AVATAR%%"] = "";
+    }
+    else
+    {
+        const SenderInfo& sender = getSenderInfo(session, outgoing, session.isChatroom() ? senderId : session.getUsrName());
+        tv["%%NAME%%"] = sender.name;
+        tv["%%WXNAME%%"] = sender.wxName;
+        tv["%%AVATAR%%"] = sender.avatar;
+    }
+
+    if (!forwardedMsg.empty())
+    {
+        // Values are added after the ones of this message
+        parseForwardedMsgs(session, msg, forwardedMsgTitle, forwardedMsg, tvs);
+    }
+    return res;
+}
 
-    // std::string localPortrait;
+bool MessageParser::parsePortrait(const WXMSG& msg, const Session& session, const std::string& senderId, TemplateValues& tv) const
+{
+    return true;
+}
 
+const MessageParser::SenderInfo& MessageParser::getSenderInfo(const Session& session, bool outgoing, const std::string& senderId) const
+{
+    if (m_senderSession != &session)
+    {
+        m_senders.clear();
+        m_senderSession = &session;
+    }
+    
+    // Outgoing messages are keyed by the empty usrName, as the sender of a chatroom message can be myself as well
+    static const std::string OUTGOING_KEY;
+    const std::string& key = outgoing ? OUTGOING_KEY : senderId;
+    std::unordered_map<std::string, SenderInfo>::const_iterator it = m_senders.find(key);
+    if (it != m_senders.cend())
+    {
+        return it->second;
+    }
+    
+    SenderInfo& sender = m_senders[key];
+    
+    std::string portraitPath = (DIR_ASSETS DIR_SEP_STR "Portrait" DIR_SEP_STR);
+    std::string portraitUrlPath = (DIR_ASSETS "/Portrait/");
+    
     const Friend* protraitUser = NULL;
-    if (session.isChatroom())
+    if (outgoing)
+    {
+        sender.name = m_myself.getDisplayName();    // CSS will prevent showing the name for self in chatrooms
+        sender.wxName = m_myself.getWxName();
+        sender.avatar = portraitUrlPath + m_myself.getLocalPortrait();
+        protraitUser = &m_myself;
+    }
+    else if (session.isChatroom())
     {
-        tv["%%ALIGNMENT%%"] = (msg.des == 0) ? ALIGNMENT_RIGHT : ALIGNMENT_LEFT;
-        if (msg.des == 0)
+        const std::string& senderHash = m_friends.getHash(senderId);
+        std::string senderDisplayName = session.getMemberName(senderId);
+        const Friend *f = m_friends.getFriend(senderHash);
+        if (senderDisplayName.empty() && NULL != f)
         {
-            tv["%%NAME%%"] = m_myself.getDisplayName();    // CSS will prevent showing the name for self
-            tv["%%WXNAME%%"] = m_myself.getWxName();
-            tv["%%AVATAR%%"] = portraitUrlPath + m_myself.getLocalPortrait();
-            // remotePortrait = m_myself.getPortrait();
-            protraitUser = &m_myself;
+            senderDisplayName = f->getDisplayName();
+        }
+        sender.name = senderDisplayName.empty() ? senderId : senderDisplayName;
+        if (NULL != f)
+        {
+            protraitUser = f;
+            sender.wxName = f->getWxName();
         }
         else
         {
-            if (!senderId.empty())
-            {
-                std::string senderHash = md5(senderId);
-                std::string senderDisplayName = session.getMemberName(senderId);
-                const Friend *f = m_friends.getFriend(senderHash);
-                if (senderDisplayName.empty() && NULL != f)
-                {
-                    senderDisplayName = f->getDisplayName();
-                }
-                tv["%%NAME%%"] = senderDisplayName.empty() ? senderId : senderDisplayName;
-                if (NULL != f)
-                {
-                    protraitUser = f;
-                    tv["%%WXNAME%%"] = f->getWxName();
-                }
-                if (NULL == f)
-                {
-                    ensureDefaultPortraitIconExisted(combinePath(session.getOutputFileName(), portraitPath));
-                }
-                tv["%%AVATAR%%"] = portraitUrlPath + ((NULL != f) ? f->getLocalPortrait() : "DefaultAvatar.png");
-            }
-            else
-            {
-                tv["%%NAME%%"] = senderId;
-                tv["%%AVATAR%%"] = "";
-            }
+            ensureDefaultPortraitIconExisted(combinePath(session.getOutputFileName(), portraitPath));
         }
+        sender.avatar = portraitUrlPath + ((NULL != f) ? f->getLocalPortrait() : "DefaultAvatar.png");
     }
     else
     {
-        if (msg.des == 0 || session.getUsrName() == m_myself.getUsrName())
+        const Friend *f = m_friends.getFriend(session.getHash());
+        if (NULL == f)
         {
-            tv["%%ALIGNMENT%%"] = ALIGNMENT_RIGHT;
-            tv["%%NAME%%"] = m_myself.getDisplayName();
-            tv["%%WXNAME%%"] = m_myself.getWxName();
-            tv["%%AVATAR%%"] = portraitUrlPath + m_myself.getLocalPortrait();
-            
-            protraitUser = &m_myself;
+            sender.name = session.getDisplayName();
+            sender.wxName = session.getWxName();
+            if (session.isPortraitEmpty())
+            {
+                ensureDefaultPortraitIconExisted(portraitPath);
+            }
+            sender.avatar = portraitUrlPath + (session.isPortraitEmpty() ? "DefaultAvatar.png" : session.getLocalPortrait());
+            protraitUser = &session;
         }
         else
         {
-            tv["%%ALIGNMENT%%"] = ALIGNMENT_LEFT;
-
-            const Friend *f = m_friends.getFriend(session.getHash());
-            if (NULL == f)
-            {
-                tv["%%NAME%%"] = session.getDisplayName();
-                tv["%%WXNAME%%"] = session.getWxName();
-                if (session.isPortraitEmpty())
-                {
-                    ensureDefaultPortraitIconExisted(portraitPath);
-                }
-                // localPortrait = combinePath(session.getOutputFileName(), portraitPath + (session.isPortraitEmpty() ? "DefaultAvatar.png" : session.getLocalPortrait()));
-                // remotePortrait = session.getPortrait();
-                tv["%%AVATAR%%"] = portraitUrlPath + (session.isPortraitEmpty() ? "DefaultAvatar.png" : session.getLocalPortrait());
-                
-                protraitUser = &session;
-            }
-            else
-            {
-                tv["%%NAME%%"] = f->getDisplayName();
-                tv["%%WXNAME%%"] = f->getWxName();
-                // localPortrait = portraitPath + f->getLocalPortrait();
-                // remotePortrait = f->getPortrait();
-                tv["%%AVATAR%%"] = portraitUrlPath + f->getLocalPortrait();
-                
-                protraitUser = f;
-            }
+            sender.name = f->getDisplayName();
+            sender.wxName = f->getWxName();
+            sender.avatar = portraitUrlPath + f->getLocalPortrait();
+            protraitUser = f;
         }
     }
-
+    
     if (!m_options.isTextMode())
     {
         if (NULL != protraitUser)
         {
             copyPortraitIcon(&session, *protraitUser, combinePath(m_outputPath, session.getOutputFileName(), portraitPath));
-            // m_downloader.addTask(remotePortrait, combinePath(m_outputPath, session.getOutputFileName(), localPortrait), msg.createTime);
         }
+        sender.name = safeHTML(sender.name);
     }
     
-    if (!m_options.isTextMode())
-    {
-        tv["%%NAME%%"] = safeHTML(tv["%%NAME%%"]);
-    }
-
-    if (!forwardedMsg.empty())
-    {
-        // This funtion will change tvs and causes tv invalid, so we do it at last
-        parseForwardedMsgs(session, msg, forwardedMsgTitle, forwardedMsg, tvs);
-    }
-    return res;
-}
-
-bool MessageParser::parsePortrait(const WXMSG& msg, const Session& session, const std::string& senderId, TemplateValues& tv) const
-{
-    return true;
+    return sender;
 }
 
 /////////////////////////////////////
@@ -319,7 +320,7 @@ bool MessageParser::parseVoice(const WXMSG& msg, const Session& session, Templat
         std::string assetsDir = combinePath(m_outputPath, session.getOutputFileName(), DIR_ASSETS);
         ensureDirectoryExisted(assetsDir);
         std::string mp3Path = combinePath(assetsDir, msg.msgId + ".mp3");
-        m_taskManager.convertAudio(&session, audioSrc, mp3Path, (voiceFormat == "0") ? TaskManager::AUDIO_FORMAT_AMR : TaskManager::AUDIO_FORMAT_SILK, ITunesDb::parseModifiedTime(audioSrcFile->blob));
+        m_taskManager.convertAudio(&session, audioSrc, mp3Path, (voiceFormat == "0") ? TaskManager::AUDIO_FORMAT_AMR : TaskManager::AUDIO_FORMAT_SILK, ITunesDb::getModifiedTime(audioSrcFile));
         result = true;
 #else
         std::string assetsDir = combinePath(m_outputPath, session.getOutputFileName(), DIR_ASSETS);
@@ -330,6 +331,7 @@ bool MessageParser::parseVoice(const WXMSG& msg, const Session& session, Templat
         m_error.clear();
         std::string err;
         bool isSilk = false;
+        TRACE_SPAN_ARG(TRACE_CAT_TASK, "transcode", mp3Path);
 
         // SILK-v3
         if (silkToPcm(audioSrc, m_pcmData, isSilk, &err) && !m_pcmData.empty())
@@ -365,7 +367,7 @@ bool MessageParser::parseVoice(const WXMSG& msg, const Session& session, Templat
         
         if (result)
         {
-            updateFileTime(mp3Path, ITunesDb::parseModifiedTime(audioSrcFile->blob));
+            updateFileTime(mp3Path, ITunesDb::getModifiedTime(audioSrcFile));
         }
         else
         {
@@ -514,8 +516,29 @@ bool MessageParser::parseEmotion(const WXMSG& msg, const Session& session, Templ
 
 bool MessageParser::parseAppMsg(const WXMSG& msg, const Session& session, std::string& senderId, std::string& forwardedMsg, std::string& forwardedMsgTitle, TemplateValues& tv) const
 {
+    // Everything parseAppMsg and parseAppMsg* handlers read, pulled out in one pass over the xml.
+    // Add the path here when a handler starts to read a new one.
+    static const XmlStreamParser::Schema appMsgSchema = {
+        // parseAppMsg
+        "/msg/fromusername", "/msg/appmsg/type", "/msg/appmsg/@appid", "/msg/appinfo/appname",
+        // APPMSGTYPE_TEXT / APPMSGTYPE_URL / APPMSGTYPE_ATTACH / APPMSGTYPE_FWD_MSG / APPMSGTYPE_REFER
+        "/msg/appmsg/title", "/msg/appmsg/des", "/msg/appmsg/url", "/msg/appmsg/thumburl", "/msg/appmsg/appattach/fileext", "/msg/appmsg/recorditem",
+        // Default / APPMSGTYPE_NOTE / APPMSGTYPE_TRANSFERS
+        "/msg/appmsg/*",
+        // APPMSGTYPE_TRANSFERS
+        "/msg/appmsg/wcpayinfo/*",
+        // APPMSGTYPE_CHANNEL_CARD
+        "/msg/appmsg/findernamecard/*",
+        // APPMSGTYPE_CHANNELS
+        "/msg/appmsg/finderFeed/*", "/msg/appmsg/finderFeed/mediaList/media/*",
+        // APPMSGTYPE_REFER
+        "/msg/appmsg/refermsg/*",
+        // APPMSGTYPE_PAT
+        "/msg/appmsg/patMsg/records/record/fromUser", "/msg/appmsg/patMsg/records/record/templete", "/msg/appmsg/patMsg/records/record/pattedUser"
+    };
+    
     WXAPPMSG appMsg = {&msg, 0, std::string(), std::string(), senderId};
-    XmlParser xmlParser(msg.content, true);
+    XmlStreamParser xmlParser(appMsgSchema, msg.content, true);
     if (senderId.empty())
     {
         xmlParser.parseNodeValue("/msg/fromusername", senderId);
@@ -545,7 +568,7 @@ bool MessageParser::parseAppMsg(const WXMSG& msg, const Session& session, std::s
         std::string vFile = combinePath(m_userBase, "appicon", appMsg.appId + ".png");
         std::string portraitDir = (DIR_ASSETS DIR_SEP_STR "Portrait");
 
-        if (m_iTunesDb.copyFile(vFile, combinePath(m_outputPath, session.getOutputFileName(), portraitDir), "appicon_" + appMsg.appId + ".png"))
+        if (copyBackupFile(vFile, combinePath(m_outputPath, session.getOutputFileName(), portraitDir, "appicon_" + appMsg.appId + ".png")))
         {
             std::string portraitUrlDir = (DIR_ASSETS "/Portrait");
             appMsg.localAppIcon = portraitUrlDir + "/appicon_" + appMsg.appId + ".png";
@@ -865,7 +888,7 @@ bool MessageParser::parseSystem(const WXMSG& msg, const Session& session, Templa
 
 ////////////////////////////////
 
-bool MessageParser::parseAppMsgText(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgText(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     std::string title;
     xmlParser.parseNodeValue("/msg/appmsg/title", title);
@@ -875,27 +898,27 @@ bool MessageParser::parseAppMsgText(const WXAPPMSG& appMsg, const XmlParser& xml
     return true;
 }
 
-bool MessageParser::parseAppMsgImage(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgImage(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgAudio(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgAudio(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgVideo(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgVideo(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgEmotion(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgEmotion(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgUrl(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgUrl(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     std::string title;
     std::string desc;
@@ -908,7 +931,7 @@ bool MessageParser::parseAppMsgUrl(const WXAPPMSG& appMsg, const XmlParser& xmlP
     // Check Local File
     std::string vThumbFile = m_userBase + "/OpenData/" + session.getHash() + "/" + appMsg.msg->msgId + ".pic_thum";
     std::string destPath = combinePath(m_outputPath, session.getOutputFileName(), DIR_ASSETS);
-    if (m_iTunesDb.copyFile(vThumbFile, destPath, appMsg.msg->msgId + "_thum.jpg"))
+    if (copyBackupFile(vThumbFile, combinePath(destPath, appMsg.msg->msgId + "_thum.jpg")))
     {
         thumbUrl = (DIR_ASSETS "/") + appMsg.msg->msgId + "_thum.jpg";
     }
@@ -930,7 +953,7 @@ bool MessageParser::parseAppMsgUrl(const WXAPPMSG& appMsg, const XmlParser& xmlP
     return true;
 }
 
-bool MessageParser::parseAppMsgAttachment(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgAttachment(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
 #ifndef NDEBUG
     writeFile(combinePath(m_outputPath, "../dbg", "msg_" + std::to_string(appMsg.msg->type) + "_attach_" + appMsg.msg->msgId + ".txt"), appMsg.msg->content);
@@ -950,24 +973,24 @@ bool MessageParser::parseAppMsgAttachment(const WXAPPMSG& appMsg, const XmlParse
     return parseFile(combinePath(m_outputPath, session.getOutputFileName()), DIR_ASSETS, DIR_ASSETS, attachFileName, attachOutputFileName, title, tv);
 }
 
-bool MessageParser::parseAppMsgOpen(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgOpen(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgEmoji(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgEmoji(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     // Can't parse the detail info of emoji as the url is encrypted
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgRtLocation(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgRtLocation(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     tv["%%MESSAGE%%"] = m_resManager.getLocaleString("[Real-time Location]");
     return true;
 }
 
-bool MessageParser::parseAppMsgFwdMsg(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, std::string& forwardedMsg, std::string& forwardedMsgTitle, TemplateValues& tv) const
+bool MessageParser::parseAppMsgFwdMsg(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, std::string& forwardedMsg, std::string& forwardedMsgTitle, TemplateValues& tv) const
 {
     std::string title;
     xmlParser.parseNodeValue("/msg/appmsg/title", title);
@@ -982,12 +1005,12 @@ bool MessageParser::parseAppMsgFwdMsg(const WXAPPMSG& appMsg, const XmlParser& x
     return true;
 }
 
-bool MessageParser::parseAppMsgCard(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgCard(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgChannelCard(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgChannelCard(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     // Channel Card
     std::map<std::string, std::string> nodes = { {"username", ""}, {"avatar", ""}, {"nickname", ""}};
@@ -999,16 +1022,20 @@ bool MessageParser::parseAppMsgChannelCard(const WXAPPMSG& appMsg, const XmlPars
     return parseChannelCard(session, portraitDir, portraitUrlDir, nodes["username"], nodes["avatar"], "", nodes["nickname"], tv);
 }
 
-bool MessageParser::parseAppMsgChannels(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgChannels(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
 #ifndef NDEBUG
     writeFile(combinePath(m_outputPath, "../dbg", "msg" + std::to_string(appMsg.msg->type) + "_app_" + std::to_string(appMsg.appMsgType) + "_" + appMsg.msg->msgId + ".txt"), appMsg.msg->content);
 #endif
     
-    return parseChannels(appMsg.msg->msgId, xmlParser, NULL, "/msg/appmsg/finderFeed", session, tv);
+    std::map<std::string, std::string> nodes = CHANNELS_NODES;
+    std::map<std::string, std::string> videoNodes = CHANNELS_VIDEO_NODES;
+    xmlParser.parseNodesValue("/msg/appmsg/finderFeed/*", nodes);
+    xmlParser.parseNodesValue("/msg/appmsg/finderFeed/mediaList/media/*", videoNodes);
+    return parseChannels(appMsg.msg->msgId, nodes, videoNodes, session, tv);
 }
 
-bool MessageParser::parseAppMsgRefer(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgRefer(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     // Refer Message
     std::string title;
@@ -1044,7 +1071,8 @@ bool MessageParser::parseAppMsgRefer(const WXAPPMSG& appMsg, const XmlParser& xm
         else if (nodes["type"] == "49")
         {
             // APPMSG
-            XmlParser subAppMsgXmlParser(nodes["content"], true);
+            static const XmlStreamParser::Schema subAppMsgSchema = { "/msg/appmsg/title" };
+            XmlStreamParser subAppMsgXmlParser(subAppMsgSchema, nodes["content"], true);
             std::string subAppMsgTitle;
             subAppMsgXmlParser.parseNodeValue("/msg/appmsg/title", subAppMsgTitle);
             tv["%%REFERMSG%%"] = subAppMsgTitle;
@@ -1063,7 +1091,7 @@ bool MessageParser::parseAppMsgRefer(const WXAPPMSG& appMsg, const XmlParser& xm
     return true;
 }
 
-bool MessageParser::parseAppMsgTransfer(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgTransfer(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
 #ifndef NDEBUG
     writeFile(combinePath(m_outputPath, "../dbg", "msg" + std::to_string(appMsg.msg->type) + "_app_transfer_" + appMsg.msg->msgId + ".xml"), appMsg.msg->content);
@@ -1124,13 +1152,13 @@ bool MessageParser::parseAppMsgTransfer(const WXAPPMSG& appMsg, const XmlParser&
     return true;
 }
 
-bool MessageParser::parseAppMsgRedPacket(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgRedPacket(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     tv["%%MESSAGE%%"] = m_resManager.getLocaleString("[Red Packet]");
     return true;
 }
 
-bool MessageParser::parseAppMsgPat(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgPat(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     // int recordNum = 0;
     // xmlParser.parseNodeValue("/msg/appmsg/patMsg/records/record/fromUser", fromUser);
@@ -1175,12 +1203,12 @@ bool MessageParser::parseAppMsgPat(const WXAPPMSG& appMsg, const XmlParser& xmlP
     return true;
 }
 
-bool MessageParser::parseAppMsgReaderType(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgReaderType(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgNote(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgNote(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
 #if !defined(NDEBUG) || defined(DBG_PERF)
     writeFile(combinePath(m_outputPath, "../dbg", "msg" + std::to_string(appMsg.msg->type) + "_app_24_" + appMsg.msg->msgId + ".txt"), appMsg.msg->content);
@@ -1195,7 +1223,8 @@ bool MessageParser::parseAppMsgNote(const WXAPPMSG& appMsg, const XmlParser& xml
     
     if (!nodes["recorditem"].empty())
     {
-        XmlParser xmlParser2(nodes["recorditem"], true);
+        static const XmlStreamParser::Schema recordInfoSchema = { "/recordinfo/*" };
+        XmlStreamParser xmlParser2(recordInfoSchema, nodes["recorditem"], true);
         
         std::map<std::string, std::string> nodes2 = { {"info", ""}, {"desc", ""}, {"edittime", ""}, {"favusername", ""} };
         xmlParser2.parseNodesValue("/recordinfo/*", nodes2);
@@ -1232,7 +1261,7 @@ bool MessageParser::parseAppMsgNote(const WXAPPMSG& appMsg, const XmlParser& xml
     return true;
 }
 
-bool MessageParser::parseAppMsgUnknownType(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgUnknownType(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
 #if !defined(NDEBUG) || defined(DBG_PERF)
     writeFile(combinePath(m_outputPath, "../dbg", "msg" + std::to_string(appMsg.msg->type) + "_app_unknwn_" + std::to_string(appMsg.appMsgType) + ".txt"), appMsg.msg->content);
@@ -1240,7 +1269,7 @@ bool MessageParser::parseAppMsgUnknownType(const WXAPPMSG& appMsg, const XmlPars
     return parseAppMsgDefault(appMsg, xmlParser, session, tv);
 }
 
-bool MessageParser::parseAppMsgDefault(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const
+bool MessageParser::parseAppMsgDefault(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const
 {
     std::map<std::string, std::string> nodes = { {"title", ""}, {"type", ""}, {"des", ""}, {"url", ""}, {"thumburl", ""}, {"recorditem", ""} };
     xmlParser.parseNodesValue("/msg/appmsg/*", nodes);
@@ -1312,7 +1341,7 @@ bool MessageParser::parseFwdMsgLink(const WXFWDMSG& fwdMsg, const XmlParser& xml
     if (!m_options.isTextMode())
     {
         std::string vfile = m_userBase + "/OpenData/" + session.getHash() + "/" + fwdMsg.msg->msgId + "/" + fwdMsg.dataId + ".record_thumb";
-        hasThumb = m_iTunesDb.copyFile(vfile, combinePath(m_outputPath, session.getOutputFileName(), DIR_ASSETS, fwdMsg.msg->msgId), fwdMsg.dataId + "_thumb.jpg");
+        hasThumb = copyBackupFile(vfile, combinePath(combinePath(m_outputPath, session.getOutputFileName(), DIR_ASSETS, fwdMsg.msg->msgId), fwdMsg.dataId + "_thumb.jpg"));
     }
     
     if (!(link.empty()))
@@ -1438,15 +1467,14 @@ bool MessageParser::parseVideo(const std::string& sessionPath, const std::string
     if (!m_options.isTextMode())
     {
         std::string fullAssetsPath = combinePath(sessionPath, sessionAssetsPath);
-        ensureDirectoryExisted(fullAssetsPath);
-        hasThumb = m_iTunesDb.copyFile(srcThumb, combinePath(fullAssetsPath, destThumb));
+        hasThumb = copyBackupFile(srcThumb, combinePath(fullAssetsPath, destThumb));
         if (!srcRawVideo.empty())
         {
-            hasVideo = m_iTunesDb.copyFile(srcRawVideo, combinePath(fullAssetsPath, destVideo), true);
+            hasVideo = copyBackupFile(srcRawVideo, combinePath(fullAssetsPath, destVideo), true);
         }
         if (!hasVideo)
         {
-            hasVideo = m_iTunesDb.copyFile(srcVideo, combinePath(fullAssetsPath, destVideo));
+            hasVideo = copyBackupFile(srcVideo, combinePath(fullAssetsPath, destVideo));
         }
     }
 
@@ -1482,14 +1510,14 @@ bool MessageParser::parseImage(const std::string& sessionPath, const std::string
     if (!m_options.isTextMode())
     {
         std::string fullAssetsPath = combinePath(sessionPath, sessionAssetsPath);
-        hasThumb = m_iTunesDb.copyFile(srcThumb, fullAssetsPath, destThumb);
+        hasThumb = copyBackupFile(srcThumb, combinePath(fullAssetsPath, destThumb));
         if (!srcHdOrPre.empty())
         {
-            hasImage = m_iTunesDb.copyFile(srcHdOrPre, fullAssetsPath, dest);
+            hasImage = copyBackupFile(srcHdOrPre, combinePath(fullAssetsPath, dest));
         }
         if (!hasImage)
         {
-            hasImage = m_iTunesDb.copyFile(src, fullAssetsPath, dest);
+            hasImage = copyBackupFile(src, combinePath(fullAssetsPath, dest));
         }
     }
 
@@ -1523,7 +1551,7 @@ bool MessageParser::parseFile(const std::string& sessionPath, const std::string&
     bool hasFile = false;
     if (!m_options.isTextMode())
     {
-        hasFile = m_iTunesDb.copyFile(src, combinePath(sessionPath, sessionAssetsPath), dest);
+        hasFile = copyBackupFile(src, combinePath(sessionPath, sessionAssetsPath, dest));
     }
 
     if (hasFile)
@@ -1640,8 +1668,8 @@ bool MessageParser::parseChannelCard(const Session& session, const std::string&
 bool MessageParser::parseChannels(const std::string& msgId, const XmlParser& xmlParser, xmlNodePtr parentNode, const std::string& finderFeedXPath, const Session& session, TemplateValues& tv) const
 {
     // Channels SHI PIN HAO
-    std::map<std::string, std::string> nodes = { {"objectId", ""}, {"nickname", ""}, {"avatar", ""}, {"desc", ""}, {"mediaCount", ""}, {"feedType", ""}, {"desc", ""}, {"username", ""}};
-    std::map<std::string, std::string> videoNodes = { {"mediaType", ""}, {"url", ""}, {"thumbUrl", ""}, {"coverUrl", ""}, {"videoPlayDuration", ""}};
+    std::map<std::string, std::string> nodes = CHANNELS_NODES;
+    std::map<std::string, std::string> videoNodes = CHANNELS_VIDEO_NODES;
     
     if (NULL == parentNode)
     {
@@ -1653,6 +1681,12 @@ bool MessageParser::parseChannels(const std::string& msgId, const XmlParser& xml
         xmlParser.parseChildNodesValue(parentNode, finderFeedXPath + "/*", nodes);
         xmlParser.parseChildNodesValue(parentNode, finderFeedXPath + "/mediaList/media/*", videoNodes);
     }
+    
+    return parseChannels(msgId, nodes, videoNodes, session, tv);
+}
+
+bool MessageParser::parseChannels(const std::string& msgId, std::map<std::string, std::string>& nodes, std::map<std::string, std::string>& videoNodes, const Session& session, TemplateValues& tv) const
+{
 #ifndef NDEBUG
     if (nodes["mediaCount"] == "")
     {
@@ -1708,13 +1742,12 @@ bool MessageParser::parseChannels(const std::string& msgId, const XmlParser& xml
     return true;
 }
 
-bool MessageParser::parseForwardedMsgs(const Session& session, const WXMSG& msg, const std::string& title, const std::string& message, std::vector<TemplateValues>& tvs) const
+bool MessageParser::parseForwardedMsgs(const Session& session, const WXMSG& msg, const std::string& title, const std::string& message, TemplateValuesArena& tvs) const
 {
     std::string portraitPath = (DIR_ASSETS DIR_SEP_STR "Portrait" DIR_SEP_STR);
     std::string portraitUrlPath = (DIR_ASSETS "/Portrait/");
     
-    tvs.push_back(TemplateValues("notice"));
-    TemplateValues& beginTv = tvs.back();
+    TemplateValues& beginTv = tvs.add("notice");
     beginTv["%%MESSAGE%%"] = formatString(m_resManager.getLocaleString("<< %s"), title.c_str());
     beginTv["%%EXTRA_CLS%%"] = "fmsgtag";   // tag for forwarded msg
     
@@ -1748,7 +1781,7 @@ bool MessageParser::parseForwardedMsgs(const Session& session, const WXMSG& msg,
             fmsg.rawMessage = xmlParser.getNodeOuterXml(node);
             writeFile(combinePath(m_outputPath, "../dbg", "fwdmsg_" + fmsg.dataType + ".txt"), fmsg.rawMessage);
 #endif
-            TemplateValues& tv = *(tvs.emplace(tvs.end(), "msg"));
+            TemplateValues& tv = tvs.add("msg");
             tv["%%ALIGNMENT%%"] = "left";
             tv["%%EXTRA_CLS%%"] = "fmsg";   // forwarded msg
             
@@ -1822,8 +1855,7 @@ bool MessageParser::parseForwardedMsgs(const Session& session, const WXMSG& msg,
         }
     }
     
-    tvs.push_back(TemplateValues("notice"));
-    TemplateValues& endTv = tvs.back();
+    TemplateValues& endTv = tvs.add("notice");
     endTv["%%MESSAGE%%"] = formatString(m_resManager.getLocaleString("%s Ends >>"), title.c_str());
     endTv["%%EXTRA_CLS%%"] = "fmsgtag";   // tag for forwarded msg
     
@@ -1846,7 +1878,7 @@ std::string MessageParser::getDisplayTime(int ms) const
 
 bool MessageParser::copyPortraitIcon(const Session* session, const std::string& usrName, const std::string& portraitUrl, const std::string& portraitUrlLD, const std::string& destPath) const
 {
-    return copyPortraitIcon(session, usrName, md5(usrName), portraitUrl, portraitUrlLD, destPath);
+    return copyPortraitIcon(session, usrName, m_friends.getHash(usrName), portraitUrl, portraitUrlLD, destPath);
 }
 
 bool MessageParser::copyPortraitIcon(const Session* session, const Friend& f, const std::string& destPath) const
@@ -1880,17 +1912,8 @@ bool MessageParser::copyPortraitIcon(const Session* session, const std::string&
         {
             normalizePath(srcPath);
             
-            bool result = ::copyFile(srcPath, destFullPath, true);
-            if (result)
+            if (::copyFileWithTime(srcPath, destFullPath, ITunesDb::getModifiedTime(file)))
             {
-                if (file->modifiedTime != 0)
-                {
-                    updateFileTime(destFullPath, static_cast<time_t>(file->modifiedTime));
-                }
-                else if (!file->blob.empty())
-                {
-                    updateFileTime(destFullPath, ITunesDb::parseModifiedTime(file->blob));
-                }
                 hasPortrait = true;
             }
         }
@@ -1939,6 +1962,29 @@ bool MessageParser::copyPortraitIcon(const Session* session, const std::string&
     return hasPortrait;
 }
 
+bool MessageParser::copyBackupFile(const std::string& vpath, const std::string& dest, bool overwrite/* = false*/) const
+{
+    const ITunesFile* file = m_iTunesDb.findITunesFile(vpath);
+    if (NULL == file)
+    {
+        return false;
+    }
+    std::string srcPath = m_iTunesDb.getRealPath(*file);
+    if (srcPath.empty())
+    {
+        return false;
+    }
+    normalizePath(srcPath);
+    // The manifest may list a file which isn't in the backup, the caller falls back to the next candidate then
+    if (!existsFile(srcPath))
+    {
+        return false;
+    }
+    
+    m_taskManager.copyFile(srcPath, normalizePath(dest), ITunesDb::getModifiedTime(file), overwrite);
+    return true;
+}
+
 void MessageParser::ensureDefaultPortraitIconExisted(const std::string& portraitPath) const
 {
     std::string dest = combinePath(m_outputPath, portraitPath);
@@ -1975,7 +2021,7 @@ std::string MessageParser::getMemberDisplayName(const std::string& usrName, cons
         displayName = session.getMemberName(usrName);
         if (displayName.empty())
         {
-            const Friend *f = usrName == m_myself.getUsrName() ? &m_myself : m_friends.getFriend(md5(usrName));
+            const Friend *f = usrName == m_myself.getUsrName() ? &m_myself : m_friends.getFriendByUid(usrName);
             if (NULL != f)
             {
                 displayName = f->getDisplayName();
@@ -1998,7 +2044,7 @@ std::string MessageParser::getMemberDisplayName(const std::string& usrName, cons
         }
         else
         {
-            const Friend *f = m_friends.getFriend(md5(usrName));
+            const Friend *f = m_friends.getFriendByUid(usrName);
             if (NULL != f)
             {
                 displayName = f->getDisplayName();
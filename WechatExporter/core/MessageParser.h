@@ -10,6 +10,7 @@
 #define MessageParser_h
 
 #include <string>
+#include <unordered_map>
 #ifndef NDEBUG
 #include <cassert>
 #endif
@@ -23,65 +24,6 @@
 #include "XmlParser.h"
 #include "Utils.h"
 
-class TemplateValues
-{
-private:
-    std::map<std::string, std::string> m_values;
-    std::string m_name;
-    
-public:
-    using const_iterator = std::map<std::string, std::string>::const_iterator;
-
-public:
-    TemplateValues()
-    {
-    }
-    TemplateValues(const std::string& name) : m_name(name)
-    {
-    }
-    std::string getName() const
-    {
-        return m_name;
-    }
-    void setName(const std::string& name)
-    {
-        m_name = name;
-    }
-    std::string& operator[](const std::string& k)
-    {
-        return m_values[k];
-    }
-    bool hasValue(const std::string& key) const
-    {
-        return m_values.find(key) != m_values.cend();
-    }
-    
-    const_iterator cbegin() const
-    {
-        return m_values.cbegin();
-    }
-    
-    const_iterator cend() const
-    {
-        return m_values.cend();
-    }
-    
-    void clear()
-    {
-        m_values.clear();
-    }
-    
-    void clearName()
-    {
-        m_name.clear();
-    }
-    
-    const std::map<std::string, std::string>& getValues() const
-    {
-        return m_values;
-    }
-};
-
 struct WechatTemplateHandler
 {
     XmlParser& m_xmlParser;
@@ -244,7 +186,7 @@ public:
     
     MessageParser(const ITunesDb& iTunesDb, const ITunesDb& iTunesDbShare, TaskManager& taskManager, Friends& friends, Friend myself, const ExportOption& options, const std::string& resPath, const std::string& outputPath, const ResManager& resManager);
     
-    bool parse(WXMSG& msg, const Session& session, std::vector<TemplateValues>& tvs) const;
+    bool parse(WXMSG& msg, const Session& session, TemplateValuesArena& tvs) const;
     
     bool copyPortraitIcon(const Session* session, const std::string& usrName, const std::string& portraitUrl, const std::string& portraitUrlLD, const std::string& destPath) const;
     bool copyPortraitIcon(const Session* session, const std::string& usrName, const std::string& usrNameHash, const std::string& portraitUrl, const std::string& portraitUrlLD, const std::string& destPath) const;
@@ -262,6 +204,15 @@ protected:
     
     bool parsePortrait(const WXMSG& msg, const Session& session, const std::string& senderId, TemplateValues& tv) const;
     
+    // Resolved sender of the messages in the current session, the portrait is copied when the sender is resolved
+    struct SenderInfo
+    {
+        std::string name;   // escaped unless in text mode
+        std::string wxName;
+        std::string avatar;
+    };
+    const SenderInfo& getSenderInfo(const Session& session, bool outgoing, const std::string& senderId) const;
+    
     bool parseText(const WXMSG& msg, const Session& session, TemplateValues& tv) const;
     bool parseImage(const WXMSG& msg, const Session& session, TemplateValues& tv) const;
     bool parseVoice(const WXMSG& msg, const Session& session, TemplateValues& tv) const;
@@ -280,28 +231,28 @@ protected:
     bool parseSystem(const WXMSG& msg, const Session& session, TemplateValues& tv) const;
     
     // APP MSG
-    bool parseAppMsgText(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgImage(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgAudio(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgVideo(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgEmotion(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgUrl(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgAttachment(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgOpen(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgEmoji(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgRtLocation(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgFwdMsg(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, std::string& fwdMsg, std::string& fwdMsgTitle, TemplateValues& tv) const;
-    bool parseAppMsgCard(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgChannelCard(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgChannels(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgRefer(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgTransfer(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgRedPacket(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgPat(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgReaderType(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgNote(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgUnknownType(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
-    bool parseAppMsgDefault(const WXAPPMSG& appMsg, const XmlParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgText(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgImage(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgAudio(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgVideo(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgEmotion(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgUrl(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgAttachment(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgOpen(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgEmoji(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgRtLocation(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgFwdMsg(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, std::string& fwdMsg, std::string& fwdMsgTitle, TemplateValues& tv) const;
+    bool parseAppMsgCard(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgChannelCard(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgChannels(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgRefer(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgTransfer(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgRedPacket(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgPat(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgReaderType(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgNote(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgUnknownType(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
+    bool parseAppMsgDefault(const WXAPPMSG& appMsg, const XmlStreamParser& xmlParser, const Session& session, TemplateValues& tv) const;
 
     // FORWARDEWD MSG
     bool parseFwdMsgText(const WXFWDMSG& fwdMsg, const XmlParser& xmlParser, xmlNodePtr itemNode, const Session& session, TemplateValues& tv) const;
@@ -323,7 +274,8 @@ protected:
     bool parseCard(const Session& session, const std::string& sessionPath, const std::string& portraitDir, const std::string& portraitUrlDir, const std::string& cardMessage, TemplateValues& tv) const;
     bool parseChannelCard(const Session& session, const std::string& portraitDir, const std::string& portraitUrlDir, const std::string& usrName, const std::string& avatar, const std::string& avatarLD, const std::string& name, TemplateValues& tv) const;
     bool parseChannels(const std::string& msgId, const XmlParser& xmlParser, xmlNodePtr parentNode, const std::string& finderFeedXPath, const Session& session, TemplateValues& tv) const;
-    bool parseForwardedMsgs(const Session& session, const WXMSG& msg, const std::string& title, const std::string& message, std::vector<TemplateValues>& tvs) const;
+    bool parseChannels(const std::string& msgId, std::map<std::string, std::string>& nodes, std::map<std::string, std::string>& videoNodes, const Session& session, TemplateValues& tv) const;
+    bool parseForwardedMsgs(const Session& session, const WXMSG& msg, const std::string& title, const std::string& message, TemplateValuesArena& tvs) const;
     
     std::string getDisplayTime(int ms) const;
     
@@ -339,6 +291,10 @@ protected:
     
     void ensureDefaultPortraitIconExisted(const std::string& portraitPath) const;
     
+    // Only resolves the file in the backup and queues the copy on TaskManager,
+    // returns false if the file doesn't exist in the backup.
+    bool copyBackupFile(const std::string& vpath, const std::string& dest, bool overwrite = false) const;
+    
     static bool removeSupportUrl(std::string& url);
 protected:
     const ITunesDb& m_iTunesDb;
@@ -354,6 +310,9 @@ protected:
     const std::string m_outputPath;
     std::string m_userBase;
     mutable std::string m_error;
+    
+    mutable const Session* m_senderSession;
+    mutable std::unordered_map<std::string, SenderInfo> m_senders;  // senderId => SenderInfo
 
 protected:
 #ifndef USING_ASYNC_TASK_FOR_MP3
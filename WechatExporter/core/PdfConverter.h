@@ -14,6 +14,11 @@ class PdfConverter
 public:
     virtual bool makeUserDirectory(const std::string& dirName) = 0;
     virtual bool convert(const std::string& htmlPath, const std::string& pdfPath) = 0;
+    // For the converters which print the pages asynchronously
+    virtual bool waitForCompletion()
+    {
+        return true;
+    }
     virtual ~PdfConverter() {}
 };
 
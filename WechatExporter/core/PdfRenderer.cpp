@@ -0,0 +1,650 @@
+//
+//  PdfRenderer.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2022/6/2.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "PdfRenderer.h"
+#include <chrono>
+#include <cstdlib>
+#include <cerrno>
+#include <json/json.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+#include "FileSystem.h"
+#include "Utils.h"
+#include "Tracer.h"
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+#define PDF_RENDERER_TIMEOUT        120000  // ms, for loading or printing one page
+#define PDF_RENDERER_STOP_TIMEOUT   5000    // ms
+
+static std::string buildFileUrl(const std::string& path)
+{
+    static const char HEX_CHARS[] = "0123456789ABCDEF";
+    std::string url = "file://";
+    url.reserve(url.size() + path.size() + (path.size() >> 2));
+    for (std::string::const_iterator it = path.cbegin(); it != path.cend(); ++it)
+    {
+        unsigned char ch = static_cast<unsigned char>(*it);
+        if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '/' || ch == '-' || ch == '_' || ch == '.' || ch == '~')
+        {
+            url.push_back(static_cast<char>(ch));
+        }
+        else
+        {
+            url.push_back('%');
+            url.push_back(HEX_CHARS[ch >> 4]);
+            url.push_back(HEX_CHARS[ch & 0x0F]);
+        }
+    }
+    return url;
+}
+
+static std::vector<int8_t> buildBase64DecodingTable()
+{
+    const char* chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::vector<int8_t> table(256, -1);
+    for (int idx = 0; idx < 64; ++idx)
+    {
+        table[static_cast<unsigned char>(chars[idx])] = static_cast<int8_t>(idx);
+    }
+    return table;
+}
+
+static bool decodeBase64(const std::string& value, std::vector<unsigned char>& data)
+{
+    // Called by all the renderers, the initialization of the local static is thread-safe
+    static const std::vector<int8_t> DECODING_TABLE = buildBase64DecodingTable();
+
+    data.clear();
+    data.reserve(value.size() / 4 * 3);
+    uint32_t bits = 0;
+    int numberOfBits = 0;
+    for (std::string::const_iterator it = value.cbegin(); it != value.cend(); ++it)
+    {
+        if (*it == '=')
+        {
+            break;
+        }
+        int8_t decoded = DECODING_TABLE[static_cast<unsigned char>(*it)];
+        if (decoded < 0)
+        {
+            return false;
+        }
+        bits = (bits << 6) | static_cast<uint32_t>(decoded);
+        numberOfBits += 6;
+        if (numberOfBits >= 8)
+        {
+            numberOfBits -= 8;
+            data.push_back(static_cast<unsigned char>((bits >> numberOfBits) & 0xFF));
+        }
+    }
+    return true;
+}
+
+#ifndef _WIN32
+
+// One headless browser process, the messages of the pipe are JSON objects terminated by '\0'
+class PdfRenderer
+{
+public:
+    PdfRenderer(const std::string& browserPath, const std::string& userDataDir) : m_browserPath(browserPath), m_userDataDir(userDataDir), m_pid(-1), m_writeFd(-1), m_readFd(-1), m_scanned(0), m_lastId(0), m_loaded(false)
+    {
+    }
+
+    ~PdfRenderer()
+    {
+        stop();
+    }
+
+    bool print(const std::string& htmlPath, const std::string& pdfPath, std::string& error)
+    {
+        if (m_pid <= 0 && !start(error))
+        {
+            return false;
+        }
+
+        Json::Value params(Json::objectValue);
+        Json::Value result;
+        if (m_sessionId.empty())
+        {
+            // One page(target) per browser, it is navigated to every html file
+            params["url"] = "about:blank";
+            if (!call("Target.createTarget", params, false, result, error))
+            {
+                return false;
+            }
+            params = Json::Value(Json::objectValue);
+            params["targetId"] = result["targetId"];
+            params["flatten"] = true;
+            if (!call("Target.attachToTarget", params, false, result, error))
+            {
+                return false;
+            }
+            m_sessionId = result["sessionId"].asString();
+            if (!call("Page.enable", Json::Value(Json::objectValue), true, result, error))
+            {
+                return false;
+            }
+        }
+
+        m_loaded = false;
+        params = Json::Value(Json::objectValue);
+        params["url"] = buildFileUrl(htmlPath);
+        if (!call("Page.navigate", params, true, result, error))
+        {
+            return false;
+        }
+        if (result.isMember("errorText"))
+        {
+            // The browser is still fine
+            error = "Failed to load " + htmlPath + ": " + result["errorText"].asString();
+            return false;
+        }
+        if (!waitForLoaded(error))
+        {
+            return false;
+        }
+
+        params = Json::Value(Json::objectValue);
+        params["printBackground"] = true;
+        params["displayHeaderFooter"] = false;
+        if (!call("Page.printToPDF", params, true, result, error))
+        {
+            return false;
+        }
+
+        std::vector<unsigned char> data;
+        if (!decodeBase64(result["data"].asString(), data) || !writeFile(pdfPath, data))
+        {
+            error = "Failed to write " + pdfPath;
+            return false;
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        if (m_pid > 0 && m_writeFd != -1)
+        {
+            std::string error;
+            Json::Value result;
+            call("Browser.close", Json::Value(Json::objectValue), false, result, error, PDF_RENDERER_STOP_TIMEOUT);
+        }
+        terminate();
+    }
+
+protected:
+    // The browser exits once its pipe is closed, it is killed if it doesn't
+    void terminate()
+    {
+        if (m_writeFd != -1)
+        {
+            close(m_writeFd);
+            m_writeFd = -1;
+        }
+        if (m_readFd != -1)
+        {
+            close(m_readFd);
+            m_readFd = -1;
+        }
+        if (m_pid > 0)
+        {
+            int status = 0;
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(PDF_RENDERER_STOP_TIMEOUT);
+            while (waitpid(m_pid, &status, WNOHANG) == 0)
+            {
+                if (std::chrono::steady_clock::now() >= deadline)
+                {
+                    kill(m_pid, SIGKILL);
+                    waitpid(m_pid, &status, 0);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            m_pid = -1;
+        }
+        m_sessionId.clear();
+        m_buffer.clear();
+        m_scanned = 0;
+    }
+
+    bool start(std::string& error)
+    {
+        // Serialized so that no other browser inherits the pipes between pipe() and FD_CLOEXEC
+        static std::mutex spawnMutex;
+        std::lock_guard<std::mutex> lock(spawnMutex);
+
+        int toBrowser[2] = { -1, -1 };
+        int fromBrowser[2] = { -1, -1 };
+        if (pipe(toBrowser) != 0)
+        {
+            error = "Failed to create pipe for the browser";
+            return false;
+        }
+        if (pipe(fromBrowser) != 0)
+        {
+            close(toBrowser[0]);
+            close(toBrowser[1]);
+            error = "Failed to create pipe for the browser";
+            return false;
+        }
+        // The ends of the browser are moved above 4 so that dup2 to 3 and 4 can't overwrite each other
+        int browserRead = fcntl(toBrowser[0], F_DUPFD_CLOEXEC, 5);
+        int browserWrite = fcntl(fromBrowser[1], F_DUPFD_CLOEXEC, 5);
+        close(toBrowser[0]);
+        close(fromBrowser[1]);
+        m_writeFd = toBrowser[1];
+        m_readFd = fromBrowser[0];
+        fcntl(m_writeFd, F_SETFD, FD_CLOEXEC);
+        fcntl(m_readFd, F_SETFD, FD_CLOEXEC);
+#ifdef F_SETNOSIGPIPE
+        fcntl(m_writeFd, F_SETNOSIGPIPE, 1);
+#endif
+
+        makeDirectory(m_userDataDir);
+        std::string userDataDirArg = "--user-data-dir=" + m_userDataDir;
+        const char* args[] = { m_browserPath.c_str(), "--headless", "--disable-gpu", "--disable-extensions", "--no-first-run", "--no-default-browser-check", "--remote-debugging-pipe", userDataDirArg.c_str(), "about:blank", NULL };
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, browserRead, 3);
+        posix_spawn_file_actions_adddup2(&actions, browserWrite, 4);
+
+        pid_t pid = -1;
+        int rc = (browserRead < 0 || browserWrite < 0) ? -1 : posix_spawn(&pid, m_browserPath.c_str(), &actions, NULL, const_cast<char * const *>(args), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (browserRead >= 0)
+        {
+            close(browserRead);
+        }
+        if (browserWrite >= 0)
+        {
+            close(browserWrite);
+        }
+        if (rc != 0)
+        {
+            error = "Failed to start " + m_browserPath;
+            terminate();
+            return false;
+        }
+        m_pid = pid;
+        return true;
+    }
+
+    bool call(const std::string& method, const Json::Value& params, bool pageLevel, Json::Value& result, std::string& error, int timeout = PDF_RENDERER_TIMEOUT)
+    {
+        int id = ++m_lastId;
+        Json::Value command(Json::objectValue);
+        command["id"] = id;
+        command["method"] = method;
+        command["params"] = params;
+        if (pageLevel)
+        {
+            command["sessionId"] = m_sessionId;
+        }
+
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        std::string data = Json::writeString(builder, command);
+        data.push_back('\0');
+        if (!writeAll(data))
+        {
+            error = method + ": the browser has exited";
+            terminate();
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+        Json::Value message;
+        while (readMessage(message, deadline, error))
+        {
+            if (message.isMember("id") && message["id"].asInt() == id)
+            {
+                if (message.isMember("error"))
+                {
+                    error = method + ": " + message["error"]["message"].asString();
+                    return false;
+                }
+                result = message["result"];
+                return true;
+            }
+        }
+        error = method + ": " + error;
+        terminate();
+        return false;
+    }
+
+    bool waitForLoaded(std::string& error)
+    {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(PDF_RENDERER_TIMEOUT);
+        Json::Value message;
+        while (!m_loaded)
+        {
+            if (!readMessage(message, deadline, error))
+            {
+                error = "Page.loadEventFired: " + error;
+                terminate();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Events are only checked for the load event of the page, the others are dropped
+    bool readMessage(Json::Value& message, std::chrono::steady_clock::time_point deadline, std::string& error)
+    {
+        char buffer[65536];
+        while (true)
+        {
+            std::string::size_type end = m_buffer.find('\0', m_scanned);
+            if (end != std::string::npos)
+            {
+                Json::CharReaderBuilder builder;
+                std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+                std::string errors;
+                bool parsed = reader->parse(m_buffer.c_str(), m_buffer.c_str() + end, &message, &errors);
+                m_buffer.erase(0, end + 1);
+                m_scanned = 0;
+                if (!parsed)
+                {
+                    continue;
+                }
+                if (!message.isMember("id") && message["method"].asString() == "Page.loadEventFired" && message["sessionId"].asString() == m_sessionId)
+                {
+                    m_loaded = true;
+                }
+                return true;
+            }
+            m_scanned = m_buffer.size();
+
+            int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+            if (timeout <= 0)
+            {
+                error = "timeout";
+                return false;
+            }
+            struct pollfd pfd;
+            pfd.fd = m_readFd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            int rc = poll(&pfd, 1, timeout);
+            if (rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (rc <= 0)
+            {
+                error = rc == 0 ? "timeout" : "poll failed";
+                return false;
+            }
+            ssize_t bytesRead = read(m_readFd, buffer, sizeof(buffer));
+            if (bytesRead < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytesRead <= 0)
+            {
+                error = "the browser has exited";
+                return false;
+            }
+            m_buffer.append(buffer, static_cast<size_t>(bytesRead));
+        }
+    }
+
+    bool writeAll(const std::string& data)
+    {
+#ifndef F_SETNOSIGPIPE
+        // Writing to a dead browser raises SIGPIPE, which is blocked on this thread only and consumed below
+        // so that the signal disposition of the host process is left alone
+        sigset_t pipeSet;
+        sigset_t oldSet;
+        sigset_t pendingSet;
+        sigemptyset(&pipeSet);
+        sigaddset(&pipeSet, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+        sigpending(&pendingSet);
+        bool wasPending = sigismember(&pendingSet, SIGPIPE) == 1;
+#endif
+        bool succeeded = true;
+        size_t offset = 0;
+        while (offset < data.size())
+        {
+            ssize_t bytesWritten = write(m_writeFd, data.c_str() + offset, data.size() - offset);
+            if (bytesWritten < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                succeeded = false;
+                break;
+            }
+            offset += static_cast<size_t>(bytesWritten);
+        }
+#ifndef F_SETNOSIGPIPE
+        if (!succeeded && errno == EPIPE && !wasPending)
+        {
+            struct timespec zeroTimeout = { 0, 0 };
+            while (sigtimedwait(&pipeSet, NULL, &zeroTimeout) == -1 && errno == EINTR)
+            {
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+#endif
+        return succeeded;
+    }
+
+private:
+    std::string m_browserPath;
+    std::string m_userDataDir;
+    pid_t m_pid;
+    int m_writeFd;
+    int m_readFd;
+    std::string m_buffer;
+    std::string::size_type m_scanned;   // no '\0' before it in m_buffer
+    int m_lastId;
+    std::string m_sessionId;
+    bool m_loaded;
+};
+
+#else
+
+class PdfRenderer
+{
+public:
+    PdfRenderer(const std::string& browserPath, const std::string& userDataDir)
+    {
+    }
+
+    bool print(const std::string& htmlPath, const std::string& pdfPath, std::string& error)
+    {
+        error = "PDF rendering is not supported";
+        return false;
+    }
+};
+
+#endif
+
+PdfRendererPool::PdfRendererPool(const std::string& browserPath, const std::string& outputDir, size_t numberOfRenderers/* = 0*/, Logger* logger/* = NULL*/) : m_browserPath(browserPath), m_outputDir(outputDir), m_numberOfRenderers(numberOfRenderers), m_logger(logger), m_numberOfPrinting(0), m_stopped(false), m_numberOfFailures(0)
+{
+    if (0 == m_numberOfRenderers)
+    {
+        m_numberOfRenderers = std::thread::hardware_concurrency() / 2;
+    }
+    if (m_numberOfRenderers < 1)
+    {
+        m_numberOfRenderers = 1;
+    }
+    else if (m_numberOfRenderers > MAX_RENDERERS)
+    {
+        m_numberOfRenderers = MAX_RENDERERS;
+    }
+}
+
+PdfRendererPool::~PdfRendererPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+    }
+    m_pageCv.notify_all();
+    m_doneCv.notify_all();
+    for (std::vector<std::thread>::iterator it = m_threads.begin(); it != m_threads.end(); ++it)
+    {
+        if (it->joinable())
+        {
+            it->join();
+        }
+    }
+    m_threads.clear();
+}
+
+std::string PdfRendererPool::findBrowser()
+{
+#ifdef _WIN32
+    return "";
+#elif defined(__APPLE__)
+    const char* paths[] = { "/Applications/Google Chrome.app/Contents/MacOS/Google Chrome", "/Applications/Microsoft Edge.app/Contents/MacOS/Microsoft Edge", "/Applications/Chromium.app/Contents/MacOS/Chromium" };
+    for (size_t idx = 0; idx < sizeof(paths) / sizeof(const char *); ++idx)
+    {
+        if (existsFile(paths[idx]))
+        {
+            return paths[idx];
+        }
+    }
+    return "";
+#else
+    const char* names[] = { "google-chrome", "google-chrome-stable", "chromium", "chromium-browser", "microsoft-edge" };
+    const char* env = getenv("PATH");
+    std::vector<std::string> dirs = split(NULL == env ? "/usr/bin:/usr/local/bin" : env, ":");
+    for (size_t idx = 0; idx < sizeof(names) / sizeof(const char *); ++idx)
+    {
+        for (std::vector<std::string>::const_iterator it = dirs.cbegin(); it != dirs.cend(); ++it)
+        {
+            std::string path = combinePath(*it, names[idx]);
+            if (!it->empty() && existsFile(path))
+            {
+                return path;
+            }
+        }
+    }
+    return "";
+#endif
+}
+
+bool PdfRendererPool::isPdfSupported() const
+{
+#ifdef _WIN32
+    return false;
+#else
+    return !m_browserPath.empty() && existsFile(m_browserPath);
+#endif
+}
+
+bool PdfRendererPool::makeUserDirectory(const std::string& dirName)
+{
+    return makeDirectory(combinePath(m_outputDir, "pdf", dirName));
+}
+
+bool PdfRendererPool::convert(const std::string& htmlPath, const std::string& pdfPath)
+{
+    if (!isPdfSupported())
+    {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_threads.empty())
+    {
+        for (size_t idx = 0; idx < m_numberOfRenderers; ++idx)
+        {
+            m_threads.emplace_back(&PdfRendererPool::ThreadFunc, this, idx);
+        }
+    }
+    // Back pressure: the html files are small but the exporting should not run far ahead of the printing
+    m_doneCv.wait(lock, [this] { return m_stopped || m_pages.size() < m_numberOfRenderers * QUEUED_PAGES_PER_RENDERER; });
+    if (m_stopped)
+    {
+        return false;
+    }
+    m_pages.push(std::make_pair(htmlPath, pdfPath));
+    lock.unlock();
+    m_pageCv.notify_one();
+    return true;
+}
+
+bool PdfRendererPool::waitForCompletion()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCv.wait(lock, [this] { return m_stopped || (m_pages.empty() && 0 == m_numberOfPrinting); });
+    return 0 == m_numberOfFailures.load(std::memory_order_relaxed);
+}
+
+void PdfRendererPool::ThreadFunc(size_t index)
+{
+    if (Tracer::isEnabled())
+    {
+        Tracer::setThreadName("pdf" + std::to_string(index + 1));
+    }
+
+    // Each browser needs its own profile to run side by side
+    std::string userDataDir = combinePath(m_outputDir, "pdf", ".renderer" + std::to_string(index + 1));
+    {
+        PdfRenderer renderer(m_browserPath, userDataDir);
+        while (true)
+        {
+            std::pair<std::string, std::string> page;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_pageCv.wait(lock, [this] { return m_stopped || !m_pages.empty(); });
+                if (m_stopped)
+                {
+                    break;
+                }
+                page = m_pages.front();
+                m_pages.pop();
+                m_numberOfPrinting++;
+            }
+            m_doneCv.notify_all();
+
+            std::string error;
+            bool succeeded = false;
+            {
+                TRACE_SPAN_ARG(TRACE_CAT_TASK, "pdf", page.second);
+                succeeded = renderer.print(page.first, page.second, error);
+            }
+            if (!succeeded)
+            {
+                m_numberOfFailures++;
+                if (NULL != m_logger)
+                {
+                    m_logger->write("Failed to print PDF: " + page.second + " " + error);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_numberOfPrinting--;
+            }
+            m_doneCv.notify_all();
+        }
+    }
+    deleteDirectory(userDataDir);
+}
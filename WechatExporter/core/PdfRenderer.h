@@ -0,0 +1,69 @@
+//
+//  PdfRenderer.h
+//  WechatExporter
+//
+//  Created by Matthew on 2022/6/2.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#ifndef PdfRenderer_h
+#define PdfRenderer_h
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "PdfConverter.h"
+#include "Logger.h"
+
+// PdfConverter which keeps a few headless Chrome(or Edge) processes alive instead of starting one browser
+// per page. Each renderer drives its browser with the DevTools protocol over --remote-debugging-pipe.
+// convert() only queues the page(and blocks while the queue is full), the renderers print the queued pages
+// concurrently, so the printing overlaps with exporting the next sessions. Not supported on Windows yet.
+class PdfRendererPool : public PdfConverter
+{
+public:
+    static const size_t MAX_RENDERERS = 4;
+    static const size_t QUEUED_PAGES_PER_RENDERER = 4;
+
+    // numberOfRenderers: 0 means half of the hardware threads(1 to MAX_RENDERERS)
+    PdfRendererPool(const std::string& browserPath, const std::string& outputDir, size_t numberOfRenderers = 0, Logger* logger = NULL);
+    virtual ~PdfRendererPool();
+
+    static std::string findBrowser();
+
+    bool isPdfSupported() const;
+
+    virtual bool makeUserDirectory(const std::string& dirName);
+    virtual bool convert(const std::string& htmlPath, const std::string& pdfPath);
+    virtual bool waitForCompletion();
+
+    uint32_t getNumberOfFailures() const
+    {
+        return m_numberOfFailures.load(std::memory_order_relaxed);
+    }
+
+protected:
+    void ThreadFunc(size_t index);
+
+private:
+    std::string m_browserPath;
+    std::string m_outputDir;
+    size_t m_numberOfRenderers;
+    Logger* m_logger;
+
+    std::vector<std::thread> m_threads;     // started by the first page
+    std::mutex m_mutex;
+    std::condition_variable m_pageCv;       // new page or stopped
+    std::condition_variable m_doneCv;       // room in the queue or a page is done
+    std::queue<std::pair<std::string, std::string>> m_pages;    // (html, pdf)
+    size_t m_numberOfPrinting;
+    bool m_stopped;
+    std::atomic<uint32_t> m_numberOfFailures;
+};
+
+#endif /* PdfRenderer_h */
@@ -250,6 +250,17 @@ const std::string& ResManager::buildFromTemplate(const std::string& key, const s
     return it->second.build(values);
 }
 
+const std::string& ResManager::buildFromTemplate(const std::string& key, const TemplateValues& values) const
+{
+    auto it = m_newTemplates.find(key);
+    if (it == m_newTemplates.cend())
+    {
+        return m_emptyString;
+    }
+    
+    return it->second.build(values);
+}
+
 std::string ResManager::checkEmptyTemplates() const
 {
     std::vector<std::string> keys;
@@ -119,6 +119,7 @@ public:
     std::string checkEmptyTemplates() const;
     
     const std::string& buildFromTemplate(const std::string& key, const std::map<std::string, std::string>& values) const;
+    const std::string& buildFromTemplate(const std::string& key, const TemplateValues& values) const;
 
     // Emoji
     bool hasEmojiTag(const std::string& msg) const;
@@ -0,0 +1,429 @@
+//
+//  SearchDatabase.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2022/6/8.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "SearchDatabase.h"
+#include <algorithm>
+#include <cstring>
+#include <sqlite3.h>
+#include <json/json.h>
+#include "WechatObjects.h"
+#include "Template.h"
+#include "SearchIndex.h"
+#include "ExportOption.h"
+#include "ExportContext.h"
+#include "Utils.h"
+
+#define SEARCH_DB_SCHEMA \
+    "CREATE TABLE IF NOT EXISTS sessions(id INTEGER PRIMARY KEY, account TEXT NOT NULL, usrName TEXT NOT NULL, displayName TEXT, path TEXT, UNIQUE(account, usrName));" \
+    "CREATE TABLE IF NOT EXISTS messages(id INTEGER PRIMARY KEY, session INTEGER NOT NULL, msgId INTEGER NOT NULL, createTime INTEGER, type INTEGER, des INTEGER, sender TEXT, senderName TEXT, content TEXT, media TEXT, UNIQUE(session, msgId));" \
+    "CREATE INDEX IF NOT EXISTS messages_createTime ON messages(createTime);" \
+    "CREATE VIRTUAL TABLE IF NOT EXISTS messages_fts USING fts5(tokens, content='', detail=none);"
+
+#define SEARCH_DB_SELECT \
+    "SELECT s.account,s.usrName,s.displayName,s.path,m.msgId,m.createTime,m.type,m.des,m.sender,m.senderName,m.content,m.media " \
+    "FROM messages m JOIN sessions s ON s.id=m.session WHERE "
+
+static const char* TEXT_KEYS[] = {"%%MESSAGE%%", "%%SHARINGTITLE%%", "%%CARDNAME%%"};
+static const char* MEDIA_KEYS[] = {"%%IMGPATH%%", "%%VIDEOPATH%%", "%%AUDIOPATH%%", "%%EMOJIPATH%%", "%%SHARINGURL%%"};
+
+static bool isKeyOf(const std::string& key, const char** keys, size_t numberOfKeys)
+{
+    for (size_t idx = 0; idx < numberOfKeys; ++idx)
+    {
+        if (key == keys[idx])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline void bindText(sqlite3_stmt* stmt, int idx, const std::string& value)
+{
+    sqlite3_bind_text(stmt, idx, value.c_str(), static_cast<int>(value.size()), SQLITE_STATIC);
+}
+
+static inline std::string getColumnText(sqlite3_stmt* stmt, int idx)
+{
+    const unsigned char* value = sqlite3_column_text(stmt, idx);
+    return (NULL == value) ? std::string() : std::string(reinterpret_cast<const char *>(value), sqlite3_column_bytes(stmt, idx));
+}
+
+SearchDatabase::SearchDatabase() : m_db(NULL), m_insertMsgStmt(NULL), m_insertFtsStmt(NULL), m_sessionId(0), m_html(true), m_numberOfPendingMessages(0)
+{
+}
+
+SearchDatabase::~SearchDatabase()
+{
+    close();
+}
+
+std::string SearchDatabase::getPath(const std::string& outputDir)
+{
+    return combinePath(outputDir, WXEXP_DATA_FOLDER, WXEXP_SEARCH_DB_FILE);
+}
+
+bool SearchDatabase::open(const std::string& path, bool readOnly/* = true*/)
+{
+    close();
+    int rc = openSqlite3Database(path, &m_db, readOnly);
+    if (SQLITE_OK != rc)
+    {
+        setError();
+        close();
+        return false;
+    }
+    if (readOnly)
+    {
+        return true;
+    }
+
+    // Same as ExportContext, the database can be rebuilt by exporting again
+    execute("PRAGMA synchronous=OFF;");
+    if (!execute(SEARCH_DB_SCHEMA))
+    {
+        close();
+        return false;
+    }
+
+    const char* sql = "INSERT OR IGNORE INTO messages(session,msgId,createTime,type,des,sender,senderName,content,media) VALUES(?,?,?,?,?,?,?,?,?)";
+    if (SQLITE_OK != sqlite3_prepare_v2(m_db, sql, -1, &m_insertMsgStmt, NULL))
+    {
+        setError();
+        close();
+        return false;
+    }
+    sql = "INSERT INTO messages_fts(rowid,tokens) VALUES(?,?)";
+    if (SQLITE_OK != sqlite3_prepare_v2(m_db, sql, -1, &m_insertFtsStmt, NULL))
+    {
+        setError();
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SearchDatabase::close()
+{
+    if (m_numberOfPendingMessages > 0)
+    {
+        endSession();
+    }
+    if (NULL != m_insertMsgStmt)
+    {
+        sqlite3_finalize(m_insertMsgStmt);
+        m_insertMsgStmt = NULL;
+    }
+    if (NULL != m_insertFtsStmt)
+    {
+        sqlite3_finalize(m_insertFtsStmt);
+        m_insertFtsStmt = NULL;
+    }
+    if (NULL != m_db)
+    {
+        sqlite3_close(m_db);
+        m_db = NULL;
+    }
+    m_sessionId = 0;
+}
+
+bool SearchDatabase::beginSession(const std::string& account, const Session& session, const std::string& sessionPath, bool html)
+{
+    m_sessionId = 0;
+    m_html = html;
+    if (NULL == m_insertMsgStmt)
+    {
+        return false;
+    }
+
+    sqlite3_stmt* stmt = NULL;
+    const char* sql = "INSERT OR IGNORE INTO sessions(account,usrName) VALUES(?,?)";
+    int rc = sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL);
+    if (SQLITE_OK == rc)
+    {
+        bindText(stmt, 1, account);
+        bindText(stmt, 2, session.getUsrName());
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+
+    // The display name and the folder may be changed since last exporting
+    sql = "UPDATE sessions SET displayName=?,path=? WHERE account=? AND usrName=?";
+    rc = sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL);
+    if (SQLITE_OK == rc)
+    {
+        bindText(stmt, 1, session.getDisplayName());
+        bindText(stmt, 2, sessionPath);
+        bindText(stmt, 3, account);
+        bindText(stmt, 4, session.getUsrName());
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+
+    sql = "SELECT id FROM sessions WHERE account=? AND usrName=?";
+    rc = sqlite3_prepare_v2(m_db, sql, -1, &stmt, NULL);
+    if (SQLITE_OK == rc)
+    {
+        bindText(stmt, 1, account);
+        bindText(stmt, 2, session.getUsrName());
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            m_sessionId = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    if (0 == m_sessionId)
+    {
+        setError();
+        return false;
+    }
+
+    m_numberOfPendingMessages = 0;
+    return execute("BEGIN;");
+}
+
+bool SearchDatabase::insertMessage(const WXMSG& msg, const TemplateValuesArena& tvs)
+{
+    if (0 == m_sessionId)
+    {
+        return false;
+    }
+
+    m_sender.clear();
+    m_senderName.clear();
+    m_content.clear();
+    m_media.clear();
+    for (TemplateValuesArena::const_iterator it = tvs.cbegin(); it != tvs.cend(); ++it)
+    {
+        for (TemplateValues::const_iterator itValue = it->cbegin(); itValue != it->cend(); ++itValue)
+        {
+            const std::string& key = itValue->first;
+            const std::string& value = itValue->second;
+            if (value.empty())
+            {
+                continue;
+            }
+            if (key == "%%NAME%%")
+            {
+                if (m_senderName.empty())
+                {
+                    appendText(m_senderName, value);
+                }
+            }
+            else if (key == "%%WXNAME%%")
+            {
+                if (m_sender.empty())
+                {
+                    m_sender = value;
+                }
+            }
+            else if (isKeyOf(key, TEXT_KEYS, sizeof(TEXT_KEYS) / sizeof(const char *)))
+            {
+                if (!m_content.empty())
+                {
+                    m_content.push_back('\n');
+                }
+                appendText(m_content, value);
+            }
+            else if (isKeyOf(key, MEDIA_KEYS, sizeof(MEDIA_KEYS) / sizeof(const char *)))
+            {
+                // Local files only, SHARINGURL is a web link for most sharings
+                if (value == "##" || value.find("://") != std::string::npos)
+                {
+                    continue;
+                }
+                if (!m_media.empty())
+                {
+                    m_media.push_back('\n');
+                }
+                m_media.append(value);
+            }
+        }
+    }
+
+    sqlite3_reset(m_insertMsgStmt);
+    sqlite3_bind_int64(m_insertMsgStmt, 1, m_sessionId);
+    sqlite3_bind_int64(m_insertMsgStmt, 2, msg.msgIdValue);
+    sqlite3_bind_int64(m_insertMsgStmt, 3, msg.createTime);
+    sqlite3_bind_int(m_insertMsgStmt, 4, msg.type);
+    sqlite3_bind_int(m_insertMsgStmt, 5, msg.des);
+    bindText(m_insertMsgStmt, 6, m_sender);
+    bindText(m_insertMsgStmt, 7, m_senderName);
+    bindText(m_insertMsgStmt, 8, m_content);
+    bindText(m_insertMsgStmt, 9, m_media);
+    int rc = sqlite3_step(m_insertMsgStmt);
+    if (SQLITE_DONE != rc)
+    {
+        setError();
+        return false;
+    }
+    if (sqlite3_changes(m_db) == 0)
+    {
+        // Exported before
+        return true;
+    }
+
+    m_text = m_senderName;
+    m_text.push_back('\n');
+    m_text.append(m_content);
+    SearchIndexBuilder::tokenize(m_text.c_str(), m_text.size(), m_tokens);
+    std::sort(m_tokens.begin(), m_tokens.end());
+    m_tokens.erase(std::unique(m_tokens.begin(), m_tokens.end()), m_tokens.end());
+    m_tokenText.clear();
+    for (std::vector<std::string>::const_iterator it = m_tokens.cbegin(); it != m_tokens.cend(); ++it)
+    {
+        if (it != m_tokens.cbegin())
+        {
+            m_tokenText.push_back(' ');
+        }
+        m_tokenText.append(*it);
+    }
+
+    sqlite3_reset(m_insertFtsStmt);
+    sqlite3_bind_int64(m_insertFtsStmt, 1, sqlite3_last_insert_rowid(m_db));
+    bindText(m_insertFtsStmt, 2, m_tokenText);
+    rc = sqlite3_step(m_insertFtsStmt);
+    if (SQLITE_DONE != rc)
+    {
+        setError();
+        return false;
+    }
+
+    if (++m_numberOfPendingMessages >= MESSAGES_PER_TRANSACTION)
+    {
+        m_numberOfPendingMessages = 0;
+        return execute("COMMIT;BEGIN;");
+    }
+    return true;
+}
+
+bool SearchDatabase::endSession()
+{
+    if (0 == m_sessionId)
+    {
+        return false;
+    }
+    m_sessionId = 0;
+    m_numberOfPendingMessages = 0;
+    return execute("COMMIT;");
+}
+
+bool SearchDatabase::search(const std::string& keyword, size_t limit, std::vector<SearchResult>& results)
+{
+    results.clear();
+    if (NULL == m_db)
+    {
+        return false;
+    }
+
+    std::string lowerKeyword = toLower(keyword);
+    std::vector<std::string> tokens;
+    SearchIndexBuilder::tokenize(lowerKeyword.c_str(), lowerKeyword.size(), tokens);
+    std::string match;
+    for (std::vector<std::string>::const_iterator it = tokens.cbegin(); it != tokens.cend(); ++it)
+    {
+        // The tokens are [0-9a-z] or CJK only, no quote to escape
+        if (!match.empty())
+        {
+            match.push_back(' ');
+        }
+        match.append("\"" + *it + "\"");
+    }
+
+    std::string pattern = "%";
+    for (std::string::const_iterator it = keyword.cbegin(); it != keyword.cend(); ++it)
+    {
+        if (*it == '%' || *it == '_' || *it == '\\')
+        {
+            pattern.push_back('\\');
+        }
+        pattern.push_back(*it);
+    }
+    pattern.push_back('%');
+
+    // Keywords without any n-gram(one CJK character or less than 3 letters) scan the messages
+    std::string sql = SEARCH_DB_SELECT;
+    if (!match.empty())
+    {
+        sql += "m.id IN (SELECT rowid FROM messages_fts WHERE messages_fts MATCH ?3) AND ";
+    }
+    sql += "(m.content LIKE ?1 ESCAPE '\\' OR m.senderName LIKE ?1 ESCAPE '\\') ORDER BY m.createTime DESC LIMIT ?2";
+
+    sqlite3_stmt* stmt = NULL;
+    if (SQLITE_OK != sqlite3_prepare_v2(m_db, sql.c_str(), -1, &stmt, NULL))
+    {
+        setError();
+        return false;
+    }
+    bindText(stmt, 1, pattern);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(limit));
+    if (!match.empty())
+    {
+        bindText(stmt, 3, match);
+    }
+
+    int rc = SQLITE_OK;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        results.emplace_back();
+        SearchResult& result = results.back();
+        result.account = getColumnText(stmt, 0);
+        result.sessionUsrName = getColumnText(stmt, 1);
+        result.sessionName = getColumnText(stmt, 2);
+        result.sessionPath = getColumnText(stmt, 3);
+        result.msgId = sqlite3_column_int64(stmt, 4);
+        result.createTime = static_cast<unsigned int>(sqlite3_column_int64(stmt, 5));
+        result.type = sqlite3_column_int(stmt, 6);
+        result.des = sqlite3_column_int(stmt, 7);
+        result.sender = getColumnText(stmt, 8);
+        result.senderName = getColumnText(stmt, 9);
+        result.content = getColumnText(stmt, 10);
+        result.media = getColumnText(stmt, 11);
+    }
+    if (SQLITE_DONE != rc)
+    {
+        setError();
+    }
+    sqlite3_finalize(stmt);
+
+    return SQLITE_DONE == rc;
+}
+
+bool SearchDatabase::execute(const char* sql)
+{
+    char* errMsg = NULL;
+    int rc = sqlite3_exec(m_db, sql, NULL, NULL, &errMsg);
+    if (SQLITE_OK != rc)
+    {
+        m_error = (NULL != errMsg) ? errMsg : sqlite3_errstr(rc);
+    }
+    if (NULL != errMsg)
+    {
+        sqlite3_free(errMsg);
+    }
+    return SQLITE_OK == rc;
+}
+
+void SearchDatabase::appendText(std::string& output, const std::string& value)
+{
+    if (m_html)
+    {
+        SearchIndexBuilder::htmlToText(value.c_str(), value.size(), m_text);
+        output.append(m_text);
+    }
+    else
+    {
+        output.append(value);
+    }
+}
+
+void SearchDatabase::setError()
+{
+    m_error = (NULL != m_db) ? sqlite3_errmsg(m_db) : "Failed to open the database";
+}
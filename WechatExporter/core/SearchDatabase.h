@@ -0,0 +1,98 @@
+//
+//  SearchDatabase.h
+//  WechatExporter
+//
+//  Created by Matthew on 2022/6/8.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#ifndef SearchDatabase_h
+#define SearchDatabase_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define WXEXP_SEARCH_DB_FILE    "search.db"
+
+struct sqlite3;
+struct sqlite3_stmt;
+class Session;
+struct WXMSG;
+class TemplateValuesArena;
+
+struct SearchResult
+{
+    std::string account;
+    std::string sessionUsrName;
+    std::string sessionName;
+    std::string sessionPath;    // relative to the output directory
+    int64_t msgId;
+    unsigned int createTime;
+    int type;
+    int des;
+    std::string sender;
+    std::string senderName;
+    std::string content;
+    std::string media;          // relative to sessionPath, one path per line
+};
+
+// Full-text search database of all exported sessions(.wxexp/search.db), filled by the exporter while
+// it enumerates the messages. The plain text of the messages is kept in the messages table and
+// messages_fts is a contentless FTS5 table of the n-grams from SearchIndexBuilder::tokenize: the
+// unicode61 tokenizer would take a whole CJK sentence as one token.
+// Not thread-safe, the sessions are exported one by one.
+class SearchDatabase
+{
+public:
+    static const int MESSAGES_PER_TRANSACTION = 4096;
+
+    SearchDatabase();
+    ~SearchDatabase();
+
+    // .wxexp/search.db in the output directory
+    static std::string getPath(const std::string& outputDir);
+
+    // The tables are created if readOnly is false
+    bool open(const std::string& path, bool readOnly = true);
+    void close();
+
+    const std::string& getError() const
+    {
+        return m_error;
+    }
+
+    // html: the template values are html(not text mode)
+    bool beginSession(const std::string& account, const Session& session, const std::string& sessionPath, bool html);
+    // The messages already in the database(incremental exporting) are skipped
+    bool insertMessage(const WXMSG& msg, const TemplateValuesArena& tvs);
+    bool endSession();
+
+    // Case-insensitive(ASCII) substring search in the text and sender names, newest messages first
+    bool search(const std::string& keyword, size_t limit, std::vector<SearchResult>& results);
+
+private:
+    bool execute(const char* sql);
+    void appendText(std::string& output, const std::string& value);
+    void setError();
+
+private:
+    sqlite3*        m_db;
+    sqlite3_stmt*   m_insertMsgStmt;
+    sqlite3_stmt*   m_insertFtsStmt;
+    int64_t         m_sessionId;
+    bool            m_html;
+    int             m_numberOfPendingMessages;
+    std::string     m_error;
+
+    // Reused by insertMessage
+    std::string     m_sender;
+    std::string     m_senderName;
+    std::string     m_content;
+    std::string     m_media;
+    std::string     m_text;
+    std::string     m_tokenText;
+    std::vector<std::string> m_tokens;
+};
+
+#endif /* SearchDatabase_h */
@@ -0,0 +1,453 @@
+//
+//  SearchIndex.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2022/6/6.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "SearchIndex.h"
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include "FileSystem.h"
+#include "Utils.h"
+
+#define CHAR_CLASS_NONE     0
+#define CHAR_CLASS_LATIN    1
+#define CHAR_CLASS_CJK      2
+
+#define LATIN_GRAM_SIZE     3
+#define CJK_GRAM_SIZE       2
+
+#define INVALID_CODE_POINT  0xFFFFFFFF
+
+static uint32_t decodeUtf8(const char* s, size_t length, size_t& pos)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char *>(s);
+    uint32_t ch = p[pos];
+    size_t numberOfBytes = 0;
+    if (ch < 0x80)
+    {
+        ++pos;
+        return ch;
+    }
+    else if ((ch & 0xE0) == 0xC0)
+    {
+        ch &= 0x1F;
+        numberOfBytes = 1;
+    }
+    else if ((ch & 0xF0) == 0xE0)
+    {
+        ch &= 0x0F;
+        numberOfBytes = 2;
+    }
+    else if ((ch & 0xF8) == 0xF0)
+    {
+        ch &= 0x07;
+        numberOfBytes = 3;
+    }
+    else
+    {
+        ++pos;
+        return INVALID_CODE_POINT;
+    }
+
+    if (pos + numberOfBytes >= length)
+    {
+        pos = length;
+        return INVALID_CODE_POINT;
+    }
+    for (size_t idx = 1; idx <= numberOfBytes; ++idx)
+    {
+        if ((p[pos + idx] & 0xC0) != 0x80)
+        {
+            pos += idx;
+            return INVALID_CODE_POINT;
+        }
+        ch = (ch << 6) | (p[pos + idx] & 0x3F);
+    }
+    pos += numberOfBytes + 1;
+    return ch;
+}
+
+static void appendUtf8(std::string& output, uint32_t ch)
+{
+    if (ch < 0x80)
+    {
+        output.push_back(static_cast<char>(ch));
+    }
+    else if (ch < 0x800)
+    {
+        output.push_back(static_cast<char>(0xC0 | (ch >> 6)));
+        output.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+    }
+    else if (ch < 0x10000)
+    {
+        output.push_back(static_cast<char>(0xE0 | (ch >> 12)));
+        output.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+    }
+    else if (ch < 0x110000)
+    {
+        output.push_back(static_cast<char>(0xF0 | (ch >> 18)));
+        output.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+    }
+}
+
+// Lowercases ch in place, same as getCharClass in frame.html
+static inline int getCharClass(uint32_t& ch)
+{
+    if (ch >= 'A' && ch <= 'Z')
+    {
+        ch += 'a' - 'A';
+        return CHAR_CLASS_LATIN;
+    }
+    if ((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z'))
+    {
+        return CHAR_CLASS_LATIN;
+    }
+    // The only non-ASCII characters which are turned into ASCII letters by toLowerCase() of javascript
+    if (ch == 0x212A)   // KELVIN SIGN
+    {
+        ch = 'k';
+        return CHAR_CLASS_LATIN;
+    }
+    if (ch == 0x0130)   // LATIN CAPITAL LETTER I WITH DOT ABOVE
+    {
+        ch = 'i';
+        return CHAR_CLASS_LATIN;
+    }
+    // Kana, CJK Ext-A, CJK Unified Ideographs, Hangul, CJK Compatibility Ideographs and CJK Ext-B...
+    if ((ch >= 0x3040 && ch <= 0x30FF) || (ch >= 0x3400 && ch <= 0x4DBF) || (ch >= 0x4E00 && ch <= 0x9FFF) ||
+        (ch >= 0xAC00 && ch <= 0xD7AF) || (ch >= 0xF900 && ch <= 0xFAFF) || (ch >= 0x20000 && ch <= 0x2FFFF))
+    {
+        return CHAR_CLASS_CJK;
+    }
+    return CHAR_CLASS_NONE;
+}
+
+static void flushRun(std::string& run, std::vector<size_t>& offsets, int charClass, std::vector<std::string>& tokens)
+{
+    const size_t gramSize = (charClass == CHAR_CLASS_LATIN) ? LATIN_GRAM_SIZE : CJK_GRAM_SIZE;
+    const size_t numberOfChars = offsets.size();
+    if (charClass != CHAR_CLASS_NONE && numberOfChars >= gramSize)
+    {
+        offsets.push_back(run.size());
+        for (size_t idx = 0; idx + gramSize <= numberOfChars; ++idx)
+        {
+            tokens.push_back(run.substr(offsets[idx], offsets[idx + gramSize] - offsets[idx]));
+        }
+    }
+    run.clear();
+    offsets.clear();
+}
+
+// Checks the class attribute of the tag in [pos, tagEnd)
+static bool isIndexedSpan(const std::string& html, size_t pos, size_t tagEnd)
+{
+    size_t classPos = html.find("class=\"", pos);
+    if (classPos == std::string::npos || classPos >= tagEnd)
+    {
+        return false;
+    }
+    classPos += 7;
+    size_t classEnd = html.find('"', classPos);
+    if (classEnd == std::string::npos || classEnd > tagEnd)
+    {
+        return false;
+    }
+
+    while (classPos < classEnd)
+    {
+        size_t nameEnd = html.find(' ', classPos);
+        if (nameEnd == std::string::npos || nameEnd > classEnd)
+        {
+            nameEnd = classEnd;
+        }
+        if ((nameEnd - classPos == 7 && html.compare(classPos, 7, "dspname") == 0) ||
+            (nameEnd - classPos == 8 && html.compare(classPos, 8, "msg-text") == 0))
+        {
+            return true;
+        }
+        classPos = nameEnd + 1;
+    }
+    return false;
+}
+
+// Only the entities which safeHTML produces, plus the numeric ones
+static void appendDecodedEntity(std::string& output, const char* entity, size_t length)
+{
+    if (length > 1 && entity[0] == '#')
+    {
+        uint32_t ch = 0;
+        if (entity[1] == 'x' || entity[1] == 'X')
+        {
+            ch = static_cast<uint32_t>(std::strtoul(std::string(entity + 2, length - 2).c_str(), NULL, 16));
+        }
+        else
+        {
+            ch = static_cast<uint32_t>(std::strtoul(std::string(entity + 1, length - 1).c_str(), NULL, 10));
+        }
+        appendUtf8(output, ch);
+    }
+    else if (length == 3 && std::strncmp(entity, "amp", 3) == 0)
+    {
+        output.push_back('&');
+    }
+    else if (length == 2 && std::strncmp(entity, "lt", 2) == 0)
+    {
+        output.push_back('<');
+    }
+    else if (length == 2 && std::strncmp(entity, "gt", 2) == 0)
+    {
+        output.push_back('>');
+    }
+    else if (length == 4 && std::strncmp(entity, "quot", 4) == 0)
+    {
+        output.push_back('"');
+    }
+    else
+    {
+        // Any other entity is a separator
+        output.push_back(' ');
+    }
+}
+
+SearchIndexBuilder::SearchIndexBuilder()
+{
+}
+
+void SearchIndexBuilder::addMessage(uint32_t page, const std::string& message)
+{
+    size_t pos = 0;
+    while ((pos = message.find("<span", pos)) != std::string::npos)
+    {
+        size_t tagEnd = message.find('>', pos);
+        if (tagEnd == std::string::npos)
+        {
+            break;
+        }
+        pos += 5;
+        if (!isIndexedSpan(message, pos, tagEnd))
+        {
+            continue;
+        }
+
+        // Look for the matching </span>
+        size_t contentStart = tagEnd + 1;
+        size_t contentEnd = std::string::npos;
+        size_t depth = 1;
+        size_t cur = contentStart;
+        while (depth > 0)
+        {
+            size_t closePos = message.find("</span>", cur);
+            if (closePos == std::string::npos)
+            {
+                break;
+            }
+            size_t openPos = message.find("<span", cur);
+            if (openPos != std::string::npos && openPos < closePos)
+            {
+                ++depth;
+                cur = openPos + 5;
+            }
+            else
+            {
+                if (--depth == 0)
+                {
+                    contentEnd = closePos;
+                }
+                cur = closePos + 7;
+            }
+        }
+        if (contentEnd == std::string::npos)
+        {
+            break;
+        }
+
+        addText(page, message.c_str() + contentStart, contentEnd - contentStart);
+        pos = contentEnd + 7;
+    }
+}
+
+void SearchIndexBuilder::addText(uint32_t page, const char* html, size_t length)
+{
+    htmlToText(html, length, m_text);
+    tokenize(m_text.c_str(), m_text.size(), m_tokens);
+    for (std::vector<std::string>::const_iterator it = m_tokens.cbegin(); it != m_tokens.cend(); ++it)
+    {
+        // Pages are added in ascending order, so the posting lists are sorted and unique
+        std::vector<uint32_t>& pages = m_postings[*it];
+        if (pages.empty() || pages.back() != page)
+        {
+            pages.push_back(page);
+        }
+    }
+}
+
+void SearchIndexBuilder::htmlToText(const char* html, size_t length, std::string& text)
+{
+    text.clear();
+    for (size_t pos = 0; pos < length; ++pos)
+    {
+        char ch = html[pos];
+        if (ch == '<')
+        {
+            const char* tagEnd = static_cast<const char *>(std::memchr(html + pos, '>', length - pos));
+            if (NULL == tagEnd)
+            {
+                break;
+            }
+            size_t namePos = pos + 1;
+            if (namePos < length && html[namePos] == '/')
+            {
+                ++namePos;
+            }
+            if (namePos + 2 <= length && (html[namePos] == 'b' || html[namePos] == 'B') && (html[namePos + 1] == 'r' || html[namePos + 1] == 'R') &&
+                (namePos + 2 == length || !std::isalnum(static_cast<unsigned char>(html[namePos + 2]))))
+            {
+                text.push_back('\n');
+            }
+            pos = tagEnd - html;
+        }
+        else if (ch == '&')
+        {
+            const char* semicolon = static_cast<const char *>(std::memchr(html + pos, ';', std::min(length - pos, static_cast<size_t>(12))));
+            if (NULL == semicolon)
+            {
+                text.push_back(ch);
+                continue;
+            }
+            appendDecodedEntity(text, html + pos + 1, semicolon - html - pos - 1);
+            pos = semicolon - html;
+        }
+        else
+        {
+            text.push_back(ch);
+        }
+    }
+}
+
+void SearchIndexBuilder::tokenize(const char* text, size_t length, std::vector<std::string>& tokens)
+{
+    tokens.clear();
+
+    std::string run;
+    std::vector<size_t> offsets;
+    int runClass = CHAR_CLASS_NONE;
+    size_t pos = 0;
+    while (pos < length)
+    {
+        size_t start = pos;
+        uint32_t ch = decodeUtf8(text, length, pos);
+        int charClass = (ch == INVALID_CODE_POINT) ? CHAR_CLASS_NONE : getCharClass(ch);
+        if (charClass != runClass)
+        {
+            flushRun(run, offsets, runClass, tokens);
+            runClass = charClass;
+        }
+        if (charClass == CHAR_CLASS_NONE)
+        {
+            continue;
+        }
+        offsets.push_back(run.size());
+        if (ch < 0x80)
+        {
+            run.push_back(static_cast<char>(ch));
+        }
+        else
+        {
+            run.append(text + start, pos - start);
+        }
+    }
+    flushRun(run, offsets, runClass, tokens);
+}
+
+uint32_t SearchIndexBuilder::hashToken(const std::string& token)
+{
+    // FNV-1a over the code points, see hashToken in frame.html
+    uint32_t hash = 2166136261u;
+    size_t pos = 0;
+    while (pos < token.size())
+    {
+        hash ^= decodeUtf8(token.c_str(), token.size(), pos);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t SearchIndexBuilder::getNumberOfShards() const
+{
+    if (m_postings.empty())
+    {
+        return 0;
+    }
+    uint32_t numberOfShards = 1;
+    while (numberOfShards < MAX_SHARDS && m_postings.size() > numberOfShards * TOKENS_PER_SHARD)
+    {
+        numberOfShards <<= 1;
+    }
+    return numberOfShards;
+}
+
+bool SearchIndexBuilder::write(const std::string& dataPath, uint32_t& numberOfShards) const
+{
+    numberOfShards = getNumberOfShards();
+    if (0 == numberOfShards)
+    {
+        return true;
+    }
+
+    // Sorted, so that the files don't change if the messages don't
+    typedef std::unordered_map<std::string, std::vector<uint32_t>>::const_iterator PostingIterator;
+    std::vector<PostingIterator> postings;
+    postings.reserve(m_postings.size());
+    for (PostingIterator it = m_postings.cbegin(); it != m_postings.cend(); ++it)
+    {
+        postings.push_back(it);
+    }
+    std::sort(postings.begin(), postings.end(), [](const PostingIterator& lhs, const PostingIterator& rhs) { return lhs->first < rhs->first; });
+
+    std::vector<std::string> shards(numberOfShards);
+    for (uint32_t idx = 0; idx < numberOfShards; ++idx)
+    {
+        shards[idx] = "searchIndexLoaded(" + std::to_string(idx) + ",{";
+    }
+    for (std::vector<PostingIterator>::const_iterator itPosting = postings.cbegin(); itPosting != postings.cend(); ++itPosting)
+    {
+        PostingIterator it = *itPosting;
+        std::string& shard = shards[hashToken(it->first) % numberOfShards];
+        if (shard.back() != '{')
+        {
+            shard.push_back(',');
+        }
+        appendJsonString(shard, it->first.c_str(), it->first.size());
+        shard.append(":[");
+        uint32_t prevPage = 0;
+        for (std::vector<uint32_t>::const_iterator itPage = it->second.cbegin(); itPage != it->second.cend(); ++itPage)
+        {
+            if (itPage != it->second.cbegin())
+            {
+                shard.push_back(',');
+            }
+            shard.append(std::to_string(*itPage - prevPage));
+            prevPage = *itPage;
+        }
+        shard.push_back(']');
+    }
+
+    bool succeeded = true;
+    for (uint32_t idx = 0; idx < numberOfShards; ++idx)
+    {
+        shards[idx].append("});\n");
+        if (!writeFile(combinePath(dataPath, "idx-" + std::to_string(idx) + ".js"), shards[idx]))
+        {
+            succeeded = false;
+        }
+    }
+    return succeeded;
+}
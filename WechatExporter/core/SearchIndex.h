@@ -0,0 +1,63 @@
+//
+//  SearchIndex.h
+//  WechatExporter
+//
+//  Created by Matthew on 2022/6/6.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#ifndef SearchIndex_h
+#define SearchIndex_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Inverted index of a session which is emitted with the paged html output, so that the search box of
+// frame.html only loads the msg-N.js pages which can contain the keyword.
+// The text of span.dspname and span.msg-text(the elements filterMsg matches) is split into runs of
+// [0-9a-z] and runs of CJK characters, everything else is a separator. Latin runs are indexed by
+// trigrams and CJK runs by bigrams, so a page which contains the keyword always contains all the
+// n-grams of the keyword(substring match, same as filterMsg). The tokenizer in frame.html must be kept
+// in sync with this one.
+// The posting lists(delta-encoded page numbers) are sharded by FNV-1a hash of the token and written as
+// Data/idx-N.js scripts calling searchIndexLoaded(N, {...}), which work with file:// urls.
+class SearchIndexBuilder
+{
+public:
+    static const size_t TOKENS_PER_SHARD = 2048;
+    static const uint32_t MAX_SHARDS = 256;
+
+    SearchIndexBuilder();
+
+    // message: the rendered html of one message, page: the number in msg-<page>.js
+    void addMessage(uint32_t page, const std::string& message);
+    bool isEmpty() const
+    {
+        return m_postings.empty();
+    }
+    size_t getNumberOfTokens() const
+    {
+        return m_postings.size();
+    }
+
+    uint32_t getNumberOfShards() const;
+    // Writes idx-0.js ... idx-<numberOfShards - 1>.js into dataPath
+    bool write(const std::string& dataPath, uint32_t& numberOfShards) const;
+
+    // innerText of the html: tags are dropped(<br> is a line break) and entities are decoded
+    static void htmlToText(const char* html, size_t length, std::string& text);
+    static void tokenize(const char* text, size_t length, std::vector<std::string>& tokens);
+    static uint32_t hashToken(const std::string& token);
+
+protected:
+    void addText(uint32_t page, const char* html, size_t length);
+
+private:
+    std::unordered_map<std::string, std::vector<uint32_t>> m_postings;
+    std::vector<std::string> m_tokens;
+    std::string m_text;
+};
+
+#endif /* SearchIndex_h */
@@ -10,12 +10,14 @@
 #include "AsyncTask.h"
 #include "FileSystem.h"
 
-TaskManager::TaskManager(Logger* logger) : m_logger(logger), m_downloadExecutor(NULL)
+TaskManager::TaskManager(Logger* logger) : m_logger(logger), m_downloadExecutor(NULL), m_copyExecutor(NULL)
 #ifdef USING_ASYNC_TASK_FOR_MP3
     , m_audioExecutor(NULL)
 #endif
+    , m_numberOfPendingCopies(0), m_copyCancelled(false)
 {
     m_downloadExecutor = new AsyncExecutor(2, 4, this);
+    m_copyExecutor = new AsyncExecutor(2, 4, this);
 #ifdef USING_ASYNC_TASK_FOR_MP3
     m_audioExecutor = new AsyncExecutor(1, 1, this);
 #endif
@@ -23,6 +25,7 @@ TaskManager::TaskManager(Logger* logger) : m_logger(logger), m_downloadExecutor(
     
 #if !defined(NDEBUG) || defined(DBG_PERF)
     m_downloadExecutor->setTag("dl");
+    m_copyExecutor->setTag("cp");
 #ifdef USING_ASYNC_TASK_FOR_MP3
     if (NULL != m_audioExecutor && m_audioExecutor != m_downloadExecutor)
     {
@@ -46,6 +49,10 @@ void TaskManager::shutdown()
         m_audioExecutor->shutdown();
     }
 #endif
+    if (NULL != m_copyExecutor)
+    {
+        m_copyExecutor->shutdown();
+    }
     if (NULL != m_downloadExecutor)
     {
         m_downloadExecutor->shutdown();
@@ -61,6 +68,11 @@ void TaskManager::shutdownExecutors()
         m_audioExecutor = NULL;
     }
 #endif
+    if (NULL != m_copyExecutor)
+    {
+        delete m_copyExecutor;
+        m_copyExecutor = NULL;
+    }
     if (NULL != m_downloadExecutor)
     {
         delete m_downloadExecutor;
@@ -93,6 +105,10 @@ bool TaskManager::waitForCompltion(unsigned int ms)
     }
      */
     
+    if (!m_copyExecutor->waitForCompltion(ms))
+    {
+        return false;
+    }
     if (!m_downloadExecutor->waitForCompltion(ms))
     {
         return false;
@@ -120,6 +136,14 @@ void TaskManager::cancel()
     }
     
     m_downloadExecutor->cancel();
+    m_copyExecutor->cancel();
+    {
+        // Queued copies are dropped by the executor without callbacks
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_copyCancelled = true;
+        m_numberOfPendingCopies = 0;
+    }
+    m_copyCv.notify_all();
 #ifdef USING_ASYNC_TASK_FOR_MP3
     if (NULL != m_audioExecutor && m_audioExecutor != m_downloadExecutor)
     {
@@ -141,6 +165,7 @@ void TaskManager::cancel()
 size_t TaskManager::getNumberOfQueue(std::string& queueDesc) const
 {
     size_t numberOfDownloads = m_downloadExecutor->getNumberOfQueue();
+    size_t numberOfCopies = m_copyExecutor->getNumberOfQueue();
 #ifdef USING_ASYNC_TASK_FOR_MP3
     size_t numberOfAudio = 0;
     if (m_audioExecutor != m_downloadExecutor)
@@ -159,6 +184,14 @@ size_t TaskManager::getNumberOfQueue(std::string& queueDesc) const
     {
         queueDesc += std::to_string(numberOfDownloads) + " downloads";
     }
+    if (numberOfCopies > 0)
+    {
+        if (!queueDesc.empty())
+        {
+            queueDesc += ", ";
+        }
+        queueDesc += std::to_string(numberOfCopies) + " copies";
+    }
 #ifdef USING_ASYNC_TASK_FOR_MP3
     if (numberOfAudio > 0)
     {
@@ -170,7 +203,7 @@ size_t TaskManager::getNumberOfQueue(std::string& queueDesc) const
     }
 #endif
 
-    return numberOfDownloads
+    return numberOfDownloads + numberOfCopies
 #ifdef USING_ASYNC_TASK_FOR_MP3
 		+ numberOfAudio
 #endif
@@ -184,13 +217,6 @@ void TaskManager::setUserAgent(const std::string& userAgent)
 
 void TaskManager::onTaskStart(const AsyncExecutor* executor, const AsyncExecutor::Task *task)
 {
-    if (NULL != m_logger && task->getType() != TASK_TYPE_AUDIO)
-    {
-        if (task->getType() == TASK_TYPE_PDF)
-        {
-            m_logger->write("Task Starts: " + task->getName());
-        }
-    }
 }
 
 void TaskManager::onTaskComplete(const AsyncExecutor* executor, const AsyncExecutor::Task *task, bool succeeded)
@@ -208,12 +234,38 @@ void TaskManager::onTaskComplete(const AsyncExecutor* executor, const AsyncExecu
             {
                 // m_logger->write("Task Ends: " + task->getName());
             }
-            if (task->getType() == TASK_TYPE_PDF)
+        }
+#endif
+    }
+    
+    std::string output;
+    if (task->getType() == TASK_TYPE_DOWNLOAD)
+    {
+        output = dynamic_cast<const DownloadTask *>(task)->getOutput();
+    }
+    else if (task->getType() == TASK_TYPE_COPY)
+    {
+        output = dynamic_cast<const CopyTask *>(task)->getDest();
+    }
+    if (!output.empty())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::set<std::string>::iterator itResumed = m_resumedTasks.find(output);
+        if (itResumed != m_resumedTasks.end())
+        {
+            m_resumedTasks.erase(itResumed);
+            std::map<std::string, PendingTask>::const_iterator itPending = m_pendingTasks.find(output);
+            if (!succeeded && itPending != m_pendingTasks.cend())
             {
-                // m_logger->write("Task Ends: " + task->getName());
+                m_failedResumedTasks.push_back(itPending->second);
             }
         }
-#endif
+        if (m_pendingTasks.erase(output) > 0)
+        {
+            // Removed after it's added, so the added ones are applied first when the journal is read
+            m_addedPendingTasks.erase(output);
+            m_removedPendingTasks.insert(output);
+        }
     }
     
     // const Session* session = task->getUserData() == NULL ? NULL : reinterpret_cast<const Session *>(task->getUserData());
@@ -249,12 +301,111 @@ void TaskManager::onTaskComplete(const AsyncExecutor* executor, const AsyncExecu
             m_downloadExecutor->addTask(*it);
         }
     }
+    else if (executor == m_copyExecutor)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_numberOfPendingCopies > 0)
+        {
+            m_numberOfPendingCopies--;
+        }
+        lock.unlock();
+        m_copyCv.notify_all();
+    }
     else if ((task->getType() == TASK_TYPE_COPY) || (task->getType() == TASK_TYPE_AUDIO))
     {
         // check copy task
     }
 }
 
+void TaskManager::copyFile(const std::string& src, const std::string& dest, time_t mtime, bool overwrite)
+{
+#ifndef NDEBUG
+    if (dest.find(ALT_DIR_SEP) != std::string::npos)
+    {
+        assert(!"Directory is invalid");
+    }
+#endif
+    
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // m_copiedFiles is cleared after each session, the copy of the same dest may still be pending
+        if (m_copyCancelled || m_copiedFiles.find(dest) != m_copiedFiles.end() || m_pendingTasks.find(dest) != m_pendingTasks.end())
+        {
+            return;
+        }
+        m_copiedFiles.insert(dest);
+        
+        // Back pressure: the render thread shouldn't run too far ahead of the disk
+        m_copyCv.wait(lock, [this] { return m_copyCancelled || m_numberOfPendingCopies < MAX_PENDING_COPIES; });
+        if (m_copyCancelled)
+        {
+            return;
+        }
+        m_numberOfPendingCopies++;
+        
+        PendingTask& pendingTask = m_pendingTasks[dest];
+        pendingTask.output = dest;
+        pendingTask.src = src;
+        pendingTask.mtime = mtime;
+        pendingTask.download = false;
+        m_addedPendingTasks[dest] = pendingTask;
+        m_removedPendingTasks.erase(dest);
+    }
+    
+    CopyTask *task = new CopyTask(src, dest, "CP: " + src + " => " + dest, mtime, overwrite);
+    task->setTaskId(AsyncExecutor::genNextTaskId());
+    m_copyExecutor->addTask(task);
+}
+
+void TaskManager::clearCopiedFiles()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_copiedFiles.clear();
+}
+
+void TaskManager::waitForCopies()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_copyCv.wait(lock, [this] { return m_copyCancelled || m_numberOfPendingCopies == 0; });
+}
+
+void TaskManager::getPendingTasks(std::vector<PendingTask>& tasks)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    tasks.reserve(tasks.size() + m_pendingTasks.size());
+    for (std::map<std::string, PendingTask>::const_iterator it = m_pendingTasks.cbegin(); it != m_pendingTasks.cend(); ++it)
+    {
+        tasks.push_back(it->second);
+    }
+    m_addedPendingTasks.clear();
+    m_removedPendingTasks.clear();
+}
+
+void TaskManager::getPendingTaskChanges(std::vector<PendingTask>& addedTasks, std::vector<std::string>& removedOutputs)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    addedTasks.reserve(addedTasks.size() + m_addedPendingTasks.size());
+    for (std::map<std::string, PendingTask>::const_iterator it = m_addedPendingTasks.cbegin(); it != m_addedPendingTasks.cend(); ++it)
+    {
+        addedTasks.push_back(it->second);
+    }
+    removedOutputs.insert(removedOutputs.end(), m_removedPendingTasks.cbegin(), m_removedPendingTasks.cend());
+    m_addedPendingTasks.clear();
+    m_removedPendingTasks.clear();
+}
+
+void TaskManager::markResumedTask(const std::string& output)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_resumedTasks.insert(output);
+}
+
+void TaskManager::getFailedResumedTasks(std::vector<PendingTask>& tasks) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    tasks.insert(tasks.end(), m_failedResumedTasks.cbegin(), m_failedResumedTasks.cend());
+}
+
 void TaskManager::download(const Session* session, const std::string &url, const std::string &backupUrl, const std::string& output, time_t mtime, const std::string& defaultFile/* = ""*/, std::string type/* = ""*/)
 {
 #ifndef NDEBUG
@@ -305,6 +456,15 @@ void TaskManager::download(const Session* session, const std::string &url, const
     task->setUserData(reinterpret_cast<const void *>(session));
     
     std::unique_lock<std::mutex> lock(m_mutex);
+    PendingTask& pendingTask = m_pendingTasks[output];
+    pendingTask.output = output;
+    pendingTask.src = url;
+    pendingTask.backupSrc = backupUrl;
+    pendingTask.defaultFile = defaultFile;
+    pendingTask.mtime = mtime;
+    pendingTask.download = true;
+    m_addedPendingTasks[output] = pendingTask;
+    m_removedPendingTasks.erase(output);
     if (downloadFile)
     {
         m_downloadingTasks.insert(std::pair<std::string, uint32_t>(url, taskId));
@@ -17,12 +17,28 @@
 #include "PdfConverter.h"
 #include "Logger.h"
 
+// Local copies queued ahead of the copy executor before the caller is blocked
+#define MAX_PENDING_COPIES  1024
+
+// A download or a local copy which is queued but not done yet, the checkpoints of the exporting keep them
+// so that an interrupted exporting can queue them again
+struct PendingTask
+{
+    std::string output;
+    std::string src;            // url, or the file in the backup for local copies
+    std::string backupSrc;      // backup url
+    std::string defaultFile;
+    time_t mtime;
+    bool download;
+};
+
 class TaskManager : public AsyncExecutor::Callback
 {
 private:
     Logger* m_logger;
     
     AsyncExecutor   *m_downloadExecutor;
+    AsyncExecutor   *m_copyExecutor;
 #ifdef USING_ASYNC_TASK_FOR_MP3
     AsyncExecutor   *m_audioExecutor;
 #endif
@@ -36,6 +52,19 @@ private:
     
     std::map<uint32_t, std::set<AsyncExecutor::Task *>> m_copyTaskQueue;
     
+    std::set<std::string> m_copiedFiles;
+    // Output => task, the tasks are removed when they are done(succeeded or failed)
+    std::map<std::string, PendingTask> m_pendingTasks;
+    // The changes of m_pendingTasks since they were got last time, which go to the journal of the checkpoint
+    std::map<std::string, PendingTask> m_addedPendingTasks;
+    std::set<std::string> m_removedPendingTasks;
+    // The outputs of the tasks resumed from the checkpoint, and those of them which failed again
+    std::set<std::string> m_resumedTasks;
+    std::vector<PendingTask> m_failedResumedTasks;
+    size_t m_numberOfPendingCopies;
+    bool m_copyCancelled;
+    std::condition_variable m_copyCv;
+    
 #ifdef USING_ASYNC_TASK_FOR_MP3
     std::queue<std::vector<unsigned char>> m_Buffers;
 #endif
@@ -57,6 +86,20 @@ public:
     bool waitForCompltion(unsigned int ms);
 
     void download(const Session* session, const std::string &url, const std::string &backupUrl, const std::string& output, time_t mtime, const std::string& defaultFile = "", std::string type = "");
+    // Copies a local file(from the backup) on the copy executor, deduplicated by dest.
+    // The caller is only blocked while MAX_PENDING_COPIES copies are pending.
+    void copyFile(const std::string& src, const std::string& dest, time_t mtime, bool overwrite);
+    // Forgets the copied dests, which are all in the folder of one session, so the set doesn't grow with the exporting
+    void clearCopiedFiles();
+    // Blocks until all queued copies are done, e.g. before the html is converted to pdf
+    void waitForCopies();
+    // The downloads and copies which are not done yet, ordered by output
+    void getPendingTasks(std::vector<PendingTask>& tasks);
+    // The tasks queued and the outputs of the tasks done since the last call of getPendingTasks or getPendingTaskChanges
+    void getPendingTaskChanges(std::vector<PendingTask>& addedTasks, std::vector<std::string>& removedOutputs);
+    // Called before a task of the checkpoint is queued again, so its failure can be reported
+    void markResumedTask(const std::string& output);
+    void getFailedResumedTasks(std::vector<PendingTask>& tasks) const;
 #ifdef USING_ASYNC_TASK_FOR_MP3
     enum AUDIO_FORMAT
     {
@@ -11,6 +11,12 @@
 #define TEMPLATE_TAG "%%"
 #define TEMPLATE_TAG_LENGTH 2
 
+TemplateValuesArena& TemplateValuesArena::local()
+{
+    static thread_local TemplateValuesArena arena;
+    return arena;
+}
+
 
 Template::Template()
 {
@@ -74,3 +80,23 @@ const std::string& Template::build(const std::map<std::string, std::string>& val
 
     return m_result;
 }
+
+const std::string& Template::build(const TemplateValues& values) const
+{
+    m_result.assign(m_template);
+    
+    for (auto it = m_tags.crbegin(); it != m_tags.crend(); ++it)
+    {
+        const std::string* value = values.find(it->tag);
+        if (NULL == value)
+        {
+            m_result.erase(m_result.begin() + it->pos, m_result.begin() + it->pos + it->length);
+        }
+        else
+        {
+            m_result.replace(it->pos, it->length, *value);
+        }
+    }
+
+    return m_result;
+}
@@ -11,7 +11,10 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
+#include <cstring>
+#include <algorithm>
 
 struct TEMPLATE_TAG
 {
@@ -22,6 +25,218 @@ struct TEMPLATE_TAG
     TEMPLATE_TAG(const std::string& t, size_t p, size_t l) : tag(t), pos(p), length(l) {}
 };
 
+// Values of one message template. The key/value slots are kept when the values are cleared, so that
+// filling the template for the next message reuses the capacity of the strings instead of allocating.
+// m_order holds the indexes of the slots sorted by key, it is searched by binary search and iterated in key order.
+class TemplateValues
+{
+public:
+    using value_type = std::pair<std::string, std::string>;
+    
+    class const_iterator
+    {
+    public:
+        const_iterator(const std::vector<value_type>* values, std::vector<size_t>::const_iterator it) : m_values(values), m_it(it)
+        {
+        }
+        const value_type& operator*() const
+        {
+            return (*m_values)[*m_it];
+        }
+        const value_type* operator->() const
+        {
+            return &(*m_values)[*m_it];
+        }
+        const_iterator& operator++()
+        {
+            ++m_it;
+            return *this;
+        }
+        bool operator==(const const_iterator& rhs) const
+        {
+            return m_it == rhs.m_it;
+        }
+        bool operator!=(const const_iterator& rhs) const
+        {
+            return m_it != rhs.m_it;
+        }
+        
+    private:
+        const std::vector<value_type>* m_values;
+        std::vector<size_t>::const_iterator m_it;
+    };
+    
+private:
+    std::vector<value_type> m_values;
+    std::vector<size_t> m_order;
+    size_t m_size;
+    std::string m_name;
+
+public:
+    TemplateValues() : m_size(0)
+    {
+    }
+    TemplateValues(const std::string& name) : m_size(0), m_name(name)
+    {
+    }
+    const std::string& getName() const
+    {
+        return m_name;
+    }
+    void setName(const std::string& name)
+    {
+        m_name = name;
+    }
+    void setName(const char* name)
+    {
+        m_name.assign(name);
+    }
+    std::string& operator[](const std::string& k)
+    {
+        return getValue(k.c_str(), k.size());
+    }
+    std::string& operator[](const char* k)
+    {
+        return getValue(k, std::strlen(k));
+    }
+    bool hasValue(const std::string& key) const
+    {
+        return find(key) != NULL;
+    }
+    const std::string* find(const std::string& key) const
+    {
+        size_t pos = lowerBound(key.c_str(), key.size());
+        if (pos < m_size && m_values[m_order[pos]].first == key)
+        {
+            return &m_values[m_order[pos]].second;
+        }
+        return NULL;
+    }
+    
+    const_iterator cbegin() const
+    {
+        return const_iterator(&m_values, m_order.cbegin());
+    }
+    
+    const_iterator cend() const
+    {
+        return const_iterator(&m_values, m_order.cbegin() + m_size);
+    }
+    
+    void clear()
+    {
+        m_size = 0;
+    }
+    
+    void clearName()
+    {
+        m_name.clear();
+    }
+    
+private:
+    size_t lowerBound(const char* k, size_t length) const
+    {
+        size_t low = 0;
+        size_t high = m_size;
+        while (low < high)
+        {
+            size_t mid = (low + high) / 2;
+            if (m_values[m_order[mid]].first.compare(0, std::string::npos, k, length) < 0)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        return low;
+    }
+    
+    std::string& getValue(const char* k, size_t length)
+    {
+        size_t pos = lowerBound(k, length);
+        if (pos < m_size)
+        {
+            std::pair<std::string, std::string>& value = m_values[m_order[pos]];
+            if (value.first.compare(0, std::string::npos, k, length) == 0)
+            {
+                return value.second;
+            }
+        }
+        
+        // Slots [0, m_size) are in use, so the slot m_size is the free one
+        if (m_size == m_values.size())
+        {
+            m_values.emplace_back();
+            m_order.push_back(0);
+        }
+        std::copy_backward(m_order.begin() + pos, m_order.begin() + m_size, m_order.begin() + m_size + 1);
+        m_order[pos] = m_size;
+        std::pair<std::string, std::string>& value = m_values[m_size++];
+        value.first.assign(k, length);
+        value.second.clear();
+        return value.second;
+    }
+};
+
+// Scratch space of the template values of one message, reset after each message. The values are
+// recycled rather than destroyed, so the render loop stops allocating them once it is warmed up.
+// References returned by add stay valid until reset.
+class TemplateValuesArena
+{
+public:
+    using const_iterator = std::deque<TemplateValues>::const_iterator;
+    
+    TemplateValuesArena() : m_size(0)
+    {
+    }
+    
+    // The arena of the calling thread, which keeps its capacity across sessions
+    static TemplateValuesArena& local();
+    
+    TemplateValues& add(const char* name)
+    {
+        if (m_size == m_values.size())
+        {
+            m_values.emplace_back();
+        }
+        TemplateValues& tv = m_values[m_size++];
+        tv.clear();
+        tv.setName(name);
+        return tv;
+    }
+    
+    void reset()
+    {
+        m_size = 0;
+    }
+    
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+    
+    size_t size() const
+    {
+        return m_size;
+    }
+    
+    const_iterator cbegin() const
+    {
+        return m_values.cbegin();
+    }
+    
+    const_iterator cend() const
+    {
+        return m_values.cbegin() + m_size;
+    }
+    
+private:
+    std::deque<TemplateValues> m_values;
+    size_t m_size;
+};
+
 class Template
 {
 public:
@@ -35,6 +250,7 @@ public:
     std::string build(const std::vector<std::pair<std::string, std::string>>& values) const;
     
     const std::string& build(const std::map<std::string, std::string>& values) const;
+    const std::string& build(const TemplateValues& values) const;
     
 protected:
     std::string m_template;
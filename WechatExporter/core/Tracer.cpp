@@ -0,0 +1,170 @@
+//
+//  Tracer.cpp
+//  WechatExporter
+//
+//  Created by Matthew on 2022/5/10.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#include "Tracer.h"
+#include "FileSystem.h"
+#include "Utils.h"
+
+std::atomic<bool> Tracer::s_enabled(false);
+std::atomic<int64_t> Tracer::s_epoch(0);
+std::mutex Tracer::s_mutex;
+std::list<Tracer::ThreadBuffer *> Tracer::s_buffers;
+
+static int64_t steadyMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline void appendJsonString(std::string& output, const std::string& value)
+{
+    appendJsonString(output, value.c_str(), value.size());
+}
+
+void Tracer::enable(bool enabled)
+{
+    if (enabled && !s_enabled.load())
+    {
+        s_epoch.store(steadyMicroseconds());
+    }
+    s_enabled.store(enabled);
+}
+
+int64_t Tracer::now()
+{
+    return steadyMicroseconds() - s_epoch.load(std::memory_order_relaxed);
+}
+
+Tracer::ThreadBuffer* Tracer::getThreadBuffer()
+{
+    // The buffer is owned by s_buffers so that the events survive the thread
+    static thread_local ThreadBuffer* buffer = NULL;
+    if (NULL == buffer)
+    {
+        buffer = new ThreadBuffer();
+        std::lock_guard<std::mutex> lock(s_mutex);
+        buffer->tid = static_cast<uint32_t>(s_buffers.size() + 1);
+        buffer->name = "thread" + std::to_string(buffer->tid);
+        buffer->events.reserve(1024);
+        s_buffers.push_back(buffer);
+    }
+    return buffer;
+}
+
+void Tracer::addEvent(const char* category, const char* name, int64_t ts, int64_t dur, const std::string& arg)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->events.emplace_back();
+    Event& evt = buffer->events.back();
+    evt.category = category;
+    evt.name = name;
+    evt.ts = ts;
+    evt.dur = dur;
+    evt.arg = arg;
+}
+
+void Tracer::setThreadName(const std::string& name)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->name = name;
+}
+
+size_t Tracer::getNumberOfEvents()
+{
+    size_t numberOfEvents = 0;
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (std::list<ThreadBuffer *>::iterator it = s_buffers.begin(); it != s_buffers.end(); ++it)
+    {
+        std::lock_guard<std::mutex> bufferLock((*it)->mutex);
+        numberOfEvents += (*it)->events.size();
+    }
+    return numberOfEvents;
+}
+
+void Tracer::reset()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (std::list<ThreadBuffer *>::iterator it = s_buffers.begin(); it != s_buffers.end(); ++it)
+    {
+        std::lock_guard<std::mutex> bufferLock((*it)->mutex);
+        (*it)->events.clear();
+    }
+    s_epoch.store(steadyMicroseconds());
+}
+
+void Tracer::summarize(std::map<std::string, std::pair<uint64_t, int64_t>>& stages)
+{
+    stages.clear();
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (std::list<ThreadBuffer *>::iterator it = s_buffers.begin(); it != s_buffers.end(); ++it)
+    {
+        std::lock_guard<std::mutex> bufferLock((*it)->mutex);
+        for (std::vector<Event>::const_iterator itEvt = (*it)->events.cbegin(); itEvt != (*it)->events.cend(); ++itEvt)
+        {
+            std::pair<uint64_t, int64_t>& stage = stages[itEvt->name];
+            stage.first++;
+            stage.second += itEvt->dur;
+        }
+    }
+}
+
+bool Tracer::exportChromeTrace(const std::string& path)
+{
+    File file;
+    if (!file.open(path, false))
+    {
+        return false;
+    }
+
+    bool succeeded = true;
+    size_t bytesWritten = 0;
+    std::string data = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for (std::list<ThreadBuffer *>::iterator it = s_buffers.begin(); it != s_buffers.end(); ++it)
+    {
+        std::lock_guard<std::mutex> bufferLock((*it)->mutex);
+        const std::string tid = std::to_string((*it)->tid);
+
+        if (!first)
+        {
+            data.append(",\n");
+        }
+        first = false;
+        data.append("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":").append(tid).append(",\"args\":{\"name\":");
+        appendJsonString(data, (*it)->name);
+        data.append("}}");
+
+        for (std::vector<Event>::const_iterator itEvt = (*it)->events.cbegin(); itEvt != (*it)->events.cend(); ++itEvt)
+        {
+            data.append(",\n{\"ph\":\"X\",\"pid\":1,\"tid\":").append(tid);
+            data.append(",\"cat\":\"").append(itEvt->category).append("\",\"name\":\"").append(itEvt->name);
+            data.append("\",\"ts\":").append(std::to_string(itEvt->ts)).append(",\"dur\":").append(std::to_string(itEvt->dur));
+            if (!itEvt->arg.empty())
+            {
+                data.append(",\"args\":{\"detail\":");
+                appendJsonString(data, itEvt->arg);
+                data.append("}");
+            }
+            data.append("}");
+
+            if (data.size() >= 1048576)
+            {
+                succeeded = succeeded && file.write(reinterpret_cast<const unsigned char *>(data.c_str()), data.size(), bytesWritten);
+                data.clear();
+            }
+        }
+    }
+    data.append("\n]}\n");
+    succeeded = succeeded && file.write(reinterpret_cast<const unsigned char *>(data.c_str()), data.size(), bytesWritten);
+    file.close();
+
+    return succeeded;
+}
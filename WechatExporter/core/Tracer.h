@@ -0,0 +1,169 @@
+//
+//  Tracer.h
+//  WechatExporter
+//
+//  Created by Matthew on 2022/5/10.
+//  Copyright © 2022 Matthew. All rights reserved.
+//
+
+#ifndef Tracer_h
+#define Tracer_h
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#define TRACE_CAT_ITUNES    "itunes"
+#define TRACE_CAT_EXPORT    "export"
+#define TRACE_CAT_SESSION   "session"
+#define TRACE_CAT_TASK      "task"
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// Scoped span, the name and category must be string literals(or any other static strings)
+#define TRACE_SPAN(category, name) TraceSpan TRACE_CONCAT(__traceSpan, __LINE__)(category, name)
+#define TRACE_SPAN_ARG(category, name, arg) TraceSpan TRACE_CONCAT(__traceSpan, __LINE__)(category, name, arg)
+
+// Always compiled in and toggled at runtime. Spans are appended to a buffer owned by the current
+// thread (no contention between threads) and kept after the thread ends, so they can be exported
+// as a Chrome trace(chrome://tracing or https://ui.perfetto.dev) once the export finishes.
+class Tracer
+{
+public:
+    struct Event
+    {
+        const char* category;
+        const char* name;
+        int64_t ts;     // us since the tracer was enabled
+        int64_t dur;    // us
+        std::string arg;
+    };
+
+    static void enable(bool enabled);
+    static inline bool isEnabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static int64_t now();
+    static void addEvent(const char* category, const char* name, int64_t ts, int64_t dur, const std::string& arg);
+    static void setThreadName(const std::string& name);
+
+    static size_t getNumberOfEvents();
+    static void reset();
+    // Aggregates the recorded spans by name: name => (count, total us)
+    static void summarize(std::map<std::string, std::pair<uint64_t, int64_t>>& stages);
+    static bool exportChromeTrace(const std::string& path);
+
+protected:
+    struct ThreadBuffer
+    {
+        uint32_t tid;
+        std::string name;
+        std::mutex mutex;   // only contended while exporting
+        std::vector<Event> events;
+    };
+
+    static ThreadBuffer* getThreadBuffer();
+
+private:
+    static std::atomic<bool> s_enabled;
+    static std::atomic<int64_t> s_epoch;
+    static std::mutex s_mutex;
+    static std::list<ThreadBuffer *> s_buffers;
+};
+
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const char* name) : m_category(category), m_name(name), m_start(-1)
+    {
+        if (Tracer::isEnabled())
+        {
+            m_start = Tracer::now();
+        }
+    }
+
+    TraceSpan(const char* category, const char* name, const std::string& arg) : m_category(category), m_name(name), m_start(-1)
+    {
+        if (Tracer::isEnabled())
+        {
+            m_arg = arg;
+            m_start = Tracer::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        end();
+    }
+
+    void end()
+    {
+        if (m_start >= 0)
+        {
+            Tracer::addEvent(m_category, m_name, m_start, Tracer::now() - m_start, m_arg);
+            m_start = -1;
+        }
+    }
+
+private:
+    const char* m_category;
+    const char* m_name;
+    int64_t m_start;
+    std::string m_arg;
+};
+
+// A stage which runs in many short pieces(e.g. once per message) between start and stop. The pieces are
+// summed up and added as one span by end, which places it at ts and returns the end of the span, so the
+// stages of a loop are laid one after another inside the span of the loop.
+class TraceAccumulator
+{
+public:
+    TraceAccumulator(const char* category, const char* name) : m_category(category), m_name(name), m_enabled(Tracer::isEnabled()), m_start(-1), m_total(0)
+    {
+    }
+
+    inline void start()
+    {
+        if (m_enabled)
+        {
+            m_start = Tracer::now();
+        }
+    }
+
+    inline void stop()
+    {
+        if (m_start >= 0)
+        {
+            m_total += Tracer::now() - m_start;
+            m_start = -1;
+        }
+    }
+
+    int64_t end(int64_t ts)
+    {
+        stop();
+        if (m_enabled && m_total > 0)
+        {
+            Tracer::addEvent(m_category, m_name, ts, m_total, std::string());
+            ts += m_total;
+            m_total = 0;
+        }
+        return ts;
+    }
+
+private:
+    const char* m_category;
+    const char* m_name;
+    bool m_enabled;
+    int64_t m_start;
+    int64_t m_total;
+};
+
+#endif /* Tracer_h */
@@ -17,6 +17,7 @@
 #include <codecvt>
 #include <locale>
 #include <cstdio>
+#include <cstring>
 #include <chrono>
 #ifdef _WIN32
 #include <direct.h>
@@ -42,6 +43,14 @@
 #include <uuid/uuid.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define ESCAPING_WITH_SSE2
+#endif
+
 
 int replaceAll(std::string& input, const std::string& search, const std::string& replace)
 {
@@ -165,11 +174,231 @@ std::string join(std::vector<std::string>::const_iterator b, std::vector<std::st
     return os.str();
 }
 
+// Escaping kernels: the input is scanned 16 bytes(SSE2) or 8 bytes(SWAR) at a time for the bytes
+// which need escaping, clean runs are appended in bulk and the output is grown once up front.
+#ifdef ESCAPING_WITH_SSE2
+static inline unsigned int countTrailingZeros(unsigned int mask)
+{
+#ifdef _MSC_VER
+    unsigned long idx = 0;
+    _BitScanForward(&idx, mask);
+    return static_cast<unsigned int>(idx);
+#else
+    return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+}
+#else
+#define SWAR_ONES   0x0101010101010101ULL
+#define SWAR_HIGHS  0x8080808080808080ULL
+
+// Non-zero if any byte of x is less than n(n <= 128)
+static inline uint64_t hasByteLessThan(uint64_t x, uint64_t n)
+{
+    return (x - SWAR_ONES * n) & ~x & SWAR_HIGHS;
+}
+
+static inline uint64_t hasByte(uint64_t x, uint64_t ch)
+{
+    return hasByteLessThan(x ^ (SWAR_ONES * ch), 1);
+}
+#endif
+
+static inline bool isHtmlSpecial(unsigned char ch)
+{
+    return ch == '&' || ch == '<' || ch == '>' || ch == '\r' || ch == '\n';
+}
+
+// 0xE2 is the lead byte of U+2028/U+2029, which are line terminators in JavaScript
+static inline bool isJsonSpecial(unsigned char ch)
+{
+    return ch < 0x20 || ch == '"' || ch == '\\' || ch == 0xE2;
+}
+
+// Returns the position of the first byte which needs escaping, or length if there is none
+static size_t findHtmlSpecial(const char* s, size_t pos, size_t length)
+{
+#ifdef ESCAPING_WITH_SSE2
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; pos + 16 <= length; pos += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + pos));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)), _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))));
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(m));
+        if (mask != 0)
+        {
+            return pos + countTrailingZeros(mask);
+        }
+    }
+#else
+    for (; pos + 8 <= length; pos += 8)
+    {
+        uint64_t x = 0;
+        std::memcpy(&x, s + pos, 8);
+        if (hasByte(x, '&') | hasByte(x, '<') | hasByte(x, '>') | hasByte(x, '\r') | hasByte(x, '\n'))
+        {
+            break;
+        }
+    }
+#endif
+    for (; pos < length; ++pos)
+    {
+        if (isHtmlSpecial(static_cast<unsigned char>(s[pos])))
+        {
+            break;
+        }
+    }
+    return pos;
+}
+
+static size_t findJsonSpecial(const char* s, size_t pos, size_t length)
+{
+#ifdef ESCAPING_WITH_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    const __m128i lineSep = _mm_set1_epi8(static_cast<char>(0xE2));
+    for (; pos + 16 <= length; pos += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + pos));
+        // v <= 0x1F (unsigned) <=> max(v, 0x1F) == 0x1F
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)), _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl), _mm_cmpeq_epi8(v, lineSep)));
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(m));
+        if (mask != 0)
+        {
+            return pos + countTrailingZeros(mask);
+        }
+    }
+#else
+    for (; pos + 8 <= length; pos += 8)
+    {
+        uint64_t x = 0;
+        std::memcpy(&x, s + pos, 8);
+        if (hasByteLessThan(x, 0x20) | hasByte(x, '"') | hasByte(x, '\\') | hasByte(x, 0xE2))
+        {
+            break;
+        }
+    }
+#endif
+    for (; pos < length; ++pos)
+    {
+        if (isJsonSpecial(static_cast<unsigned char>(s[pos])))
+        {
+            break;
+        }
+    }
+    return pos;
+}
+
+void appendSafeHTML(std::string& output, const char* s, size_t length)
+{
+    output.reserve(output.size() + length + (length >> 3));
+    size_t start = 0;
+    while (start < length)
+    {
+        size_t pos = findHtmlSpecial(s, start, length);
+        output.append(s + start, pos - start);
+        if (pos >= length)
+        {
+            break;
+        }
+        switch (s[pos])
+        {
+            case '&':
+                output.append("&amp;", 5);
+                break;
+            case '<':
+                output.append("&lt;", 4);
+                break;
+            case '>':
+                output.append("&gt;", 4);
+                break;
+            case '\r':
+                // \r\n, \r and \n are all line breaks
+                if (pos + 1 < length && s[pos + 1] == '\n')
+                {
+                    ++pos;
+                }
+                output.append("<br/>", 5);
+                break;
+            default:
+                output.append("<br/>", 5);
+                break;
+        }
+        start = pos + 1;
+    }
+}
+
 std::string safeHTML(const std::string& s)
 {
-    static std::vector<std::pair<std::string, std::string>> replaces =
-    { {"&", "&amp;"}, /*{" ", "&nbsp;"}, */{"<", "&lt;"}, {">", "&gt;"}, {"\r\n", "<br/>"}, {"\r", "<br/>"}, {"\n", "<br/>"} };
-    return replaceAll(s, replaces);
+    std::string result;
+    appendSafeHTML(result, s.c_str(), s.size());
+    return result;
+}
+
+void appendJsonString(std::string& output, const char* s, size_t length)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    
+    output.reserve(output.size() + length + (length >> 3) + 2);
+    output.push_back('"');
+    size_t start = 0;
+    while (start < length)
+    {
+        size_t pos = findJsonSpecial(s, start, length);
+        output.append(s + start, pos - start);
+        if (pos >= length)
+        {
+            break;
+        }
+        unsigned char ch = static_cast<unsigned char>(s[pos]);
+        switch (ch)
+        {
+            case '"':
+                output.append("\\\"", 2);
+                break;
+            case '\\':
+                output.append("\\\\", 2);
+                break;
+            case '\b':
+                output.append("\\b", 2);
+                break;
+            case '\f':
+                output.append("\\f", 2);
+                break;
+            case '\n':
+                output.append("\\n", 2);
+                break;
+            case '\r':
+                output.append("\\r", 2);
+                break;
+            case '\t':
+                output.append("\\t", 2);
+                break;
+            case 0xE2:
+                if (pos + 2 < length && static_cast<unsigned char>(s[pos + 1]) == 0x80 && (static_cast<unsigned char>(s[pos + 2]) & 0xFE) == 0xA8)
+                {
+                    output.append(static_cast<unsigned char>(s[pos + 2]) == 0xA8 ? "\\u2028" : "\\u2029", 6);
+                    pos += 2;
+                }
+                else
+                {
+                    output.push_back(s[pos]);
+                }
+                break;
+            default:
+                {
+                    char buf[6] = { '\\', 'u', '0', '0', HEX_DIGITS[ch >> 4], HEX_DIGITS[ch & 0x0F] };
+                    output.append(buf, 6);
+                }
+                break;
+        }
+        start = pos + 1;
+    }
+    output.push_back('"');
 }
 
 void removeHtmlTags(std::string& html)
@@ -193,28 +422,172 @@ std::string removeCdata(const std::string& str)
     return str;
 }
 
-std::string fromUnixTime(unsigned int unixtime, bool localTime/* = true*/)
+#define SECONDS_PER_DAY     86400
+
+static const char DIGITS_00_99[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+// http://howardhinnant.github.io/date_algorithms.html
+static int64_t daysFromCivil(int64_t y, unsigned int m, unsigned int d)
 {
-    std::time_t ts = unixtime;
-    std::tm* t1 = std::localtime(&ts);
-    if (!localTime)
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned int yoe = static_cast<unsigned int>(y - era * 400);
+    const unsigned int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+static void civilFromDays(int64_t z, DateTimeParts& parts)
+{
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned int doe = static_cast<unsigned int>(z - era * 146097);
+    const unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned int mp = (5 * doy + 2) / 153;
+    const unsigned int m = mp < 10 ? mp + 3 : mp - 9;
+    parts.year = static_cast<uint16_t>(static_cast<int64_t>(yoe) + era * 400 + (m <= 2));
+    parts.month = static_cast<uint8_t>(m);
+    parts.day = static_cast<uint8_t>(doy - (153 * mp + 2) / 5 + 1);
+}
+
+static inline int64_t floorDiv(int64_t a, int64_t b)
+{
+    return (a >= 0 ? a : a - b + 1) / b;
+}
+
+static bool queryUtcOffset(int64_t ts, int32_t& offset)
+{
+    std::time_t tt = static_cast<std::time_t>(ts);
+    std::tm tm;
+#ifdef _WIN32
+    if (localtime_s(&tm, &tt) != 0)
     {
-        std::time_t local_secs = std::mktime(t1);
+        return false;
+    }
+#else
+    if (localtime_r(&tt, &tm) == NULL)
+    {
+        return false;
+    }
+#endif
+    int64_t localSeconds = daysFromCivil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * SECONDS_PER_DAY + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+    offset = static_cast<int32_t>(localSeconds - ts);
+    return true;
+}
 
-        struct tm *t2 = gmtime(&ts);
-        std::time_t gmt_secs = mktime(t2);
-        
-        ts -= gmt_secs - local_secs;
-        t1 = std::localtime(&ts);
+static int32_t getUtcOffset(int64_t ts)
+{
+    // [start, end) in UTC seconds where offset applies, or where each timestamp is converted if varying
+    struct UtcOffsetCache
+    {
+        int64_t start;
+        int64_t end;
+        int32_t offset;
+        bool varying;
+    };
+    static thread_local UtcOffsetCache cache = { 0, 0, 0, false };
+    
+    int32_t offset = 0;
+    if (ts >= cache.start && ts < cache.end)
+    {
+        if (!cache.varying)
+        {
+            return cache.offset;
+        }
+        return queryUtcOffset(ts, offset) ? offset : 0;
+    }
+    
+    if (!queryUtcOffset(ts, offset))
+    {
+        return 0;
+    }
+    
+    // Some zones used offsets with seconds(e.g. Liberia was -0:44:30 until 1972), don't cache them
+    if (offset % 60 != 0)
+    {
+        return offset;
+    }
+    
+    // The local day containing ts, the offset is assumed not to change inside it if it's the same at both ends
+    int64_t start = floorDiv(ts + offset, SECONDS_PER_DAY) * SECONDS_PER_DAY - offset;
+    int64_t end = start + SECONDS_PER_DAY;
+    int32_t startOffset = 0;
+    int32_t endOffset = 0;
+    if (!queryUtcOffset(start, startOffset) || !queryUtcOffset(end - 1, endOffset) || startOffset != offset || endOffset != offset)
+    {
+        // The offset changes on this day, convert each timestamp of it
+        cache.start = start;
+        cache.end = end;
+        cache.varying = true;
+        return offset;
+    }
+    
+    cache.start = start;
+    cache.end = end;
+    cache.offset = offset;
+    cache.varying = false;
+    return offset;
+}
+
+void splitUnixTime(unsigned int unixtime, DateTimeParts& parts, bool localTime/* = true*/)
+{
+    int64_t ts = unixtime;
+    if (localTime)
+    {
+        ts += getUtcOffset(ts);
     }
     
-    char buf[30] = { 0 };
-	std::strftime(buf, 30, "%Y-%m-%d %H:%M:%S", t1);
+    int64_t days = floorDiv(ts, SECONDS_PER_DAY);
+    unsigned int seconds = static_cast<unsigned int>(ts - days * SECONDS_PER_DAY);
+    civilFromDays(days, parts);
+    parts.hour = static_cast<uint8_t>(seconds / 3600);
+    parts.minute = static_cast<uint8_t>(seconds / 60 % 60);
+    parts.second = static_cast<uint8_t>(seconds % 60);
+}
 
-    // std::stringstream ss; // or if you're going to print, just input directly into the output stream
-    // ss << std::put_time(t, "%Y-%m-%d %H:%M:%S");
+static inline char* formatTwoDigits(char* p, unsigned int value)
+{
+    p[0] = DIGITS_00_99[value * 2];
+    p[1] = DIGITS_00_99[value * 2 + 1];
+    return p + 2;
+}
 
-    return std::string(buf);
+// buf must have 19 chars at least
+static size_t formatUnixTime(unsigned int unixtime, char* buf, bool localTime)
+{
+    DateTimeParts parts;
+    splitUnixTime(unixtime, parts, localTime);
+    
+    char* p = formatTwoDigits(buf, parts.year / 100 % 100);
+    p = formatTwoDigits(p, parts.year % 100);
+    *p++ = '-';
+    p = formatTwoDigits(p, parts.month);
+    *p++ = '-';
+    p = formatTwoDigits(p, parts.day);
+    *p++ = ' ';
+    p = formatTwoDigits(p, parts.hour);
+    *p++ = ':';
+    p = formatTwoDigits(p, parts.minute);
+    *p++ = ':';
+    p = formatTwoDigits(p, parts.second);
+
+    return p - buf;
+}
+
+std::string fromUnixTime(unsigned int unixtime, bool localTime/* = true*/)
+{
+    char buf[19];
+    size_t length = formatUnixTime(unixtime, buf, localTime);
+    return std::string(buf, length);
+}
+
+void fromUnixTime(unsigned int unixtime, std::string& output, bool localTime/* = true*/)
+{
+    char buf[19];
+    size_t length = formatUnixTime(unixtime, buf, localTime);
+    output.assign(buf, length);
 }
 
 uint32_t getUnixTimeStamp()
@@ -583,8 +956,13 @@ std::string getTimestampString(bool includingYMD/* = false*/, bool includingMs/*
 
     std::time_t tt;
     tt = system_clock::to_time_t ( currentTime );
-	auto timeinfo = localtime (&tt);
-	strftime (buffer, 80, includingYMD ? "%F %H:%M:%S" : "%H:%M:%S", timeinfo);
+    std::tm timeinfo;
+#ifdef _WIN32
+    localtime_s(&timeinfo, &tt);
+#else
+    localtime_r(&tt, &timeinfo);
+#endif
+	strftime (buffer, 80, includingYMD ? "%F %H:%M:%S" : "%H:%M:%S", &timeinfo);
     if (includingMs)
     {
         auto transformed = currentTime.time_since_epoch().count() / 1000000;
@@ -53,15 +53,38 @@ std::string formatString(const std::string& format, Args && ...args)
 // int makePath(const std::string& path, mode_t mode);
 
 std::string md5(const std::string& s);
+// Hashes many short strings(user names, chatroom ids...) at once, 4 at a time with SSE2
+void md5Batch(const std::vector<std::string>& values, std::vector<std::string>& hashes);
 std::string sha1(const std::string& s);
 std::string md5File(const std::string& path);
 
 std::string safeHTML(const std::string& s);
+// Single pass escaping, the result is appended to output
+void appendSafeHTML(std::string& output, const char* s, size_t length);
+// Quoted JSON string, U+2028/U+2029 are escaped as well so the result can be embedded in scripts
+void appendJsonString(std::string& output, const char* s, size_t length);
 void removeHtmlTags(std::string& html);
 
 std::string removeCdata(const std::string& str);
 
+struct DateTimeParts
+{
+    uint16_t year;
+    uint8_t month;  // 1-12
+    uint8_t day;    // 1-31
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+};
+
+// Thread-safe replacements of localtime/strftime. The UTC offset is cached per thread for the
+// current local day(except the days of DST transitions), so consecutive messages don't take
+// the global tz lock. localTime = false formats the time in UTC
+void splitUnixTime(unsigned int unixtime, DateTimeParts& parts, bool localTime = true);
+// "%Y-%m-%d %H:%M:%S"
 std::string fromUnixTime(unsigned int unixtime, bool localTime = true);
+// Reuses the capacity of output
+void fromUnixTime(unsigned int unixtime, std::string& output, bool localTime = true);
 uint32_t getUnixTimeStamp();
 
 const char* calcVarint32Ptr(const char* p, const char* limit, uint32_t* value);
@@ -9,6 +9,9 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <vector>
+#include <cstring>
+#include <cstdint>
 
 #if defined(_WIN32)
 #include <windows.h>
@@ -25,6 +28,165 @@
 
 #include "FileSystem.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MD5_WITH_SSE2
+#endif
+
+// User names, chatroom ids and the other ids which are hashed fit in one block(<= 55 bytes with the
+// padding), they are hashed here instead of going through the platform API for each of them
+#define MD5_MAX_SINGLE_BLOCK_LENGTH 55
+
+static const uint32_t MD5_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int MD5_SHIFTS[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static inline int md5WordIndex(int round)
+{
+    return round < 16 ? round : (round < 32 ? ((5 * round + 1) & 15) : (round < 48 ? ((3 * round + 5) & 15) : ((7 * round) & 15)));
+}
+
+// Pads data(length <= MD5_MAX_SINGLE_BLOCK_LENGTH) into the little-endian words of the last block
+static void md5PadSingleBlock(const char* data, size_t length, uint32_t words[16])
+{
+    unsigned char block[64] = { 0 };
+    std::memcpy(block, data, length);
+    block[length] = 0x80;
+    uint64_t bits = static_cast<uint64_t>(length) << 3;
+    for (int idx = 0; idx < 8; ++idx)
+    {
+        block[56 + idx] = static_cast<unsigned char>(bits >> (idx * 8));
+    }
+    for (int idx = 0; idx < 16; ++idx)
+    {
+        words[idx] = static_cast<uint32_t>(block[idx * 4]) | (static_cast<uint32_t>(block[idx * 4 + 1]) << 8) | (static_cast<uint32_t>(block[idx * 4 + 2]) << 16) | (static_cast<uint32_t>(block[idx * 4 + 3]) << 24);
+    }
+}
+
+static void md5ToHex(const uint32_t state[4], std::string& hash)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    hash.resize(32);
+    for (int idx = 0; idx < 16; ++idx)
+    {
+        unsigned char ch = static_cast<unsigned char>(state[idx >> 2] >> ((idx & 3) * 8));
+        hash[idx * 2] = HEX_DIGITS[ch >> 4];
+        hash[idx * 2 + 1] = HEX_DIGITS[ch & 0x0F];
+    }
+}
+
+static void md5SingleBlock(const char* data, size_t length, std::string& hash)
+{
+    uint32_t words[16];
+    md5PadSingleBlock(data, length, words);
+    
+    uint32_t a = 0x67452301;
+    uint32_t b = 0xefcdab89;
+    uint32_t c = 0x98badcfe;
+    uint32_t d = 0x10325476;
+    for (int round = 0; round < 64; ++round)
+    {
+        uint32_t f = 0;
+        if (round < 16)
+        {
+            f = (b & c) | (~b & d);
+        }
+        else if (round < 32)
+        {
+            f = (d & b) | (~d & c);
+        }
+        else if (round < 48)
+        {
+            f = b ^ c ^ d;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+        }
+        f += a + MD5_K[round] + words[md5WordIndex(round)];
+        a = d;
+        d = c;
+        c = b;
+        b += (f << MD5_SHIFTS[round]) | (f >> (32 - MD5_SHIFTS[round]));
+    }
+    
+    uint32_t state[4] = { a + 0x67452301, b + 0xefcdab89, c + 0x98badcfe, d + 0x10325476 };
+    md5ToHex(state, hash);
+}
+
+#ifdef MD5_WITH_SSE2
+// 4 single block messages at a time, one per 32-bit lane
+static void md5SingleBlockX4(const std::string* values[4], std::string* hashes[4])
+{
+    uint32_t words[16][4];
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        uint32_t laneWords[16];
+        md5PadSingleBlock(values[lane]->c_str(), values[lane]->size(), laneWords);
+        for (int idx = 0; idx < 16; ++idx)
+        {
+            words[idx][lane] = laneWords[idx];
+        }
+    }
+    
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i a = _mm_set1_epi32(0x67452301);
+    __m128i b = _mm_set1_epi32(static_cast<int>(0xefcdab89));
+    __m128i c = _mm_set1_epi32(static_cast<int>(0x98badcfe));
+    __m128i d = _mm_set1_epi32(0x10325476);
+    for (int round = 0; round < 64; ++round)
+    {
+        __m128i f;
+        if (round < 16)
+        {
+            f = _mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d));
+        }
+        else if (round < 32)
+        {
+            f = _mm_or_si128(_mm_and_si128(d, b), _mm_andnot_si128(d, c));
+        }
+        else if (round < 48)
+        {
+            f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+        }
+        else
+        {
+            f = _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ones)));
+        }
+        f = _mm_add_epi32(_mm_add_epi32(f, a), _mm_add_epi32(_mm_set1_epi32(static_cast<int>(MD5_K[round])), _mm_loadu_si128(reinterpret_cast<const __m128i *>(words[md5WordIndex(round)]))));
+        a = d;
+        d = c;
+        c = b;
+        b = _mm_add_epi32(b, _mm_or_si128(_mm_sll_epi32(f, _mm_cvtsi32_si128(MD5_SHIFTS[round])), _mm_srl_epi32(f, _mm_cvtsi32_si128(32 - MD5_SHIFTS[round]))));
+    }
+    
+    uint32_t states[4][4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(states[0]), _mm_add_epi32(a, _mm_set1_epi32(0x67452301)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(states[1]), _mm_add_epi32(b, _mm_set1_epi32(static_cast<int>(0xefcdab89))));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(states[2]), _mm_add_epi32(c, _mm_set1_epi32(static_cast<int>(0x98badcfe))));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(states[3]), _mm_add_epi32(d, _mm_set1_epi32(0x10325476)));
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        uint32_t state[4] = { states[0][lane], states[1][lane], states[2][lane], states[3][lane] };
+        md5ToHex(state, *hashes[lane]);
+    }
+}
+#endif
+
 std::string md5Impl(const void* data, size_t dataSize)
 {
     std::stringstream stream;
@@ -75,9 +237,50 @@ std::string md5Impl(const void* data, size_t dataSize)
 
 std::string md5(const std::string& s)
 {
+    if (s.size() <= MD5_MAX_SINGLE_BLOCK_LENGTH)
+    {
+        std::string hash;
+        md5SingleBlock(s.c_str(), s.size(), hash);
+        return hash;
+    }
     return md5Impl(s.c_str(), s.size());
 }
 
+void md5Batch(const std::vector<std::string>& values, std::vector<std::string>& hashes)
+{
+    hashes.resize(values.size());
+#ifdef MD5_WITH_SSE2
+    const std::string* lanes[4];
+    std::string* laneHashes[4];
+    int numberOfLanes = 0;
+#endif
+    for (size_t idx = 0; idx < values.size(); ++idx)
+    {
+        if (values[idx].size() > MD5_MAX_SINGLE_BLOCK_LENGTH)
+        {
+            hashes[idx] = md5Impl(values[idx].c_str(), values[idx].size());
+            continue;
+        }
+#ifdef MD5_WITH_SSE2
+        lanes[numberOfLanes] = &values[idx];
+        laneHashes[numberOfLanes] = &hashes[idx];
+        if (++numberOfLanes == 4)
+        {
+            md5SingleBlockX4(lanes, laneHashes);
+            numberOfLanes = 0;
+        }
+#else
+        md5SingleBlock(values[idx].c_str(), values[idx].size(), hashes[idx]);
+#endif
+    }
+#ifdef MD5_WITH_SSE2
+    for (int lane = 0; lane < numberOfLanes; ++lane)
+    {
+        md5SingleBlock(lanes[lane]->c_str(), lanes[lane]->size(), *laneHashes[lane]);
+    }
+#endif
+}
+
 std::string md5File(const std::string& path)
 {
     std::vector<unsigned char> data;
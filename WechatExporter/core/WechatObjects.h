@@ -257,7 +257,8 @@ public:
     inline std::string getUsrName() const { return m_usrName; }
     inline std::string getWxName() const { return m_wxName.empty() ? m_usrName : m_wxName; }
     inline std::string getHash() const { return m_uidHash; }
-    void setUsrName(const std::string& usrName) { this->m_usrName = usrName; m_uidHash = md5(usrName);  m_outputFileName = m_uidHash; m_isChatroom = isChatroom(usrName); }
+    void setUsrName(const std::string& usrName) { setUsrName(usrName, md5(usrName)); }
+    void setUsrName(const std::string& usrName, const std::string& hash) { this->m_usrName = usrName; m_uidHash = hash;  m_outputFileName = m_uidHash; m_isChatroom = isChatroom(usrName); }
     inline bool isUsrNameEmpty() const
     {
         return m_usrName.empty();
@@ -627,10 +628,7 @@ public:
     }
     Friend* getFriendByUid(const std::string& uid)
     {
-        std::map<std::string, std::string>::const_iterator it = hashes.find(uid);
-        std::string hash = it == hashes.cend() ? md5(uid) : it->second;
-        
-        std::map<std::string, Friend>::iterator it2 = friends.find(hash);
+        std::map<std::string, Friend>::iterator it2 = friends.find(getHash(uid));
         if (it2 == friends.end())
         {
             return NULL;
@@ -638,29 +636,69 @@ public:
         return &(it2->second);
         // return getFriend(hash);
     }
-    
-    Friend& addFriend(const std::string& uid)
+    // Friends of the uids(NULL if not found), the uids which are not in hashes are hashed in a batch
+    void getFriendsByUids(const std::vector<std::string>& uids, std::vector<const Friend *>& result) const
     {
-        std::map<std::string, std::string>::const_iterator it = hashes.find(uid);
-        std::string hash = it == hashes.cend() ? md5(uid) : it->second;
-        if (it == hashes.cend())
+        std::vector<std::string> missingUids;
+        std::vector<std::string> missingHashes;
+        for (std::vector<std::string>::const_iterator it = uids.cbegin(); it != uids.cend(); ++it)
         {
-            hashes[uid] = hash;
+            if (hashes.find(*it) == hashes.cend())
+            {
+                missingUids.push_back(*it);
+            }
         }
+        md5Batch(missingUids, missingHashes);
         
-        friends[hash] = Friend(uid, hash);
-        return friends[hash];
+        result.assign(uids.size(), NULL);
+        size_t missingIndex = 0;
+        for (size_t idx = 0; idx < uids.size(); ++idx)
+        {
+            std::map<std::string, std::string>::const_iterator it = hashes.find(uids[idx]);
+            const std::string& hash = it == hashes.cend() ? missingHashes[missingIndex++] : it->second;
+            std::map<std::string, Friend>::const_iterator it2 = friends.find(hash);
+            if (it2 != friends.cend())
+            {
+                result[idx] = &(it2->second);
+            }
+        }
     }
     
-    void addHash(const std::string& uid)
+    // Memoized md5 of uid
+    const std::string& getHash(const std::string& uid)
     {
-        std::map<std::string, std::string>::const_iterator it = hashes.find(uid);
-        if (it == hashes.cend())
+        std::map<std::string, std::string>::iterator it = hashes.find(uid);
+        if (it == hashes.end())
+        {
+            it = hashes.insert(it, std::pair<std::string, std::string>(uid, md5(uid)));
+        }
+        return it->second;
+    }
+    
+    // Hashes the uids in a batch up front, addFriend/getHash pick the hashes up later
+    void addHashes(const std::vector<std::string>& uids)
+    {
+        std::vector<std::string> hashValues;
+        md5Batch(uids, hashValues);
+        for (size_t idx = 0; idx < uids.size(); ++idx)
         {
-            hashes[uid] = md5(uid);
+            hashes.insert(std::pair<std::string, std::string>(uids[idx], hashValues[idx]));
         }
     }
     
+    Friend& addFriend(const std::string& uid)
+    {
+        const std::string& hash = getHash(uid);
+        Friend& f = friends[hash];
+        f = Friend(uid, hash);
+        return f;
+    }
+    
+    void addHash(const std::string& uid)
+    {
+        getHash(uid);
+    }
+    
 };
 
 class Session : public Friend
@@ -878,6 +916,11 @@ public:
     {
         return m_owner;
     }
+    
+    void setOwner(const Friend* owner)
+    {
+        m_owner = owner;
+    }
 
 };
 
@@ -915,6 +958,15 @@ struct SessionLastMsgTimeCompare
     }
 };
 
+// The last message time is not loaded yet in the lazy loading, CreateTime of session.db is used instead
+struct SessionActiveTimeCompare
+{
+    bool operator()(const Session& s1, const Session& s2) const
+    {
+        return std::max(s1.getLastMessageTime(), s1.getCreateTime()) > std::max(s2.getLastMessageTime(), s2.getCreateTime());
+    }
+};
+
 struct WXMSG
 {
     unsigned int createTime;
@@ -698,9 +698,28 @@ bool FriendsParser::parseWcdb(const std::string& mmPath, Friends& friends)
         return false;
     }
     
-    std::string sql = "SELECT userName,dbContactRemark,dbContactChatRoom,dbContactHeadImage,type FROM Friend";
+    // Hash all the user names in a batch first, addFriend picks the hashes up while parsing the rows
+    std::string sql = "SELECT userName FROM Friend UNION ALL SELECT userName FROM OpenIMContact";
     sqlite3_stmt* stmt = NULL;
     rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+    if (rc == SQLITE_OK)
+    {
+        std::vector<std::string> uids;
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const char* val = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            if (NULL != val)
+            {
+                uids.push_back(val);
+            }
+        }
+        friends.addHashes(uids);
+    }
+    sqlite3_finalize(stmt);
+    
+    sql = "SELECT userName,dbContactRemark,dbContactChatRoom,dbContactHeadImage,type FROM Friend";
+    stmt = NULL;
+    rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
     if (rc != SQLITE_OK)
     {
         std::string error = sqlite3_errmsg(db);
@@ -1068,7 +1087,7 @@ bool WechatInfoParser::parsePreferences(WechatInfo& wechatInfo)
     return true;
 }
 
-SessionsParser::SessionsParser(ITunesDb *iTunesDb, ITunesDb *iTunesDbShare, const Friends& friends, const std::string& cellDataVersion, Logger* logger, bool detailedInfo/* = true*/) : m_iTunesDb(iTunesDb), m_iTunesDbShare(iTunesDbShare), m_friends(friends), m_cellDataVersion(cellDataVersion), m_detailedInfo(detailedInfo), m_logger(logger)
+SessionsParser::SessionsParser(ITunesDb *iTunesDb, ITunesDb *iTunesDbShare, const Friends& friends, const std::string& cellDataVersion, Logger* logger, bool detailedInfo/* = true*/) : m_iTunesDb(iTunesDb), m_iTunesDbShare(iTunesDbShare), m_friends(friends), m_cellDataVersion(cellDataVersion), m_detailedInfo(detailedInfo), m_logger(logger), m_detailsPrepared(false)
 {
     if (cellDataVersion.empty())
     {
@@ -1076,6 +1095,18 @@ SessionsParser::SessionsParser(ITunesDb *iTunesDb, ITunesDb *iTunesDbShare, cons
     }
 }
 
+SessionsParser::~SessionsParser()
+{
+    for (std::map<std::string, sqlite3 *>::iterator it = m_messageDbs.begin(); it != m_messageDbs.end(); ++it)
+    {
+        if (NULL != it->second)
+        {
+            sqlite3_close(it->second);
+        }
+    }
+    m_messageDbs.clear();
+}
+
 void SessionsParser::debugLog(const std::string& log)
 {
     if (NULL != m_logger)
@@ -1088,73 +1119,11 @@ bool SessionsParser::parse(const Friend& user, std::vector<Session>& sessions)
 {
     std::string usrNameHash = user.getHash();
     std::string userRoot = "Documents/" + usrNameHash;
-    std::string sessionDbPath = m_iTunesDb->findRealPath(combinePath(userRoot, "session", "session.db"));
-    if (sessionDbPath.empty())
+    if (!parseSessionDb(user, userRoot, sessions))
     {
         return false;
     }
 
-    sqlite3 *db = NULL;
-    int rc = openSqlite3Database(sessionDbPath, &db);
-    if (rc != SQLITE_OK)
-    {
-        sqlite3_close(db);
-        return false;
-    }
-    
-    std::string sql = "SELECT ConStrRes1,CreateTime,unreadcount,UsrName FROM SessionAbstract";
-
-    sqlite3_stmt* stmt = NULL;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
-    if (rc != SQLITE_OK)
-    {
-        std::string error = sqlite3_errmsg(db);
-        sqlite3_close(db);
-        return false;
-    }
-
-    while (sqlite3_step(stmt) == SQLITE_ROW)
-    {
-        const char *usrName = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        if (NULL == usrName/* || Session::isSubscription(usrName)*/)
-        {
-            continue;
-        }
-
-        std::vector<Session>::iterator it = sessions.emplace(sessions.cend(), &user);
-        Session& session = (*it);
-
-        session.setUsrName(usrName);
-        session.setCreateTime(static_cast<unsigned int>(sqlite3_column_int(stmt, 1)));
-        const char* extFileName = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        if (NULL != extFileName)
-        {
-            session.setExtFileName(extFileName);
-        }
-        else
-        {
-            // Guess ext file name
-            // /session/data/c3/2488b928e0bf604ec1cb02b53f18a7
-            std::string relativePath = combinePath(userRoot, "session/data", session.getHash().substr(0, 2), session.getHash().substr(2));
-            const ITunesFile* file = m_iTunesDb->findITunesFile(relativePath);
-            if (NULL != file)
-            {
-                session.setExtFileName(file->relativePath.substr(userRoot.size())); // file->relativePath is formatted
-            }
-            
-        }
-        session.setUnreadCount(sqlite3_column_int(stmt, 2));
-        
-        const Friend* f = m_friends.getFriend(session.getHash());
-        if (NULL != f)
-        {
-            it->update(*f);
-        }
-    }
-    
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    
     parseUniversalSessions(user, userRoot, sessions);
 
     // if (m_detailedInfo)
@@ -1201,14 +1170,9 @@ bool SessionsParser::parse(const Friend& user, std::vector<Session>& sessions)
     std::string shareUserRoot = "share/" + usrNameHash;
     parseSessionsInGroupApp(shareUserRoot, sessions);
 
-    int sessionId = 1;
+    assignEmptyUsrNames(sessions);
     for (std::vector<Session>::iterator it = sessions.begin(); it != sessions.end(); ++it)
     {
-        if (it->isUsrNameEmpty())
-        {
-            it->setEmptyUsrName("wxid_unknwn_" + std::to_string(sessionId++));
-        }
-
         if (it->isDisplayNameEmpty() && !it->isMemberIdsEmpty())
         {
             // Combine the display name from member list
@@ -1264,27 +1228,230 @@ bool SessionsParser::parse(const Friend& user, std::vector<Session>& sessions)
     return true;
 }
 
-bool SessionsParser::parseDisplayNameFromMembers(const Friend& user, Session& session)
+bool SessionsParser::parseSessions(const Friend& user, std::vector<Session>& sessions)
 {
-    std::string memberIds = session.getMemberIds();
-    std::vector<std::string> members = memberIds.empty() ? session.getMemberUsrNames() : split(memberIds, ";");
-    // std::vector<std::string displayName;
-    for (auto it = members.begin(); it != members.end();)
+    std::string userRoot = "Documents/" + user.getHash();
+    if (!parseSessionDb(user, userRoot, sessions))
+    {
+        return false;
+    }
+    
+    parseUniversalSessions(user, userRoot, sessions);
+    assignEmptyUsrNames(sessions);
+    
+    return true;
+}
+
+bool SessionsParser::parseSessionDetails(const Friend& user, Session& session)
+{
+    std::string usrNameHash = user.getHash();
+    std::string userRoot = "Documents/" + usrNameHash;
+    if (!m_detailsPrepared)
+    {
+        prepareSessionDetails(user);
+    }
+    
+    // Same steps as parse, only for one session
+    std::map<std::string, std::string>::const_iterator it = m_chatTables.find(session.getHash());
+    if (it != m_chatTables.cend())
+    {
+        std::map<std::string, sqlite3 *>::const_iterator itDb = m_messageDbs.find(it->second);
+        if (itDb != m_messageDbs.cend() && NULL != itDb->second)
+        {
+            parseChatTable(user, itDb->second, it->second, "Chat_" + session.getHash(), session);
+        }
+    }
+    
+    if (!session.isExtFileNameEmpty())
+    {
+        parseCellData(userRoot, session);
+    }
+    
+    std::string shareUserRoot = "share/" + usrNameHash;
+    if (session.isDisplayNameEmpty())
     {
-        if (user.getUsrName() == *it)
+        std::map<std::string, std::string>::const_iterator itName = m_groupAppNames.find(session.getUsrName());
+        if (itName != m_groupAppNames.cend())
         {
-            it = members.erase(it);
+            session.setDisplayName(itName->second);
+        }
+    }
+    parseSessionAvatar(shareUserRoot, session);
+    
+    if (session.isDisplayNameEmpty() && !session.isMemberIdsEmpty())
+    {
+        parseDisplayNameFromMembers(user, session);
+    }
+    
+    return true;
+}
+
+void SessionsParser::prepareSessionDetails(const Friend& user)
+{
+    m_detailsPrepared = true;
+    
+    // Only the table names are read here, the tables themselves are queried by parseSessionDetails
+    std::string userRoot = "Documents/" + user.getHash();
+    MessageDbFilter filter(userRoot);
+    ITunesFileVector dbs = m_iTunesDb->filter(filter);
+    const ITunesFile* file = m_iTunesDb->findITunesFile(combinePath(userRoot, "DB", "MM.sqlite"));
+    if (NULL != file)
+    {
+        dbs.push_back(const_cast<ITunesFile *>(file));
+    }
+    
+    std::string sql = "SELECT name FROM sqlite_master WHERE type='table' AND name LIKE 'Chat\\_%' ESCAPE '\\'";
+    for (ITunesFilesConstIterator it = dbs.cbegin(); it != dbs.cend(); ++it)
+    {
+        std::string mmPath = m_iTunesDb->getRealPath(*it);
+        sqlite3 *db = NULL;
+        int rc = openSqlite3Database(mmPath, &db);
+        if (rc != SQLITE_OK)
+        {
+            sqlite3_close(db);
             continue;
         }
+        m_messageDbs[mmPath] = db;
         
-        const Friend* member = m_friends.getFriendByUid(*it);
-        if (NULL != member)
+        sqlite3_stmt* stmt = NULL;
+        rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+        if (rc != SQLITE_OK)
+        {
+            continue;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            if (NULL != name)
+            {
+                // The later db wins as parseMessageDbs does
+                m_chatTables[name + 5] = mmPath;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    
+    std::string shareUserRoot = "share/" + user.getHash();
+    std::string archives[] = {"sessionData.archive", "extraSessionExtraSessionData.archive"};
+    size_t numberOfArchives = sizeof(archives) / sizeof(std::string);
+    for (size_t idx = 0; idx < numberOfArchives; ++idx)
+    {
+        std::vector<std::pair<std::string, std::string>> names;
+        std::string archivePath = m_iTunesDbShare->findRealPath(combinePath(shareUserRoot, "session", archives[idx]));
+        if (archivePath.empty() || !parseSessionDataArchive(archivePath, names))
+        {
+            continue;
+        }
+        for (std::vector<std::pair<std::string, std::string>>::const_iterator it = names.cbegin(); it != names.cend(); ++it)
         {
-            std::string displayName = member->getDisplayName();
-            it->swap(displayName);
+            // The first non-empty name wins as parseSessionsInGroupApp does
+            std::string& displayName = m_groupAppNames[it->first];
+            if (displayName.empty())
+            {
+                displayName = it->second;
+            }
+        }
+    }
+}
+
+void SessionsParser::assignEmptyUsrNames(std::vector<Session>& sessions)
+{
+    int sessionId = 1;
+    for (std::vector<Session>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+    {
+        if (it->isUsrNameEmpty())
+        {
+            it->setEmptyUsrName("wxid_unknwn_" + std::to_string(sessionId++));
         }
+    }
+}
+
+bool SessionsParser::parseSessionDb(const Friend& user, const std::string& userRoot, std::vector<Session>& sessions)
+{
+    std::string sessionDbPath = m_iTunesDb->findRealPath(combinePath(userRoot, "session", "session.db"));
+    if (sessionDbPath.empty())
+    {
+        return false;
+    }
+
+    sqlite3 *db = NULL;
+    int rc = openSqlite3Database(sessionDbPath, &db);
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return false;
+    }
+    
+    std::string sql = "SELECT ConStrRes1,CreateTime,unreadcount,UsrName FROM SessionAbstract";
+
+    sqlite3_stmt* stmt = NULL;
+    rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+    if (rc != SQLITE_OK)
+    {
+        std::string error = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        return false;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char *usrName = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+        if (NULL == usrName/* || Session::isSubscription(usrName)*/)
+        {
+            continue;
+        }
+
+        std::vector<Session>::iterator it = sessions.emplace(sessions.cend(), &user);
+        Session& session = (*it);
+
+        session.setUsrName(usrName);
+        session.setCreateTime(static_cast<unsigned int>(sqlite3_column_int(stmt, 1)));
+        const char* extFileName = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        if (NULL != extFileName)
+        {
+            session.setExtFileName(extFileName);
+        }
+        else
+        {
+            // Guess ext file name
+            // /session/data/c3/2488b928e0bf604ec1cb02b53f18a7
+            std::string relativePath = combinePath(userRoot, "session/data", session.getHash().substr(0, 2), session.getHash().substr(2));
+            const ITunesFile* file = m_iTunesDb->findITunesFile(relativePath);
+            if (NULL != file)
+            {
+                session.setExtFileName(file->relativePath.substr(userRoot.size())); // file->relativePath is formatted
+            }
+            
+        }
+        session.setUnreadCount(sqlite3_column_int(stmt, 2));
         
-        ++it;
+        const Friend* f = m_friends.getFriend(session.getHash());
+        if (NULL != f)
+        {
+            it->update(*f);
+        }
+    }
+    
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    
+    return true;
+}
+
+bool SessionsParser::parseDisplayNameFromMembers(const Friend& user, Session& session)
+{
+    std::string memberIds = session.getMemberIds();
+    std::vector<std::string> members = memberIds.empty() ? session.getMemberUsrNames() : split(memberIds, ";");
+    members.erase(std::remove(members.begin(), members.end(), user.getUsrName()), members.end());
+    
+    std::vector<const Friend *> memberFriends;
+    m_friends.getFriendsByUids(members, memberFriends);
+    for (size_t idx = 0; idx < members.size(); ++idx)
+    {
+        if (NULL != memberFriends[idx])
+        {
+            members[idx] = memberFriends[idx]->getDisplayName();
+        }
     }
     
     session.setDisplayName(join(members, ","));
@@ -1343,8 +1510,9 @@ bool SessionsParser::parseUniversalSessions(const Friend& user, const std::strin
             std::vector<Session>::iterator it = std::lower_bound(sessions.begin(), sessions.end(), usrName, comp);
             if (it == sessions.end() || it->getUsrName() != usrName)
             {
-                Session session(usrName, md5(usrName), &user);
-                session.setUsrName(usrName);
+                std::string usrNameHash = md5(usrName);
+                Session session(usrName, usrNameHash, &user);
+                session.setUsrName(usrName, usrNameHash);
                 session.setLastMessageTime(static_cast<unsigned int>(sqlite3_column_int(stmt, 1)));
                 session.setUnreadCount(sqlite3_column_int(stmt, 2));
                 // /session/data/c3/2488b928e0bf604ec1cb02b53f18a7
@@ -1449,132 +1617,139 @@ bool SessionsParser::parseMessageDb(const Friend& user, const std::string& mmPat
             std::vector<Session>::iterator it = std::lower_bound(sessions.begin(), sessions.end(), chatId, comp);
             if (it != sessions.end() && it->getHash() == chatId)
             {
-                int recordCount = 0;
-                std::string sql2 = "SELECT COUNT(*) AS rc FROM " + name;
-                sqlite3_stmt* stmt2 = NULL;
-                rc = sqlite3_prepare_v2(db, sql2.c_str(), (int)(sql2.size()), &stmt2, NULL);
-                if (rc == SQLITE_OK)
-                {
-                    it->setDbFile(mmPath);
-                    
-                    if (sqlite3_step(stmt2) == SQLITE_ROW)
-                    {
-                        recordCount = sqlite3_column_int(stmt2, 0);
-                        it->setRecordCount(recordCount);
-                    }
-                    
-                    sqlite3_finalize(stmt2);
-                    
-                    /*
-                    uint32_t lastCreateTime = 0;
-                    std::string sql3 = "SELECT MAX(CreateTime) AS lct FROM " + name;
-                    sqlite3_stmt* stmt3 = NULL;
-                    rc = sqlite3_prepare_v2(db, sql3.c_str(), (int)(sql3.size()), &stmt3, NULL);
-                    if (rc == SQLITE_OK)
-                    {
-                        if (sqlite3_step(stmt3) == SQLITE_ROW)
-                        {
-                            lastCreateTime = sqlite3_column_int(stmt3, 0);
-                        }
-                        sqlite3_finalize(stmt3);
-                    }
+                parseChatTable(user, db, mmPath, name, *it);
+            }
+            else
+            {
+                // ASSERT (false)
+            }
+            
+        }
+    }
+    
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    
+    return true;
+}
 
-                    it = deletedSessions.emplace(deletedSessions.cend(), "", chatId, &user);
-                    it->setDbFile(mmPath);
-                    it->setLastMessageTime(lastCreateTime);
-                    it->setRecordCount(recordCount);
-                    */
-                }
-                
-                sql2 = "SELECT CreateTime,Des,Message,Type FROM " + name + " ORDER BY CreateTime DESC LIMIT 1";
-                rc = sqlite3_prepare_v2(db, sql2.c_str(), (int)(sql2.size()), &stmt2, NULL);
-                if (rc == SQLITE_OK)
+bool SessionsParser::parseChatTable(const Friend& user, sqlite3 *db, const std::string& mmPath, const std::string& tableName, Session& session)
+{
+    int recordCount = 0;
+    std::string sql2 = "SELECT COUNT(*) AS rc FROM " + tableName;
+    sqlite3_stmt* stmt2 = NULL;
+    int rc = sqlite3_prepare_v2(db, sql2.c_str(), (int)(sql2.size()), &stmt2, NULL);
+    if (rc == SQLITE_OK)
+    {
+        session.setDbFile(mmPath);
+        
+        if (sqlite3_step(stmt2) == SQLITE_ROW)
+        {
+            recordCount = sqlite3_column_int(stmt2, 0);
+            session.setRecordCount(recordCount);
+        }
+        
+        sqlite3_finalize(stmt2);
+        
+        /*
+        uint32_t lastCreateTime = 0;
+        std::string sql3 = "SELECT MAX(CreateTime) AS lct FROM " + tableName;
+        sqlite3_stmt* stmt3 = NULL;
+        rc = sqlite3_prepare_v2(db, sql3.c_str(), (int)(sql3.size()), &stmt3, NULL);
+        if (rc == SQLITE_OK)
+        {
+            if (sqlite3_step(stmt3) == SQLITE_ROW)
+            {
+                lastCreateTime = sqlite3_column_int(stmt3, 0);
+            }
+            sqlite3_finalize(stmt3);
+        }
+
+        it = deletedSessions.emplace(deletedSessions.cend(), "", chatId, &user);
+        it->setDbFile(mmPath);
+        it->setLastMessageTime(lastCreateTime);
+        it->setRecordCount(recordCount);
+        */
+    }
+    
+    sql2 = "SELECT CreateTime,Des,Message,Type FROM " + tableName + " ORDER BY CreateTime DESC LIMIT 1";
+    rc = sqlite3_prepare_v2(db, sql2.c_str(), (int)(sql2.size()), &stmt2, NULL);
+    if (rc == SQLITE_OK)
+    {
+        if (sqlite3_step(stmt2) == SQLITE_ROW)
+        {
+            sqlite3_int64 lastCreateTime = sqlite3_column_int64(stmt2, 0);
+            int des = sqlite3_column_int(stmt2, 1);
+            const unsigned char *pMsg = sqlite3_column_text(stmt2, 2);
+            int type = sqlite3_column_int(stmt2, 3);
+            
+            session.setLastMessageTime((unsigned int)lastCreateTime);
+            if (NULL != pMsg)
+            {
+                std::string msg = (const char *)pMsg;
+                if (session.isChatroom())
                 {
-                    if (sqlite3_step(stmt2) == SQLITE_ROW)
+                    if (des != 0)
                     {
-                        sqlite3_int64 lastCreateTime = sqlite3_column_int64(stmt2, 0);
-                        int des = sqlite3_column_int(stmt2, 1);
-                        const unsigned char *pMsg = sqlite3_column_text(stmt2, 2);
-                        int type = sqlite3_column_int(stmt2, 3);
-                        
-                        it->setLastMessageTime((unsigned int)lastCreateTime);
-                        if (NULL != pMsg)
+                        std::string::size_type enter = msg.find(":\n");
+                        if (enter != std::string::npos && enter + 2 < msg.size())
                         {
-                            std::string msg = (const char *)pMsg;
-                            if (it->isChatroom())
+                            std::string senderId = msg.substr(0, enter);
+                            
+                            session.setLastMessageUsrName(senderId, m_friends);
+                            if (type == 1)
                             {
-                                if (des != 0)
-                                {
-                                    std::string::size_type enter = msg.find(":\n");
-                                    if (enter != std::string::npos && enter + 2 < msg.size())
-                                    {
-                                        std::string senderId = msg.substr(0, enter);
-                                        
-                                        it->setLastMessageUsrName(senderId, m_friends);
-                                        if (type == 1)
-                                        {
-                                            msg = msg.substr(enter + 2);
-                                            it->setLastMessage(msg);
-                                        }
-                                        else
-                                        {
-                                            // it->setLastMessage("");
-                                        }
-                                    }
-                                }
-                                else
-                                {
-                                    // Me
-                                    
-                                    it->setLastMessageUsrName(user.getUsrName(), user.getDisplayName());
-                                    if (type == 1)
-                                    {
-                                        it->setLastMessage(msg);
-                                    }
-                                    else
-                                    {
-                                        // it->setLastMessage("-");
-                                    }
-                                }
+                                msg = msg.substr(enter + 2);
+                                session.setLastMessage(msg);
                             }
                             else
                             {
-                                if (des != 0)
-                                {
-                                    it->setLastMessageUsrName(it->getUsrName(), m_friends);
-                                }
-                                else
-                                {
-                                    // Me
-                                    it->setLastMessageUsrName(user.getUsrName(), user.getDisplayName());
-                                }
-                                if (type == 1)
-                                {
-                                    it->setLastMessage(msg);
-                                }
-                                else
-                                {
-                                    // it->setLastMessage("-");
-                                }
+                                // session.setLastMessage("");
                             }
                         }
                     }
-
-                    sqlite3_finalize(stmt2);
-                    
+                    else
+                    {
+                        // Me
+                        
+                        session.setLastMessageUsrName(user.getUsrName(), user.getDisplayName());
+                        if (type == 1)
+                        {
+                            session.setLastMessage(msg);
+                        }
+                        else
+                        {
+                            // session.setLastMessage("-");
+                        }
+                    }
+                }
+                else
+                {
+                    if (des != 0)
+                    {
+                        session.setLastMessageUsrName(session.getUsrName(), m_friends);
+                    }
+                    else
+                    {
+                        // Me
+                        session.setLastMessageUsrName(user.getUsrName(), user.getDisplayName());
+                    }
+                    if (type == 1)
+                    {
+                        session.setLastMessage(msg);
+                    }
+                    else
+                    {
+                        // session.setLastMessage("-");
+                    }
                 }
             }
-            else
-            {
-                // ASSERT (false)
-            }
-            
         }
+
+        sqlite3_finalize(stmt2);
+        
     }
     
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    
     return true;
 }
 
@@ -1707,7 +1882,7 @@ bool SessionsParser::parseCellData(const std::string& userRoot, Session& session
             unsigned int modifiedTime = 0;
             if (items.size() > 1)
             {
-                modifiedTime = ITunesDb::parseModifiedTime((*it)->blob);
+                modifiedTime = ITunesDb::getModifiedTime(*it);
             }
             if (session.isDisplayNameEmpty() || (!displayName.empty() && modifiedTime > lastModifiedTime))
             {
@@ -1734,154 +1909,106 @@ bool SessionsParser::parseSessionsInGroupApp(const std::string& userRoot, std::v
     SessionHashCompare comp;
     std::sort(sessions.begin(), sessions.end(), comp);
     
-    std::string sessionDataArchivePath = m_iTunesDbShare->findRealPath(combinePath(userRoot, "session", "sessionData.archive"));
-    if (!sessionDataArchivePath.empty())
+    std::string archives[] = {"sessionData.archive", "extraSessionExtraSessionData.archive"};
+    size_t numberOfArchives = sizeof(archives) / sizeof(std::string);
+    for (size_t idx = 0; idx < numberOfArchives; ++idx)
     {
-        std::vector<unsigned char> contents;
-        if (readFile(sessionDataArchivePath, contents))
+        std::vector<std::pair<std::string, std::string>> names;
+        std::string archivePath = m_iTunesDbShare->findRealPath(combinePath(userRoot, "session", archives[idx]));
+        if (archivePath.empty() || !parseSessionDataArchive(archivePath, names))
         {
-            RawMessage msg;
-            if (msg.merge(reinterpret_cast<const char *>(&contents[0]), static_cast<int>(contents.size())))
-            {
-                std::string value;
-                if (msg.parse("1", value))
-                {
-                    uint32_t blockLen = 0;
-                    const char * data = value.c_str();
-                    const char * data1 = NULL;
-                    while ((data1 = calcVarint32Ptr(data, value.c_str() + value.size(), &blockLen)) != NULL)
-                    {
-                        RawMessage msg2;
-                        if (msg2.merge(data1, static_cast<int>(blockLen)))
-                        {
-                            std::string usrName;
-                            if (msg2.parse("1", usrName))
-                            {
-                                Session* session = NULL;
-                                std::map<std::string, Session*>::iterator it = sessionMap.find(usrName);
-                                if (it != sessionMap.end())
-                                {
-                                    session = it->second;
-                                }
-                                else
-                                {
-                                    std::string uidHash = md5(usrName);
-                                    std::vector<Session>::iterator it = std::lower_bound(sessions.begin(), sessions.end(), uidHash, comp);
-                                    if (it != sessions.end() && it->getHash() == uidHash)
-                                    {
-                                        session = &(*it);
-                                        if (it->isUsrNameEmpty())
-                                        {
-                                            it->setUsrName(usrName);
-                                            sessionMap.insert(sessionMap.cend(), std::make_pair<>(usrName, session));
-                                        }
-                                    }
-                                }
-                                
-                                if (NULL != session && session->isDisplayNameEmpty())
-                                {
-                                    std::string nameCand1;
-                                    std::string nameCand2;
-                                    if (msg2.parse("2", nameCand1))
-                                    {
-                                        // nameCand1 = value2;
-                                    }
-                                    if (!msg2.parse("3", nameCand2))
-                                    {
-                                        nameCand2 = "";
-                                    }
-                                    session->setDisplayName(nameCand2.empty() ? nameCand1 : nameCand2);
-                                }
-                            }
-                        }
-            
-                        data = data1 + blockLen;
-                    }
-                }
-            }
+            continue;
         }
-    }
-    
-    std::string extraSessionDataArchivePath = m_iTunesDbShare->findRealPath(combinePath(userRoot, "session", "extraSessionExtraSessionData.archive"));
-    if (!extraSessionDataArchivePath.empty())
-    {
-        std::vector<unsigned char> contents;
-        if (readFile(extraSessionDataArchivePath, contents))
+        
+        for (std::vector<std::pair<std::string, std::string>>::const_iterator itName = names.cbegin(); itName != names.cend(); ++itName)
         {
-            RawMessage msg;
-            if (msg.merge(reinterpret_cast<const char *>(&contents[0]), static_cast<int>(contents.size())))
+            const std::string& usrName = itName->first;
+            Session* session = NULL;
+            std::map<std::string, Session*>::iterator it = sessionMap.find(usrName);
+            if (it != sessionMap.end())
+            {
+                session = it->second;
+            }
+            else
             {
-                std::string value;
-                if (msg.parse("1", value))
+                std::string uidHash = md5(usrName);
+                std::vector<Session>::iterator it = std::lower_bound(sessions.begin(), sessions.end(), uidHash, comp);
+                if (it != sessions.end() && it->getHash() == uidHash)
                 {
-                    uint32_t blockLen = 0;
-                    const char * data = value.c_str();
-                    const char * data1 = NULL;
-                    while ((data1 = calcVarint32Ptr(data, value.c_str() + value.size(), &blockLen)) != NULL)
+                    session = &(*it);
+                    if (it->isUsrNameEmpty())
                     {
-                        RawMessage msg2;
-                        if (msg2.merge(data1, static_cast<int>(blockLen)))
-                        {
-                            std::string value2;
-                            if (msg2.parse("1", value2))
-                            {
-                                Session* session = NULL;
-                                std::map<std::string, Session*>::iterator it = sessionMap.find(value2);
-                                if (it != sessionMap.end())
-                                {
-                                    session = it->second;
-                                }
-                                else
-                                {
-                                    std::string uidHash = md5(value2);
-                                    std::vector<Session>::iterator it = std::lower_bound(sessions.begin(), sessions.end(), uidHash, comp);
-                                    if (it != sessions.end() && it->getHash() == uidHash)
-                                    {
-                                        session = &(*it);
-                                        if (it->isUsrNameEmpty())
-                                        {
-                                            it->setUsrName(value2);
-                                            sessionMap.insert(sessionMap.cend(), std::make_pair<>(value2, session));
-                                        }
-                                    }
-                                }
-                                
-                                if (NULL != session && session->isDisplayNameEmpty())
-                                {
-                                    std::string name;
-                                    if (msg2.parse("2", value2))
-                                    {
-                                        name = value2;
-                                    }
-                                    if (!msg2.parse("3", value2))
-                                    {
-                                        value2 = "";
-                                    }
-                                    session->setDisplayName(value2.empty() ? name : value2);
-                                }
-                            }
-                        }
-            
-                        data = data1 + blockLen;
+                        it->setUsrName(usrName);
+                        sessionMap.insert(sessionMap.cend(), std::make_pair<>(usrName, session));
                     }
                 }
             }
+            
+            if (NULL != session && session->isDisplayNameEmpty())
+            {
+                session->setDisplayName(itName->second);
+            }
         }
     }
     
     // copy avatar
     for (std::vector<Session>::iterator it = sessions.begin(); it != sessions.end(); ++it)
     {
-        std::string avatarPath = m_iTunesDbShare->findRealPath(combinePath(userRoot, "session", "headImg", it->getHash() + ".pic"));
-        if (!avatarPath.empty() && !Friend::isDefaultAvatar(avatarPath))
+        parseSessionAvatar(userRoot, *it);
+    }
+
+    return true;
+}
+
+bool SessionsParser::parseSessionDataArchive(const std::string& archivePath, std::vector<std::pair<std::string, std::string>>& names)
+{
+    std::vector<unsigned char> contents;
+    if (!readFile(archivePath, contents) || contents.empty())
+    {
+        return false;
+    }
+    
+    RawMessage msg;
+    std::string value;
+    if (!msg.merge(reinterpret_cast<const char *>(&contents[0]), static_cast<int>(contents.size())) || !msg.parse("1", value))
+    {
+        return false;
+    }
+    
+    uint32_t blockLen = 0;
+    const char * data = value.c_str();
+    const char * data1 = NULL;
+    while ((data1 = calcVarint32Ptr(data, value.c_str() + value.size(), &blockLen)) != NULL)
+    {
+        RawMessage msg2;
+        std::string usrName;
+        if (msg2.merge(data1, static_cast<int>(blockLen)) && msg2.parse("1", usrName))
         {
-            it->setPortrait("file://" + avatarPath);
+            std::string nameCand1;
+            std::string nameCand2;
+            msg2.parse("2", nameCand1);
+            if (!msg2.parse("3", nameCand2))
+            {
+                nameCand2 = "";
+            }
+            names.push_back(std::make_pair(usrName, nameCand2.empty() ? nameCand1 : nameCand2));
         }
-    }
 
+        data = data1 + blockLen;
+    }
+    
     return true;
 }
 
+void SessionsParser::parseSessionAvatar(const std::string& userRoot, Session& session)
+{
+    std::string avatarPath = m_iTunesDbShare->findRealPath(combinePath(userRoot, "session", "headImg", session.getHash() + ".pic"));
+    if (!avatarPath.empty() && !Friend::isDefaultAvatar(avatarPath))
+    {
+        session.setPortrait("file://" + avatarPath);
+    }
+}
+
 SessionParser::SessionParser(const ExportOption& options) : m_options(options)
 {
 }
@@ -1927,6 +2054,59 @@ uint32_t SessionParser::calcNumberOfMessages(const Session& session, uint64_t mi
     return recordCount;
 }
 
+bool SessionParser::queryMaxIds(const std::string& dbFile, const std::vector<std::string>& sessionHashes, std::map<std::string, int64_t>& maxIds)
+{
+    sqlite3* db = NULL;
+    int rc = openSqlite3Database(dbFile, &db);
+    if (rc != SQLITE_OK)
+    {
+        if (NULL != db)
+        {
+            sqlite3_close(db);
+            db = NULL;
+        }
+        return false;
+    }
+    
+    // SQLITE_MAX_COMPOUND_SELECT is 500 by default
+    const size_t tablesPerQuery = 256;
+    bool succeeded = true;
+    for (size_t start = 0; start < sessionHashes.size(); start += tablesPerQuery)
+    {
+        size_t end = std::min(start + tablesPerQuery, sessionHashes.size());
+        std::string sql;
+        for (size_t idx = start; idx < end; ++idx)
+        {
+            if (idx > start)
+            {
+                sql += " UNION ALL ";
+            }
+            // The hash is md5 in hex, no quote to escape
+            sql += "SELECT '" + sessionHashes[idx] + "',MAX(MesLocalID) FROM Chat_" + sessionHashes[idx];
+        }
+        
+        sqlite3_stmt* stmt = NULL;
+        rc = sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL);
+        if (rc != SQLITE_OK)
+        {
+            succeeded = false;
+            continue;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const char* hash = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            if (NULL != hash)
+            {
+                maxIds[hash] = sqlite3_column_int64(stmt, 1);
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    
+    return succeeded;
+}
+
 struct MSG_ENUMERATOR_CONTEXT
 {
     sqlite3* db;
@@ -15,6 +15,7 @@
 #include <vector>
 #include <atomic>
 #include <map>
+#include <sqlite3.h>
 #include "Utils.h"
 #include "Downloader.h"
 #include "WechatObjects.h"
@@ -307,19 +308,39 @@ private:
     const Friends&  m_friends;
     bool            m_detailedInfo;
     Logger*         m_logger;
+    
+    // States of parseSessionDetails, built on its first call
+    bool                                m_detailsPrepared;
+    std::map<std::string, std::string>  m_chatTables;      // session hash => message db
+    std::map<std::string, sqlite3 *>    m_messageDbs;      // message db => opened connection
+    std::map<std::string, std::string>  m_groupAppNames;   // usrName => display name in the group app
 
 public:
     SessionsParser(ITunesDb *iTunesDb, ITunesDb *iTunesDbShare, const Friends& friends, const std::string& cellDataVersion, Logger* logger, bool detailedInfo = true);
+    ~SessionsParser();
     
     bool parse(const Friend& user, std::vector<Session>& sessions);
+    
+    // Lazy loading: parseSessions only reads the sessions from session.db(usrName, create time, unread count
+    // and the names of friends), the message count, last message and display name of each session are
+    // filled later by parseSessionDetails
+    bool parseSessions(const Friend& user, std::vector<Session>& sessions);
+    bool parseSessionDetails(const Friend& user, Session& session);
 
 private:
+    bool parseSessionDb(const Friend& user, const std::string& userRoot, std::vector<Session>& sessions);
     bool parseUniversalSessions(const Friend& user, const std::string& userRoot, std::vector<Session>& sessions);
     bool parseCellData(const std::string& userRoot, Session& session);
     bool parseMessageDbs(const Friend& user, const std::string& userRoot, std::vector<Session>& sessions);
     bool parseMessageDb(const Friend& user, const std::string& mmPath, std::vector<Session>& sessions, std::vector<Session>& deletedSessions);
+    bool parseChatTable(const Friend& user, sqlite3 *db, const std::string& mmPath, const std::string& tableName, Session& session);
     
     bool parseSessionsInGroupApp(const std::string& userRoot, std::vector<Session>& sessions);
+    bool parseSessionDataArchive(const std::string& archivePath, std::vector<std::pair<std::string, std::string>>& names);
+    void parseSessionAvatar(const std::string& userRoot, Session& session);
+    
+    void prepareSessionDetails(const Friend& user);
+    void assignEmptyUsrNames(std::vector<Session>& sessions);
     
     bool parseDisplayNameFromMembers(const Friend& user, Session& session);
     
@@ -354,6 +375,8 @@ public:
 
     MessageEnumerator* buildMsgEnumerator(const Session& session, uint64_t minId);
     static uint32_t calcNumberOfMessages(const Session& session, uint64_t minId);
+    // MAX(MesLocalID) of the chat tables(Chat_<hash>) in one message database, batched into compound selects
+    static bool queryMaxIds(const std::string& dbFile, const std::vector<std::string>& sessionHashes, std::map<std::string, int64_t>& maxIds);
 };
 
 
@@ -7,6 +7,7 @@
 //
 
 #include "XmlParser.h"
+#include <cassert>
 
 struct NodeValueHandler
 {
@@ -235,3 +236,223 @@ bool XmlParser::parseAttributesValue(const std::string& xpath, std::map<std::str
     AttributesHandler handler = {attributes};
     return parseWithHandler(xpath, handler);
 }
+
+XmlStreamParser::Schema::Schema(std::initializer_list<const char *> paths)
+{
+    for (std::initializer_list<const char *>::const_iterator it = paths.begin(); it != paths.end(); ++it)
+    {
+        std::string path = *it;
+        std::string attribute;
+        bool children = false;
+        std::string::size_type pos = path.rfind('/');
+        if (pos != std::string::npos && pos + 1 < path.size() && path[pos + 1] == '@')
+        {
+            attribute = path.substr(pos + 2);
+            path.resize(pos);
+        }
+        else if (pos != std::string::npos && path.compare(pos, std::string::npos, "/*") == 0)
+        {
+            children = true;
+            path.resize(pos);
+        }
+        
+        std::map<std::string, Entry>::iterator itEntry = m_entries.find(path);
+        if (itEntry == m_entries.end())
+        {
+            itEntry = m_entries.insert(itEntry, std::make_pair(path, Entry(m_entries.size())));
+        }
+        if (!attribute.empty())
+        {
+            itEntry->second.attributes.push_back(attribute);
+        }
+        else if (children)
+        {
+            itEntry->second.children = true;
+        }
+        else
+        {
+            itEntry->second.text = true;
+        }
+    }
+}
+
+XmlStreamParser::XmlStreamParser(const Schema& schema, const std::string& xml, bool noError/* = false*/) : m_schema(schema), m_values(schema.m_entries.size()), m_valid(false)
+{
+    parse(xml, noError);
+}
+
+void XmlStreamParser::parse(const std::string& xml, bool noError)
+{
+    int options = XML_PARSE_RECOVER;
+    if (noError)
+    {
+        options |= XML_PARSE_NOERROR | XML_PARSE_NOWARNING;
+    }
+    xmlTextReaderPtr reader = xmlReaderForMemory(xml.c_str(), static_cast<int>(xml.size()), NULL, NULL, options);
+    if (NULL == reader)
+    {
+        return;
+    }
+    
+    struct Frame
+    {
+        size_t pathLength;
+        const Schema::Entry* entry;
+        std::string* sinks[2];  // inner text of the element itself and/or as a child of a "/*" entry
+    };
+    
+    std::string path;
+    std::vector<Frame> frames;
+    frames.reserve(16);
+    
+    while (xmlTextReaderRead(reader) == 1)
+    {
+        int nodeType = xmlTextReaderNodeType(reader);
+        if (nodeType == XML_READER_TYPE_ELEMENT)
+        {
+            m_valid = true;
+            const char* name = reinterpret_cast<const char *>(xmlTextReaderConstLocalName(reader));
+            Frame frame = { path.size(), NULL, { NULL, NULL } };
+            path.append("/").append(NULL == name ? "" : name);
+            
+            const Schema::Entry* entry = m_schema.findEntry(path);
+            if (NULL != entry)
+            {
+                Value& value = m_values[entry->index];
+                if (!value.found)
+                {
+                    value.found = true;
+                    if (entry->text)
+                    {
+                        frame.sinks[0] = &value.text;
+                    }
+                    for (std::vector<std::string>::const_iterator it = entry->attributes.cbegin(); it != entry->attributes.cend(); ++it)
+                    {
+                        xmlChar* attr = xmlTextReaderGetAttribute(reader, BAD_CAST(it->c_str()));
+                        if (NULL != attr)
+                        {
+                            value.attributes[*it] = reinterpret_cast<char *>(attr);
+                            xmlFree(attr);
+                        }
+                    }
+                }
+                if (entry->children)
+                {
+                    frame.entry = entry;
+                }
+            }
+            
+            if (!frames.empty() && NULL != frames.back().entry)
+            {
+                // Child of "/*" entry, the later one wins as XmlParser::parseNodesValue does
+                Value& parentValue = m_values[frames.back().entry->index];
+                parentValue.hasChildren = true;
+                std::string& childText = parentValue.children[NULL == name ? "" : name];
+                childText.clear();
+                frame.sinks[1] = &childText;
+            }
+            
+            if (xmlTextReaderIsEmptyElement(reader))
+            {
+                path.resize(frame.pathLength);
+            }
+            else
+            {
+                frames.push_back(frame);
+            }
+        }
+        else if (nodeType == XML_READER_TYPE_END_ELEMENT)
+        {
+            if (!frames.empty())
+            {
+                path.resize(frames.back().pathLength);
+                frames.pop_back();
+            }
+        }
+        else if (nodeType == XML_READER_TYPE_TEXT || nodeType == XML_READER_TYPE_CDATA || nodeType == XML_READER_TYPE_WHITESPACE || nodeType == XML_READER_TYPE_SIGNIFICANT_WHITESPACE)
+        {
+            // Inner text includes the text of all descendants, same as xmlNodeGetContent
+            const char* text = reinterpret_cast<const char *>(xmlTextReaderConstValue(reader));
+            if (NULL == text)
+            {
+                continue;
+            }
+            for (std::vector<Frame>::iterator it = frames.begin(); it != frames.end(); ++it)
+            {
+                if (NULL != it->sinks[0])
+                {
+                    it->sinks[0]->append(text);
+                }
+                if (NULL != it->sinks[1])
+                {
+                    it->sinks[1]->append(text);
+                }
+            }
+        }
+    }
+    
+    xmlFreeTextReader(reader);
+}
+
+bool XmlStreamParser::parseNodeValue(const std::string& xpath, std::string& value) const
+{
+    const Schema::Entry* entry = m_schema.findEntry(xpath);
+    if (NULL == entry || !entry->text)
+    {
+        assert(!"xpath is not declared in schema");
+        return false;
+    }
+    const Value& v = m_values[entry->index];
+    if (!v.found)
+    {
+        return false;
+    }
+    value = v.text;
+    return true;
+}
+
+bool XmlStreamParser::parseNodesValue(const std::string& xpath, std::map<std::string, std::string>& values) const
+{
+    const Schema::Entry* entry = NULL;
+    if (xpath.size() > 2 && xpath.compare(xpath.size() - 2, 2, "/*") == 0)
+    {
+        entry = m_schema.findEntry(xpath.substr(0, xpath.size() - 2));
+    }
+    if (NULL == entry || !entry->children)
+    {
+        assert(!"xpath is not declared in schema");
+        return false;
+    }
+    const Value& v = m_values[entry->index];
+    if (!v.hasChildren)
+    {
+        return false;
+    }
+    for (std::map<std::string, std::string>::iterator it = values.begin(); it != values.end(); ++it)
+    {
+        std::map<std::string, std::string>::const_iterator itChild = v.children.find(it->first);
+        if (itChild != v.children.cend())
+        {
+            it->second = itChild->second;
+        }
+    }
+    return true;
+}
+
+bool XmlStreamParser::parseAttributeValue(const std::string& xpath, const std::string& attributeName, std::string& value) const
+{
+    const Schema::Entry* entry = m_schema.findEntry(xpath);
+    if (NULL == entry)
+    {
+        assert(!"xpath is not declared in schema");
+        return false;
+    }
+    const Value& v = m_values[entry->index];
+    std::map<std::string, std::string>::const_iterator it = v.attributes.find(attributeName);
+    if (it == v.attributes.cend())
+    {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
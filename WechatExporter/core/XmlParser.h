@@ -12,9 +12,12 @@
 #include <cstdio>
 #include <string>
 #include <map>
+#include <vector>
+#include <initializer_list>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
+#include <libxml/xmlreader.h>
 
 class XmlParser;
 
@@ -97,6 +100,76 @@ private:
     xmlXPathContextPtr m_xpathCtx;
 };
 
+// Pulls the values declared in a schema out of the xml in one forward pass(xmlTextReader), no DOM or XPath
+// context is built. The query functions mirror the ones of XmlParser, so handlers can take either of them,
+// but only the paths declared in the schema can be queried:
+//   "/a/b"         inner text of the first b
+//   "/a/b/@attr"   attribute of the first b
+//   "/a/b/*"       inner text of the children of b, for parseNodesValue("/a/b/*", ...)
+class XmlStreamParser
+{
+public:
+    class Schema
+    {
+    public:
+        Schema(std::initializer_list<const char *> paths);
+        
+    private:
+        friend class XmlStreamParser;
+        
+        struct Entry
+        {
+            size_t index;
+            bool text;
+            bool children;
+            std::vector<std::string> attributes;
+            
+            Entry(size_t idx) : index(idx), text(false), children(false)
+            {
+            }
+        };
+        
+        const Entry* findEntry(const std::string& path) const
+        {
+            std::map<std::string, Entry>::const_iterator it = m_entries.find(path);
+            return it == m_entries.cend() ? NULL : &(it->second);
+        }
+        
+        std::map<std::string, Entry> m_entries;
+    };
+    
+    XmlStreamParser(const Schema& schema, const std::string& xml, bool noError = false);
+    
+    bool isValid() const
+    {
+        return m_valid;
+    }
+    
+    bool parseNodeValue(const std::string& xpath, std::string& value) const;
+    bool parseNodesValue(const std::string& xpath, std::map<std::string, std::string>& values) const;  // e.g.: /path1/path2/*
+    bool parseAttributeValue(const std::string& xpath, const std::string& attributeName, std::string& value) const;
+    
+private:
+    struct Value
+    {
+        bool found;
+        bool hasChildren;
+        std::string text;
+        std::map<std::string, std::string> attributes;
+        std::map<std::string, std::string> children;
+        
+        Value() : found(false), hasChildren(false)
+        {
+        }
+    };
+    
+    void parse(const std::string& xml, bool noError);
+    
+    const Schema& m_schema;
+    std::vector<Value> m_values;
+    bool m_valid;
+};
+
 inline std::string XmlParser::getNodeInnerText(xmlNodePtr node)
 {
     if (NULL == node->children)
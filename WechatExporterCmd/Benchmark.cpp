@@ -0,0 +1,1174 @@
+//
+//  Benchmark.cpp
+//  WechatExporterCmd
+//
+//  Created by Matthew on 2022/5/14.
+//
+
+#include "Benchmark.h"
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sqlite3.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+#include "FileSystem.h"
+#include "Tracer.h"
+#include "AsyncLogger.h"
+#include "ITunesParser.h"
+#include "MessageParser.h"
+#include "TaskManager.h"
+#include "ResManager.h"
+
+// Writes a synthetic iTunes backup: Manifest.db + hashed files, which is good enough for Exporter to run through
+class SyntheticBackupGenerator
+{
+public:
+    SyntheticBackupGenerator(const std::string& backupDir, const BenchmarkConfig& config) : m_backupDir(backupDir), m_config(config), m_random(config.seed), m_manifestDb(NULL), m_stmt(NULL), m_numberOfFiles(0), m_numberOfMessages(0)
+    {
+    }
+
+    ~SyntheticBackupGenerator()
+    {
+        closeManifest();
+    }
+
+    uint64_t getNumberOfFiles() const
+    {
+        return m_numberOfFiles;
+    }
+
+    uint64_t getNumberOfMessages() const
+    {
+        return m_numberOfMessages;
+    }
+
+    bool generate()
+    {
+        if (!existsDirectory(m_backupDir) && !makeDirectory(m_backupDir))
+        {
+            return false;
+        }
+        if (!openManifest())
+        {
+            return false;
+        }
+
+        const std::string userHash = md5(BENCH_ACCOUNT_USRNAME);
+        const std::string userRoot = "Documents/" + userHash;
+
+        writeFile(combinePath(m_backupDir, "Info.plist"), buildPlist("<key>Device Name</key><string>Benchmark</string><key>Display Name</key><string>Benchmark</string><key>Product Version</key><string>15.4</string><key>iTunes Version</key><string>12.12</string><key>Last Backup Date</key><date>2022-05-14T00:00:00Z</date>"));
+        writeFile(combinePath(m_backupDir, "Manifest.plist"), buildPlist("<key>IsEncrypted</key><false/><key>Lockdown</key><dict><key>ProductVersion</key><string>15.4</string></dict>"));
+
+        addFile(BENCH_DOMAIN_APP, "Library/Preferences/com.tencent.xin.plist", buildPlist("<key>prevStartupVersions</key><array><string>8.0.20</string></array>"));
+        addFile(BENCH_DOMAIN_APP, userRoot + "/mmsetting.archive", buildKeyedArchive(BENCH_ACCOUNT_USRNAME, BENCH_ACCOUNT_NAME));
+
+        // Members are shared by all chatrooms, other sessions are 1:1 chats with friends
+        std::vector<std::string> members;
+        for (unsigned int idx = 0; idx < m_config.numberOfMembers; ++idx)
+        {
+            members.push_back("wxid_benchmember" + std::to_string(idx));
+        }
+        std::vector<std::string> sessions;
+        for (unsigned int idx = 0; idx < m_config.numberOfSessions; ++idx)
+        {
+            sessions.push_back(idx < m_config.numberOfChatrooms ? ("1000" + std::to_string(idx) + "@chatroom") : ("wxid_benchfriend" + std::to_string(idx)));
+        }
+
+        bool result = buildContactDb(userRoot, sessions, members) && buildSessionDb(userRoot, sessions) && buildMessageDbs(userRoot, sessions, members);
+
+        // Avatars in shared domain
+        for (std::vector<std::string>::const_iterator it = sessions.cbegin(); it != sessions.cend(); ++it)
+        {
+            addFile(BENCH_DOMAIN_GROUP, "share/" + userHash + "/session/headImg/" + md5(*it) + ".pic", buildMedia(2048));
+        }
+
+        return closeManifest() && result;
+    }
+
+protected:
+    std::string buildPlist(const std::string& body) const
+    {
+        return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n<plist version=\"1.0\"><dict>" + body + "</dict></plist>\n";
+    }
+
+    std::string buildKeyedArchive(const std::string& usrName, const std::string& displayName) const
+    {
+        return buildPlist("<key>$archiver</key><string>NSKeyedArchiver</string><key>$objects</key><array><string>$null</string>"
+                          "<dict><key>UsrName</key><dict><key>CF$UID</key><integer>2</integer></dict><key>NickName</key><dict><key>CF$UID</key><integer>3</integer></dict><key>AliasName</key><dict><key>CF$UID</key><integer>4</integer></dict></dict>"
+                          "<string>" + usrName + "</string><string>" + displayName + "</string><string>" + usrName + "</string></array>"
+                          "<key>$top</key><dict><key>root</key><dict><key>CF$UID</key><integer>1</integer></dict></dict><key>$version</key><integer>100000</integer>");
+    }
+
+    static void appendVarint(std::string& data, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        data.push_back(static_cast<char>(value));
+    }
+
+    static void appendProtobufString(std::string& data, uint32_t field, const std::string& value)
+    {
+        appendVarint(data, (field << 3) | 2);
+        appendVarint(data, value.size());
+        data.append(value);
+    }
+
+    std::vector<unsigned char> buildMedia(size_t size)
+    {
+        // JPEG SOI + random payload, the content is never decoded
+        std::vector<unsigned char> data(size);
+        for (size_t idx = 0; idx < size; ++idx)
+        {
+            data[idx] = static_cast<unsigned char>(m_random() & 0xFF);
+        }
+        if (size >= 2)
+        {
+            data[0] = 0xFF;
+            data[1] = 0xD8;
+        }
+        return data;
+    }
+
+    std::string buildText(size_t numberOfWords)
+    {
+        static const char* words[] = {"hello", "ok", "thanks", "tomorrow", "meeting", "lunch", "好的", "明天见", "收到", "谢谢", "哈哈哈", "[Smile]", "[Grin]", "<b>", "&amp;", "\"quoted\""};
+        std::string text;
+        for (size_t idx = 0; idx < numberOfWords; ++idx)
+        {
+            if (idx > 0)
+            {
+                text.push_back(' ');
+            }
+            text.append(words[m_random() % (sizeof(words) / sizeof(const char *))]);
+        }
+        return text;
+    }
+
+    bool openManifest()
+    {
+        std::string dbPath = combinePath(m_backupDir, "Manifest.db");
+        deleteFile(dbPath);
+        if (SQLITE_OK != openSqlite3Database(dbPath, &m_manifestDb, false))
+        {
+            return false;
+        }
+        sqlite3_exec(m_manifestDb, "CREATE TABLE Files (fileID TEXT PRIMARY KEY, domain TEXT, relativePath TEXT, flags INTEGER, file BLOB);CREATE INDEX FilesDomainIdx ON Files(domain);CREATE INDEX FilesRelativePathIdx ON Files(relativePath);CREATE TABLE Properties (key TEXT PRIMARY KEY, value BLOB);BEGIN;", NULL, NULL, NULL);
+        std::string sql = "INSERT OR REPLACE INTO Files(fileID,domain,relativePath,flags,file) VALUES(?,?,?,1,NULL)";
+        return SQLITE_OK == sqlite3_prepare_v2(m_manifestDb, sql.c_str(), (int)(sql.size()), &m_stmt, NULL);
+    }
+
+    bool closeManifest()
+    {
+        if (NULL != m_stmt)
+        {
+            sqlite3_finalize(m_stmt);
+            m_stmt = NULL;
+        }
+        bool result = true;
+        if (NULL != m_manifestDb)
+        {
+            result = (SQLITE_OK == sqlite3_exec(m_manifestDb, "COMMIT;", NULL, NULL, NULL));
+            sqlite3_close(m_manifestDb);
+            m_manifestDb = NULL;
+        }
+        return result;
+    }
+
+    // Returns the real path of the file in the backup
+    std::string registerFile(const std::string& domain, const std::string& relativePath)
+    {
+        std::string fileId = sha1(domain + "-" + relativePath);
+        std::string dir = combinePath(m_backupDir, fileId.substr(0, 2));
+        if (!existsDirectory(dir))
+        {
+            makeDirectory(dir);
+        }
+
+        sqlite3_reset(m_stmt);
+        sqlite3_bind_text(m_stmt, 1, fileId.c_str(), (int)fileId.size(), SQLITE_TRANSIENT);
+        sqlite3_bind_text(m_stmt, 2, domain.c_str(), (int)domain.size(), SQLITE_TRANSIENT);
+        sqlite3_bind_text(m_stmt, 3, relativePath.c_str(), (int)relativePath.size(), SQLITE_TRANSIENT);
+        sqlite3_step(m_stmt);
+        ++m_numberOfFiles;
+
+        return combinePath(dir, fileId);
+    }
+
+    template<class T>
+    bool addFile(const std::string& domain, const std::string& relativePath, const T& data)
+    {
+        return writeFile(registerFile(domain, relativePath), data);
+    }
+
+    sqlite3* createDb(const std::string& relativePath, const char* schema)
+    {
+        std::string path = registerFile(BENCH_DOMAIN_APP, relativePath);
+        deleteFile(path);
+        sqlite3* db = NULL;
+        if (SQLITE_OK != openSqlite3Database(path, &db, false))
+        {
+            sqlite3_close(db);
+            return NULL;
+        }
+        sqlite3_exec(db, "PRAGMA journal_mode=OFF;PRAGMA synchronous=OFF;", NULL, NULL, NULL);
+        if (NULL != schema && SQLITE_OK != sqlite3_exec(db, schema, NULL, NULL, NULL))
+        {
+            sqlite3_close(db);
+            return NULL;
+        }
+        return db;
+    }
+
+    bool buildContactDb(const std::string& userRoot, const std::vector<std::string>& sessions, const std::vector<std::string>& members)
+    {
+        sqlite3* mmDb = createDb(userRoot + "/DB/MM.sqlite", "CREATE TABLE Friend_Ext(userName TEXT);");
+        if (NULL == mmDb)
+        {
+            return false;
+        }
+        sqlite3_close(mmDb);
+
+        sqlite3* db = createDb(userRoot + "/DB/WCDB_Contact.sqlite", "CREATE TABLE Friend(userName TEXT PRIMARY KEY, dbContactRemark BLOB, dbContactChatRoom BLOB, dbContactHeadImage BLOB, type INTEGER);CREATE TABLE OpenIMContact(userName TEXT PRIMARY KEY, dbContactRemark BLOB, dbContactChatRoom BLOB, dbContactHeadImage BLOB, type INTEGER);BEGIN;");
+        if (NULL == db)
+        {
+            return false;
+        }
+
+        std::string roomData = "<RoomData>";
+        for (std::vector<std::string>::const_iterator it = members.cbegin(); it != members.cend(); ++it)
+        {
+            roomData += "<Member UserName=\"" + *it + "\"><DisplayName>" + buildText(1) + "</DisplayName></Member>";
+        }
+        roomData += "</RoomData>";
+
+        std::string sql = "INSERT INTO Friend(userName,dbContactRemark,dbContactChatRoom,dbContactHeadImage,type) VALUES(?,?,?,NULL,?)";
+        sqlite3_stmt* stmt = NULL;
+        if (SQLITE_OK != sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL))
+        {
+            sqlite3_close(db);
+            return false;
+        }
+
+        std::vector<std::string> contacts(sessions);
+        contacts.insert(contacts.end(), members.cbegin(), members.cend());
+        for (std::vector<std::string>::const_iterator it = contacts.cbegin(); it != contacts.cend(); ++it)
+        {
+            bool chatroom = endsWith(*it, "@chatroom");
+            std::string remark;
+            appendProtobufString(remark, 1, (chatroom ? "Group " : "Friend ") + it->substr(it->size() - 4));
+            appendProtobufString(remark, 2, *it);
+            std::string chatroomData;
+            if (chatroom)
+            {
+                appendProtobufString(chatroomData, 6, roomData);
+            }
+
+            sqlite3_reset(stmt);
+            sqlite3_bind_text(stmt, 1, it->c_str(), (int)it->size(), SQLITE_TRANSIENT);
+            sqlite3_bind_blob(stmt, 2, remark.c_str(), (int)remark.size(), SQLITE_TRANSIENT);
+            sqlite3_bind_blob(stmt, 3, chatroomData.c_str(), (int)chatroomData.size(), SQLITE_TRANSIENT);
+            sqlite3_bind_int(stmt, 4, chatroom ? 2 : 3);
+            sqlite3_step(stmt);
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+        sqlite3_close(db);
+        return true;
+    }
+
+    bool buildSessionDb(const std::string& userRoot, const std::vector<std::string>& sessions)
+    {
+        sqlite3* db = createDb(userRoot + "/session/session.db", "CREATE TABLE SessionAbstract(UsrName TEXT PRIMARY KEY, ConStrRes1 TEXT, CreateTime INTEGER, unreadcount INTEGER);BEGIN;");
+        if (NULL == db)
+        {
+            return false;
+        }
+        std::string sql = "INSERT INTO SessionAbstract(UsrName,ConStrRes1,CreateTime,unreadcount) VALUES(?,NULL,?,0)";
+        sqlite3_stmt* stmt = NULL;
+        if (SQLITE_OK != sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL))
+        {
+            sqlite3_close(db);
+            return false;
+        }
+        for (std::vector<std::string>::const_iterator it = sessions.cbegin(); it != sessions.cend(); ++it)
+        {
+            sqlite3_reset(stmt);
+            sqlite3_bind_text(stmt, 1, it->c_str(), (int)it->size(), SQLITE_TRANSIENT);
+            sqlite3_bind_int(stmt, 2, BENCH_BASE_TIME);
+            sqlite3_step(stmt);
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+        sqlite3_close(db);
+        return true;
+    }
+
+    int pickMessageType()
+    {
+        unsigned int total = 0;
+        for (int idx = 0; idx < BENCH_MSG_MAX; ++idx)
+        {
+            total += m_config.mix[idx];
+        }
+        if (total == 0)
+        {
+            return BENCH_MSG_TEXT;
+        }
+        unsigned int value = m_random() % total;
+        for (int idx = 0; idx < BENCH_MSG_MAX; ++idx)
+        {
+            if (value < m_config.mix[idx])
+            {
+                return idx;
+            }
+            value -= m_config.mix[idx];
+        }
+        return BENCH_MSG_TEXT;
+    }
+
+    bool buildMessageDbs(const std::string& userRoot, const std::vector<std::string>& sessions, const std::vector<std::string>& members)
+    {
+        std::vector<sqlite3 *> dbs;
+        for (unsigned int idx = 1; idx <= m_config.numberOfMessageDbs; ++idx)
+        {
+            sqlite3* db = createDb(userRoot + "/DB/message_" + std::to_string(idx) + ".sqlite", "BEGIN;");
+            if (NULL == db)
+            {
+                break;
+            }
+            dbs.push_back(db);
+        }
+        if (dbs.size() != m_config.numberOfMessageDbs)
+        {
+            for (std::vector<sqlite3 *>::iterator it = dbs.begin(); it != dbs.end(); ++it)
+            {
+                sqlite3_close(*it);
+            }
+            return false;
+        }
+
+        int64_t msgSvrId = 1000000;
+        for (size_t sessionIdx = 0; sessionIdx < sessions.size(); ++sessionIdx)
+        {
+            const std::string& usrName = sessions[sessionIdx];
+            const std::string sessionHash = md5(usrName);
+            const bool chatroom = endsWith(usrName, "@chatroom");
+            sqlite3* db = dbs[sessionIdx % dbs.size()];
+
+            std::string table = "Chat_" + sessionHash;
+            std::string sql = "CREATE TABLE " + table + "(CreateTime INTEGER DEFAULT 0, Des INTEGER, ImgStatus INTEGER DEFAULT 0, MesLocalID INTEGER PRIMARY KEY AUTOINCREMENT, Message TEXT, MesSvrID INTEGER DEFAULT 0, Status INTEGER DEFAULT 0, TableVer INTEGER DEFAULT 1, Type INTEGER)";
+            sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+            sql = "INSERT INTO " + table + "(CreateTime,Des,MesLocalID,Message,MesSvrID,Status,TableVer,Type) VALUES(?,?,?,?,?,2,1,?)";
+            sqlite3_stmt* stmt = NULL;
+            if (SQLITE_OK != sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL))
+            {
+                continue;
+            }
+
+            unsigned int createTime = BENCH_BASE_TIME;
+            for (unsigned int msgIdx = 1; msgIdx <= m_config.numberOfMessages; ++msgIdx)
+            {
+                createTime += 1 + (m_random() % 7200);
+                const int des = (m_random() % 2);
+                const std::string msgId = std::to_string(msgIdx);
+                std::string content;
+                int type = 1;
+                bool hasMedia = (m_random() % 100) < m_config.mediaRatio;
+                switch (pickMessageType())
+                {
+                    case BENCH_MSG_IMAGE:
+                        type = 3;
+                        content = "<?xml version=\"1.0\"?><msg><img length=\"4096\" hdlength=\"0\" cdnthumbwidth=\"120\" cdnthumbheight=\"90\" /></msg>";
+                        if (hasMedia)
+                        {
+                            addFile(BENCH_DOMAIN_APP, userRoot + "/Img/" + sessionHash + "/" + msgId + ".pic", buildMedia(4096));
+                            addFile(BENCH_DOMAIN_APP, userRoot + "/Img/" + sessionHash + "/" + msgId + ".pic_thum", buildMedia(512));
+                        }
+                        break;
+                    case BENCH_MSG_VIDEO:
+                        type = 43;
+                        content = "<?xml version=\"1.0\"?><msg><videomsg length=\"16384\" playlength=\"3\" cdnthumbwidth=\"160\" cdnthumbheight=\"120\" fromusername=\"" + usrName + "\" /></msg>";
+                        if (hasMedia)
+                        {
+                            addFile(BENCH_DOMAIN_APP, userRoot + "/Video/" + sessionHash + "/" + msgId + ".mp4", buildMedia(16384));
+                            addFile(BENCH_DOMAIN_APP, userRoot + "/Video/" + sessionHash + "/" + msgId + ".video_thum", buildMedia(512));
+                        }
+                        break;
+                    case BENCH_MSG_LINK:
+                        type = 49;
+                        content = "<?xml version=\"1.0\"?><msg><appmsg appid=\"\" sdkver=\"0\"><title>" + buildText(4) + "</title><des>" + buildText(12) + "</des><type>5</type><url>https://example.com/article/" + msgId + "</url></appmsg><fromusername>" + usrName + "</fromusername><appinfo><version>1</version><appname></appname></appinfo></msg>";
+                        break;
+                    case BENCH_MSG_SYSTEM:
+                        type = 10000;
+                        content = buildText(6);
+                        break;
+                    default:
+                        type = 1;
+                        content = buildText(1 + (m_random() % 30));
+                        break;
+                }
+                if (chatroom && des != 0 && type != 10000 && !members.empty())
+                {
+                    content = members[m_random() % members.size()] + ":\n" + content;
+                }
+
+                sqlite3_reset(stmt);
+                sqlite3_bind_int(stmt, 1, (int)createTime);
+                sqlite3_bind_int(stmt, 2, des);
+                sqlite3_bind_int64(stmt, 3, msgIdx);
+                sqlite3_bind_text(stmt, 4, content.c_str(), (int)content.size(), SQLITE_TRANSIENT);
+                sqlite3_bind_int64(stmt, 5, msgSvrId++);
+                sqlite3_bind_int(stmt, 6, type);
+                sqlite3_step(stmt);
+                ++m_numberOfMessages;
+            }
+            sqlite3_finalize(stmt);
+        }
+
+        for (std::vector<sqlite3 *>::iterator it = dbs.begin(); it != dbs.end(); ++it)
+        {
+            sqlite3_exec(*it, "COMMIT;", NULL, NULL, NULL);
+            sqlite3_close(*it);
+        }
+        return true;
+    }
+
+private:
+    std::string m_backupDir;
+    BenchmarkConfig m_config;
+    std::mt19937 m_random;
+    sqlite3* m_manifestDb;
+    sqlite3_stmt* m_stmt;
+    uint64_t m_numberOfFiles;
+    uint64_t m_numberOfMessages;
+};
+
+// KB
+uint64_t getMemoryUsage()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    {
+        return static_cast<uint64_t>(pmc.WorkingSetSize / 1024);
+    }
+    return 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+    {
+        return 0;
+    }
+    return static_cast<uint64_t>(info.resident_size / 1024);
+#else
+    // The second field of statm is the resident pages, its size is 0 so readFile can't be used
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (NULL == fp)
+    {
+        return 0;
+    }
+    if (fscanf(fp, "%llu %llu", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(fp);
+    return static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE)) / 1024;
+#endif
+}
+
+// The process-wide high-water mark(ru_maxrss/PeakWorkingSetSize) can't be reset between the runs,
+// so the peak of one run is taken by sampling the current RSS while it runs
+class MemorySampler
+{
+public:
+    MemorySampler() : m_peak(getMemoryUsage()), m_stopped(false), m_thread(&MemorySampler::ThreadFunc, this)
+    {
+    }
+
+    ~MemorySampler()
+    {
+        stop();
+    }
+
+    uint64_t stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cv.notify_one();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+        uint64_t usage = getMemoryUsage();
+        if (usage > m_peak)
+        {
+            m_peak = usage;
+        }
+        return m_peak;
+    }
+
+private:
+    void ThreadFunc()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_cv.wait_for(lock, std::chrono::milliseconds(10), [this] { return m_stopped; }))
+        {
+            uint64_t usage = getMemoryUsage();
+            if (usage > m_peak)
+            {
+                m_peak = usage;
+            }
+        }
+    }
+
+    uint64_t m_peak;
+    bool m_stopped;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+};
+
+uint64_t countMessagesInBackup(const std::string& backupDir)
+{
+    uint64_t numberOfMessages = 0;
+    sqlite3* db = NULL;
+    if (SQLITE_OK != openSqlite3Database(combinePath(backupDir, "Manifest.db"), &db))
+    {
+        sqlite3_close(db);
+        return 0;
+    }
+    std::vector<std::string> fileIds;
+    std::string sql = "SELECT fileID FROM Files WHERE domain='" BENCH_DOMAIN_APP "' AND relativePath LIKE 'Documents/%/DB/message_%.sqlite'";
+    sqlite3_stmt* stmt = NULL;
+    if (SQLITE_OK == sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL))
+    {
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            fileIds.push_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+
+    for (std::vector<std::string>::const_iterator it = fileIds.cbegin(); it != fileIds.cend(); ++it)
+    {
+        db = NULL;
+        if (SQLITE_OK != openSqlite3Database(combinePath(backupDir, it->substr(0, 2), *it), &db))
+        {
+            sqlite3_close(db);
+            continue;
+        }
+        std::vector<std::string> tables;
+        sql = "SELECT name FROM sqlite_master WHERE type='table' AND name LIKE 'Chat\\_%' ESCAPE '\\'";
+        if (SQLITE_OK == sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL))
+        {
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                tables.push_back(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+            }
+            sqlite3_finalize(stmt);
+        }
+        for (std::vector<std::string>::const_iterator itTable = tables.cbegin(); itTable != tables.cend(); ++itTable)
+        {
+            sql = "SELECT COUNT(*) FROM " + *itTable;
+            if (SQLITE_OK == sqlite3_prepare_v2(db, sql.c_str(), (int)(sql.size()), &stmt, NULL))
+            {
+                if (sqlite3_step(stmt) == SQLITE_ROW)
+                {
+                    numberOfMessages += sqlite3_column_int64(stmt, 0);
+                }
+                sqlite3_finalize(stmt);
+            }
+        }
+        sqlite3_close(db);
+    }
+    return numberOfMessages;
+}
+
+int generateSyntheticBackup(const std::string& backupDir, const BenchmarkConfig& config)
+{
+    std::cout << "Generating synthetic backup in " << backupDir << std::endl;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SyntheticBackupGenerator generator(backupDir, config);
+    if (!generator.generate())
+    {
+        std::cout << "Failed to generate synthetic backup." << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Generated " << generator.getNumberOfMessages() << " messages, " << generator.getNumberOfFiles() << " files in " << seconds << "s" << std::endl;
+    return 0;
+}
+
+int runBenchmark(const std::string& backupDir, const std::string& outputDir, const std::string& resultPath, const BenchmarkConfig& config, BenchmarkExport exportFunc)
+{
+    const uint64_t numberOfMessages = countMessagesInBackup(backupDir);
+    const bool textModes[] = { true, false };
+    const char* formatNames[] = { "text", "html" };
+
+    Json::Value resultObj(Json::objectValue);
+    resultObj["timestamp"] = getTimestampString(true);
+    resultObj["backup"] = backupDir;
+    resultObj["config"] = config.toJson();
+    resultObj["messages"] = Json::Value::UInt64(numberOfMessages);
+    resultObj["runs"] = Json::Value(Json::arrayValue);
+
+    int result = 0;
+    for (size_t idx = 0; idx < sizeof(textModes) / sizeof(bool); ++idx)
+    {
+        std::string runOutputDir = combinePath(outputDir, std::string("bench-") + formatNames[idx]);
+        if (existsDirectory(runOutputDir))
+        {
+            deleteDirectory(runOutputDir);
+        }
+        makeDirectory(runOutputDir);
+
+        uint64_t copies[COPY_METHOD_MAX];
+        for (int method = 0; method < COPY_METHOD_MAX; ++method)
+        {
+            copies[method] = getNumberOfCopies(method);
+        }
+        Tracer::reset();
+        Tracer::enable(true);
+        MemorySampler memorySampler;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int exportResult = exportFunc(backupDir, runOutputDir, textModes[idx]);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t peakRss = memorySampler.stop();
+        Tracer::enable(false);
+
+        Json::Value runObj(Json::objectValue);
+        runObj["mode"] = formatNames[idx];
+        if (exportResult != 0)
+        {
+            // The timings of a failed exporting don't mean anything
+            runObj["failed"] = true;
+            runObj["exitCode"] = exportResult;
+            std::cout << formatNames[idx] << ": failed(" << exportResult << ")" << std::endl;
+            resultObj["runs"].append(runObj);
+            result = 1;
+            continue;
+        }
+        runObj["seconds"] = seconds;
+        runObj["messagesPerSecond"] = seconds > 0 ? (double)numberOfMessages / seconds : 0.0;
+        runObj["peakRssKB"] = Json::Value::UInt64(peakRss);
+        runObj["stages"] = Json::Value(Json::objectValue);
+
+        std::map<std::string, std::pair<uint64_t, int64_t>> stages;
+        Tracer::summarize(stages);
+        for (std::map<std::string, std::pair<uint64_t, int64_t>>::const_iterator it = stages.cbegin(); it != stages.cend(); ++it)
+        {
+            Json::Value stageObj(Json::objectValue);
+            stageObj["count"] = Json::Value::UInt64(it->second.first);
+            stageObj["ms"] = (double)it->second.second / 1000.0;
+            runObj["stages"][it->first] = stageObj;
+        }
+        runObj["copies"] = Json::Value(Json::objectValue);
+        for (int method = 0; method < COPY_METHOD_MAX; ++method)
+        {
+            runObj["copies"][getCopyMethodName(method)] = Json::Value::UInt64(getNumberOfCopies(method) - copies[method]);
+        }
+
+        std::cout << formatNames[idx] << ": " << seconds << "s, " << runObj["messagesPerSecond"].asDouble() << " msgs/s, peak RSS " << runObj["peakRssKB"].asUInt64() << "KB" << std::endl;
+        resultObj["runs"].append(runObj);
+    }
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "  ";
+    builder["emitUTF8"] = true;
+    std::string resultJson = Json::writeString(builder, resultObj);
+    if (!resultPath.empty())
+    {
+        if (!writeFile(resultPath, resultJson))
+        {
+            std::cout << "Failed to write benchmark result: " << resultPath << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << resultJson << std::endl;
+    }
+    return result;
+}
+#ifdef WXEXP_COUNT_ALLOCATIONS
+// Allocations made by the calling thread, used by the parser benchmark only.
+// Counted per thread so the executors of TaskManager and the logger don't add noise.
+static thread_local uint64_t s_numberOfAllocations = 0;
+
+void* operator new(size_t size)
+{
+    ++s_numberOfAllocations;
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (NULL == p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+bool isCountingAllocations()
+{
+    return true;
+}
+
+uint64_t getNumberOfAllocations()
+{
+    return s_numberOfAllocations;
+}
+#else
+bool isCountingAllocations()
+{
+    return false;
+}
+
+uint64_t getNumberOfAllocations()
+{
+    return 0;
+}
+#endif // WXEXP_COUNT_ALLOCATIONS
+
+struct ParserCorpus
+{
+    std::string name;
+    int type;
+    std::vector<std::string> contents;
+
+    ParserCorpus(const std::string& n, int t) : name(n), type(t)
+    {
+    }
+};
+
+class ParserCorpusBuilder
+{
+public:
+    ParserCorpusBuilder(uint32_t seed) : m_random(seed)
+    {
+    }
+
+    void build(std::vector<ParserCorpus>& corpora, unsigned int numberOfMessages)
+    {
+        // Handlers of MessageParser, APPMSG ones are dispatched by /msg/appmsg/type
+        const int types[] = { MessageParser::MSGTYPE_TEXT, MessageParser::MSGTYPE_IMAGE, MessageParser::MSGTYPE_VOICE, MessageParser::MSGTYPE_SHARECARD, MessageParser::MSGTYPE_VIDEO, MessageParser::MSGTYPE_EMOTICON, MessageParser::MSGTYPE_LOCATION, MessageParser::MSGTYPE_VOIPMSG, MessageParser::MSGTYPE_SYS, MessageParser::MSGTYPE_RECALLED };
+        const char* typeNames[] = { "text", "image", "voice", "card", "video", "emoticon", "location", "call", "system", "sysmsg" };
+        const int appTypes[] = { MessageParser::APPMSGTYPE_URL, MessageParser::APPMSGTYPE_ATTACH, MessageParser::APPMSGTYPE_FWD_MSG, MessageParser::APPMSGTYPE_CHANNELS, MessageParser::APPMSGTYPE_REFER, MessageParser::APPMSGTYPE_PAT, MessageParser::APPMSGTYPE_TRANSFERS, MessageParser::APPMSGTYPE_RED_ENVELOPES };
+        const char* appTypeNames[] = { "app.url", "app.attach", "app.fwdmsg", "app.channels", "app.refer", "app.pat", "app.transfer", "app.redenvelope" };
+
+        for (size_t idx = 0; idx < sizeof(types) / sizeof(int); ++idx)
+        {
+            ParserCorpus& corpus = *corpora.emplace(corpora.end(), typeNames[idx], types[idx]);
+            for (unsigned int msgIdx = 0; msgIdx < numberOfMessages; ++msgIdx)
+            {
+                corpus.contents.push_back(buildMessage(types[idx], msgIdx));
+            }
+        }
+        for (size_t idx = 0; idx < sizeof(appTypes) / sizeof(int); ++idx)
+        {
+            ParserCorpus& corpus = *corpora.emplace(corpora.end(), appTypeNames[idx], (int)MessageParser::MSGTYPE_APP);
+            for (unsigned int msgIdx = 0; msgIdx < numberOfMessages; ++msgIdx)
+            {
+                corpus.contents.push_back(buildAppMessage(appTypes[idx], msgIdx));
+            }
+        }
+    }
+
+    // Captured contents: msg_type_<TYPE>*.txt, as dumped into dbg folder by debug builds
+    static bool load(std::vector<ParserCorpus>& corpora, const std::string& corpusDir)
+    {
+        std::vector<std::string> subDirs;
+        std::vector<std::string> files;
+        if (!listDirectory(corpusDir, subDirs, files))
+        {
+            return false;
+        }
+        std::sort(files.begin(), files.end());
+        std::map<int, size_t> indexes;
+        for (std::vector<std::string>::const_iterator it = files.cbegin(); it != files.cend(); ++it)
+        {
+            if (!startsWith(*it, "msg_type_"))
+            {
+                continue;
+            }
+            std::string::size_type pos = 9;
+            while (pos < it->size() && (*it)[pos] >= '0' && (*it)[pos] <= '9')
+            {
+                ++pos;
+            }
+            if (pos == 9)
+            {
+                continue;
+            }
+            int type = std::atoi(it->substr(9, pos - 9).c_str());
+            std::map<int, size_t>::iterator itIndex = indexes.find(type);
+            if (itIndex == indexes.end())
+            {
+                itIndex = indexes.insert(itIndex, std::make_pair(type, corpora.size()));
+                corpora.emplace_back("captured." + std::to_string(type), type);
+            }
+            corpora[itIndex->second].contents.push_back(readFile(combinePath(corpusDir, *it)));
+        }
+        return !corpora.empty();
+    }
+
+protected:
+    std::string buildWords(size_t numberOfWords)
+    {
+        static const char* words[] = {"hello", "ok", "thanks", "tomorrow", "meeting", "好的", "明天见", "收到", "[Smile]", "[Grin]", "<b>", "&amp;"};
+        std::string text;
+        for (size_t idx = 0; idx < numberOfWords; ++idx)
+        {
+            if (idx > 0)
+            {
+                text.push_back(' ');
+            }
+            text.append(words[m_random() % (sizeof(words) / sizeof(const char *))]);
+        }
+        return text;
+    }
+
+    // Words embedded into xml contents, which are escaped as WeChat does
+    std::string buildXmlWords(size_t numberOfWords)
+    {
+        return safeHTML(buildWords(numberOfWords));
+    }
+
+    std::string buildMessage(int type, unsigned int msgIdx)
+    {
+        switch (type)
+        {
+            case MessageParser::MSGTYPE_IMAGE:
+                return "<?xml version=\"1.0\"?><msg><img aeskey=\"" + md5(std::to_string(msgIdx)) + "\" length=\"4096\" hdlength=\"0\" cdnthumbwidth=\"120\" cdnthumbheight=\"90\" md5=\"" + md5(std::to_string(m_random())) + "\" /></msg>";
+            case MessageParser::MSGTYPE_VOICE:
+                return "<msg><voicemsg endflag=\"1\" length=\"2048\" voicelength=\"" + std::to_string(1000 + m_random() % 59000) + "\" voiceformat=\"4\" /></msg>";
+            case MessageParser::MSGTYPE_SHARECARD:
+                return "<?xml version=\"1.0\"?>\n<msg bigheadimgurl=\"\" smallheadimgurl=\"\" username=\"wxid_benchcard" + std::to_string(msgIdx) + "\" nickname=\"" + buildXmlWords(2) + "\" fullpy=\"\" shortpy=\"\" alias=\"\" province=\"\" city=\"\" sex=\"1\" certflag=\"0\" sign=\"\" />";
+            case MessageParser::MSGTYPE_VIDEO:
+                return "<?xml version=\"1.0\"?><msg><videomsg length=\"16384\" playlength=\"" + std::to_string(1 + m_random() % 60) + "\" cdnthumbwidth=\"160\" cdnthumbheight=\"120\" fromusername=\"wxid_benchfriend\" md5=\"" + md5(std::to_string(msgIdx)) + "\" /></msg>";
+            case MessageParser::MSGTYPE_EMOTICON:
+                return "<msg><emoji fromusername=\"wxid_benchfriend\" tousername=\"" BENCH_ACCOUNT_USRNAME "\" type=\"2\" md5=\"" + md5(std::to_string(m_random() % 64)) + "\" len=\"1024\" productid=\"\" cdnurl=\"\" width=\"120\" height=\"120\" /></msg>";
+            case MessageParser::MSGTYPE_LOCATION:
+                return "<?xml version=\"1.0\"?>\n<msg><location x=\"39.9" + std::to_string(m_random() % 1000) + "\" y=\"116.3" + std::to_string(m_random() % 1000) + "\" scale=\"16\" label=\"" + buildXmlWords(3) + "\" maptype=\"roadmap\" poiname=\"" + buildXmlWords(2) + "\" poiid=\"\" /></msg>";
+            case MessageParser::MSGTYPE_VOIPMSG:
+                return "<voipmsg type=\"VoIPBubbleMsg\"><VoIPBubbleMsg><msg><![CDATA[Duration 00:" + std::to_string(10 + m_random() % 50) + "]]></msg><room_type>1</room_type></VoIPBubbleMsg></voipmsg>";
+            case MessageParser::MSGTYPE_SYS:
+                // Not starting with a tag, which is taken as an unknown format by debug builds
+                return "\"Bench Friend\" " + buildWords(6);
+            case MessageParser::MSGTYPE_RECALLED:
+                // Chatroom invitation, rendered by the template and link_list of sysmsgtemplate
+                return "<sysmsg type=\"sysmsgtemplate\"><sysmsgtemplate><content_template type=\"tmpl_type_profile\"><plain><![CDATA[]]></plain><template><![CDATA[\"$username$\" invited \"$names$\" to the group chat]]></template><link_list><link name=\"username\" type=\"link_profile\"><memberlist><member><username><![CDATA[wxid_benchfriend]]></username><nickname><![CDATA[" + buildWords(1) + "]]></nickname></member></memberlist></link><link name=\"names\" type=\"link_profile\"><memberlist><member><username><![CDATA[wxid_benchmember" + std::to_string(msgIdx) + "]]></username><nickname><![CDATA[" + buildWords(1) + "]]></nickname></member><member><username><![CDATA[wxid_benchmember" + std::to_string(msgIdx + 1) + "]]></username><nickname><![CDATA[" + buildWords(1) + "]]></nickname></member></memberlist><separator><![CDATA[, ]]></separator></link></link_list></content_template></sysmsgtemplate></sysmsg>";
+            default:
+                return buildWords(1 + (m_random() % 30));
+        }
+    }
+
+    std::string buildAppMessage(int appMsgType, unsigned int msgIdx)
+    {
+        std::string appMsg;
+        switch (appMsgType)
+        {
+            case MessageParser::APPMSGTYPE_ATTACH:
+                appMsg = "<title>" + buildXmlWords(2) + ".pdf</title><des></des><type>6</type><appattach><totallen>" + std::to_string(m_random() % 1048576) + "</totallen><fileext>pdf</fileext><attachid>@cdn_" + md5(std::to_string(msgIdx)) + "</attachid></appattach>";
+                break;
+            case MessageParser::APPMSGTYPE_FWD_MSG:
+            {
+                std::string recordInfo = "<recordinfo><title>" + buildXmlWords(3) + "</title><desc>" + buildXmlWords(6) + "</desc><datalist count=\"5\">";
+                for (int itemIdx = 0; itemIdx < 5; ++itemIdx)
+                {
+                    recordInfo += "<dataitem datatype=\"1\" dataid=\"" + md5(std::to_string(msgIdx * 5 + itemIdx)) + "\"><datadesc>" + buildXmlWords(8) + "</datadesc><sourcename>" + buildXmlWords(1) + "</sourcename><sourcetime>2020-1-1 10:" + std::to_string(10 + itemIdx) + "</sourcetime><srcMsgCreateTime>" + std::to_string(BENCH_BASE_TIME + itemIdx) + "</srcMsgCreateTime><dataitemsource><fromusr>wxid_benchmember" + std::to_string(itemIdx) + "</fromusr></dataitemsource></dataitem>";
+                }
+                recordInfo += "</datalist><favusername>" BENCH_ACCOUNT_USRNAME "</favusername></recordinfo>";
+                appMsg = "<title>" + buildXmlWords(3) + "</title><des>" + buildXmlWords(6) + "</des><type>19</type><url>https://support.weixin.qq.com/cgi-bin/mmsupport-bin/readtemplate?t=page/favorite_record__w_unsupport</url><recorditem><![CDATA[" + recordInfo + "]]></recorditem>";
+                break;
+            }
+            case MessageParser::APPMSGTYPE_CHANNELS:
+                appMsg = "<title>" + buildXmlWords(3) + "</title><type>51</type><finderFeed><objectId>" + std::to_string(m_random()) + "</objectId><nickname>" + buildXmlWords(1) + "</nickname><avatar></avatar><desc>" + buildXmlWords(8) + "</desc><mediaCount>1</mediaCount><mediaList><media><mediaType>4</mediaType><url></url><thumbUrl></thumbUrl></media></mediaList></finderFeed>";
+                break;
+            case MessageParser::APPMSGTYPE_REFER:
+                appMsg = "<title>" + buildXmlWords(4) + "</title><type>57</type><refermsg><type>1</type><svrid>" + std::to_string(m_random()) + "</svrid><fromusr>wxid_benchfriend</fromusr><chatusr>wxid_benchmember1</chatusr><displayname>" + buildXmlWords(1) + "</displayname><content>" + buildXmlWords(10) + "</content></refermsg>";
+                break;
+            case MessageParser::APPMSGTYPE_PAT:
+                appMsg = "<title>pat</title><type>62</type><patMsg><chatUser>wxid_benchfriend</chatUser><records><recordNum>1</recordNum><record><fromUser>wxid_benchmember1</fromUser><pattedUser>" BENCH_ACCOUNT_USRNAME "</pattedUser><templete><![CDATA[\"${wxid_benchmember1}\" patted \"${" BENCH_ACCOUNT_USRNAME "}\"]]></templete><createTime>" + std::to_string(BENCH_BASE_TIME + msgIdx) + "</createTime></record></records></patMsg>";
+                break;
+            case MessageParser::APPMSGTYPE_TRANSFERS:
+                appMsg = "<title>Transfer</title><des>Received</des><type>2000</type><wcpayinfo><paysubtype>" + std::to_string(m_random() % 2 ? 1 : 3) + "</paysubtype><feedesc>￥" + std::to_string(1 + m_random() % 1000) + ".00</feedesc><pay_memo>" + buildXmlWords(2) + "</pay_memo><receiver_username>wxid_benchmember1</receiver_username><payer_username>" BENCH_ACCOUNT_USRNAME "</payer_username></wcpayinfo>";
+                break;
+            case MessageParser::APPMSGTYPE_RED_ENVELOPES:
+                appMsg = "<title>" + buildXmlWords(2) + "</title><des>" + buildXmlWords(2) + "</des><type>2001</type><wcpayinfo><sendertitle>" + buildXmlWords(3) + "</sendertitle></wcpayinfo>";
+                break;
+            default:
+                appMsg = "<title>" + buildXmlWords(4) + "</title><des>" + buildXmlWords(12) + "</des><type>5</type><url>https://example.com/article/" + std::to_string(msgIdx) + "</url><thumburl></thumburl>";
+                break;
+        }
+        return "<?xml version=\"1.0\"?><msg><appmsg appid=\"\" sdkver=\"0\">" + appMsg + "</appmsg><fromusername>wxid_benchfriend</fromusername><scene>0</scene><appinfo><version>1</version><appname></appname></appinfo><commenturl></commenturl></msg>";
+    }
+
+private:
+    std::mt19937 m_random;
+};
+
+// Refills an arena with the parsed values of each message, twice: once to warm it up and once to count.
+// The arena recycles the slots and the capacity of their strings, so the second pass should not allocate at all.
+static uint64_t countArenaAllocations(const std::vector<TemplateValues>& parsedValues, const std::vector<size_t>& numberOfParsedValues)
+{
+    TemplateValuesArena arena;
+    uint64_t numberOfAllocations = 0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const uint64_t allocations = getNumberOfAllocations();
+        std::vector<TemplateValues>::const_iterator itValues = parsedValues.cbegin();
+        for (std::vector<size_t>::const_iterator it = numberOfParsedValues.cbegin(); it != numberOfParsedValues.cend(); ++it)
+        {
+            arena.reset();
+            for (size_t idx = 0; idx < *it; ++idx, ++itValues)
+            {
+                TemplateValues& tv = arena.add(itValues->getName().c_str());
+                for (TemplateValues::const_iterator itValue = itValues->cbegin(); itValue != itValues->cend(); ++itValue)
+                {
+                    tv[itValue->first] = itValue->second;
+                }
+            }
+        }
+        numberOfAllocations = getNumberOfAllocations() - allocations;
+    }
+    return numberOfAllocations;
+}
+
+// Replays per-type message contents through MessageParser::parse and renders them with the templates of text and html modes.
+// ITunesDb is empty, so there are no file copies or transcoding, only the parsing/rendering of the handlers is measured.
+// The synthetic corpus carries no urls, so no downloads are queued either.
+int runParserBenchmark(const std::string& languageCode, const std::string& workDir, const std::string& outputDir, const std::string& corpusDir, const std::string& resultPath, const BenchmarkConfig& config)
+{
+    std::vector<ParserCorpus> corpora;
+    if (!corpusDir.empty())
+    {
+        if (!ParserCorpusBuilder::load(corpora, corpusDir))
+        {
+            std::cout << "No msg_type_*.txt files found in " << corpusDir << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        ParserCorpusBuilder builder(config.seed);
+        builder.build(corpora, config.numberOfMessages);
+    }
+
+    std::string runOutputDir = combinePath(outputDir, "bench-parser");
+    if (existsDirectory(runOutputDir))
+    {
+        deleteDirectory(runOutputDir);
+    }
+    makeDirectory(runOutputDir);
+
+    const bool countingAllocations = isCountingAllocations();
+    int numberOfArenaFailures = 0;
+    if (!countingAllocations)
+    {
+        std::cout << "Allocations are not counted, build Benchmark.cpp with WXEXP_COUNT_ALLOCATIONS to count them." << std::endl;
+    }
+
+    AsyncLogger logger(LOG_LEVEL_NONE);
+    ITunesDb iTunesDb(runOutputDir, "Manifest.db");
+    ITunesDb iTunesDbShare(runOutputDir, "Manifest.db");
+
+    Friend myself;
+    myself.setUsrName(BENCH_ACCOUNT_USRNAME);
+    myself.setDisplayName(BENCH_ACCOUNT_NAME);
+    Friends friends;
+    friends.addFriend(BENCH_ACCOUNT_USRNAME).setDisplayName(BENCH_ACCOUNT_NAME);
+    friends.addFriend("wxid_benchfriend").setDisplayName("Bench Friend");
+
+    Session friendSession(&myself);
+    friendSession.setUsrName("wxid_benchfriend");
+    friendSession.setDisplayName("Bench Friend");
+    Session chatroomSession(&myself);
+    chatroomSession.setUsrName("10000@chatroom");
+    chatroomSession.setDisplayName("Bench Group");
+    for (unsigned int idx = 0; idx < config.numberOfMembers; ++idx)
+    {
+        std::string usrName = "wxid_benchmember" + std::to_string(idx);
+        friends.addFriend(usrName).setDisplayName("Member " + std::to_string(idx));
+        chatroomSession.addMember(usrName, "Member " + std::to_string(idx));
+    }
+
+    Json::Value resultObj(Json::objectValue);
+    resultObj["timestamp"] = getTimestampString(true);
+    resultObj["corpus"] = corpusDir.empty() ? "synthetic" : corpusDir;
+    resultObj["handlers"] = Json::Value(Json::arrayValue);
+
+    const bool textModes[] = { true, false };
+    const char* modeNames[] = { "text", "html" };
+    const char* templatesNames[] = { "templates_txt", "templates" };
+    for (size_t modeIdx = 0; modeIdx < sizeof(textModes) / sizeof(bool); ++modeIdx)
+    {
+        ResManager resManager;
+        if (!resManager.initResources(workDir, languageCode, templatesNames[modeIdx]))
+        {
+            // Same as Exporter, templates_txt doesn't have the templates used by html mode only
+            std::cout << "Some resources of " << templatesNames[modeIdx] << " are missing in " << workDir << std::endl;
+        }
+        TaskManager taskManager(&logger);
+        ExportOption options;
+        options.setTextMode(textModes[modeIdx]);
+        if (!textModes[modeIdx])
+        {
+            options.setLoadingDataOnScroll();
+        }
+        std::string modeOutputDir = combinePath(runOutputDir, modeNames[modeIdx]);
+        makeDirectory(modeOutputDir);
+
+        MessageParser msgParser(iTunesDb, iTunesDbShare, taskManager, friends, myself, options, workDir, modeOutputDir, resManager);
+
+        TemplateValuesArena& tvs = TemplateValuesArena::local();
+        for (std::vector<ParserCorpus>::const_iterator it = corpora.cbegin(); it != corpora.cend(); ++it)
+        {
+            std::vector<TemplateValues> parsedValues;
+            std::vector<size_t> numberOfParsedValues;
+            uint64_t numberOfFailures = 0;
+            uint64_t bytesRendered = 0;
+            int64_t elapsed = 0;
+            int64_t renderingElapsed = 0;
+            uint64_t numberOfAllocations = 0;
+            uint64_t numberOfRenderingAllocations = 0;
+            unsigned int msgIdx = 0;
+            for (std::vector<std::string>::const_iterator itContent = it->contents.cbegin(); itContent != it->contents.cend(); ++itContent, ++msgIdx)
+            {
+                // Alternate 1:1 and chatroom sessions, the chatroom ones carry a sender prefix
+                const bool chatroom = (msgIdx % 2) == 1;
+                WXMSG msg;
+                msg.createTime = BENCH_BASE_TIME + msgIdx;
+                msg.des = (msgIdx % 4) < 2 ? 0 : 1;
+                msg.type = it->type;
+                msg.msgIdValue = msgIdx + 1;
+                msg.msgId = std::to_string(msg.msgIdValue);
+                msg.msgSvrId = 1000000 + msgIdx;
+                msg.status = 2;
+                msg.tableVersion = 1;
+                msg.content = (chatroom && msg.des != 0 && config.numberOfMembers > 0) ? ("wxid_benchmember" + std::to_string(msgIdx % config.numberOfMembers) + ":\n" + *itContent) : *itContent;
+                tvs.reset();
+
+                uint64_t allocations = getNumberOfAllocations();
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                bool result = msgParser.parse(msg, chatroom ? chatroomSession : friendSession, tvs);
+                std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+                elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+                numberOfAllocations += getNumberOfAllocations() - allocations;
+
+                if (!result)
+                {
+                    ++numberOfFailures;
+                }
+                if (countingAllocations)
+                {
+                    parsedValues.insert(parsedValues.end(), tvs.cbegin(), tvs.cend());
+                    numberOfParsedValues.push_back(tvs.size());
+                }
+
+                // Same as Exporter::exportMessage, every TemplateValues is built with the template named by it
+                allocations = getNumberOfAllocations();
+                start = std::chrono::steady_clock::now();
+                for (TemplateValuesArena::const_iterator itTv = tvs.cbegin(); itTv != tvs.cend(); ++itTv)
+                {
+                    bytesRendered += resManager.buildFromTemplate(itTv->getName(), *itTv).size();
+                }
+                end = std::chrono::steady_clock::now();
+                renderingElapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+                numberOfRenderingAllocations += getNumberOfAllocations() - allocations;
+            }
+
+            const double numberOfMessages = it->contents.empty() ? 1.0 : (double)it->contents.size();
+            Json::Value handlerObj(Json::objectValue);
+            handlerObj["mode"] = modeNames[modeIdx];
+            handlerObj["handler"] = it->name;
+            handlerObj["type"] = it->type;
+            handlerObj["messages"] = Json::Value::UInt64(it->contents.size());
+            handlerObj["failures"] = Json::Value::UInt64(numberOfFailures);
+            handlerObj["nsPerMessage"] = (double)elapsed / numberOfMessages;
+            handlerObj["renderingNsPerMessage"] = (double)renderingElapsed / numberOfMessages;
+            uint64_t numberOfArenaAllocations = 0;
+            if (countingAllocations)
+            {
+                handlerObj["allocationsPerMessage"] = (double)numberOfAllocations / numberOfMessages;
+                handlerObj["renderingAllocationsPerMessage"] = (double)numberOfRenderingAllocations / numberOfMessages;
+                numberOfArenaAllocations = countArenaAllocations(parsedValues, numberOfParsedValues);
+                handlerObj["arenaAllocations"] = Json::Value::UInt64(numberOfArenaAllocations);
+                if (numberOfArenaAllocations > 0)
+                {
+                    ++numberOfArenaFailures;
+                }
+            }
+            handlerObj["bytesRenderedPerMessage"] = (double)bytesRendered / numberOfMessages;
+            resultObj["handlers"].append(handlerObj);
+
+            std::cout << modeNames[modeIdx] << "." << it->name << ": " << handlerObj["nsPerMessage"].asDouble() << " + " << handlerObj["renderingNsPerMessage"].asDouble() << " ns/msg";
+            if (countingAllocations)
+            {
+                std::cout << ", " << handlerObj["allocationsPerMessage"].asDouble() << " + " << handlerObj["renderingAllocationsPerMessage"].asDouble() << " allocs/msg";
+            }
+            std::cout << ", " << handlerObj["bytesRenderedPerMessage"].asDouble() << " bytes/msg" << std::endl;
+            if (numberOfArenaAllocations > 0)
+            {
+                std::cout << modeNames[modeIdx] << "." << it->name << ": " << numberOfArenaAllocations << " allocations in the warmed-up TemplateValuesArena, expected 0" << std::endl;
+            }
+        }
+
+        taskManager.shutdown();
+    }
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "  ";
+    builder["emitUTF8"] = true;
+    std::string result = Json::writeString(builder, resultObj);
+    if (!resultPath.empty())
+    {
+        if (!writeFile(resultPath, result))
+        {
+            std::cout << "Failed to write benchmark result: " << resultPath << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << result << std::endl;
+    }
+    return numberOfArenaFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+//
+//  Benchmark.h
+//  WechatExporterCmd
+//
+//  Created by Matthew on 2022/5/14.
+//
+
+#ifndef Benchmark_h
+#define Benchmark_h
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <json/json.h>
+#include "Utils.h"
+
+#define BENCH_DOMAIN_APP        "AppDomain-com.tencent.xin"
+#define BENCH_DOMAIN_GROUP      "AppDomainGroup-group.com.tencent.xin"
+#define BENCH_ACCOUNT_USRNAME   "wxid_benchowner"
+#define BENCH_ACCOUNT_NAME      "Bench Owner"
+#define BENCH_BASE_TIME         1577836800  // 2020-01-01
+
+#define BENCH_MSG_TEXT      0
+#define BENCH_MSG_IMAGE     1
+#define BENCH_MSG_VIDEO     2
+#define BENCH_MSG_LINK      3
+#define BENCH_MSG_SYSTEM    4
+#define BENCH_MSG_MAX       5
+
+struct BenchmarkConfig
+{
+    unsigned int numberOfSessions;
+    unsigned int numberOfMessages;      // per session
+    unsigned int numberOfChatrooms;     // the first N sessions are chatrooms
+    unsigned int numberOfMembers;       // per chatroom
+    unsigned int numberOfMessageDbs;    // message_1.sqlite ... message_N.sqlite
+    unsigned int mediaRatio;            // percentage of image/video messages which have files in the backup
+    unsigned int mix[BENCH_MSG_MAX];    // weight of each message type
+    uint32_t seed;
+
+    BenchmarkConfig() : numberOfSessions(20), numberOfMessages(2000), numberOfChatrooms(5), numberOfMembers(50), numberOfMessageDbs(4), mediaRatio(100), seed(1)
+    {
+        mix[BENCH_MSG_TEXT] = 60;
+        mix[BENCH_MSG_IMAGE] = 15;
+        mix[BENCH_MSG_VIDEO] = 5;
+        mix[BENCH_MSG_LINK] = 15;
+        mix[BENCH_MSG_SYSTEM] = 5;
+    }
+
+    // "sessions:20,messages:2000,chatrooms:5,members:50,dbs:4,media:100,text:60,image:15,video:5,link:15,system:5,seed:1"
+    bool parse(const std::string& options)
+    {
+        std::vector<std::string> items = split(options, ",");
+        for (std::vector<std::string>::const_iterator it = items.cbegin(); it != items.cend(); ++it)
+        {
+            std::string::size_type pos = it->find(':');
+            if (pos == std::string::npos || !isNumber(it->substr(pos + 1)))
+            {
+                return false;
+            }
+            std::string name = it->substr(0, pos);
+            unsigned int value = static_cast<unsigned int>(std::stoul(it->substr(pos + 1)));
+            if (name == "sessions") numberOfSessions = value;
+            else if (name == "messages") numberOfMessages = value;
+            else if (name == "chatrooms") numberOfChatrooms = value;
+            else if (name == "members") numberOfMembers = value;
+            else if (name == "dbs") numberOfMessageDbs = value > 0 ? value : 1;
+            else if (name == "media") mediaRatio = value > 100 ? 100 : value;
+            else if (name == "text") mix[BENCH_MSG_TEXT] = value;
+            else if (name == "image") mix[BENCH_MSG_IMAGE] = value;
+            else if (name == "video") mix[BENCH_MSG_VIDEO] = value;
+            else if (name == "link") mix[BENCH_MSG_LINK] = value;
+            else if (name == "system") mix[BENCH_MSG_SYSTEM] = value;
+            else if (name == "seed") seed = value;
+            else return false;
+        }
+        return true;
+    }
+
+    Json::Value toJson() const
+    {
+        Json::Value obj(Json::objectValue);
+        obj["sessions"] = numberOfSessions;
+        obj["messages"] = numberOfMessages;
+        obj["chatrooms"] = numberOfChatrooms;
+        obj["members"] = numberOfMembers;
+        obj["dbs"] = numberOfMessageDbs;
+        obj["media"] = mediaRatio;
+        obj["text"] = mix[BENCH_MSG_TEXT];
+        obj["image"] = mix[BENCH_MSG_IMAGE];
+        obj["video"] = mix[BENCH_MSG_VIDEO];
+        obj["link"] = mix[BENCH_MSG_LINK];
+        obj["system"] = mix[BENCH_MSG_SYSTEM];
+        obj["seed"] = seed;
+        return obj;
+    }
+};
+
+// Runs one export of backupDir into outputDir, supplied by the front end so the benchmark doesn't depend on its options
+typedef std::function<int (const std::string& backupDir, const std::string& outputDir, bool textMode)> BenchmarkExport;
+
+// KB, the current resident set of the process
+uint64_t getMemoryUsage();
+uint64_t countMessagesInBackup(const std::string& backupDir);
+int generateSyntheticBackup(const std::string& backupDir, const BenchmarkConfig& config);
+// Runs the export in text and html modes and reports throughput, stage timings(collected by Tracer) and
+// the peak RSS of each run, sampled while it runs so the first mode doesn't show up in the second one
+int runBenchmark(const std::string& backupDir, const std::string& outputDir, const std::string& resultPath, const BenchmarkConfig& config, BenchmarkExport exportFunc);
+// Replays per-type message contents through MessageParser::parse and the templates in text and html modes
+int runParserBenchmark(const std::string& languageCode, const std::string& workDir, const std::string& outputDir, const std::string& corpusDir, const std::string& resultPath, const BenchmarkConfig& config);
+
+// Allocations are only counted when Benchmark.cpp is built with WXEXP_COUNT_ALLOCATIONS,
+// which replaces the global operator new of the whole executable, so keep it off in release builds.
+bool isCountingAllocations();
+uint64_t getNumberOfAllocations();
+
+#endif /* Benchmark_h */
@@ -20,6 +20,9 @@
 #endif
 
 #include "WechatExporterCmd.h"
+#include "AsyncLogger.h"
+#include "Tracer.h"
+#include "Benchmark.h"
 
 
 std::string getCurrentLanguageCode();
@@ -27,22 +30,6 @@ std::string getExecutablePath();
 std::string getExecutableDir();
 
 
-class LoggerImpl : public Logger
-{
-public:
-    
-    void write(const std::string& log)
-    {
-        std::cout << log << std::endl;
-    }
-    
-    void debug(const std::string& log)
-    {
-        std::cout << "DBG:: " << log << std::endl;
-    }
-    
-};
-
 int main(int argc, const char * argv[]) {
     
     const char * fullPath = argv[0];
@@ -51,6 +38,19 @@ int main(int argc, const char * argv[]) {
     int outputFormat = OUTPUT_FORMAT_HTML;
     int asyncLoading = HTML_OPTION_ONSCROLL;
     bool outputFilter = false;
+    bool searchDatabase = false;
+    std::string searchKeyword;
+    size_t searchLimit = 100;
+    int logLevel = LOG_LEVEL_INFO;
+    bool jsonLogs = false;
+    std::string logFile;
+    std::string traceFile;
+    std::string browserPath;
+    std::string benchGenDir;
+    std::string benchDir;
+    std::string benchResult;
+    std::string benchParser;
+    BenchmarkConfig benchConfig;
     std::string backupDir;
     std::string outputDir;
     std::string account;
@@ -87,6 +87,21 @@ int main(int argc, const char * argv[]) {
         {
             sessions.push_back(parseArgumentwithQuato(equals_pos + 1));
         }
+        else if (name == "--format")
+        {
+            if (strcmp("text", equals_pos + 1) == 0)
+            {
+                outputFormat = OUTPUT_FORMAT_TEXT;
+            }
+            else if (strcmp("pdf", equals_pos + 1) == 0)
+            {
+                outputFormat = OUTPUT_FORMAT_PDF;
+            }
+        }
+        else if (name == "--browser")
+        {
+            browserPath = parseArgumentwithQuato(equals_pos + 1);
+        }
         else if (name == "--asyncloading")
         {
             if (strcmp("sync", equals_pos + 1) == 0)
@@ -105,6 +120,99 @@ int main(int argc, const char * argv[]) {
                 outputFilter = true;
             }
         }
+        else if (name == "--searchdb")
+        {
+            if (strcmp("yes", equals_pos + 1) == 0)
+            {
+                searchDatabase = true;
+            }
+        }
+        else if (name == "--search")
+        {
+            searchKeyword = parseArgumentwithQuato(equals_pos + 1);
+        }
+        else if (name == "--limit")
+        {
+            searchLimit = static_cast<size_t>(strtoul(equals_pos + 1, NULL, 10));
+        }
+        else if (name == "--loglevel")
+        {
+            if (strcmp("debug", equals_pos + 1) == 0)
+            {
+                logLevel = LOG_LEVEL_DEBUG;
+            }
+            else if (strcmp("none", equals_pos + 1) == 0)
+            {
+                logLevel = LOG_LEVEL_NONE;
+            }
+        }
+        else if (name == "--logformat")
+        {
+            if (strcmp("json", equals_pos + 1) == 0)
+            {
+                jsonLogs = true;
+            }
+        }
+        else if (name == "--logfile")
+        {
+            logFile = parseArgumentwithQuato(equals_pos + 1);
+        }
+        else if (name == "--trace")
+        {
+            traceFile = parseArgumentwithQuato(equals_pos + 1);
+        }
+        else if (name == "--bench-gen")
+        {
+            benchGenDir = parseArgumentwithQuato(equals_pos + 1);
+        }
+        else if (name == "--bench-options")
+        {
+            if (!benchConfig.parse(equals_pos + 1))
+            {
+                std::cout << "Invalid benchmark options: " << (equals_pos + 1) << std::endl;
+                return 1;
+            }
+        }
+        else if (name == "--bench")
+        {
+            benchDir = parseArgumentwithQuato(equals_pos + 1);
+        }
+        else if (name == "--bench-result")
+        {
+            benchResult = parseArgumentwithQuato(equals_pos + 1);
+        }
+        else if (name == "--bench-parser")
+        {
+            benchParser = parseArgumentwithQuato(equals_pos + 1);
+        }
+    }
+    
+    if (!benchGenDir.empty())
+    {
+        return generateSyntheticBackup(benchGenDir, benchConfig);
+    }
+    if (!searchKeyword.empty())
+    {
+        if (outputDir.empty() || !existsDirectory(outputDir))
+        {
+            std::cout << "Please input valid output directory." << std::endl;
+            return 1;
+        }
+        return searchMessages(outputDir, searchKeyword, searchLimit);
+    }
+    if (!benchParser.empty())
+    {
+        // Neither the backup nor the account is used
+        backupDir = outputDir;
+        account = BENCH_ACCOUNT_NAME;
+    }
+    if (!benchDir.empty())
+    {
+        backupDir = benchDir;
+        if (account.empty())
+        {
+            account = BENCH_ACCOUNT_NAME;
+        }
     }
     
     if (backupDir.empty() || !existsDirectory(backupDir))
@@ -132,9 +240,41 @@ int main(int argc, const char * argv[]) {
     }
     
     std::string languageCode = getCurrentLanguageCode();
-    LoggerImpl logger;
+    if (!benchParser.empty())
+    {
+        return runParserBenchmark(languageCode, workDir, outputDir, benchParser == "synthetic" ? "" : benchParser, benchResult, benchConfig);
+    }
+    if (!benchDir.empty())
+    {
+        return runBenchmark(backupDir, outputDir, benchResult, benchConfig, [&](const std::string& benchBackupDir, const std::string& benchOutputDir, bool textMode) {
+            AsyncLogger benchLogger(LOG_LEVEL_NONE);
+            return exportSessions(languageCode, &benchLogger, workDir, benchBackupDir, benchOutputDir, account, std::vector<std::string>(), textMode ? OUTPUT_FORMAT_TEXT : OUTPUT_FORMAT_HTML, HTML_OPTION_ONSCROLL, false);
+        });
+    }
+    
+    AsyncLogger logger(logLevel, jsonLogs);
+    if (!logFile.empty() && !logger.openLogFile(logFile))
+    {
+        std::cout << "Failed to open log file: " << logFile << std::endl;
+    }
+    
+    if (!traceFile.empty())
+    {
+        Tracer::enable(true);
+    }
     
-    return exportSessions(languageCode, &logger, workDir, backupDir, outputDir, account, sessions, outputFormat, asyncLoading, outputFilter);
+    int result = exportSessions(languageCode, &logger, workDir, backupDir, outputDir, account, sessions, outputFormat, asyncLoading, outputFilter, browserPath, searchDatabase);
+    
+    if (!traceFile.empty())
+    {
+        Tracer::enable(false);
+        if (!Tracer::exportChromeTrace(traceFile))
+        {
+            logger.write("Failed to write trace file: " + traceFile);
+        }
+    }
+    logger.stop();
+    return result;
 }
 
 std::string getExecutablePath()
@@ -9,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <chrono>
 
 
 #ifdef _WIN32
@@ -16,6 +17,8 @@
 #elif defined(__APPLE__)
 #include "Utils.h"
 #include "Exporter.h"
+#include "PdfRenderer.h"
+#include "SearchDatabase.h"
 #include "IDeviceBackup.h"
 #include "WechatSource.h"
 #else
@@ -26,6 +29,7 @@
 
 #define OUTPUT_FORMAT_HTML      0
 #define OUTPUT_FORMAT_TEXT      1
+#define OUTPUT_FORMAT_PDF       2
 
 #define HTML_OPTION_SYNC        0
 #define HTML_OPTION_ONSCROLL    1
@@ -42,13 +46,33 @@ void printHelp(const char *executableName)
              "Export Wechat chat history based on the options given:\n"
              "  --backup=PATH       Specify the directory of iTunes Backup\n"
              "  --output=PATH       Specify the directory in that Wechat chat history will be exported.\n"
-             "  --format=FORMAT     FORMAT may be one of 'html', 'text'. 'html' is default.\n"
+             "  --format=FORMAT     FORMAT may be one of 'html', 'text', 'pdf'. 'html' is default.\n"
+             "                      'pdf' prints the html files into the 'pdf' folder with headless Chrome or Edge.\n"
+             "  --browser=PATH      Chrome or Edge executable used by the 'pdf' format if it is not found automatically.\n"
              "  --account=ACCOUNT   Specify the WeChat account which will be exported.\n"
              "  --session=SESSION   Friend name or chat group name which will be exported. May be specified multiple times\n"
              "                      If no session is specified, all sessions of the account will be exported.\n"
              "  --asyncloading=[HTML LOADING OPTION]\n"
              "                      [HTML LOADING OPTION] may be one of 'sync', 'onscroll', 'oninit'. 'onscroll' is default.\n"
              "  --filter=FILTER     FILTER may be one of 'no', 'yes'. 'no' is default.\n"
+             "  --searchdb=SEARCHDB SEARCHDB may be one of 'no', 'yes'. 'no' is default.\n"
+             "                      'yes' saves the exported messages into the full-text search database(.wxexp/search.db).\n"
+             "  --search=KEYWORD    Search the messages exported into --output with --searchdb=yes and exit.\n"
+             "  --limit=N           Maximum number of the messages found by --search. 100 is default.\n"
+             "  --loglevel=LEVEL    LEVEL may be one of 'debug', 'info', 'none'. 'info' is default.\n"
+             "  --logformat=FORMAT  FORMAT may be one of 'text', 'json'(JSON lines). 'text' is default.\n"
+             "  --logfile=PATH      Write the logs into the file too.\n"
+             "  --trace=PATH        Record performance trace and save it as Chrome trace JSON file.\n"
+             "  --bench-gen=PATH    Generate a synthetic iTunes backup for benchmark into the directory and exit.\n"
+             "  --bench-options=OPTIONS\n"
+             "                      Shape of the synthetic backup, e.g. 'sessions:20,messages:2000,chatrooms:5,members:50,dbs:4,\n"
+             "                      media:100,text:60,image:15,video:5,link:15,system:5,seed:1'.\n"
+             "  --bench=PATH        Export the (synthetic) backup in text and html modes into --output and report\n"
+             "                      throughput, stage timings and peak memory as JSON.\n"
+             "  --bench-parser=[synthetic|PATH]\n"
+             "                      Replay synthetic messages(--bench-options messages:N per handler) or captured\n"
+             "                      msg_type_*.txt files in PATH through the message parser and report the cost per handler.\n"
+             "  --bench-result=PATH Save the benchmark result into the file instead of printing it.\n"
              "  --help              Show this help.\n"
           << std::endl;
 }
@@ -77,11 +101,23 @@ std::string parseArgumentwithQuato(const char *path)
     return parsedPath;
 }
 
-int exportSessions(const std::string& languageCode, Logger* logger, const std::string& workDir, const std::string& backupDir, const std::string& outputDir, const std::string& account, const std::vector<std::string>& sessions, int outputFormat, int asyncLoading, bool outputFilter)
+int exportSessions(const std::string& languageCode, Logger* logger, const std::string& workDir, const std::string& backupDir, const std::string& outputDir, const std::string& account, const std::vector<std::string>& sessions, int outputFormat, int asyncLoading, bool outputFilter, const std::string& browserPath = "", bool searchDatabase = false)
 {
     // const std::string& workDir, const std::string& backup, const std::string& output, Logger* logger, PdfConverter* pdfConverter
     
-    Exporter exp(workDir, backupDir, outputDir, logger, NULL);
+    PdfRendererPool* pdfConverter = NULL;
+    if (outputFormat == OUTPUT_FORMAT_PDF)
+    {
+        pdfConverter = new PdfRendererPool(browserPath.empty() ? PdfRendererPool::findBrowser() : browserPath, outputDir, 0, logger);
+        if (!pdfConverter->isPdfSupported())
+        {
+            std::cout << "Chrome or Edge is required by the 'pdf' format, specify it with --browser=PATH." << std::endl;
+            delete pdfConverter;
+            return 1;
+        }
+    }
+    
+    Exporter exp(workDir, backupDir, outputDir, logger, pdfConverter);
     exp.setLanguageCode(languageCode);
     ExportOption options;
     
@@ -91,6 +127,14 @@ int exportSessions(const std::string& languageCode, Logger* logger, const std::s
         exp.setExtName("txt");
         exp.setTemplatesName("templates_txt");
     }
+    else if (outputFormat == OUTPUT_FORMAT_PDF)
+    {
+        exp.setExtName("html");
+        exp.setTemplatesName("templates");
+        // All the messages must be in the page when it is printed
+        options.setPdfMode();
+        options.setSyncLoading();
+    }
     else
     {
         exp.setExtName("html");
@@ -108,11 +152,12 @@ int exportSessions(const std::string& languageCode, Logger* logger, const std::s
             }
         }
     }
-    if (outputFilter)
+    if (outputFilter && outputFormat != OUTPUT_FORMAT_PDF)
     {
         options.supportsFilter();
     }
     options.filterByName();
+    options.buildSearchDatabase(searchDatabase);
     
     exp.setOptions(options);
     
@@ -129,10 +174,57 @@ int exportSessions(const std::string& languageCode, Logger* logger, const std::s
     
     exp.filterUsersAndSessions(usersAndSessions);
     
-    exp.run();
+    bool started = exp.run();
     
     exp.waitForComplition();
     
+    if (NULL != pdfConverter)
+    {
+        delete pdfConverter;
+    }
+    
+    return started ? 0 : 1;
+}
+
+int searchMessages(const std::string& outputDir, const std::string& keyword, size_t limit)
+{
+    std::string dbPath = SearchDatabase::getPath(outputDir);
+    if (!existsFile(dbPath))
+    {
+        std::cout << "No search database in the output directory, export with --searchdb=yes first." << std::endl;
+        return 1;
+    }
+    
+    SearchDatabase searchDb;
+    if (!searchDb.open(dbPath))
+    {
+        std::cout << "Failed to open the search database: " << searchDb.getError() << std::endl;
+        return 1;
+    }
+    
+    std::vector<SearchResult> results;
+    auto startTime = std::chrono::steady_clock::now();
+    if (!searchDb.search(keyword, limit, results))
+    {
+        std::cout << "Failed to search: " << searchDb.getError() << std::endl;
+        return 1;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+    
+    for (std::vector<SearchResult>::const_iterator it = results.cbegin(); it != results.cend(); ++it)
+    {
+        std::string content = it->content;
+        replaceAll(content, "\n", " ");
+        std::cout << fromUnixTime(it->createTime) << " [" << it->sessionName << "] " << it->senderName << ": " << content << std::endl;
+        if (!it->media.empty())
+        {
+            std::string media = it->media;
+            replaceAll(media, "\n", "\n    " + it->sessionPath + "/");
+            std::cout << "    " << it->sessionPath << "/" << media << std::endl;
+        }
+    }
+    std::cout << results.size() << " message(s) found in " << elapsed << " ms." << std::endl;
+    
     return 0;
 }
 
@@ -2,9 +2,13 @@
 
 #include "..\WechatExporter\core\FileSystem.h"
 #include "..\WechatExporter\core\Logger.h"
+#include "..\WechatExporter\core\AsyncLogger.h"
+#include "..\WechatExporter\core\Tracer.h"
 #include "..\WechatExporter\core\PdfConverter.h"
+#include "..\WechatExporter\core\PdfRenderer.h"
 #include "..\WechatExporter\core\ExportOption.h"
 #include "..\WechatExporter\core\Exporter.h"
+#include "..\WechatExporter\core\SearchDatabase.h"
 #include "..\WechatExporter\core\Updater.h"
 #include "..\WechatExporter\core\IDeviceBackup.h"
 #include "..\WechatExporter\core\WechatSource.h"
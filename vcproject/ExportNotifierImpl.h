@@ -20,7 +20,8 @@ public:
 	static const UINT WM_TASKS_START = WM_USER + 19;
 	static const UINT WM_TASKS_COMPLETE = WM_USER + 20;
 	static const UINT WM_TASKS_PROGRESS = WM_USER + 21;
-	static const UINT WM_EN_END = WM_TASKS_PROGRESS;
+	static const UINT WM_SESSION_DETAILS = WM_USER + 22;
+	static const UINT WM_EN_END = WM_SESSION_DETAILS;
 
 public:
 	ExportNotifierImpl(HWND hWnd) : m_hWnd(hWnd)
@@ -86,5 +87,15 @@ public:
 	{
 		::PostMessage(m_hWnd, WM_TASKS_COMPLETE, 0, (LPARAM)(cancelled ? 1 : 0));
 	}
+
+	void onSessionDetailsLoaded(const std::string& usrName, const Session& session) const
+	{
+		// The loader keeps filling its own sessions, the copy is freed by the view
+		std::pair<std::string, Session>* details = new std::pair<std::string, Session>(usrName, session);
+		if (!::PostMessage(m_hWnd, WM_SESSION_DETAILS, 0, reinterpret_cast<LPARAM>(details)))
+		{
+			delete details;
+		}
+	}
 };
 
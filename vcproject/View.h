@@ -74,17 +74,19 @@ private:
 				m_exp.setLanguageCode("zh-Hans");
 			}
 
-			bool ret = m_exp.loadUsersAndSessions();
+			// Only the list of sessions here, the details come with WM_SESSION_DETAILS
+			bool ret = m_exp.loadUsersAndSessions(true);
 			::PostMessage(m_hWnd, WM_LOADDATA, (ret ? 1 : 0), reinterpret_cast<LPARAM>(this));
 			return ret;
 		}
 	public:
 
-		CLoadingHandler(HWND hWnd, const std::string& resDir, const std::string& backupDir, Logger* logger) : m_hWnd(hWnd), m_exp(resDir, backupDir, "", logger, NULL)
+		CLoadingHandler(HWND hWnd, const std::string& resDir, const std::string& backupDir, Logger* logger, ExportNotifier* notifier) : m_hWnd(hWnd), m_exp(resDir, backupDir, "", logger, NULL)
 		{
 			ExportOption options;
 			options.outputDebugLogs(AppConfiguration::OutputDebugLogs());
 			m_exp.setOptions(options);
+			m_exp.setNotifier(notifier);
 		}
 
 		~CLoadingHandler()
@@ -106,6 +108,16 @@ private:
 			m_exp.swapUsersAndSessions(usersAndSessions);
 		}
 
+		void loadSessionDetails()
+		{
+			m_exp.loadSessionDetails();
+		}
+
+		void prioritizeSessionDetails(const std::string& usrName, const std::vector<std::string>& sessionUsrNames)
+		{
+			m_exp.prioritizeSessionDetails(usrName, sessionUsrNames);
+		}
+
 		CString getVersions() const
 		{
 			CW2T pszV1(CA2W(m_exp.getITunesVersion().c_str(), CP_UTF8));
@@ -119,6 +131,9 @@ private:
 		}
 	};
 
+	// Kept after the users and sessions are loaded, it goes on loading the details of the sessions
+	CLoadingHandler* m_loadingHandler;
+
 	class CUpdateHandler : public CIdleHandler
 	{
 	protected:
@@ -190,6 +205,7 @@ public:
 	static const UINT WM_UPD_VIEWSTATE = WM_MSG_START + 1;
 	static const UINT WM_LOADDATA = WM_MSG_START + 2;
 	static const UINT WM_CHKUPDATE = WM_MSG_START + 3;
+	static const UINT WM_SESSION_DETAILS = ExportNotifierImpl::WM_SESSION_DETAILS;
 
 	CView() : CDialogImpl<CView>(), CDialogResize<CView>(), m_viewState(VS_IDLE), m_eventIdProgress(0)
 	{
@@ -221,6 +237,7 @@ public:
 		m_pdfConverter = NULL;
 		m_notifier = NULL;
 		m_exporter = NULL;
+		m_loadingHandler = NULL;
 
 		m_itemClicked = -2;
 
@@ -301,6 +318,7 @@ public:
 
 	void OnFinalMessage(HWND hWnd)
 	{
+		SAFE_DELETE(m_loadingHandler);
 		if (NULL != m_exporter)
 		{
 			m_exporter->cancel();
@@ -347,7 +365,9 @@ public:
 		MESSAGE_HANDLER(WM_UPD_VIEWSTATE, OnUpdateViewState)
 		MESSAGE_HANDLER(WM_LOADDATA, OnLoadData)
 		MESSAGE_HANDLER(WM_CHKUPDATE, OnCheckUpdate)
+		MESSAGE_HANDLER(WM_SESSION_DETAILS, OnSessionDetails)
 		NOTIFY_HANDLER(IDC_SESSIONS, LVN_ITEMCHANGED, OnListItemChanged)
+		NOTIFY_HANDLER(IDC_SESSIONS, LVN_ENDSCROLL, OnListEndScroll)
 		NOTIFY_CODE_HANDLER(HDN_ITEMSTATEICONCLICK, OnHeaderItemStateIconClick)
 		NOTIFY_HANDLER(IDC_SESSIONS, NM_CLICK, OnListClick)
 		REFLECT_NOTIFICATIONS()
@@ -409,12 +429,69 @@ public:
 			handler->waitForCompletion();
 			handler->getUsersAndSessions(m_usersAndSessions);
 
+			SAFE_DELETE(m_loadingHandler);
+			if (wParam != 0)
+			{
+				m_loadingHandler = handler;
+				m_loadingHandler->loadSessionDetails();
+			}
+
 			LoadUsers(handler->getVersions());
 			PostMessage(WM_UPD_VIEWSTATE, VS_IDLE, 1);
 			
-			delete handler;
+			if (m_loadingHandler != handler)
+			{
+				delete handler;
+			}
+		}
+
+		return 0;
+	}
+
+	LRESULT OnSessionDetails(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled)
+	{
+		std::pair<std::string, Session>* details = reinterpret_cast<std::pair<std::string, Session> *>(lParam);
+		if (NULL == details)
+		{
+			return 0;
+		}
+
+		for (std::vector<std::pair<Friend, std::vector<Session>>>::iterator it = m_usersAndSessions.begin(); it != m_usersAndSessions.end(); ++it)
+		{
+			if (it->first.getUsrName() != details->first)
+			{
+				continue;
+			}
+			for (std::vector<Session>::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2)
+			{
+				if (it2->getUsrName() != details->second.getUsrName())
+				{
+					continue;
+				}
+				// The copy comes from the loader, keep the owner and data of ours
+				void *data = it2->getData();
+				*it2 = details->second;
+				it2->setOwner(&(it->first));
+				it2->setData(data);
+
+				// The items keep the pointers of the sessions
+				CListViewCtrl listViewCtrl = GetDlgItem(IDC_SESSIONS);
+				LVFINDINFO findInfo = {};
+				findInfo.flags = LVFI_PARAM;
+				findInfo.lParam = reinterpret_cast<LPARAM>(&(*it2));
+				int nItem = listViewCtrl.FindItem(&findInfo, -1);
+				if (nItem != -1)
+				{
+					CString strDeletedSession;
+					strDeletedSession.LoadStringW(RBN_DELETEDBAND);
+					SetSessionItemTexts(listViewCtrl, nItem, *it2, strDeletedSession);
+				}
+				break;
+			}
+			break;
 		}
 
+		delete details;
 		return 0;
 	}
 	
@@ -523,6 +600,7 @@ public:
 		listViewCtrl.DeleteAllItems();
 		// listViewCtrl.SetRedraw(TRUE);
 
+		SAFE_DELETE(m_loadingHandler);
 		m_usersAndSessions.clear();
 		cbmBox = GetDlgItem(IDC_BACKUP);
 		if (cbmBox.GetCurSel() == -1)
@@ -558,7 +636,7 @@ public:
 		PostMessage(WM_UPD_VIEWSTATE, VS_LOADING, 1);
 		
 		std::string backup = backupItem.getPath();
-		CLoadingHandler *handler = new CLoadingHandler(m_hWnd, (LPCSTR)resDir, backup, m_logger);
+		CLoadingHandler *handler = new CLoadingHandler(m_hWnd, (LPCSTR)resDir, backup, m_logger, m_notifier);
 		// _Module.GetMessageLoop()->AddIdleHandler(handler);
 		handler->startTask();
 
@@ -596,6 +674,7 @@ public:
 		}
 		LoadSessions(allUsers, usrName);
 		listViewCtrl.SetRedraw(TRUE);
+		PrioritizeSessionDetails(listViewCtrl.GetTopIndex(), listViewCtrl.GetCountPerPage());
 #ifndef NDEBUG
 		m_logger->debug("Display Sessions End");
 #endif
@@ -692,11 +771,21 @@ public:
 				SyncHeaderCheckbox();
 				m_itemClicked = -2;
 			}
-			
+			if (pnmlv->iItem != -1 && (pnmlv->uNewState & LVIS_SELECTED) && !(pnmlv->uOldState & LVIS_SELECTED))
+			{
+				PrioritizeSessionDetails(pnmlv->iItem, 1);
+			}
 		}
 		return 0;
 	}
 
+	LRESULT OnListEndScroll(int /*idCtrl*/, LPNMHDR /*pnmh*/, BOOL& /*bHandled*/)
+	{
+		CListViewCtrl listViewCtrl = GetDlgItem(IDC_SESSIONS);
+		PrioritizeSessionDetails(listViewCtrl.GetTopIndex(), listViewCtrl.GetCountPerPage());
+		return 0;
+	}
+
 	LRESULT OnListClick(int /*idCtrl*/, LPNMHDR pnmh, BOOL& bHandled)
 	{
 		LPNMITEMACTIVATE pnmia = (LPNMITEMACTIVATE)pnmh;
@@ -1567,7 +1656,6 @@ protected:
 		strDeletedSession.LoadStringW(RBN_DELETEDBAND);
 
 		BOOL includesSubscriptions = AppConfiguration::IncludeSubscriptions();
-		TCHAR recordCount[16] = { 0 };
 		for (std::vector<std::pair<Friend, std::vector<Session>>>::const_iterator it = m_usersAndSessions.cbegin(); it != m_usersAndSessions.cend(); ++it)
 		{
 			if (!allUsers)
@@ -1588,13 +1676,6 @@ protected:
 					continue;
 				}
 
-				std::string displayName = it2->getDisplayName();
-				if (displayName.empty())
-				{
-					displayName = it2->getUsrName();
-				}
-
-				CW2T pszDisplayName(CA2W(displayName.c_str(), CP_UTF8));
 				LVITEM lvItem = {};
 				lvItem.mask = LVIF_TEXT | LVIF_PARAM;
 				lvItem.iItem = listViewCtrl.GetItemCount();
@@ -1607,36 +1688,7 @@ protected:
 				lvItem.lParam = lParam;
 				int nItem = listViewCtrl.InsertItem(&lvItem);
 
-				_itot(it2->getRecordCount(), recordCount, 10);
-				if (it2->isDeleted())
-				{
-					listViewCtrl.AddItem(nItem, 1, pszDisplayName + strDeletedSession);
-				}
-				else
-				{
-					listViewCtrl.AddItem(nItem, 1, pszDisplayName);
-				}
-				listViewCtrl.AddItem(nItem, 2, recordCount);
-
-				std::string msg;
-				if (it2->isTextMessage())
-				{
-					if (it2->hasLastMessageUserDisplayName())
-					{
-						msg = it2->getLastMessageUserDisplayName() + ": " + it2->getLastMessage();
-					}
-					else
-					{
-						msg = it2->getLastMessage();
-					}
-				}
-				else
-				{
-					msg = "-";
-				}
-
-				CW2T pszDisplayMsg(CA2W(msg.c_str(), CP_UTF8));
-				listViewCtrl.AddItem(nItem, 3, pszDisplayMsg);
+				SetSessionItemTexts(listViewCtrl, nItem, *it2, strDeletedSession);
 
 				listViewCtrl.AddItem(nItem, 4, pszUserDisplayName);
 				// BOOL bRet = listViewCtrl.SetItem(&lvSubItem);
@@ -1647,6 +1699,78 @@ protected:
 		SetHeaderCheckState(listViewCtrl, TRUE);
 	}
 
+	// Name, count and last message, which are filled later by the lazy loading of sessions
+	void SetSessionItemTexts(CListViewCtrl& listViewCtrl, int nItem, const Session& session, const CString& strDeletedSession)
+	{
+		std::string displayName = session.getDisplayName();
+		if (displayName.empty())
+		{
+			displayName = session.getUsrName();
+		}
+		CW2T pszDisplayName(CA2W(displayName.c_str(), CP_UTF8));
+
+		TCHAR recordCount[16] = { 0 };
+		_itot(session.getRecordCount(), recordCount, 10);
+		if (session.isDeleted())
+		{
+			listViewCtrl.AddItem(nItem, 1, pszDisplayName + strDeletedSession);
+		}
+		else
+		{
+			listViewCtrl.AddItem(nItem, 1, pszDisplayName);
+		}
+		listViewCtrl.AddItem(nItem, 2, recordCount);
+
+		std::string msg;
+		if (session.isTextMessage())
+		{
+			if (session.hasLastMessageUserDisplayName())
+			{
+				msg = session.getLastMessageUserDisplayName() + ": " + session.getLastMessage();
+			}
+			else
+			{
+				msg = session.getLastMessage();
+			}
+		}
+		else
+		{
+			msg = "-";
+		}
+
+		CW2T pszDisplayMsg(CA2W(msg.c_str(), CP_UTF8));
+		listViewCtrl.AddItem(nItem, 3, pszDisplayMsg);
+	}
+
+	// Moves the details of the sessions in the items(visible or selected ones) ahead of the others
+	void PrioritizeSessionDetails(int nFirstItem, int numberOfItems)
+	{
+		if (NULL == m_loadingHandler || nFirstItem < 0)
+		{
+			return;
+		}
+
+		CListViewCtrl listViewCtrl = GetDlgItem(IDC_SESSIONS);
+		int nLastItem = nFirstItem + numberOfItems;
+		if (nLastItem > listViewCtrl.GetItemCount())
+		{
+			nLastItem = listViewCtrl.GetItemCount();
+		}
+		std::map<std::string, std::vector<std::string>> usersAndSessions;
+		for (int nItem = nFirstItem; nItem < nLastItem; ++nItem)
+		{
+			const Session* session = reinterpret_cast<const Session *>(listViewCtrl.GetItemData(nItem));
+			if (NULL != session && NULL != session->getOwner())
+			{
+				usersAndSessions[session->getOwner()->getUsrName()].push_back(session->getUsrName());
+			}
+		}
+		for (std::map<std::string, std::vector<std::string>>::const_iterator it = usersAndSessions.cbegin(); it != usersAndSessions.cend(); ++it)
+		{
+			m_loadingHandler->prioritizeSessionDetails(it->first, it->second);
+		}
+	}
+
 	void SyncHeaderCheckbox()
 	{
 		// Loop through all of our items.  If any of them are
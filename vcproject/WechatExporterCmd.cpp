@@ -14,6 +14,7 @@
 #include <fcntl.h>
 #include "Core.h"
 #include <WechatExporterCmd.h>
+#include <Benchmark.h>
 
 std::string getCurrentLanguageCode();
 
@@ -106,14 +107,14 @@ PrintExit:
 	return;
 }
 
-class LoggerImpl : public Logger
+class LoggerImpl : public AsyncLogger
 {
 protected:
 	UINT m_cp;
 
 public:
 
-	LoggerImpl()
+	LoggerImpl(int level, bool jsonLines) : AsyncLogger(level, jsonLines)
 	{
 		m_cp = GetConsoleOutputCP();
 		if (m_cp != CP_UTF8)
@@ -125,34 +126,23 @@ public:
 		std::wcout << L"CodePage:" << m_cp << std::endl;
 	}
 
-	void write(const std::string& log)
+	virtual ~LoggerImpl()
 	{
-		if (m_cp == CP_UTF8)
-		{
-			std::cout << log << std::endl;
-		}
-		else
-		{
-			CA2W str(log.c_str(), CP_UTF8);
-			// CW2W targetStr(str, m_cp);
-			UPrint((LPCWSTR)str);
-			UPrint(L"\r\n");
-		}
+		stop();
 	}
 
-	void debug(const std::string& log)
+protected:
+	virtual void writeConsole(const std::string& lines)
 	{
 		if (m_cp == CP_UTF8)
 		{
-			std::cout << "DBG:: " << log << std::endl;
+			AsyncLogger::writeConsole(lines);
 		}
 		else
 		{
-			CA2W str(log.c_str(), CP_UTF8);
+			CA2W str(lines.c_str(), CP_UTF8);
 			// CW2W targetStr(str, m_cp);
-			UPrint(L"DBG::");
 			UPrint((LPCWSTR)str);
-			UPrint(L"\r\n");
 		}
 	}
 };
@@ -213,6 +203,19 @@ int main()
     int outputFormat = OUTPUT_FORMAT_HTML;
     int asyncLoading = HTML_OPTION_ONSCROLL;
     bool outputFilter = false;
+    bool searchDatabase = false;
+    std::string searchKeyword;
+    size_t searchLimit = 100;
+    int logLevel = LOG_LEVEL_INFO;
+    bool jsonLogs = false;
+    std::string logFile;
+    std::string traceFile;
+    std::string browserPath;
+    std::string benchGenDir;
+    std::string benchDir;
+    std::string benchResult;
+    std::string benchParser;
+    BenchmarkConfig benchConfig;
     std::string backupDir;
     std::string outputDir;
     std::string account;
@@ -259,6 +262,21 @@ int main()
         {
             sessions.push_back(parseArgumentwithQuatoW(equals_pos + 1));
         }
+        else if (name == L"--format")
+        {
+            if (lstrcmpW(L"text", equals_pos + 1) == 0)
+            {
+                outputFormat = OUTPUT_FORMAT_TEXT;
+            }
+            else if (lstrcmpW(L"pdf", equals_pos + 1) == 0)
+            {
+                outputFormat = OUTPUT_FORMAT_PDF;
+            }
+        }
+        else if (name == L"--browser")
+        {
+            browserPath = parseArgumentwithQuatoW(equals_pos + 1);
+        }
         else if (name == L"--asyncloading")
         {
             if (lstrcmpW(L"sync", equals_pos + 1) == 0)
@@ -277,8 +295,102 @@ int main()
                 outputFilter = true;
             }
         }
+        else if (name == L"--searchdb")
+        {
+            if (lstrcmpW(L"yes", equals_pos + 1) == 0)
+            {
+                searchDatabase = true;
+            }
+        }
+        else if (name == L"--search")
+        {
+            searchKeyword = parseArgumentwithQuatoW(equals_pos + 1);
+        }
+        else if (name == L"--limit")
+        {
+            searchLimit = static_cast<size_t>(wcstoul(equals_pos + 1, NULL, 10));
+        }
+        else if (name == L"--loglevel")
+        {
+            if (lstrcmpW(L"debug", equals_pos + 1) == 0)
+            {
+                logLevel = LOG_LEVEL_DEBUG;
+            }
+            else if (lstrcmpW(L"none", equals_pos + 1) == 0)
+            {
+                logLevel = LOG_LEVEL_NONE;
+            }
+        }
+        else if (name == L"--logformat")
+        {
+            if (lstrcmpW(L"json", equals_pos + 1) == 0)
+            {
+                jsonLogs = true;
+            }
+        }
+        else if (name == L"--logfile")
+        {
+            logFile = parseArgumentwithQuatoW(equals_pos + 1);
+        }
+        else if (name == L"--trace")
+        {
+            traceFile = parseArgumentwithQuatoW(equals_pos + 1);
+        }
+        else if (name == L"--bench-gen")
+        {
+            benchGenDir = parseArgumentwithQuatoW(equals_pos + 1);
+        }
+        else if (name == L"--bench-options")
+        {
+            std::string benchOptions = parseArgumentwithQuatoW(equals_pos + 1);
+            if (!benchConfig.parse(benchOptions))
+            {
+                std::cout << "Invalid benchmark options: " << benchOptions << std::endl;
+                return 1;
+            }
+        }
+        else if (name == L"--bench")
+        {
+            benchDir = parseArgumentwithQuatoW(equals_pos + 1);
+        }
+        else if (name == L"--bench-result")
+        {
+            benchResult = parseArgumentwithQuatoW(equals_pos + 1);
+        }
+        else if (name == L"--bench-parser")
+        {
+            benchParser = parseArgumentwithQuatoW(equals_pos + 1);
+        }
     }
     
+    if (!benchGenDir.empty())
+    {
+        return generateSyntheticBackup(benchGenDir, benchConfig);
+    }
+    if (!searchKeyword.empty())
+    {
+        if (outputDir.empty() || !existsDirectory(outputDir))
+        {
+            std::cout << "Please input valid output directory." << std::endl;
+            return 1;
+        }
+        return searchMessages(outputDir, searchKeyword, searchLimit);
+    }
+    if (!benchParser.empty())
+    {
+        // Neither the backup nor the account is used
+        backupDir = outputDir;
+        account = BENCH_ACCOUNT_NAME;
+    }
+    if (!benchDir.empty())
+    {
+        backupDir = benchDir;
+        if (account.empty())
+        {
+            account = BENCH_ACCOUNT_NAME;
+        }
+    }
+
     if (backupDir.empty() || !existsDirectory(backupDir))
     {
         std::cout << "Please input valid iTunes backup directory." << std::endl;
@@ -298,9 +410,42 @@ int main()
     std::string languageCode = getCurrentLanguageCode();
 	CW2A workDir(CT2W(curDir), CP_UTF8);
 
-	LoggerImpl logger;
+	if (!benchParser.empty())
+	{
+		return runParserBenchmark(languageCode, (LPCSTR)workDir, outputDir, benchParser == "synthetic" ? "" : benchParser, benchResult, benchConfig);
+	}
+	if (!benchDir.empty())
+	{
+		std::string benchWorkDir((LPCSTR)workDir);
+		return runBenchmark(backupDir, outputDir, benchResult, benchConfig, [&](const std::string& benchBackupDir, const std::string& benchOutputDir, bool textMode) {
+			AsyncLogger benchLogger(LOG_LEVEL_NONE);
+			return exportSessions(languageCode, &benchLogger, benchWorkDir, benchBackupDir, benchOutputDir, account, std::vector<std::string>(), textMode ? OUTPUT_FORMAT_TEXT : OUTPUT_FORMAT_HTML, HTML_OPTION_ONSCROLL, false);
+		});
+	}
+
+	LoggerImpl logger(logLevel, jsonLogs);
+	if (!logFile.empty() && !logger.openLogFile(logFile))
+	{
+		std::cout << "Failed to open log file: " << logFile << std::endl;
+	}
+
+	if (!traceFile.empty())
+	{
+		Tracer::enable(true);
+	}
 
-    return exportSessions(languageCode, &logger, (LPCSTR)workDir, backupDir, outputDir, account, sessions, outputFormat, asyncLoading, outputFilter);
+    int result = exportSessions(languageCode, &logger, (LPCSTR)workDir, backupDir, outputDir, account, sessions, outputFormat, asyncLoading, outputFilter, browserPath, searchDatabase);
+
+	if (!traceFile.empty())
+	{
+		Tracer::enable(false);
+		if (!Tracer::exportChromeTrace(traceFile))
+		{
+			logger.write("Failed to write trace file: " + traceFile);
+		}
+	}
+	logger.stop();
+	return result;
 }
 
 std::string getCurrentLanguageCode()